@@ -30,6 +30,8 @@
 #include "../database/query-table.h"
 // in_auditlist()
 #include "../database/gravity-db.h"
+// gravity_index_bloom_info()
+#include "../database/gravity-index.h"
 // struct overTime
 #include "../overTime.h"
 // Version information
@@ -43,8 +45,8 @@
 // RTF_UP, RTF_GATEWAY
 #include <linux/route.h>
 
-// defined in src/dnsmasq/cache.c
-extern char *querystr(char *desc, unsigned short type);
+// defined in src/dnsmasq_interface.c
+extern const char *querytype_name(const unsigned short type) __attribute__((pure));
 
 #define min(a,b) ({ __typeof__ (a) _a = (a); __typeof__ (b) _b = (b); _a < _b ? _a : _b; })
 
@@ -894,14 +896,16 @@ void getAllQueries(const char *client_message, const int sock, const bool isteln
 		char othertype[12] = { 0 }; // Maximum is "TYPE65535" = 10 bytes
 		if(query->type == TYPE_OTHER)
 		{
-			// Check the dnsmasq RR types table for a matching record
-			qtype = querystr((char*)"", query->qtype);
+			// Check the dnsmasq RR types table for a matching record.
+			// querystr() cannot be used here as it returns a static
+			// buffer and we may run concurrently with other readers
+			qtype = querytype_name(query->qtype);
 
-			// If not known (querystr() returned "type=1234"), we replace this
-			if(!qtype || strstr(qtype, "type=") != NULL)
+			// If not known, we format the type number ourselves
+			if(qtype == NULL)
 			{
 				// Format custom type into buffer
-				sprintf(othertype, "TYPE%u", query->qtype);
+				snprintf(othertype, sizeof(othertype), "TYPE%u", query->qtype);
 				// Replace qtype pointer
 				qtype = othertype;
 			}
@@ -920,7 +924,7 @@ void getAllQueries(const char *client_message, const int sock, const bool isteln
 			continue;
 
 		// Skip those entries which so not meet the requested timeframe
-		if((from > query->timestamp && from != 0) || (query->timestamp > until && until != 0))
+		if((from > query_get_timestamp(query) && from != 0) || (query_get_timestamp(query) > until && until != 0))
 			continue;
 
 		// Skip if domain is not identical with what the user wants to see
@@ -1055,7 +1059,7 @@ void getAllQueries(const char *client_message, const int sock, const bool isteln
 		if(istelnet)
 		{
 			ssend(sock,"%lli %s %s %s %i %i %i %lu %s %i %s#%u \"%s\"",
-				(long long)query->timestamp,
+				(long long)query_get_timestamp(query),
 				qtype,
 				domain,
 				clientIPName,
@@ -1075,7 +1079,7 @@ void getAllQueries(const char *client_message, const int sock, const bool isteln
 		}
 		else
 		{
-			pack_int32(sock, (int32_t)query->timestamp);
+			pack_int32(sock, (int32_t)query_get_timestamp(query));
 
 			// Use a fixstr because the length of qtype is always 4 (max is 31 for fixstr)
 			if(!pack_fixstr(sock, qtype))
@@ -1393,9 +1397,9 @@ void getUnknownQueries(const int sock, const bool istelnet)
 		const char *clientIP = getstr(client->ippos);
 
 		if(istelnet)
-			ssend(sock, "%lli %i %i %s %s %s %i %s\n", (long long)query->timestamp, queryID, query->id, type, getstr(domain->domainpos), clientIP, query->status, query->flags.complete ? "true" : "false");
+			ssend(sock, "%lli %i %i %s %s %s %i %s\n", (long long)query_get_timestamp(query), queryID, query->id, type, getstr(domain->domainpos), clientIP, query->status, query->flags.complete ? "true" : "false");
 		else {
-			pack_int32(sock, (int32_t)query->timestamp);
+			pack_int32(sock, (int32_t)query_get_timestamp(query));
 			pack_int32(sock, query->id);
 
 			// Use a fixstr because the length of qtype is always 4 (max is 31 for fixstr)
@@ -1415,6 +1419,83 @@ void getUnknownQueries(const int sock, const bool istelnet)
 // FTL_unlink_DHCP_lease()
 extern bool FTL_unlink_DHCP_lease(const char *ipaddr);
 
+void getLockStats(const int sock, const bool istelnet)
+{
+	unsigned int num = 0;
+	const lockStatsData *stats = get_lock_stats(&num);
+	for(unsigned int i = 0; i < num; i++)
+	{
+		const lockStatsData *site = &stats[i];
+		if(istelnet)
+		{
+			// <function> <file>:<line> <count> <total wait> <max wait> <total hold> <max hold>
+			// (all times in microseconds)
+			ssend(sock, "%s %s:%i %u %llu %llu %llu %llu",
+			      site->func, site->file, site->line, site->count,
+			      (unsigned long long)site->wait_ns/1000u, (unsigned long long)site->max_wait_ns/1000u,
+			      (unsigned long long)site->hold_ns/1000u, (unsigned long long)site->max_hold_ns/1000u);
+
+			// Histograms are only recorded if enabled by LOCK_HISTOGRAMS
+			if(config.lock_histograms)
+			{
+				for(unsigned int j = 0; j < LOCK_STATS_BUCKETS; j++)
+					ssend(sock, " %u", site->wait_hist[j]);
+				for(unsigned int j = 0; j < LOCK_STATS_BUCKETS; j++)
+					ssend(sock, " %u", site->hold_hist[j]);
+			}
+			ssend(sock, "\n");
+		}
+		else
+		{
+			char location[80];
+			snprintf(location, sizeof(location), "%s %s:%i", site->func, site->file, site->line);
+			if(!pack_str32(sock, location))
+				return;
+			pack_int32(sock, site->count);
+			pack_uint64(sock, site->wait_ns);
+			pack_uint64(sock, site->max_wait_ns);
+			pack_uint64(sock, site->hold_ns);
+			pack_uint64(sock, site->max_hold_ns);
+		}
+	}
+}
+
+void getFilterStats(const int sock, const bool istelnet)
+{
+	static const char *lists[] = { "gravity", "blacklist", "whitelist" };
+	const unsigned char tables[] = { GRAVITY_TABLE, EXACT_BLACKLIST_TABLE, EXACT_WHITELIST_TABLE };
+	for(unsigned int i = 0; i < sizeof(tables)/sizeof(tables[0]); i++)
+	{
+		// Lists without Bloom filter are reported with all zeros
+		struct gravity_bloom_info info = { 0 };
+		gravity_index_bloom_info(tables[i], &info);
+		if(istelnet)
+			// <list>-bloom-filter: <bits> <hashes> <entries> <false-positive rate>
+			ssend(sock, "%s-bloom-filter: %llu %u %u %.6f\n", lists[i],
+			      (unsigned long long)info.bits, info.hashes, info.entries, info.fp_rate);
+		else
+		{
+			pack_uint64(sock, info.bits);
+			pack_int32(sock, info.hashes);
+			pack_int32(sock, info.entries);
+			pack_float(sock, info.fp_rate);
+		}
+	}
+
+	if(istelnet)
+	{
+		ssend(sock, "bloom-skipped-lookups: %u\n", counters->bloom_skipped);
+		ssend(sock, "regex-executed: %u\n", counters->regex_executed);
+		ssend(sock, "regex-skipped: %u\n", counters->regex_skipped);
+	}
+	else
+	{
+		pack_int32(sock, counters->bloom_skipped);
+		pack_int32(sock, counters->regex_executed);
+		pack_int32(sock, counters->regex_skipped);
+	}
+}
+
 void delete_lease(const char *client_message, const int sock)
 {
 	// Extract IP address from request
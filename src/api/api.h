@@ -27,6 +27,8 @@ void getClientID(const int sock, const bool istelnet);
 void getVersion(const int sock, const bool istelnet);
 void getDBstats(const int sock, const bool istelnet);
 void getUnknownQueries(const int sock, const bool istelnet);
+void getLockStats(const int sock, const bool istelnet);
+void getFilterStats(const int sock, const bool istelnet);
 void getMAXLOGAGE(const int sock);
 void getGateway(const int sock);
 void getInterfaces(const int sock);
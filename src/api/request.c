@@ -36,20 +36,22 @@ bool process_request(const char *client_message, const int sock, const bool iste
 	if(command(client_message, ">stats"))
 	{
 		processed = true;
-		lock_shm();
+		lock_shm_read();
 		getStats(sock, istelnet);
-		unlock_shm();
+		unlock_shm_read();
 	}
 	else if(command(client_message, ">overTime"))
 	{
 		processed = true;
-		lock_shm();
+		lock_shm_read();
 		getOverTime(sock, istelnet);
-		unlock_shm();
+		unlock_shm_read();
 	}
 	else if(command(client_message, ">top-domains") || command(client_message, ">top-ads"))
 	{
 		processed = true;
+		// Exclusive lock required as the audit list is checked
+		// using a prepared statement shared with other threads
 		lock_shm();
 		getTopDomains(client_message, sock, istelnet);
 		unlock_shm();
@@ -57,51 +59,51 @@ bool process_request(const char *client_message, const int sock, const bool iste
 	else if(command(client_message, ">top-clients"))
 	{
 		processed = true;
-		lock_shm();
+		lock_shm_read();
 		getTopClients(client_message, sock, istelnet);
-		unlock_shm();
+		unlock_shm_read();
 	}
 	else if(command(client_message, ">forward-dest"))
 	{
 		processed = true;
-		lock_shm();
+		lock_shm_read();
 		getUpstreamDestinations(client_message, sock, istelnet);
-		unlock_shm();
+		unlock_shm_read();
 	}
 	else if(command(client_message, ">forward-names"))
 	{
 		processed = true;
-		lock_shm();
+		lock_shm_read();
 		getUpstreamDestinations(">forward-dest unsorted", sock, istelnet);
-		unlock_shm();
+		unlock_shm_read();
 	}
 	else if(command(client_message, ">querytypes"))
 	{
 		processed = true;
-		lock_shm();
+		lock_shm_read();
 		getQueryTypes(sock, istelnet);
-		unlock_shm();
+		unlock_shm_read();
 	}
 	else if(command(client_message, ">getallqueries"))
 	{
 		processed = true;
-		lock_shm();
+		lock_shm_read();
 		getAllQueries(client_message, sock, istelnet);
-		unlock_shm();
+		unlock_shm_read();
 	}
 	else if(command(client_message, ">recentBlocked"))
 	{
 		processed = true;
-		lock_shm();
+		lock_shm_read();
 		getRecentBlocked(client_message, sock, istelnet);
-		unlock_shm();
+		unlock_shm_read();
 	}
 	else if(command(client_message, ">clientID"))
 	{
 		processed = true;
-		lock_shm();
+		lock_shm_read();
 		getClientID(sock, istelnet);
-		unlock_shm();
+		unlock_shm_read();
 	}
 	else if(command(client_message, ">version"))
 	{
@@ -119,23 +121,37 @@ bool process_request(const char *client_message, const int sock, const bool iste
 	else if(command(client_message, ">ClientsoverTime"))
 	{
 		processed = true;
-		lock_shm();
+		lock_shm_read();
 		getClientsOverTime(sock, istelnet);
-		unlock_shm();
+		unlock_shm_read();
 	}
 	else if(command(client_message, ">client-names"))
 	{
 		processed = true;
-		lock_shm();
+		lock_shm_read();
 		getClientNames(sock, istelnet);
-		unlock_shm();
+		unlock_shm_read();
 	}
 	else if(command(client_message, ">unknown"))
 	{
 		processed = true;
-		lock_shm();
+		lock_shm_read();
 		getUnknownQueries(sock, istelnet);
-		unlock_shm();
+		unlock_shm_read();
+	}
+	else if(command(client_message, ">lockstats"))
+	{
+		processed = true;
+		lock_shm_read();
+		getLockStats(sock, istelnet);
+		unlock_shm_read();
+	}
+	else if(command(client_message, ">filterstats"))
+	{
+		processed = true;
+		lock_shm_read();
+		getFilterStats(sock, istelnet);
+		unlock_shm_read();
 	}
 	else if(command(client_message, ">cacheinfo"))
 	{
@@ -34,6 +34,8 @@
 #include "lua/ftl_lua.h"
 // gravity_parseList()
 #include "tools/gravity-parseList.h"
+// regex_check()
+#include "tools/regex-check.h"
 // run_dhcp_discover()
 #include "tools/dhcp-discover.h"
 // run_arp_scan()
@@ -179,17 +181,43 @@ void parse_args(int argc, char* argv[])
 	// we offer some specialized gravity tools
 	if(argc > 1 && strcmp(argv[1], "gravity") == 0)
 	{
-		// pihole-FTL gravity parseList <infile> <outfile> <adlistID>
-		if(argc == 6 && strcmp(argv[2], "parseList") == 0)
+		// pihole-FTL gravity parseList <infile> <outfile> <adlistID> [<threads>]
+		if((argc == 6 || argc == 7) && strcmp(argv[2], "parseList") == 0)
 		{
 			// Parse the given list and write the result to the given file
-			exit(gravity_parseList(argv[3], argv[4], argv[5]));
+			exit(gravity_parseList(argv[3], argv[4], argv[5], argc == 7 ? argv[6] : NULL));
+		}
+
+		// pihole-FTL gravity updateList <infile> <gravity.db> <adlistID>
+		if(argc == 6 && strcmp(argv[2], "updateList") == 0)
+		{
+			// Apply the difference to the stored version of this list
+			exit(gravity_updateList(argv[3], argv[4], argv[5]));
+		}
+
+		// pihole-FTL gravity compileIndex <gravity.db> [<outfile>]
+		if((argc == 4 || argc == 5) && strcmp(argv[2], "compileIndex") == 0)
+		{
+			// Compile a memory-mappable index of the given database
+			exit(gravity_compileIndex(argv[3], argc == 5 ? argv[4] : NULL));
+		}
+
+		// pihole-FTL gravity checkValidator [<infile> [<lines>]]
+		if(argc >= 3 && argc <= 5 && strcmp(argv[2], "checkValidator") == 0)
+		{
+			// Compare the domain validator against the regular expressions
+			exit(gravity_checkValidator(argc > 3 ? argv[3] : NULL, argc > 4 ? argv[4] : NULL));
 		}
 
 		printf("Incorrect usage of pihole-FTL gravity subcommand\n");
 		exit(EXIT_FAILURE);
 	}
 
+	// pihole-FTL regex-check [<patterns> [<domains>]]
+	// Compare the optional regex matchers against TRE
+	if(argc > 1 && argc <= 4 && strcmp(argv[1], "regex-check") == 0)
+		exit(regex_check(argc > 2 ? argv[2] : NULL, argc > 3 ? argv[3] : NULL));
+
 	// DHCP discovery mode
 	if(argc > 1 && strcmp(argv[1], "dhcp-discover") == 0)
 	{
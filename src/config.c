@@ -39,9 +39,13 @@ FTLFileNamesStruct FTLfiles = {
 
 pthread_mutex_t lock;
 
-// Private global variables
-static char *conflinebuffer = NULL;
-static size_t size = 0;
+// Private global variables. The line buffer is kept per thread as values
+// returned by parse_FTLconf() point into it. It is registered with
+// conflinekey so it is freed when the thread exits
+static __thread char *conflinebuffer = NULL;
+static __thread size_t size = 0;
+static pthread_key_t conflinekey;
+static pthread_once_t conflinekey_once = PTHREAD_ONCE_INIT;
 
 // Private prototypes
 static char *parse_FTLconf(FILE *fp, const char * key);
@@ -259,6 +263,25 @@ void read_FTLconf(void)
 	logg("   MAXLOGAGE: Importing up to %.1f hours of log data%s",
 	     (float)config.maxlogage/3600.0f, hint);
 
+	// GC_BATCH
+	// Maximum number of queries the garbage collector removes in one go.
+	// Non-zero values enable incremental garbage collection: Outdated
+	// queries are expired in batches of this size once per second instead
+	// of all at once every ten minutes. This bounds the time the shared
+	// memory lock is held by the GC thread.
+	// defaults to: 0 (remove all outdated queries at once)
+	config.gc_batch = 0;
+	buffer = parse_FTLconf(fp, "GC_BATCH");
+
+	value = 0;
+	if(buffer != NULL && sscanf(buffer, "%i", &value) && value > 0)
+		config.gc_batch = value;
+
+	if(config.gc_batch > 0)
+		logg("   GC_BATCH: Removing at most %u queries per second", config.gc_batch);
+	else
+		logg("   GC_BATCH: Removing all outdated queries at once");
+
 	// PRIVACYLEVEL
 	// Specify if we want to anonymize the DNS queries somehow, available options are:
 	// PRIVACY_SHOW_ALL (0) = don't hide anything
@@ -680,6 +703,86 @@ void read_FTLconf(void)
 	else
 		logg("   ADDR2LINE: Disabled");
 
+	// LOCK_HISTOGRAMS
+	// Should FTL record histograms of wait and hold times of the shared
+	// memory lock per call site? Totals and maximums are always recorded
+	// defaults to: false
+	buffer = parse_FTLconf(fp, "LOCK_HISTOGRAMS");
+	config.lock_histograms = read_bool(buffer, false);
+
+	if(config.lock_histograms)
+		logg("   LOCK_HISTOGRAMS: Enabled");
+	else
+		logg("   LOCK_HISTOGRAMS: Disabled");
+
+	// GRAVITY_IN_MEMORY
+	// Should FTL keep the exact gravity, black- and whitelist domains in
+	// memory instead of querying the gravity database for each new domain?
+	// This needs memory in the order of the size of the gravity database.
+	// An up-to-date index compiled by "pihole-FTL gravity compileIndex" is
+	// mapped and used regardless of this setting
+	// defaults to: false
+	buffer = parse_FTLconf(fp, "GRAVITY_IN_MEMORY");
+	config.gravity_in_memory = read_bool(buffer, false);
+
+	if(config.gravity_in_memory)
+		logg("   GRAVITY_IN_MEMORY: Enabled");
+	else
+		logg("   GRAVITY_IN_MEMORY: Disabled");
+
+	// GRAVITY_BLOOM_FILTER
+	// Should FTL build Bloom filters of the gravity, black- and whitelist
+	// domains to skip database lookups of domains which are certainly not on
+	// these lists? This has no effect when the lists are held in memory
+	// defaults to: false
+	buffer = parse_FTLconf(fp, "GRAVITY_BLOOM_FILTER");
+	config.gravity_bloom_filter = read_bool(buffer, false);
+
+	if(config.gravity_bloom_filter)
+		logg("   GRAVITY_BLOOM_FILTER: Enabled");
+	else
+		logg("   GRAVITY_BLOOM_FILTER: Disabled");
+
+	// GRAVITY_GROUP_BITMASK
+	// Should FTL look up the groups a domain is on using statements shared
+	// by all clients and intersect them with the groups of the client instead
+	// of preparing dedicated statements for each client? This keeps the
+	// number of prepared statements independent of the number of clients
+	// defaults to: false
+	buffer = parse_FTLconf(fp, "GRAVITY_GROUP_BITMASK");
+	config.gravity_group_bitmask = read_bool(buffer, false);
+
+	if(config.gravity_group_bitmask)
+		logg("   GRAVITY_GROUP_BITMASK: Enabled");
+	else
+		logg("   GRAVITY_GROUP_BITMASK: Disabled");
+
+	// REGEX_COMBINED
+	// Should FTL combine all regex filters of a type into one automaton
+	// which checks a domain against all of them in a single pass? Filters
+	// the automaton cannot represent are still checked one after another
+	// defaults to: false
+	buffer = parse_FTLconf(fp, "REGEX_COMBINED");
+	config.regex_combined = read_bool(buffer, false);
+
+	if(config.regex_combined)
+		logg("   REGEX_COMBINED: Enabled");
+	else
+		logg("   REGEX_COMBINED: Disabled");
+
+	// REGEX_PREFILTER
+	// Should FTL skip regex filters whose required literal (such as "ads" in
+	// "(^|\.)ads\.") is not contained in the domain? The literals of all
+	// filters are searched for in a single pass over the domain
+	// defaults to: false
+	buffer = parse_FTLconf(fp, "REGEX_PREFILTER");
+	config.regex_prefilter = read_bool(buffer, false);
+
+	if(config.regex_prefilter)
+		logg("   REGEX_PREFILTER: Enabled");
+	else
+		logg("   REGEX_PREFILTER: Disabled");
+
 	// REPLY_WHEN_BUSY
 	// How should FTL handle queries when the gravity database is not available?
 	// defaults to: DROP
@@ -813,6 +916,22 @@ static void getpath(FILE* fp, const char *option, const char *defaultloc, char *
 	}
 }
 
+static void create_conflinekey(void)
+{
+	// Free the line buffer of a thread when it exits
+	pthread_key_create(&conflinekey, free);
+}
+
+// Make sure the line buffer of this thread is freed when the thread exits.
+// The key is created on first use as parse_FTLconf() may be called before
+// init_config_mutex(), e.g., by the dhcp-discover tool
+static void register_conflinebuffer(void)
+{
+	pthread_once(&conflinekey_once, create_conflinekey);
+	if(conflinebuffer != NULL && pthread_getspecific(conflinekey) != conflinebuffer)
+		pthread_setspecific(conflinekey, conflinebuffer);
+}
+
 static char *parse_FTLconf(FILE *fp, const char *key)
 {
 	// Return NULL if fp is an invalid file pointer
@@ -849,6 +968,9 @@ static char *parse_FTLconf(FILE *fp, const char *key)
 		if(conflinebuffer == NULL)
 			break;
 
+		// getline() may have (re)allocated the buffer
+		register_conflinebuffer();
+
 		// Skip comment lines
 		if(conflinebuffer[0] == '#' || conflinebuffer[0] == ';')
 			continue;
@@ -881,6 +1003,9 @@ static char *parse_FTLconf(FILE *fp, const char *key)
 	if(errno == ENOMEM)
 		logg("WARN: parse_FTLconf failed: could not allocate memory for getline");
 
+	// getline() may have allocated the buffer even if it read nothing
+	register_conflinebuffer();
+
 	const int uret = pthread_mutex_unlock(&lock);
 	if(config.debug & DEBUG_LOCKS)
 		logg("Released config lock (no match)");
@@ -51,6 +51,12 @@ typedef struct {
 	bool edns0_ecs :1;
 	bool show_dnssec :1;
 	bool addr2line :1;
+	bool lock_histograms :1;
+	bool gravity_in_memory :1;
+	bool gravity_bloom_filter :1;
+	bool gravity_group_bitmask :1;
+	bool regex_combined :1;
+	bool regex_prefilter :1;
 	struct {
 		bool mozilla_canary :1;
 		bool icloud_private_relay :1;
@@ -70,6 +76,7 @@ typedef struct {
 	int maxlogage;
 	int dns_port;
 	unsigned int delay_startup;
+	unsigned int gc_batch;
 	unsigned int network_expire;
 	unsigned int block_ttl;
 	struct {
@@ -110,6 +110,11 @@ void *DB_thread(void *val)
 		if(get_and_clear_event(RELOAD_GRAVITY))
 			FTL_reload_all_domainlists();
 
+		// Apply incremental gravity updates (after a possible full
+		// reload which also marks all changes as processed)
+		if(get_and_clear_event(RELOAD_GRAVITY_CHANGES))
+			FTL_reload_gravity_changes();
+
 		BREAK_IF_KILLED();
 
 		// Reload privacy level from pihole-FTL.conf
@@ -0,0 +1,451 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2023 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  In-memory client table
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#include "../FTL.h"
+#include "gravity-clients.h"
+// logg()
+#include "../log.h"
+// struct config
+#include "../config.h"
+// parse_client_subnet()
+#include "sqlite3-ext.h"
+
+// The client table is typically small but it is consulted for every new client
+// (and every client whose groups have to be re-resolved after a reload). Instead
+// of running subnet_match() on every row of the table, we keep a copy of the
+// table in memory:
+//  - all IP addresses and subnets are stored in one binary trie per address
+//    family, a lookup walks down the trie along the bits of the client's
+//    address and finds the longest matching prefix
+//  - all entries (including MAC addresses, host names, and interfaces) are
+//    kept in a sorted array for case-insensitive exact matches
+//  - the groups of each client are concatenated once while loading
+
+// Marker for "no entry" in the trie and the entry chains
+#define NO_ENTRY -1
+
+struct subnet_entry {
+	int id;
+	int bits;
+	int next;
+	char *text;
+};
+
+struct trie_node {
+	int child[2];
+	int entries;
+};
+
+struct subnet_trie {
+	struct trie_node *nodes;
+	unsigned int num_nodes;
+	unsigned int alloc_nodes;
+	unsigned int num_entries;
+};
+
+struct client_name {
+	char *name;
+	int id;
+};
+
+struct client_groups {
+	int id;
+	char *groups;
+};
+
+struct gravity_clients {
+	struct subnet_trie trie[2];
+	struct subnet_entry *entries;
+	unsigned int num_entries;
+	unsigned int alloc_entries;
+	struct client_name *names;
+	unsigned int num_names;
+	struct client_groups *groups;
+	unsigned int num_groups;
+};
+
+// ASCII-only case folding, this is what SQLite's NOCASE collation does
+static inline int fold(const unsigned char c)
+{
+	return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+static int __attribute__((pure)) nocase_cmp(const char *a, const char *b)
+{
+	const unsigned char *ua = (const unsigned char*)a;
+	const unsigned char *ub = (const unsigned char*)b;
+	while(*ua != '\0' && fold(*ua) == fold(*ub))
+	{
+		ua++;
+		ub++;
+	}
+	return fold(*ua) - fold(*ub);
+}
+
+static int name_cmp(const void *a, const void *b)
+{
+	const struct client_name *na = a, *nb = b;
+	const int cmp = nocase_cmp(na->name, nb->name);
+	if(cmp != 0)
+		return cmp;
+	// Equal names: lowest ID first as this is what the query returned
+	return (na->id > nb->id) - (na->id < nb->id);
+}
+
+static int name_key_cmp(const void *key, const void *elem)
+{
+	const struct client_name *name = elem;
+	return nocase_cmp(key, name->name);
+}
+
+static int groups_key_cmp(const void *key, const void *elem)
+{
+	const int id = *(const int*)key;
+	const struct client_groups *groups = elem;
+	return (id > groups->id) - (id < groups->id);
+}
+
+static inline int address_bit(const struct in6_addr *addr, const int bit)
+{
+	return (addr->s6_addr[bit/8] >> (7 - bit%8)) & 1;
+}
+
+static int trie_new_node(struct subnet_trie *trie)
+{
+	if(trie->num_nodes == trie->alloc_nodes)
+	{
+		const unsigned int alloc = trie->alloc_nodes > 0u ? 2u*trie->alloc_nodes : 64u;
+		struct trie_node *nodes = realloc(trie->nodes, alloc*sizeof(*nodes));
+		if(nodes == NULL)
+			return NO_ENTRY;
+		trie->nodes = nodes;
+		trie->alloc_nodes = alloc;
+	}
+	struct trie_node *node = &trie->nodes[trie->num_nodes];
+	node->child[0] = node->child[1] = NO_ENTRY;
+	node->entries = NO_ENTRY;
+	return (int)trie->num_nodes++;
+}
+
+// Add an IP address or subnet to the trie. The entry is stored at the node of
+// its prefix. Its rank (bits) is the CIDR as given in the database which may be
+// larger than the address length (subnet_match() returns it unaltered)
+static bool add_subnet(struct gravity_clients *clients, const int id, const char *text)
+{
+	bool isIPv6 = false;
+	int cidr = 0;
+	struct in6_addr addr = {{{ 0 }}};
+	if(!parse_client_subnet(text, &isIPv6, &addr, &cidr) || cidr <= 0)
+		return true;
+
+	struct subnet_trie *trie = &clients->trie[isIPv6 ? 1 : 0];
+	if(trie->num_nodes == 0u && trie_new_node(trie) == NO_ENTRY)
+		return false;
+
+	const int maxbits = isIPv6 ? 128 : 32;
+	const int prefix = cidr < maxbits ? cidr : maxbits;
+	int node = 0;
+	for(int i = 0; i < prefix; i++)
+	{
+		const int bit = address_bit(&addr, i);
+		int child = trie->nodes[node].child[bit];
+		if(child == NO_ENTRY)
+		{
+			// trie_new_node() may move the nodes in memory
+			if((child = trie_new_node(trie)) == NO_ENTRY)
+				return false;
+			trie->nodes[node].child[bit] = child;
+		}
+		node = child;
+	}
+
+	if(clients->num_entries == clients->alloc_entries)
+	{
+		const unsigned int alloc = clients->alloc_entries > 0u ? 2u*clients->alloc_entries : 16u;
+		struct subnet_entry *entries = realloc(clients->entries, alloc*sizeof(*entries));
+		if(entries == NULL)
+			return false;
+		clients->entries = entries;
+		clients->alloc_entries = alloc;
+	}
+
+	struct subnet_entry *entry = &clients->entries[clients->num_entries];
+	entry->id = id;
+	entry->bits = cidr;
+	entry->text = strdup(text);
+	if(entry->text == NULL)
+		return false;
+	entry->next = trie->nodes[node].entries;
+	trie->nodes[node].entries = (int)clients->num_entries++;
+	trie->num_entries++;
+
+	return true;
+}
+
+static bool load_client_table(struct gravity_clients *clients, sqlite3 *db)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, "SELECT id, ip FROM client ORDER BY id;", -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("gravity_clients_load() - SQL error prepare: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	unsigned int alloc_names = 0u;
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const int id = sqlite3_column_int(stmt, 0);
+		const char *text = (const char*)sqlite3_column_text(stmt, 1);
+		if(text == NULL)
+			continue;
+
+		if(!add_subnet(clients, id, text))
+			break;
+
+		if(clients->num_names == alloc_names)
+		{
+			alloc_names = alloc_names > 0u ? 2u*alloc_names : 16u;
+			struct client_name *names = realloc(clients->names, alloc_names*sizeof(*names));
+			if(names == NULL)
+				break;
+			clients->names = names;
+		}
+		if((clients->names[clients->num_names].name = strdup(text)) == NULL)
+			break;
+		clients->names[clients->num_names++].id = id;
+	}
+	sqlite3_finalize(stmt);
+
+	if(rc != SQLITE_DONE)
+	{
+		logg("gravity_clients_load() - Failed to read client table: %s",
+		     rc == SQLITE_ROW ? "Out of memory" : sqlite3_errstr(rc));
+		return false;
+	}
+
+	// Sort names for binary search and remove duplicates (only the entry with
+	// the lowest ID can ever match)
+	if(clients->num_names > 0u)
+	{
+		qsort(clients->names, clients->num_names, sizeof(*clients->names), name_cmp);
+		unsigned int n = 1u;
+		for(unsigned int i = 1u; i < clients->num_names; i++)
+		{
+			if(nocase_cmp(clients->names[i].name, clients->names[n-1].name) == 0)
+				free(clients->names[i].name);
+			else
+				clients->names[n++] = clients->names[i];
+		}
+		clients->num_names = n;
+	}
+
+	return true;
+}
+
+static bool load_client_groups(struct gravity_clients *clients, sqlite3 *db)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, "SELECT client_id, GROUP_CONCAT(group_id) FROM client_by_group "
+	                                "GROUP BY client_id ORDER BY client_id;", -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("gravity_clients_load() - SQL error prepare: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	unsigned int alloc_groups = 0u;
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const char *groups = (const char*)sqlite3_column_text(stmt, 1);
+		if(groups == NULL)
+			continue;
+
+		if(clients->num_groups == alloc_groups)
+		{
+			alloc_groups = alloc_groups > 0u ? 2u*alloc_groups : 16u;
+			struct client_groups *new = realloc(clients->groups, alloc_groups*sizeof(*new));
+			if(new == NULL)
+				break;
+			clients->groups = new;
+		}
+		if((clients->groups[clients->num_groups].groups = strdup(groups)) == NULL)
+			break;
+		clients->groups[clients->num_groups++].id = sqlite3_column_int(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+
+	if(rc != SQLITE_DONE)
+	{
+		logg("gravity_clients_load() - Failed to read client groups: %s",
+		     rc == SQLITE_ROW ? "Out of memory" : sqlite3_errstr(rc));
+		return false;
+	}
+
+	return true;
+}
+
+// Read the client table and the client-group assignments into memory. Returns
+// NULL on error, the caller should then fall back to querying the database
+struct gravity_clients *gravity_clients_load(sqlite3 *db)
+{
+	struct gravity_clients *clients = calloc(1, sizeof(struct gravity_clients));
+	if(clients == NULL)
+		return NULL;
+
+	if(!load_client_table(clients, db) || !load_client_groups(clients, db))
+	{
+		gravity_clients_free(clients);
+		return NULL;
+	}
+
+	if(config.debug & DEBUG_CLIENTS)
+		logg("Loaded client table: %u IPv4 and %u IPv6 subnets, %u names, %u clients with groups",
+		     clients->trie[0].num_entries, clients->trie[1].num_entries,
+		     clients->num_names, clients->num_groups);
+
+	return clients;
+}
+
+void gravity_clients_free(struct gravity_clients *clients)
+{
+	if(clients == NULL)
+		return;
+
+	for(unsigned int i = 0u; i < clients->num_entries; i++)
+		free(clients->entries[i].text);
+	free(clients->entries);
+	for(unsigned int i = 0u; i < sizeof(clients->trie)/sizeof(clients->trie[0]); i++)
+		free(clients->trie[i].nodes);
+	for(unsigned int i = 0u; i < clients->num_names; i++)
+		free(clients->names[i].name);
+	free(clients->names);
+	for(unsigned int i = 0u; i < clients->num_groups; i++)
+		free(clients->groups[i].groups);
+	free(clients->groups);
+	free(clients);
+}
+
+// Find the IP address and subnet entries matching ip with the highest number
+// of bits. The result is the same as that of the subnet_match() query: the
+// number of such entries, the highest ID among them (and its database text),
+// and the IDs of all of them
+bool gravity_clients_match_subnet(const struct gravity_clients *clients, const char *ip,
+                                  struct client_subnet_match *match)
+{
+	const bool isIPv6 = strchr(ip, ':') != NULL;
+	const struct subnet_trie *trie = &clients->trie[isIPv6 ? 1 : 0];
+	if(trie->num_nodes == 0u)
+		return false;
+
+	struct in6_addr addr = {{{ 0 }}};
+	if(inet_pton(isIPv6 ? AF_INET6 : AF_INET, ip, &addr) == 0)
+	{
+		logg("Malformed FTL IP address: %s", ip);
+		return false;
+	}
+
+	// Walk down the trie and remember the best entry
+	const int maxbits = isIPv6 ? 128 : 32;
+	const struct subnet_entry *best = NULL;
+	int count = 0;
+	int path[129];
+	int depth = 0, npath = 0;
+	for(int node = 0;;)
+	{
+		path[npath++] = node;
+		for(int e = trie->nodes[node].entries; e != NO_ENTRY; e = clients->entries[e].next)
+		{
+			const struct subnet_entry *entry = &clients->entries[e];
+			if(best == NULL || entry->bits > best->bits)
+			{
+				best = entry;
+				count = 1;
+			}
+			else if(entry->bits == best->bits)
+			{
+				count++;
+				if(entry->id > best->id)
+					best = entry;
+			}
+		}
+
+		if(depth >= maxbits)
+			break;
+		const int child = trie->nodes[node].child[address_bit(&addr, depth++)];
+		if(child == NO_ENTRY)
+			break;
+		node = child;
+	}
+
+	if(best == NULL)
+		return false;
+
+	// Collect the IDs of all entries with the same number of bits in
+	// ascending order (the order of the client table)
+	int *ids = calloc(count, sizeof(int));
+	if(ids == NULL)
+		return false;
+	int n = 0;
+	for(int i = 0; i < npath; i++)
+		for(int e = trie->nodes[path[i]].entries; e != NO_ENTRY; e = clients->entries[e].next)
+			if(clients->entries[e].bits == best->bits)
+				ids[n++] = clients->entries[e].id;
+	for(int i = 1; i < n; i++)
+		for(int j = i; j > 0 && ids[j-1] > ids[j]; j--)
+		{
+			const int tmp = ids[j];
+			ids[j] = ids[j-1];
+			ids[j-1] = tmp;
+		}
+
+	// Format the IDs the way GROUP_CONCAT() does
+	size_t len = 0u;
+	char *str = calloc(n, 12);
+	if(str == NULL)
+	{
+		free(ids);
+		return false;
+	}
+	for(int i = 0; i < n; i++)
+		len += sprintf(str + len, i > 0 ? ",%d" : "%d", ids[i]);
+	free(ids);
+
+	match->count = count;
+	match->id = best->id;
+	match->bits = best->bits;
+	match->text = strdup(best->text);
+	match->ids = str;
+	return true;
+}
+
+// Find a client table entry matching name case-insensitively, returns its ID
+// or -1 if there is no such entry
+int gravity_clients_find(const struct gravity_clients *clients, const char *name)
+{
+	if(clients->num_names == 0u)
+		return -1;
+
+	const struct client_name *found = bsearch(name, clients->names, clients->num_names,
+	                                          sizeof(*clients->names), name_key_cmp);
+	return found != NULL ? found->id : -1;
+}
+
+// Get the comma-separated groups of a client, returns NULL if the client is not
+// assigned to any group
+const char *gravity_clients_groups(const struct gravity_clients *clients, const int id)
+{
+	if(clients->num_groups == 0u)
+		return NULL;
+
+	const struct client_groups *found = bsearch(&id, clients->groups, clients->num_groups,
+	                                            sizeof(*clients->groups), groups_key_cmp);
+	return found != NULL ? found->groups : NULL;
+}
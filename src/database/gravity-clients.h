@@ -0,0 +1,36 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2023 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  In-memory client table prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef GRAVITY_CLIENTS_H
+#define GRAVITY_CLIENTS_H
+
+// type bool
+#include <stdbool.h>
+#include "sqlite3.h"
+
+struct gravity_clients;
+
+// Result of a subnet lookup, equivalent to the result of the subnet_match()
+// query in get_client_groupids()
+struct client_subnet_match {
+	int count;          // Number of entries with the same (highest) number of matching bits
+	int id;             // Highest ID among them
+	int bits;           // Number of matching bits (CIDR of the entries)
+	char *text;         // Database text of the chosen entry (has to be freed)
+	char *ids;          // Comma-separated IDs of all entries (has to be freed)
+};
+
+struct gravity_clients *gravity_clients_load(sqlite3 *db);
+void gravity_clients_free(struct gravity_clients *clients);
+bool gravity_clients_match_subnet(const struct gravity_clients *clients, const char *ip,
+                                  struct client_subnet_match *match);
+int gravity_clients_find(const struct gravity_clients *clients, const char *name) __attribute__((pure));
+const char *gravity_clients_groups(const struct gravity_clients *clients, const int id) __attribute__((pure));
+
+#endif //GRAVITY_CLIENTS_H
@@ -28,6 +28,10 @@
 #include "../datastructure.h"
 // reset_aliasclient()
 #include "aliasclients.h"
+// gravity_index_lookup()
+#include "gravity-index.h"
+// gravity_clients_load()
+#include "gravity-clients.h"
 
 // Definition of struct regexData
 #include "../regex_r.h"
@@ -42,12 +46,44 @@ sqlite3_stmt_vec *whitelist_stmt = NULL;
 sqlite3_stmt_vec *gravity_stmt = NULL;
 sqlite3_stmt_vec *blacklist_stmt = NULL;
 
+// Statements shared by all clients when looking up the groups of a domain
+// instead of using per-client statements (see domain_in_groups())
+static sqlite3_stmt *group_stmt[EXACT_WHITELIST_TABLE + 1] = { NULL };
+static const char *group_querystr[EXACT_WHITELIST_TABLE + 1] = {
+	"SELECT group_id, -1 FROM vw_gravity WHERE domain = ? AND group_id IS NOT NULL;",
+	"SELECT group_id, id FROM vw_blacklist WHERE domain = ? AND group_id IS NOT NULL;",
+	"SELECT group_id, id FROM vw_whitelist WHERE domain = ? AND group_id IS NOT NULL;"
+};
+
+// Sorted IDs of all groups, the position of a group in this array is its bit in
+// the group bitmasks
+static int *group_bits = NULL;
+static unsigned int num_groups = 0u;
+
+// Everything bound to a single connection to the gravity database. On reload, a
+// new connection is prepared completely before it replaces the current one (see
+// gravityDB_prepare_swap() and gravityDB_swap())
+struct gravity_connection {
+	sqlite3 *db;
+	sqlite3_stmt *auditlist_stmt;
+	sqlite3_stmt *group_stmt[EXACT_WHITELIST_TABLE + 1];
+	int *group_bits;
+	unsigned int num_groups;
+	bool abp_format;
+	struct gravity_clients *clients;
+};
+static struct gravity_connection next_connection = { 0 };
+static sqlite3_stmt *next_table_stmt = NULL;
+
 // Private variables
 static sqlite3 *gravity_db = NULL;
 static sqlite3_stmt* table_stmt = NULL;
 static sqlite3_stmt* auditlist_stmt = NULL;
 bool gravityDB_opened = false;
 static bool gravity_abp_format = false;
+// In-memory copy of the client table, get_client_groupids() falls back to
+// querying the database if it could not be loaded
+static struct gravity_clients *gravity_clients = NULL;
 
 // Table names corresponding to the enum defined in gravity-db.h
 static const char* tablename[] = { "vw_gravity", "vw_blacklist", "vw_whitelist", "vw_regex_blacklist", "vw_regex_whitelist" , "" };
@@ -91,26 +127,88 @@ void gravityDB_forked(void)
 	whitelist_stmt = NULL;
 	blacklist_stmt = NULL;
 	gravity_stmt = NULL;
+	for(unsigned int i = 0; i < sizeof(group_stmt)/sizeof(group_stmt[0]); i++)
+		group_stmt[i] = NULL;
+
+	// Lookups are served without the database if all lists are held in the
+	// gravity index (a mapped index file is even shared with the parent)
+	// and the client table is held in memory. Both are inherited from the
+	// parent. The database is then only opened when it is needed otherwise
+	if(gravity_index_available() && gravity_clients != NULL)
+		return;
 
 	// Open the database
 	gravityDB_open();
 }
 
-static void gravity_check_ABP_format(void)
+// Read the IDs of all groups and prepare the statements shared by all clients
+static bool gravityDB_prepare_group_statements(struct gravity_connection *conn)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(conn->db, "SELECT id FROM \"group\" ORDER BY id;", -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("gravityDB_prepare_group_statements() - SQL error prepare: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	unsigned int size = 0u;
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		if(conn->num_groups == size)
+		{
+			size = size > 0u ? 2u*size : 16u;
+			int *ids = realloc(conn->group_bits, size*sizeof(int));
+			if(ids == NULL)
+			{
+				logg("ERROR: Memory allocation failed in gravityDB_prepare_group_statements()");
+				sqlite3_finalize(stmt);
+				return false;
+			}
+			conn->group_bits = ids;
+		}
+		conn->group_bits[conn->num_groups++] = sqlite3_column_int(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+
+	if(rc != SQLITE_DONE)
+	{
+		logg("gravityDB_prepare_group_statements() - SQL error step: %s", sqlite3_errstr(rc));
+		return false;
+	}
+
+	for(unsigned int i = 0; i < sizeof(group_stmt)/sizeof(group_stmt[0]); i++)
+	{
+		rc = sqlite3_prepare_v3(conn->db, group_querystr[i], -1, SQLITE_PREPARE_PERSISTENT, &conn->group_stmt[i], NULL);
+		if(rc != SQLITE_OK)
+		{
+			logg("gravityDB_prepare_group_statements(\"%s\") - SQL error prepare: %s",
+			     group_querystr[i], sqlite3_errstr(rc));
+			return false;
+		}
+	}
+
+	if(config.debug & DEBUG_DATABASE)
+		logg("gravityDB_open(): Prepared group statements for %u groups", conn->num_groups);
+
+	return true;
+}
+
+static bool gravity_check_ABP_format(sqlite3 *db)
 {
 	// Check if we have a valid ABP format
 	// We do this by checking the "abp_domains" property in the "info" table
 
 	// Prepare statement
 	sqlite3_stmt *stmt = NULL;
-	int rc = sqlite3_prepare_v2(gravity_db,
+	int rc = sqlite3_prepare_v2(db,
 	                            "SELECT value FROM info WHERE property = 'abp_domains';",
 	                            -1, &stmt, NULL);
 
 	if( rc != SQLITE_OK )
 	{
 		logg("gravity_check_ABP_format() - SQL error prepare: %s", sqlite3_errstr(rc));
-		return;
+		return false;
 	}
 
 	// Execute statement
@@ -118,60 +216,53 @@ static void gravity_check_ABP_format(void)
 	if( rc != SQLITE_ROW )
 	{
 		// No result
-		gravity_abp_format = false;
 		sqlite3_finalize(stmt);
-		return;
+		return false;
 	}
 
 	// Get result (SQLite3 stores 1 for TRUE, 0 for FALSE)
-	gravity_abp_format = sqlite3_column_int(stmt, 0) != 0;
+	const bool abp_format = sqlite3_column_int(stmt, 0) != 0;
 
 	// Finalize statement
 	sqlite3_finalize(stmt);
+
+	return abp_format;
 }
 
-// Open gravity database
-bool gravityDB_open(void)
+// Re-check if there are any ABP-style entries in the database after a list has
+// been updated in place
+void gravityDB_refresh_ABP_format(void)
 {
-	struct stat st;
-	if(stat(FTLfiles.gravity_db, &st) != 0)
-	{
-		// File does not exist
-		logg("gravityDB_open(): %s does not exist", FTLfiles.gravity_db);
-		return false;
-	}
+	if(!gravityDB_opened)
+		return;
 
-	if(gravityDB_opened && gravity_db != NULL)
-	{
-		if(config.debug & DEBUG_DATABASE)
-			logg("gravityDB_open(): Database already connected");
-		return true;
-	}
+	gravity_abp_format = gravity_check_ABP_format(gravity_db);
+}
 
+// Open a new connection to the gravity database and prepare everything that is
+// not specific to a client. Only conn is modified so this can be done while
+// the current connection is still in use
+static bool gravityDB_connect(struct gravity_connection *conn)
+{
 	if(config.debug & DEBUG_DATABASE)
 		logg("gravityDB_open(): Trying to open %s in read-only mode", FTLfiles.gravity_db);
-	int rc = sqlite3_open_v2(FTLfiles.gravity_db, &gravity_db, SQLITE_OPEN_READONLY, NULL);
+	int rc = sqlite3_open_v2(FTLfiles.gravity_db, &conn->db, SQLITE_OPEN_READONLY, NULL);
 	if( rc != SQLITE_OK )
 	{
 		logg("gravityDB_open() - SQL error: %s", sqlite3_errstr(rc));
-		gravityDB_close();
 		return false;
 	}
 
-	// Database connection is now open
-	gravityDB_opened = true;
-
 	// Tell SQLite3 to store temporary tables in memory. This speeds up read operations on
 	// temporary tables, indices, and views.
 	if(config.debug & DEBUG_DATABASE)
 		logg("gravityDB_open(): Setting location for temporary object to MEMORY");
 	char *zErrMsg = NULL;
-	rc = sqlite3_exec(gravity_db, "PRAGMA temp_store = MEMORY", NULL, NULL, &zErrMsg);
+	rc = sqlite3_exec(conn->db, "PRAGMA temp_store = MEMORY", NULL, NULL, &zErrMsg);
 	if( rc != SQLITE_OK )
 	{
 		logg("gravityDB_open(PRAGMA temp_store) - SQL error (%i): %s", rc, zErrMsg);
 		sqlite3_free(zErrMsg);
-		gravityDB_close();
 		return false;
 	}
 
@@ -189,19 +280,18 @@ bool gravityDB_open(void)
 	//            matches 'google.de' and all of its subdomains but
 	//            also other domains ending in google.de, like
 	//            abcgoogle.de
-	rc = sqlite3_prepare_v3(gravity_db,
+	rc = sqlite3_prepare_v3(conn->db,
 	        "SELECT domain, "
 	          "CASE WHEN substr(domain, 1, 1) = '*' " // Does the database string start in '*' ?
 	            "THEN '*' || substr(:input, - length(domain) + 1) " // If so: Crop the input domain and prepend '*'
 	            "ELSE :input " // If not: Use input domain directly for comparison
 	          "END matcher "
 	        "FROM domain_audit WHERE matcher = domain" // Match where (modified) domain equals the database domain
-	        ";", -1, SQLITE_PREPARE_PERSISTENT, &auditlist_stmt, NULL);
+	        ";", -1, SQLITE_PREPARE_PERSISTENT, &conn->auditlist_stmt, NULL);
 
 	if( rc != SQLITE_OK )
 	{
 		logg("gravityDB_open(\"SELECT EXISTS(... domain_audit ...)\") - SQL error prepare: %s", sqlite3_errstr(rc));
-		gravityDB_close();
 		return false;
 	}
 
@@ -210,7 +300,69 @@ bool gravityDB_open(void)
 	// writing the changes to disk
 	if(config.debug & DEBUG_DATABASE)
 		logg("gravityDB_open(): Setting busy timeout to %d", DATABASE_BUSY_TIMEOUT);
-	sqlite3_busy_timeout(gravity_db, DATABASE_BUSY_TIMEOUT);
+	sqlite3_busy_timeout(conn->db, DATABASE_BUSY_TIMEOUT);
+
+	// Explicitly set busy handler to zero milliseconds
+	if(config.debug & DEBUG_DATABASE)
+		logg("gravityDB_open(): Setting busy timeout to zero");
+	rc = sqlite3_busy_timeout(conn->db, 0);
+	if(rc != SQLITE_OK)
+	{
+		logg("gravityDB_open() - Cannot set busy handler: %s", sqlite3_errstr(rc));
+	}
+
+	// Check (and remember) if there are any ABP-style entries in the
+	// database
+	conn->abp_format = gravity_check_ABP_format(conn->db);
+
+	// Prepare statements shared by all clients if enabled. Per-client
+	// statements are used if this fails
+	if(config.gravity_group_bitmask && !gravityDB_prepare_group_statements(conn))
+	{
+		for(unsigned int i = 0; i < sizeof(conn->group_stmt)/sizeof(conn->group_stmt[0]); i++)
+		{
+			sqlite3_finalize(conn->group_stmt[i]);
+			conn->group_stmt[i] = NULL;
+		}
+	}
+
+	// Load the client table into memory
+	conn->clients = gravity_clients_load(conn->db);
+
+	return true;
+}
+
+// Finalize all statements of a connection which has not been installed and
+// close it
+static void gravityDB_disconnect(struct gravity_connection *conn)
+{
+	for(unsigned int i = 0; i < sizeof(conn->group_stmt)/sizeof(conn->group_stmt[0]); i++)
+		sqlite3_finalize(conn->group_stmt[i]);
+	sqlite3_finalize(conn->auditlist_stmt);
+	sqlite3_close(conn->db);
+	free(conn->group_bits);
+	gravity_clients_free(conn->clients);
+	memset(conn, 0, sizeof(*conn));
+}
+
+// Make conn the current connection. The previous connection has to be closed
+// using gravityDB_close() before
+static void gravityDB_install(struct gravity_connection *conn)
+{
+	gravity_db = conn->db;
+	auditlist_stmt = conn->auditlist_stmt;
+	for(unsigned int i = 0; i < sizeof(group_stmt)/sizeof(group_stmt[0]); i++)
+		group_stmt[i] = conn->group_stmt[i];
+	free(group_bits);
+	group_bits = conn->group_bits;
+	num_groups = conn->num_groups;
+	gravity_abp_format = conn->abp_format;
+	gravity_clients_free(gravity_clients);
+	gravity_clients = conn->clients;
+	memset(conn, 0, sizeof(*conn));
+
+	// Database connection is now open
+	gravityDB_opened = true;
 
 	// Prepare private vector of statements for this process (might be a TCP fork!)
 	if(whitelist_stmt == NULL)
@@ -219,25 +371,94 @@ bool gravityDB_open(void)
 		blacklist_stmt = new_sqlite3_stmt_vec(counters->clients);
 	if(gravity_stmt == NULL)
 		gravity_stmt = new_sqlite3_stmt_vec(counters->clients);
+}
 
-	// Explicitly set busy handler to zero milliseconds
-	if(config.debug & DEBUG_DATABASE)
-		logg("gravityDB_open(): Setting busy timeout to zero");
-	rc = sqlite3_busy_timeout(gravity_db, 0);
-	if(rc != SQLITE_OK)
+// Open gravity database
+bool gravityDB_open(void)
+{
+	struct stat st;
+	if(stat(FTLfiles.gravity_db, &st) != 0)
 	{
-		logg("gravityDB_open() - Cannot set busy handler: %s", sqlite3_errstr(rc));
+		// File does not exist
+		logg("gravityDB_open(): %s does not exist", FTLfiles.gravity_db);
+		return false;
 	}
 
-	// Check (and remember in global variable) if there are any ABP-style
-	// entries in the database
-	gravity_check_ABP_format();
+	if(gravityDB_opened && gravity_db != NULL)
+	{
+		if(config.debug & DEBUG_DATABASE)
+			logg("gravityDB_open(): Database already connected");
+		return true;
+	}
+
+	struct gravity_connection conn = { 0 };
+	if(!gravityDB_connect(&conn))
+	{
+		gravityDB_disconnect(&conn);
+		gravityDB_close();
+		return false;
+	}
+	gravityDB_install(&conn);
 
 	if(config.debug & DEBUG_DATABASE)
 		logg("gravityDB_open(): Successfully opened gravity.db");
 	return true;
 }
 
+// Open and prepare a new connection to the gravity database without touching
+// the current one. This is done before locking the shared memory on reload so
+// queries are still answered from the current connection in the meantime
+bool gravityDB_prepare_swap(void)
+{
+	// Discard a connection prepared earlier but never installed
+	if(next_connection.db != NULL)
+		gravityDB_disconnect(&next_connection);
+
+	struct stat st;
+	if(stat(FTLfiles.gravity_db, &st) != 0)
+	{
+		// File does not exist
+		logg("gravityDB_prepare_swap(): %s does not exist", FTLfiles.gravity_db);
+		return false;
+	}
+
+	if(!gravityDB_connect(&next_connection))
+	{
+		gravityDB_disconnect(&next_connection);
+		return false;
+	}
+
+	// Compile the regex filters of the new connection while the current
+	// ones are still in use
+	regex_prepare_swap();
+
+	return true;
+}
+
+// Replace the current connection by the one prepared by gravityDB_prepare_swap().
+// If no new connection could be prepared, the current one (if any) is kept so
+// lookups never fail due to a missing database connection. May only be called
+// while the shared memory is locked
+bool gravityDB_swap(void)
+{
+	if(next_connection.db == NULL)
+	{
+		if(gravityDB_opened)
+		{
+			logg("WARNING: Gravity database could not be opened, keeping previous connection");
+			return false;
+		}
+		return gravityDB_reopen();
+	}
+
+	gravityDB_close();
+	gravityDB_install(&next_connection);
+
+	if(config.debug & DEBUG_DATABASE)
+		logg("gravityDB_swap(): Successfully swapped gravity.db connection");
+	return true;
+}
+
 bool gravityDB_reopen(void)
 {
 	// We call this routine when reloading the cache.
@@ -283,23 +504,11 @@ static inline const char *show_client_string(const char *hwaddr, const char *hos
 }
 
 
-// Get associated groups for this client (if defined)
-static bool get_client_groupids(clientsData* client)
+// Find the client table entries matching ip with the highest number of bits
+// using subnet_match(). Returns 1 if there is a match, 0 if there is none, and
+// -1 on error
+static int client_subnet_sql(const char *ip, struct client_subnet_match *match)
 {
-	const char *ip = getstr(client->ippos);
-	client->flags.found_group = false;
-	client->groupspos = 0u;
-
-	// Do not proceed when database is not available
-	if(!gravityDB_opened && !gravityDB_open())
-	{
-		logg("get_client_groupids(): Gravity database not available");
-		return false;
-	}
-
-	if(config.debug & DEBUG_CLIENTS)
-		logg("Querying gravity database for client with IP %s...", ip);
-
 	// Check if client is configured through the client table
 	// This will return nothing if the client is unknown/unconfigured
 	const char *querystr = "SELECT count(id) matching_count, "
@@ -317,7 +526,7 @@ static bool get_client_groupids(clientsData* client)
 	{
 		logg("get_client_groupids(\"%s\") - SQL error prepare: %s",
 		     ip, sqlite3_errstr(rc));
-		return false;
+		return -1;
 	}
 
 	// Bind ipaddr to prepared statement
@@ -327,45 +536,221 @@ static bool get_client_groupids(clientsData* client)
 		     ip, sqlite3_errstr(rc));
 		sqlite3_reset(table_stmt);
 		sqlite3_finalize(table_stmt);
-		return NULL;
+		return -1;
 	}
 
 	// Perform query
 	rc = sqlite3_step(table_stmt);
-	int matching_count = 0, chosen_match_id = -1, matching_bits = 0;
-	char *matching_ids = NULL, *chosen_match_text = NULL;
 	if(rc == SQLITE_ROW)
 	{
 		// There is a record for this client in the database,
 		// extract the result (there can be at most one line)
-		matching_count = sqlite3_column_int(table_stmt, 0);
-		chosen_match_id = sqlite3_column_int(table_stmt, 1);
-		chosen_match_text = strdup((const char*)sqlite3_column_text(table_stmt, 2));
-		matching_ids = strdup((const char*)sqlite3_column_text(table_stmt, 3));
-		matching_bits = sqlite3_column_int(table_stmt, 4);
+		match->count = sqlite3_column_int(table_stmt, 0);
+		match->id = sqlite3_column_int(table_stmt, 1);
+		match->text = strdup((const char*)sqlite3_column_text(table_stmt, 2));
+		match->ids = strdup((const char*)sqlite3_column_text(table_stmt, 3));
+		match->bits = sqlite3_column_int(table_stmt, 4);
+	}
+	else if(rc != SQLITE_DONE)
+	{
+		// Error
+		logg("get_client_groupids(\"%s\") - SQL error step: %s",
+		     ip, sqlite3_errstr(rc));
+		gravityDB_finalizeTable();
+		return -1;
+	}
 
-		if(config.debug & DEBUG_CLIENTS && matching_count == 1)
-			// Case matching_count > 1 handled below using logg_subnet_warning()
-			logg("--> Found record for %s in the client table (group ID %d)", ip, chosen_match_id);
+	// Finalize statement
+	gravityDB_finalizeTable();
+
+	return rc == SQLITE_ROW ? 1 : 0;
+}
+
+// Find the ID of the client table entry matching name (a hardware address, a
+// host name, or an interface) case-insensitively. Returns 1 if there is a
+// match, 0 if there is none, and -1 on error
+static int client_id_sql(const char *ip, const char *name, const bool interface, int *id)
+{
+	// Check if client is configured through the client table
+	// This will return nothing if the client is unknown/unconfigured
+	// We use the SQLite concatenate operator || to prepace a queried interface by ":"
+	// We use COLLATE NOCASE to ensure the comparison is done case-insensitive
+	const char *querystr = interface ?
+		"SELECT id FROM client WHERE ip = '"INTERFACE_SEP"' || ? COLLATE NOCASE;" :
+		"SELECT id FROM client WHERE ip = ? COLLATE NOCASE;";
+
+	// Prepare query
+	int rc = sqlite3_prepare_v2(gravity_db, querystr, -1, &table_stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("get_client_groupids(%s) - SQL error prepare: %s",
+			querystr, sqlite3_errstr(rc));
+		return -1;
 	}
-	else if(rc == SQLITE_DONE)
+
+	// Bind name to prepared statement
+	if((rc = sqlite3_bind_text(table_stmt, 1, name, -1, SQLITE_STATIC)) != SQLITE_OK)
 	{
-		if(config.debug & DEBUG_CLIENTS)
-			logg("--> No record for %s in the client table", ip);
+		logg("get_client_groupids(\"%s\", \"%s\"): Failed to bind name: %s",
+			ip, name, sqlite3_errstr(rc));
+		sqlite3_reset(table_stmt);
+		sqlite3_finalize(table_stmt);
+		return -1;
 	}
-	else
+
+	// Perform query
+	rc = sqlite3_step(table_stmt);
+	if(rc == SQLITE_ROW)
+	{
+		// There is a record for this client in the database,
+		// extract the result (there can be at most one line)
+		*id = sqlite3_column_int(table_stmt, 0);
+	}
+	else if(rc != SQLITE_DONE)
 	{
 		// Error
-		logg("get_client_groupids(\"%s\") - SQL error step: %s",
-		     ip, sqlite3_errstr(rc));
+		logg("get_client_groupids(\"%s\", \"%s\") - SQL error step: %s",
+			ip, name, sqlite3_errstr(rc));
 		gravityDB_finalizeTable();
+		return -1;
+	}
+
+	// Finalize statement
+	gravityDB_finalizeTable();
+
+	return rc == SQLITE_ROW ? 1 : 0;
+}
+
+// Find the client table entries matching ip, see client_subnet_sql()
+static int get_client_subnet(const char *ip, struct client_subnet_match *match)
+{
+	if(gravity_clients == NULL)
+		return client_subnet_sql(ip, match);
+
+	return gravity_clients_match_subnet(gravity_clients, ip, match) ? 1 : 0;
+}
+
+// Find the client table entry matching name, see client_id_sql()
+static int get_client_id(const char *ip, const char *name, const bool interface, int *id)
+{
+	if(gravity_clients == NULL)
+		return client_id_sql(ip, name, interface, id);
+
+	if(interface)
+	{
+		char *key = NULL;
+		if(asprintf(&key, INTERFACE_SEP"%s", name) < 0)
+			return -1;
+		*id = gravity_clients_find(gravity_clients, key);
+		free(key);
+	}
+	else
+		*id = gravity_clients_find(gravity_clients, name);
+
+	return *id >= 0 ? 1 : 0;
+}
+
+// Get the groups of the client table entry with the given ID from the
+// client_by_group table
+static bool client_groups_sql(const char *ip, const char *hwaddr, const int id, clientsData *client)
+{
+	// Build query string to get possible group associations for this particular client
+	// The SQL GROUP_CONCAT() function returns a string which is the concatenation of all
+	// non-NULL values of group_id separated by ','. The order of the concatenated elements
+	// is arbitrary, however, is of no relevance for your use case.
+	// We check using a possibly defined subnet and use the first result
+	const char *querystr = "SELECT GROUP_CONCAT(group_id) FROM client_by_group "
+	                       "WHERE client_id = ?;";
+
+	// Prepare query
+	int rc = sqlite3_prepare_v2(gravity_db, querystr, -1, &table_stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("get_client_groupids(\"%s\", \"%s\", %d) - SQL error prepare: %s",
+		     ip, hwaddr, id, sqlite3_errstr(rc));
+		sqlite3_finalize(table_stmt);
+		return false;
+	}
+
+	// Bind client ID to prepared statement
+	if((rc = sqlite3_bind_int(table_stmt, 1, id)) != SQLITE_OK)
+	{
+		logg("get_client_groupids(\"%s\", \"%s\", %d): Failed to bind chosen_match_id: %s",
+			ip, hwaddr, id, sqlite3_errstr(rc));
+		sqlite3_reset(table_stmt);
+		sqlite3_finalize(table_stmt);
 		return false;
 	}
 
+	// Perform query
+	rc = sqlite3_step(table_stmt);
+	if(rc == SQLITE_ROW)
+	{
+		// There is a record for this client in the database
+		const char* result = (const char*)sqlite3_column_text(table_stmt, 0);
+		if(result != NULL)
+		{
+			client->groupspos = addstr(result);
+			client->flags.found_group = true;
+		}
+	}
+	else if(rc == SQLITE_DONE)
+	{
+		// Found no record for this client in the database
+		// -> No associated groups
+		client->groupspos = addstr("");
+		client->flags.found_group = true;
+	}
+	else
+	{
+		logg("get_client_groupids(\"%s\", \"%s\", %d) - SQL error step: %s",
+		     ip, hwaddr, id, sqlite3_errstr(rc));
+		gravityDB_finalizeTable();
+		return false;
+	}
 	// Finalize statement
 	gravityDB_finalizeTable();
 
-	if(matching_count > 1)
+	return true;
+}
+
+// Get associated groups for this client (if defined)
+static bool get_client_groupids(clientsData* client)
+{
+	const char *ip = getstr(client->ippos);
+	client->flags.found_group = false;
+	client->groupspos = 0u;
+
+	// Do not proceed when database is not available. It is not needed if
+	// the client table is held in memory
+	if(gravity_clients == NULL && !gravityDB_opened && !gravityDB_open())
+	{
+		logg("get_client_groupids(): Gravity database not available");
+		return false;
+	}
+
+	if(config.debug & DEBUG_CLIENTS)
+		logg("Querying gravity database for client with IP %s...", ip);
+
+	// Check if client is configured through the client table
+	struct client_subnet_match match = { .id = -1 };
+	int rc = get_client_subnet(ip, &match);
+	if(rc < 0)
+		return false;
+	int chosen_match_id = match.id;
+	if(rc > 0)
+	{
+		if(config.debug & DEBUG_CLIENTS && match.count == 1)
+			// Case matching_count > 1 handled below using logg_subnet_warning()
+			logg("--> Found record for %s in the client table (group ID %d)", ip, chosen_match_id);
+	}
+	else
+	{
+		if(config.debug & DEBUG_CLIENTS)
+			logg("--> No record for %s in the client table", ip);
+	}
+
+	if(match.count > 1)
 	{
 		// There is more than one configured subnet that matches to current device
 		// with the same number of subnet mask bits. This is likely unintended by
@@ -374,19 +759,19 @@ static bool get_client_groupids(clientsData* client)
 		//   Device 10.8.0.22
 		//   Client 1: 10.8.0.0/24
 		//   Client 2: 10.8.1.0/24
-		logg_subnet_warning(ip, matching_count, matching_ids, matching_bits, chosen_match_text, chosen_match_id);
+		logg_subnet_warning(ip, match.count, match.ids, match.bits, match.text, chosen_match_id);
 	}
 
 	// Free memory if applicable
-	if(matching_ids != NULL)
+	if(match.ids != NULL)
 	{
-		free(matching_ids);
-		matching_ids = NULL;
+		free(match.ids);
+		match.ids = NULL;
 	}
-	if(chosen_match_text != NULL)
+	if(match.text != NULL)
 	{
-		free(chosen_match_text);
-		chosen_match_text = NULL;
+		free(match.text);
+		match.text = NULL;
 	}
 
 	// If we didn't find an IP address match above, try with MAC address matches
@@ -455,58 +840,22 @@ static bool get_client_groupids(clientsData* client)
 
 		// Check if client is configured through the client table
 		// This will return nothing if the client is unknown/unconfigured
-		// We use COLLATE NOCASE to ensure the comparison is done case-insensitive
-		querystr = "SELECT id FROM client WHERE ip = ? COLLATE NOCASE;";
-
-		// Prepare query
-		rc = sqlite3_prepare_v2(gravity_db, querystr, -1, &table_stmt, NULL);
-		if(rc != SQLITE_OK)
+		rc = get_client_id(ip, hwaddr, false, &chosen_match_id);
+		if(rc > 0)
 		{
-			logg("get_client_groupids(%s) - SQL error prepare: %s",
-				querystr, sqlite3_errstr(rc));
-			free(hwaddr); // hwaddr != NULL -> memory has been allocated
-			return false;
-		}
-
-		// Bind hwaddr to prepared statement
-		if((rc = sqlite3_bind_text(table_stmt, 1, hwaddr, -1, SQLITE_STATIC)) != SQLITE_OK)
-		{
-			logg("get_client_groupids(\"%s\", \"%s\"): Failed to bind hwaddr: %s",
-				ip, hwaddr, sqlite3_errstr(rc));
-			sqlite3_reset(table_stmt);
-			sqlite3_finalize(table_stmt);
-			free(hwaddr); // hwaddr != NULL -> memory has been allocated
-			return false;
-		}
-
-		// Perform query
-		rc = sqlite3_step(table_stmt);
-		if(rc == SQLITE_ROW)
-		{
-			// There is a record for this client in the database,
-			// extract the result (there can be at most one line)
-			chosen_match_id = sqlite3_column_int(table_stmt, 0);
-
 			if(config.debug & DEBUG_CLIENTS)
 				logg("--> Found record for %s in the client table (group ID %d)", hwaddr, chosen_match_id);
 		}
-		else if(rc == SQLITE_DONE)
+		else if(rc == 0)
 		{
 			if(config.debug & DEBUG_CLIENTS)
 				logg("--> There is no record for %s in the client table", hwaddr);
 		}
 		else
 		{
-			// Error
-			logg("get_client_groupids(\"%s\", \"%s\") - SQL error step: %s",
-				ip, hwaddr, sqlite3_errstr(rc));
-			gravityDB_finalizeTable();
 			free(hwaddr); // hwaddr != NULL -> memory has been allocated
 			return false;
 		}
-
-		// Finalize statement and free allocated memory
-		gravityDB_finalizeTable();
 	}
 
 	// If we did neither find an IP nor a MAC address match above, we try to look
@@ -543,61 +892,23 @@ static bool get_client_groupids(clientsData* client)
 
 		// Check if client is configured through the client table
 		// This will return nothing if the client is unknown/unconfigured
-		// We use COLLATE NOCASE to ensure the comparison is done case-insensitive
-		querystr = "SELECT id FROM client WHERE ip = ? COLLATE NOCASE;";
-
-		// Prepare query
-		rc = sqlite3_prepare_v2(gravity_db, querystr, -1, &table_stmt, NULL);
-		if(rc != SQLITE_OK)
+		rc = get_client_id(ip, hostname, false, &chosen_match_id);
+		if(rc > 0)
 		{
-			logg("get_client_groupids(%s) - SQL error prepare: %s",
-				querystr, sqlite3_errstr(rc));
-			if(hwaddr) free(hwaddr);
-			free(hostname); // hostname != NULL -> memory has been allocated
-			return false;
-		}
-
-		// Bind hostname to prepared statement
-		if((rc = sqlite3_bind_text(table_stmt, 1, hostname, -1, SQLITE_STATIC)) != SQLITE_OK)
-		{
-			logg("get_client_groupids(\"%s\", \"%s\"): Failed to bind hostname: %s",
-				ip, hostname, sqlite3_errstr(rc));
-			sqlite3_reset(table_stmt);
-			sqlite3_finalize(table_stmt);
-			if(hwaddr) free(hwaddr);
-			free(hostname); // hostname != NULL -> memory has been allocated
-			return false;
-		}
-
-		// Perform query
-		rc = sqlite3_step(table_stmt);
-		if(rc == SQLITE_ROW)
-		{
-			// There is a record for this client in the database,
-			// extract the result (there can be at most one line)
-			chosen_match_id = sqlite3_column_int(table_stmt, 0);
-
 			if(config.debug & DEBUG_CLIENTS)
 				logg("--> Found record for %s in the client table (group ID %d)", hostname, chosen_match_id);
 		}
-		else if(rc == SQLITE_DONE)
+		else if(rc == 0)
 		{
 			if(config.debug & DEBUG_CLIENTS)
 				logg("--> There is no record for %s in the client table", hostname);
 		}
 		else
 		{
-			// Error
-			logg("get_client_groupids(\"%s\", \"%s\") - SQL error step: %s",
-				ip, hostname, sqlite3_errstr(rc));
-			gravityDB_finalizeTable();
 			if(hwaddr) free(hwaddr);
 			free(hostname); // hostname != NULL -> memory has been allocated
 			return false;
 		}
-
-		// Finalize statement and free allocated memory
-		gravityDB_finalizeTable();
 	}
 
 	// If we did neither find an IP nor a MAC address and also no host name
@@ -634,65 +945,24 @@ static bool get_client_groupids(clientsData* client)
 
 		// Check if client is configured through the client table using its interface
 		// This will return nothing if the client is unknown/unconfigured
-		// We use the SQLite concatenate operator || to prepace the queried interface by ":"
-		// We use COLLATE NOCASE to ensure the comparison is done case-insensitive
-		querystr = "SELECT id FROM client WHERE ip = '"INTERFACE_SEP"' || ? COLLATE NOCASE;";
-
-		// Prepare query
-		rc = sqlite3_prepare_v2(gravity_db, querystr, -1, &table_stmt, NULL);
-		if(rc != SQLITE_OK)
+		rc = get_client_id(ip, interface, true, &chosen_match_id);
+		if(rc > 0)
 		{
-			logg("get_client_groupids(%s) - SQL error prepare: %s",
-				querystr, sqlite3_errstr(rc));
-			if(hwaddr) free(hwaddr);
-			if(hostname) free(hostname);
-			free(interface); // interface != NULL -> memory has been allocated
-			return false;
-		}
-
-		// Bind interface to prepared statement
-		if((rc = sqlite3_bind_text(table_stmt, 1, interface, -1, SQLITE_STATIC)) != SQLITE_OK)
-		{
-			logg("get_client_groupids(\"%s\", \"%s\"): Failed to bind interface: %s",
-				ip, interface, sqlite3_errstr(rc));
-			sqlite3_reset(table_stmt);
-			sqlite3_finalize(table_stmt);
-			if(hwaddr) free(hwaddr);
-			if(hostname) free(hostname);
-			free(interface); // interface != NULL -> memory has been allocated
-			return false;
-		}
-
-		// Perform query
-		rc = sqlite3_step(table_stmt);
-		if(rc == SQLITE_ROW)
-		{
-			// There is a record for this client in the database,
-			// extract the result (there can be at most one line)
-			chosen_match_id = sqlite3_column_int(table_stmt, 0);
-
 			if(config.debug & DEBUG_CLIENTS)
 				logg("--> Found record for interface "INTERFACE_SEP"%s in the client table (group ID %d)", interface, chosen_match_id);
 		}
-		else if(rc == SQLITE_DONE)
+		else if(rc == 0)
 		{
 			if(config.debug & DEBUG_CLIENTS)
 				logg("--> There is no record for interface "INTERFACE_SEP"%s in the client table", interface);
 		}
 		else
 		{
-			// Error
-			logg("get_client_groupids(\"%s\", \"%s\") - SQL error step: %s",
-				ip, interface, sqlite3_errstr(rc));
-			gravityDB_finalizeTable();
 			if(hwaddr) free(hwaddr);
 			if(hostname) free(hostname);
 			free(interface); // interface != NULL -> memory has been allocated
 			return false;
 		}
-
-		// Finalize statement and free allocated memory
-		gravityDB_finalizeTable();
 	}
 
 	// We use the default group and return early here
@@ -728,65 +998,22 @@ static bool get_client_groupids(clientsData* client)
 		return true;
 	}
 
-	// Build query string to get possible group associations for this particular client
-	// The SQL GROUP_CONCAT() function returns a string which is the concatenation of all
-	// non-NULL values of group_id separated by ','. The order of the concatenated elements
-	// is arbitrary, however, is of no relevance for your use case.
-	// We check using a possibly defined subnet and use the first result
-	querystr = "SELECT GROUP_CONCAT(group_id) FROM client_by_group "
-	           "WHERE client_id = ?;";
-
 	if(config.debug & DEBUG_CLIENTS)
-		logg("Querying gravity database for client %s (getting groups)", ip);
-
-	// Prepare query
-	rc = sqlite3_prepare_v2(gravity_db, querystr, -1, &table_stmt, NULL);
-	if(rc != SQLITE_OK)
-	{
-		logg("get_client_groupids(\"%s\", \"%s\", %d) - SQL error prepare: %s",
-		     ip, hwaddr, chosen_match_id, sqlite3_errstr(rc));
-		sqlite3_finalize(table_stmt);
-		return false;
-	}
-
-	// Bind hwaddr to prepared statement
-	if((rc = sqlite3_bind_int(table_stmt, 1, chosen_match_id)) != SQLITE_OK)
-	{
-		logg("get_client_groupids(\"%s\", \"%s\", %d): Failed to bind chosen_match_id: %s",
-			ip, hwaddr, chosen_match_id, sqlite3_errstr(rc));
-		sqlite3_reset(table_stmt);
-		sqlite3_finalize(table_stmt);
-		return false;
-	}
-
-	// Perform query
-	rc = sqlite3_step(table_stmt);
-	if(rc == SQLITE_ROW)
-	{
-		// There is a record for this client in the database
-		const char* result = (const char*)sqlite3_column_text(table_stmt, 0);
-		if(result != NULL)
-		{
-			client->groupspos = addstr(result);
-			client->flags.found_group = true;
-		}
-	}
-	else if(rc == SQLITE_DONE)
-	{
-		// Found no record for this client in the database
-		// -> No associated groups
-		client->groupspos = addstr("");
-		client->flags.found_group = true;
-	}
-	else
+		logg("Querying gravity database for client %s (getting groups)", ip);
+
+	if(gravity_clients != NULL)
 	{
-		logg("get_client_groupids(\"%s\", \"%s\", %d) - SQL error step: %s",
-		     ip, hwaddr, chosen_match_id, sqlite3_errstr(rc));
-		gravityDB_finalizeTable();
-		return false;
+		// Entries without any group are not found, this is the same as
+		// GROUP_CONCAT() returning NULL in client_groups_sql()
+		const char *groups = gravity_clients_groups(gravity_clients, chosen_match_id);
+		if(groups != NULL)
+		{
+			client->groupspos = addstr(groups);
+			client->flags.found_group = true;
+		}
 	}
-	// Finalize statement
-	gravityDB_finalizeTable();
+	else if(!client_groups_sql(ip, hwaddr, chosen_match_id, client))
+		return false;
 
 	if(config.debug & DEBUG_CLIENTS)
 	{
@@ -894,6 +1121,11 @@ bool gravityDB_prepare_client_statements(clientsData *client)
 	if(!client->flags.found_group && !get_client_groupids(client))
 		return false;
 
+	// No per-client statements are needed when using the statements shared
+	// by all clients
+	if(group_stmt[GRAVITY_TABLE] != NULL)
+		return true;
+
 	// Prepare whitelist statement
 	if(config.debug & DEBUG_DATABASE)
 		logg("gravityDB_open(): Preparing vw_whitelist statement for client %s", clientip);
@@ -993,26 +1225,31 @@ void gravityDB_close(void)
 	free_sqlite3_stmt_vec(&blacklist_stmt);
 	free_sqlite3_stmt_vec(&gravity_stmt);
 
+	// Finalize statements shared by all clients
+	for(unsigned int i = 0; i < sizeof(group_stmt)/sizeof(group_stmt[0]); i++)
+	{
+		sqlite3_finalize(group_stmt[i]);
+		group_stmt[i] = NULL;
+	}
+
 	// Finalize audit list statement
 	sqlite3_finalize(auditlist_stmt);
 	auditlist_stmt = NULL;
 
+	// Free in-memory client table
+	gravity_clients_free(gravity_clients);
+	gravity_clients = NULL;
+
 	// Close table
 	sqlite3_close(gravity_db);
 	gravity_db = NULL;
 	gravityDB_opened = false;
 }
 
-// Prepare a SQLite3 statement which can be used by gravityDB_getDomain() to get
-// blocking domains from a table which is specified when calling this function
-bool gravityDB_getTable(const unsigned char list)
+// Prepare a SQLite3 statement on db which returns the domains (and their IDs)
+// of the specified table
+static bool prepare_table(sqlite3 *db, sqlite3_stmt **stmt, const unsigned char list)
 {
-	if(!gravityDB_opened && !gravityDB_open())
-	{
-		logg("gravityDB_getTable(%u): Gravity database not available", list);
-		return false;
-	}
-
 	// Checking for smaller than GRAVITY_LIST is omitted due to list being unsigned
 	if(list >= UNKNOWN_TABLE)
 	{
@@ -1036,10 +1273,28 @@ bool gravityDB_getTable(const unsigned char list)
 		querystr = "SELECT domain, id FROM vw_regex_whitelist GROUP BY id";
 
 	// Prepare SQLite3 statement
-	int rc = sqlite3_prepare_v2(gravity_db, querystr, -1, &table_stmt, NULL);
+	int rc = sqlite3_prepare_v2(db, querystr, -1, stmt, NULL);
 	if(rc != SQLITE_OK)
 	{
 		logg("readGravity(%s) - SQL error prepare: %s", querystr, sqlite3_errstr(rc));
+		return false;
+	}
+
+	return true;
+}
+
+// Prepare a SQLite3 statement which can be used by gravityDB_getDomain() to get
+// blocking domains from a table which is specified when calling this function
+bool gravityDB_getTable(const unsigned char list)
+{
+	if(!gravityDB_opened && !gravityDB_open())
+	{
+		logg("gravityDB_getTable(%u): Gravity database not available", list);
+		return false;
+	}
+
+	if(!prepare_table(gravity_db, &table_stmt, list))
+	{
 		gravityDB_close();
 		return false;
 	}
@@ -1048,25 +1303,18 @@ bool gravityDB_getTable(const unsigned char list)
 	return true;
 }
 
-// Get a single domain from a running SELECT operation
-// This function returns a pointer to a string as long
-// as there are domains available. Once we reached the
-// end of the table, it returns NULL. It also returns
-// NULL when it encounters an error (e.g., on reading
-// errors). Errors are logged to FTL.log
-// This function is performance critical as it might
-// be called millions of times for large blocking lists
-inline const char* gravityDB_getDomain(int *rowid)
+// Get a single domain from a running SELECT operation on stmt
+static inline const char* step_table(sqlite3_stmt *stmt, int *rowid)
 {
 	// Perform step
-	const int rc = sqlite3_step(table_stmt);
+	const int rc = sqlite3_step(stmt);
 
 	// Valid row
 	if(rc == SQLITE_ROW)
 	{
-		const char* domain = (char*)sqlite3_column_text(table_stmt, 0);
+		const char* domain = (char*)sqlite3_column_text(stmt, 0);
 		if(rowid != NULL)
-			*rowid = sqlite3_column_int(table_stmt, 1);
+			*rowid = sqlite3_column_int(stmt, 1);
 		return domain;
 	}
 
@@ -1087,6 +1335,19 @@ inline const char* gravityDB_getDomain(int *rowid)
 	return NULL;
 }
 
+// Get a single domain from a running SELECT operation
+// This function returns a pointer to a string as long
+// as there are domains available. Once we reached the
+// end of the table, it returns NULL. It also returns
+// NULL when it encounters an error (e.g., on reading
+// errors). Errors are logged to FTL.log
+// This function is performance critical as it might
+// be called millions of times for large blocking lists
+inline const char* gravityDB_getDomain(int *rowid)
+{
+	return step_table(table_stmt, rowid);
+}
+
 // Finalize statement of a gravity database transaction
 void gravityDB_finalizeTable(void)
 {
@@ -1098,16 +1359,84 @@ void gravityDB_finalizeTable(void)
 	table_stmt = NULL;
 }
 
-// Get number of domains in a specified table of the gravity database We return
-// the constant DB_FAILED and log to FTL.log if we encounter any error
-int gravityDB_count(const enum gravity_tables list)
+// Get the ID of the most recent change recorded by "pihole-FTL gravity
+// updateList". Returns 0 if no changes have been recorded and DB_FAILED on
+// errors
+int gravityDB_lastChange(void)
 {
 	if(!gravityDB_opened && !gravityDB_open())
 	{
-		logg("gravityDB_count(%d): Gravity database not available", list);
+		logg("gravityDB_lastChange(): Gravity database not available");
 		return DB_FAILED;
 	}
 
+	// The table is created on demand, its absence is not an error
+	sqlite3_stmt *stmt = NULL;
+	const char *querystr = "SELECT IFNULL(MAX(id),0) FROM gravity_changes;";
+	int rc = sqlite3_prepare_v2(gravity_db, querystr, -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		if(config.debug & DEBUG_DATABASE)
+			logg("gravityDB_lastChange(): No recorded changes (%s)", sqlite3_errstr(rc));
+		return 0;
+	}
+
+	int result = DB_FAILED;
+	rc = sqlite3_step(stmt);
+	if(rc == SQLITE_ROW)
+		result = sqlite3_column_int(stmt, 0);
+	else
+		logg("gravityDB_lastChange() - SQL error step: %s", sqlite3_errstr(rc));
+
+	sqlite3_finalize(stmt);
+	return result;
+}
+
+// Start reading the domains changed after the change with the given ID. The
+// domains and change IDs are read using gravityDB_getDomain(), the groups the
+// domain belongs to now using gravityDB_getChangeGroups(). The statement has
+// to be finalized using gravityDB_finalizeTable()
+bool gravityDB_getChanges(const int since)
+{
+	if(!gravityDB_opened && !gravityDB_open())
+	{
+		logg("gravityDB_getChanges(): Gravity database not available");
+		return false;
+	}
+
+	const char *querystr = "SELECT domain, id, (SELECT group_concat(group_id) FROM vw_gravity v "
+	                       "WHERE v.domain = c.domain AND group_id IS NOT NULL) "
+	                       "FROM gravity_changes c WHERE id > ? ORDER BY id";
+	int rc = sqlite3_prepare_v2(gravity_db, querystr, -1, &table_stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("gravityDB_getChanges(%s) - SQL error prepare: %s", querystr, sqlite3_errstr(rc));
+		table_stmt = NULL;
+		return false;
+	}
+
+	if((rc = sqlite3_bind_int(table_stmt, 1, since)) != SQLITE_OK)
+	{
+		logg("gravityDB_getChanges(%s) - SQL error bind: %s", querystr, sqlite3_errstr(rc));
+		gravityDB_finalizeTable();
+		return false;
+	}
+
+	return true;
+}
+
+// Get the comma-separated IDs of the groups the domain of the current change
+// (see gravityDB_getChanges()) belongs to after all changes, e.g. "0,3". This is
+// NULL if the domain is not on any enabled adlist anymore
+const char *gravityDB_getChangeGroups(void)
+{
+	return (const char*)sqlite3_column_text(table_stmt, 2);
+}
+
+// Count the domains of a specified table on db. Returns DB_FAILED and logs to
+// FTL.log if we encounter any error
+static int count_table(sqlite3 *db, const enum gravity_tables list)
+{
 	const char *querystr = NULL;
 	// Build query string to be used depending on list to be read
 	switch (list)
@@ -1132,7 +1461,6 @@ int gravityDB_count(const enum gravity_tables list)
 			break;
 		case UNKNOWN_TABLE:
 			logg("Error: List type %u unknown!", list);
-			gravityDB_close();
 			return DB_FAILED;
 	}
 
@@ -1141,32 +1469,31 @@ int gravityDB_count(const enum gravity_tables list)
 		     tablename[list], querystr);
 
 	// Prepare query
-	int rc = sqlite3_prepare_v2(gravity_db, querystr, -1, &table_stmt, NULL);
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, querystr, -1, &stmt, NULL);
 	if(rc != SQLITE_OK){
 		logg("gravityDB_count(%s) - SQL error prepare %s", querystr, sqlite3_errstr(rc));
-		gravityDB_finalizeTable();
-		gravityDB_close();
+		sqlite3_finalize(stmt);
 		return DB_FAILED;
 	}
 
 	// Perform query
-	rc = sqlite3_step(table_stmt);
+	rc = sqlite3_step(stmt);
 	if(rc != SQLITE_ROW){
 		logg("gravityDB_count(%s) - SQL error step %s", querystr, sqlite3_errstr(rc));
 		if(list == GRAVITY_TABLE)
 		{
 			logg("Count of gravity domains not available. Please run pihole -g");
 		}
-		gravityDB_finalizeTable();
-		gravityDB_close();
+		sqlite3_finalize(stmt);
 		return DB_FAILED;
 	}
 
 	// Get result when there was no error
-	const int result = sqlite3_column_int(table_stmt, 0);
+	const int result = sqlite3_column_int(stmt, 0);
 
 	// Finalize statement
-	gravityDB_finalizeTable();
+	sqlite3_finalize(stmt);
 
 	if(config.debug & DEBUG_DATABASE)
 	{
@@ -1178,6 +1505,61 @@ int gravityDB_count(const enum gravity_tables list)
 	return result;
 }
 
+// Get number of domains in a specified table of the gravity database We return
+// the constant DB_FAILED and log to FTL.log if we encounter any error
+int gravityDB_count(const enum gravity_tables list)
+{
+	if(!gravityDB_opened && !gravityDB_open())
+	{
+		logg("gravityDB_count(%d): Gravity database not available", list);
+		return DB_FAILED;
+	}
+
+	const int result = count_table(gravity_db, list);
+	if(result == DB_FAILED)
+		gravityDB_close();
+
+	return result;
+}
+
+// Like gravityDB_count(), gravityDB_getTable(), gravityDB_getDomain() and
+// gravityDB_finalizeTable() but reading from the connection prepared by
+// gravityDB_prepare_swap(). They use their own statement so they can be used
+// while other threads use the current connection
+int gravityDB_countNext(const enum gravity_tables list)
+{
+	if(next_connection.db == NULL)
+		return DB_FAILED;
+
+	return count_table(next_connection.db, list);
+}
+
+bool gravityDB_getNextTable(const unsigned char list)
+{
+	if(next_connection.db == NULL)
+		return false;
+
+	if(!prepare_table(next_connection.db, &next_table_stmt, list))
+	{
+		sqlite3_finalize(next_table_stmt);
+		next_table_stmt = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+const char* gravityDB_getNextDomain(int *rowid)
+{
+	return step_table(next_table_stmt, rowid);
+}
+
+void gravityDB_finalizeNextTable(void)
+{
+	sqlite3_finalize(next_table_stmt);
+	next_table_stmt = NULL;
+}
+
 static enum db_result domain_in_list(const char *domain, sqlite3_stmt *stmt, const char *listname, int *domain_id)
 {
 	// Do not try to bind text to statement when database is not available
@@ -1273,64 +1655,182 @@ static void gravityDB_client_check_again(clientsData* client)
 	}
 }
 
-enum db_result in_whitelist(const char *domain, DNSCacheData *dns_cache, clientsData* client)
+// Get the prepared statement of a client for one of the exact lists, preparing
+// the statements of this client if needed. When the in-memory index or the
+// statements shared by all clients are in use, we only need to know the groups
+// of the client and no statement is returned
+static bool get_client_stmt(sqlite3_stmt_vec *const *vec, clientsData *client, sqlite3_stmt **stmt)
 {
+	*stmt = NULL;
+
+	if(gravity_index_available() || group_stmt[GRAVITY_TABLE] != NULL)
+	{
+		// Check if this client needs a rechecking of group membership
+		gravityDB_client_check_again(client);
+
+		return client->flags.found_group || get_client_groupids(client);
+	}
+
 	// If list statement is not ready and cannot be initialized (e.g. no
 	// access to the database), we return false to prevent an FTL crash
-	if(whitelist_stmt == NULL)
-		return LIST_NOT_AVAILABLE;
+	if(*vec == NULL)
+		return false;
 
 	// Check if this client needs a rechecking of group membership
 	gravityDB_client_check_again(client);
 
-	// Get whitelist statement from vector of prepared statements if available
-	sqlite3_stmt *stmt = whitelist_stmt->get(whitelist_stmt, client->id);
+	// Get statement from vector of prepared statements if available
+	*stmt = (*vec)->get(*vec, client->id);
 
 	// If client statement is not ready and cannot be initialized (e.g. no access to
-	// the database), we return false (not in whitelist) to prevent an FTL crash
-	if(stmt == NULL && !gravityDB_prepare_client_statements(client))
+	// the database), we return false to prevent an FTL crash
+	if(*stmt == NULL && !gravityDB_prepare_client_statements(client))
 	{
 		logg("ERROR: Gravity database not available");
-		return LIST_NOT_AVAILABLE;
+		return false;
 	}
 
 	// Update statement if has just been initialized
-	if(stmt == NULL)
-		stmt = whitelist_stmt->get(whitelist_stmt, client->id);
+	if(*stmt == NULL)
+		*stmt = (*vec)->get(*vec, client->id);
 
-	// We have to check both the exact whitelist (using a prepared database statement)
-	// as well the compiled regex whitelist filters to check if the current domain is
-	// whitelisted.
-	return domain_in_list(domain, stmt, "whitelist", &dns_cache->domainlist_id);
+	return true;
 }
 
-enum db_result in_gravity(const char *domain, clientsData *client)
+// Set the bit of a group in a group bitmask
+static void group_mask_set(uint64_t *mask, const int group)
 {
-	// If list statement is not ready and cannot be initialized (e.g. no
-	// access to the database), we return false to prevent an FTL crash
-	if(gravity_stmt == NULL)
+	unsigned int lo = 0u, hi = num_groups;
+	while(lo < hi)
+	{
+		const unsigned int mid = lo + (hi - lo)/2u;
+		if(group_bits[mid] == group)
+		{
+			mask[mid / 64u] |= 1ull << (mid % 64u);
+			return;
+		}
+		else if(group_bits[mid] < group)
+			lo = mid + 1u;
+		else
+			hi = mid;
+	}
+}
+
+// Look up a domain using the statement of a list shared by all clients. Instead
+// of restricting the query to the groups of the client, we get all groups the
+// domain is on as a bitmask and intersect it with the client's group bitmask
+static enum db_result domain_in_groups(const char *domain, const enum gravity_tables list,
+                                       clientsData *client, const char *listname, int *domain_id)
+{
+	sqlite3_stmt *stmt = group_stmt[list];
+	if(stmt == NULL)
 		return LIST_NOT_AVAILABLE;
 
-	// Check if this client needs a rechecking of group membership
-	gravityDB_client_check_again(client);
+	// Get bitmask of the client's groups
+	const unsigned int words = num_groups / 64u + 1u;
+	uint64_t client_mask[words], domain_mask[words];
+	memset(client_mask, 0, sizeof(client_mask));
+	memset(domain_mask, 0, sizeof(domain_mask));
+	const char *groups = getstr(client->groupspos);
+	while(*groups != '\0')
+	{
+		char *end = NULL;
+		const long group = strtol(groups, &end, 10);
+		if(end == groups)
+			break;
+		group_mask_set(client_mask, group);
+		groups = *end == ',' ? end + 1 : end;
+	}
+
+	// Get bitmask of the domain's groups
+	int rc = sqlite3_bind_text(stmt, 1, domain, -1, SQLITE_STATIC);
+	if(rc != SQLITE_OK)
+	{
+		logg("domain_in_groups(\"%s\", %s): Failed to bind domain: %s",
+		     domain, listname, sqlite3_errstr(rc));
+		return LIST_NOT_AVAILABLE;
+	}
 
-	// Get whitelist statement from vector of prepared statements
-	sqlite3_stmt *stmt = gravity_stmt->get(gravity_stmt, client->id);
+	int id = -1;
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		group_mask_set(domain_mask, sqlite3_column_int(stmt, 0));
+		id = sqlite3_column_int(stmt, 1);
+	}
 
-	// If client statement is not ready and cannot be initialized (e.g. no access to
-	// the database), we return false (not in gravity list) to prevent an FTL crash
-	if(stmt == NULL && !gravityDB_prepare_client_statements(client))
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+
+	if(rc == SQLITE_BUSY)
 	{
-		logg("ERROR: Gravity database not available");
+		logg("Gravity database is busy (%s)", listname);
+		return LIST_NOT_AVAILABLE;
+	}
+	else if(rc != SQLITE_DONE)
+	{
+		logg("domain_in_groups(\"%s\", %s): Failed to perform step: %s",
+		     domain, listname, sqlite3_errstr(rc));
 		return LIST_NOT_AVAILABLE;
 	}
 
-	// Update statement if has just been initialized
+	bool found = false;
+	for(unsigned int i = 0; i < words && !found; i++)
+		found = (client_mask[i] & domain_mask[i]) != 0u;
+
+	if(domain_id != NULL)
+		*domain_id = found ? id : -1;
+
+	if(config.debug & DEBUG_DATABASE)
+		logg("domain_in_groups(\"%s\", %s): %d", domain, listname, found ? id : -1);
+
+	return found ? FOUND : NOT_FOUND;
+}
+
+// Check if a domain is on one of the exact lists of a client, either using the
+// in-memory index, the statement shared by all clients or the client's
+// prepared statement obtained above
+static enum db_result domain_in_client_list(const char *domain, const enum gravity_tables list, sqlite3_stmt *stmt,
+                                            clientsData *client, const char *listname, int *domain_id)
+{
+	if(gravity_index_available())
+		return gravity_index_lookup(list, domain, getstr(client->groupspos), domain_id);
+
+	// Skip the database lookup if the list's Bloom filter rules out the
+	// domain
+	if(!gravity_index_may_contain(list, domain))
+	{
+		counters->bloom_skipped++;
+		if(domain_id != NULL)
+			*domain_id = -1;
+		return NOT_FOUND;
+	}
+
 	if(stmt == NULL)
-		stmt = gravity_stmt->get(gravity_stmt, client->id);
+		return domain_in_groups(domain, list, client, listname, domain_id);
+
+	return domain_in_list(domain, stmt, listname, domain_id);
+}
+
+enum db_result in_whitelist(const char *domain, DNSCacheData *dns_cache, clientsData* client)
+{
+	sqlite3_stmt *stmt = NULL;
+	if(!get_client_stmt(&whitelist_stmt, client, &stmt))
+		return LIST_NOT_AVAILABLE;
+
+	// We have to check both the exact whitelist (using a prepared database statement)
+	// as well the compiled regex whitelist filters to check if the current domain is
+	// whitelisted.
+	return domain_in_client_list(domain, EXACT_WHITELIST_TABLE, stmt, client, "whitelist", &dns_cache->domainlist_id);
+}
+
+enum db_result in_gravity(const char *domain, clientsData *client)
+{
+	sqlite3_stmt *stmt = NULL;
+	if(!get_client_stmt(&gravity_stmt, client, &stmt))
+		return LIST_NOT_AVAILABLE;
 
 	// Check if domain is exactly in gravity list
-	const enum db_result exact_match = domain_in_list(domain, stmt, "gravity", NULL);
+	const enum db_result exact_match = domain_in_client_list(domain, GRAVITY_TABLE, stmt, client, "gravity", NULL);
 	if(config.debug & DEBUG_QUERIES)
 		logg("Checking if \"%s\" is in gravity: %s",
 		     domain, exact_match == FOUND ? "yes" : "no");
@@ -1344,6 +1844,11 @@ enum db_result in_gravity(const char *domain, clientsData *client)
 	if(!gravity_abp_format)
 		return NOT_FOUND;
 
+	// Match all suffixes of the domain in a single walk through the suffix
+	// trie of ABP-style entries if it is available
+	if(gravity_index_abp_available())
+		return gravity_index_abp_lookup(domain, getstr(client->groupspos));
+
 	// Make a copy of the domain we will slowly truncate
 	// while extracting the individual components below
 	char *domainBuf = strdup(domain);
@@ -1393,7 +1898,7 @@ enum db_result in_gravity(const char *domain, clientsData *client)
 			memcpy(abpDomain+2, ptr, component_size);
 		}
 		// Check if the constructed ABP-style domain is in the gravity list
-		const enum db_result abp_match = domain_in_list(abpDomain, stmt, "gravity", NULL);
+		const enum db_result abp_match = domain_in_client_list(abpDomain, GRAVITY_TABLE, stmt, client, "gravity", NULL);
 		if(config.debug & DEBUG_QUERIES)
 			logg("Checking if \"%s\" is in gravity: %s",
 			     abpDomain, abp_match == FOUND ? "yes" : "no");
@@ -1429,30 +1934,11 @@ enum db_result in_gravity(const char *domain, clientsData *client)
 
 enum db_result in_blacklist(const char *domain, DNSCacheData *dns_cache, clientsData *client)
 {
-	// If list statement is not ready and cannot be initialized (e.g. no
-	// access to the database), we return false to prevent an FTL crash
-	if(blacklist_stmt == NULL)
-		return LIST_NOT_AVAILABLE;
-
-	// Check if this client needs a rechecking of group membership
-	gravityDB_client_check_again(client);
-
-	// Get whitelist statement from vector of prepared statements
-	sqlite3_stmt *stmt = blacklist_stmt->get(blacklist_stmt, client->id);
-
-	// If client statement is not ready and cannot be initialized (e.g. no access to
-	// the database), we return false (not in blacklist) to prevent an FTL crash
-	if(stmt == NULL && !gravityDB_prepare_client_statements(client))
-	{
-		logg("ERROR: Gravity database not available");
+	sqlite3_stmt *stmt = NULL;
+	if(!get_client_stmt(&blacklist_stmt, client, &stmt))
 		return LIST_NOT_AVAILABLE;
-	}
-
-	// Update statement if has just been initialized
-	if(stmt == NULL)
-		stmt = blacklist_stmt->get(blacklist_stmt, client->id);
 
-	return domain_in_list(domain, stmt, "blacklist", &dns_cache->domainlist_id);
+	return domain_in_client_list(domain, EXACT_BLACKLIST_TABLE, stmt, client, "blacklist", &dns_cache->domainlist_id);
 }
 
 bool in_auditlist(const char *domain)
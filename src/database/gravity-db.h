@@ -20,6 +20,8 @@ enum gravity_tables { GRAVITY_TABLE, EXACT_BLACKLIST_TABLE, EXACT_WHITELIST_TABL
 
 bool gravityDB_open(void);
 bool gravityDB_reopen(void);
+bool gravityDB_prepare_swap(void);
+bool gravityDB_swap(void);
 void gravityDB_forked(void);
 void gravityDB_reload_groups(clientsData* client);
 bool gravityDB_prepare_client_statements(clientsData* client);
@@ -29,6 +31,14 @@ const char* gravityDB_getDomain(int *rowid);
 char* get_client_names_from_ids(const char *group_ids) __attribute__ ((malloc));
 void gravityDB_finalizeTable(void);
 int gravityDB_count(const enum gravity_tables list);
+int gravityDB_countNext(const enum gravity_tables list);
+bool gravityDB_getNextTable(const unsigned char list);
+const char* gravityDB_getNextDomain(int *rowid);
+void gravityDB_finalizeNextTable(void);
+int gravityDB_lastChange(void);
+void gravityDB_refresh_ABP_format(void);
+bool gravityDB_getChanges(const int since);
+const char *gravityDB_getChangeGroups(void);
 void check_inaccessible_adlists(void);
 
 enum db_result in_gravity(const char *domain, clientsData *client);
@@ -0,0 +1,1541 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2023 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  In-memory gravity index routines
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#include "../FTL.h"
+#include "sqlite3.h"
+#include "gravity-index.h"
+// enum gravity_tables
+#include "gravity-db.h"
+// struct config
+#include "../config.h"
+// logg()
+#include "../log.h"
+// hashStr()
+#include "../datastructure.h"
+// timer_start()
+#include "../timers.h"
+// mmap()
+#include <sys/mman.h>
+// open()
+#include <fcntl.h>
+// PATH_MAX
+#include <limits.h>
+// exp(), pow()
+#include <math.h>
+
+// The exact domain lists we hold in memory. They are indexed by their
+// enum gravity_tables value
+#define NUM_INDEXED_LISTS (EXACT_WHITELIST_TABLE + 1)
+
+// Initial number of slots of the hash table of each list. This has to be a
+// power of two so we can use a bitmask to wrap around the end of the table
+#define INDEX_INITIAL_SIZE 1024u
+#define INDEX_MASK(size) ((size) - 1u)
+
+// A single slot of the hash table of a list. The domain is stored as offset
+// into the string arena of the list. As for the shared memory lookup tables,
+// the offset is stored plus one so that zeroed memory is a table full of empty
+// slots
+struct index_entry {
+	uint32_t hash;
+	uint32_t name;
+	uint32_t groupset;
+	int id;
+};
+
+struct index_list {
+	struct index_entry *slots;
+	uint32_t size;
+	uint32_t count;
+	char *strings;
+	size_t strings_len;
+	size_t strings_size;
+};
+
+// A node of the suffix trie of ABP-style entries (||domain^). Labels are stored
+// TLD-first so the path from the root to a node spells a domain suffix. The
+// children of each node are stored consecutively and sorted by their label so
+// they can be searched with a binary search. Nodes with a group set other than
+// the empty set zero terminate an entry. Node zero is the root
+struct abp_node {
+	uint32_t label;
+	uint32_t children;
+	uint32_t num_children;
+	uint32_t groupset;
+};
+
+struct abp_trie {
+	struct abp_node *nodes;
+	uint32_t num_nodes;
+	uint32_t num_entries;
+	char *strings;
+	size_t strings_len;
+};
+
+// Bloom filter of the domains on one of the lists. It is used in front of the
+// database lookups when the lists themselves are not held in memory: a domain
+// not contained in the filter is certainly not on the list. The number of bits
+// is a power of two, mask is this number minus one
+struct bloom_filter {
+	uint64_t *bits;
+	uint32_t mask;
+	uint32_t hashes;
+	uint32_t entries;
+};
+
+// Most domains are part of adlists sharing the very same few groups. Group
+// memberships are hence not stored per domain but as references to a set of
+// group IDs which is stored only once. Each set is stored in groups[] as its
+// number of members followed by the sorted group IDs. Set zero is the empty
+// set every domain starts with
+struct gravity_index {
+	bool exact;
+	struct index_list list[NUM_INDEXED_LISTS];
+	struct abp_trie abp;
+	struct bloom_filter bloom[NUM_INDEXED_LISTS];
+	int *groups;
+	size_t groups_len;
+	size_t groups_size;
+	uint32_t *groupsets;
+	uint32_t num_groupsets;
+	size_t groupsets_size;
+	struct {
+		uint32_t from;
+		int group;
+		uint32_t to;
+	} last;
+	struct {
+		uint64_t size;
+		int64_t mtime_sec;
+		int64_t mtime_nsec;
+		uint64_t stamp;
+	} source;
+	void *map;
+	size_t map_size;
+	bool abp_changed;
+};
+
+// Layout of a compiled index file as written by gravity_index_write(). The
+// sections are stored at the given (8-byte aligned) offsets exactly as they
+// are used in memory so the file can be mapped without any parsing. Files
+// are only valid on machines with the same byte order as the writer
+#define INDEX_FILE_MAGIC "FTLGIDX"
+#define INDEX_FILE_VERSION 3u
+#define INDEX_FILE_BYTEORDER 0x01020304u
+struct index_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteorder;
+	uint32_t entry_size;
+	uint32_t num_groupsets;
+	uint64_t file_size;
+	uint64_t db_size;
+	int64_t db_mtime_sec;
+	int64_t db_mtime_nsec;
+	uint64_t db_stamp;
+	struct {
+		uint64_t slots;
+		uint64_t strings;
+		uint64_t strings_len;
+		uint32_t size;
+		uint32_t count;
+	} list[NUM_INDEXED_LISTS];
+	uint64_t groups;
+	uint64_t groups_len;
+	uint64_t groupsets;
+	uint64_t abp_nodes;
+	uint64_t abp_strings;
+	uint64_t abp_strings_len;
+	uint32_t abp_num_nodes;
+	uint32_t abp_num_entries;
+};
+
+// The index lookups are served from. It is only replaced by the database
+// thread while holding the shared memory lock. TCP workers inherit it (without
+// copying as it is never written to) when they are forked
+static struct gravity_index *active = NULL;
+
+// Queries used to build the index. They select the same rows the per-client
+// statements prepared in gravityDB_prepare_client_statements() may return. Rows
+// without group cannot match any client and are skipped
+static const char *index_querystr[NUM_INDEXED_LISTS] = {
+	"SELECT domain, group_id, -1 FROM vw_gravity WHERE group_id IS NOT NULL;",
+	"SELECT domain, group_id, id FROM vw_blacklist WHERE group_id IS NOT NULL;",
+	"SELECT domain, group_id, id FROM vw_whitelist WHERE group_id IS NOT NULL;"
+};
+// Query used when only ABP-style entries are held in memory. The range makes use
+// of the index on the domain column of the gravity table
+static const char *abp_querystr =
+	"SELECT domain, group_id, -1 FROM vw_gravity WHERE group_id IS NOT NULL AND domain >= '||' AND domain < '|}';";
+static const char *index_listname[NUM_INDEXED_LISTS] = { "gravity", "blacklist", "whitelist" };
+// Everything the index depends on apart from the gravity table itself. Group,
+// adlist and domainlist edits do not necessarily change the size or the
+// modification time of the database file (e.g. in WAL mode or within the
+// timestamp granularity of the file system) so the rows are hashed into a
+// stamp stored in compiled index files instead. The last query covers changes
+// of the gravity table made by "pihole-FTL gravity updateList"
+static const char *stamp_querystr[] = {
+	"SELECT id, type, domain, enabled FROM domainlist ORDER BY id;",
+	"SELECT domainlist_id, group_id FROM domainlist_by_group ORDER BY domainlist_id, group_id;",
+	"SELECT id, enabled FROM adlist ORDER BY id;",
+	"SELECT adlist_id, group_id FROM adlist_by_group ORDER BY adlist_id, group_id;",
+	"SELECT id, enabled FROM \"group\" ORDER BY id;",
+	"SELECT IFNULL(MAX(id),0) FROM gravity_changes;"
+};
+
+// Enlarge a buffer so it can hold at least need elements of the given size
+static bool ensure_capacity(void **buffer, size_t *size, const size_t need, const size_t elemsize)
+{
+	if(need <= *size)
+		return true;
+
+	size_t newsize = *size > 0u ? *size : 64u;
+	while(newsize < need)
+		newsize *= 2u;
+
+	void *newbuffer = realloc(*buffer, newsize*elemsize);
+	if(newbuffer == NULL)
+	{
+		logg("ERROR: Memory allocation failed in gravity index (%zu bytes)", newsize*elemsize);
+		return false;
+	}
+
+	*buffer = newbuffer;
+	*size = newsize;
+	return true;
+}
+
+static struct index_entry *list_find(const struct index_list *list, const char *domain, const uint32_t hash)
+{
+	uint32_t slot = hash & INDEX_MASK(list->size);
+	for(uint32_t i = 0; i < list->size; i++)
+	{
+		struct index_entry *entry = &list->slots[slot];
+
+		// An empty slot terminates the probe sequence
+		if(entry->name == 0u)
+			return NULL;
+
+		if(entry->hash == hash && strcmp(&list->strings[entry->name - 1u], domain) == 0)
+			return entry;
+
+		slot = (slot + 1u) & INDEX_MASK(list->size);
+	}
+
+	return NULL;
+}
+
+static struct index_entry * __attribute__((pure)) list_empty_slot(struct index_entry *slots, const uint32_t size, const uint32_t hash)
+{
+	uint32_t slot = hash & INDEX_MASK(size);
+	while(slots[slot].name != 0u)
+		slot = (slot + 1u) & INDEX_MASK(size);
+
+	return &slots[slot];
+}
+
+// Double the size of the hash table of a list and redistribute all entries
+static bool list_grow(struct index_list *list)
+{
+	const uint32_t newsize = 2u*list->size;
+	struct index_entry *slots = calloc(newsize, sizeof(struct index_entry));
+	if(slots == NULL)
+	{
+		logg("ERROR: Memory allocation failed in gravity index (%u slots)", newsize);
+		return false;
+	}
+
+	for(uint32_t i = 0; i < list->size; i++)
+		if(list->slots[i].name != 0u)
+			*list_empty_slot(slots, newsize, list->slots[i].hash) = list->slots[i];
+
+	free(list->slots);
+	list->slots = slots;
+	list->size = newsize;
+	return true;
+}
+
+// Get the entry of a domain, adding it (without any groups) if it is not known
+// so far
+static struct index_entry *list_insert(struct index_list *list, const char *domain)
+{
+	const uint32_t hash = hashStr(domain);
+	struct index_entry *entry = list_find(list, domain, hash);
+	if(entry != NULL)
+		return entry;
+
+	// Keep the table at most half full so probe sequences stay short
+	if(2u*(list->count + 1u) > list->size && !list_grow(list))
+		return NULL;
+
+	// Append domain to the string arena
+	const size_t len = strlen(domain) + 1u;
+	if(list->strings_len + len >= UINT32_MAX)
+	{
+		logg("ERROR: Gravity index string arena is full");
+		return NULL;
+	}
+	if(!ensure_capacity((void**)&list->strings, &list->strings_size, list->strings_len + len, sizeof(char)))
+		return NULL;
+	memcpy(&list->strings[list->strings_len], domain, len);
+
+	entry = list_empty_slot(list->slots, list->size, hash);
+	entry->hash = hash;
+	entry->name = list->strings_len + 1u;
+	entry->groupset = 0u;
+	entry->id = -1;
+
+	list->strings_len += len;
+	list->count++;
+	return entry;
+}
+
+// Get the set containing all groups of set "from" plus the given group
+static bool groupset_with(struct gravity_index *index, const uint32_t from, const int group, uint32_t *to)
+{
+	const int *set = &index->groups[index->groupsets[from]];
+	const int n = set[0];
+	for(int i = 1; i <= n; i++)
+	{
+		if(set[i] == group)
+		{
+			*to = from;
+			return true;
+		}
+	}
+
+	// Domains are typically read in blocks sharing the same adlist so the
+	// very same union is needed over and over again
+	if(index->last.from == from && index->last.group == group)
+	{
+		*to = index->last.to;
+		return true;
+	}
+
+	// Build the new sorted set at the end of the groups buffer without
+	// committing it yet. This may move the buffer so we have to get the
+	// pointer to the old set again afterwards
+	const size_t len = (size_t)n + 2u;
+	if(!ensure_capacity((void**)&index->groups, &index->groups_size, index->groups_len + len, sizeof(int)))
+		return false;
+	set = &index->groups[index->groupsets[from]];
+	int *newset = &index->groups[index->groups_len];
+	newset[0] = n + 1;
+	int j = 1;
+	bool inserted = false;
+	for(int i = 1; i <= n; i++)
+	{
+		if(!inserted && group < set[i])
+		{
+			newset[j++] = group;
+			inserted = true;
+		}
+		newset[j++] = set[i];
+	}
+	if(!inserted)
+		newset[j] = group;
+
+	// Check if we know this set already. There are typically only a handful
+	// of distinct sets so a linear search is fine here
+	uint32_t id = 0u;
+	for(; id < index->num_groupsets; id++)
+		if(memcmp(&index->groups[index->groupsets[id]], newset, len*sizeof(int)) == 0)
+			break;
+
+	if(id == index->num_groupsets)
+	{
+		if(!ensure_capacity((void**)&index->groupsets, &index->groupsets_size, index->num_groupsets + 1u, sizeof(uint32_t)))
+			return false;
+		index->groupsets[index->num_groupsets++] = index->groups_len;
+		index->groups_len += len;
+	}
+
+	index->last.from = from;
+	index->last.group = group;
+	index->last.to = id;
+	*to = id;
+	return true;
+}
+
+// Check if a group is contained in the comma-separated list of group IDs of a
+// client, e.g. "0,3,5"
+static bool group_in_string(const int group, const char *groups)
+{
+	const char *p = groups;
+	while(p != NULL && *p != '\0')
+	{
+		char *end = NULL;
+		const long id = strtol(p, &end, 10);
+		if(end == p)
+			break;
+		if(id == group)
+			return true;
+		p = *end == ',' ? end + 1 : end;
+	}
+
+	return false;
+}
+
+static bool in_groupset(const struct gravity_index *index, const uint32_t groupset, const char *groups)
+{
+	const int *set = &index->groups[index->groupsets[groupset]];
+	for(int i = 1; i <= set[0]; i++)
+		if(group_in_string(set[i], groups))
+			return true;
+
+	return false;
+}
+
+static bool index_init(struct gravity_index *index)
+{
+	for(unsigned int i = 0; i < NUM_INDEXED_LISTS; i++)
+	{
+		index->list[i].slots = calloc(INDEX_INITIAL_SIZE, sizeof(struct index_entry));
+		if(index->list[i].slots == NULL)
+			return false;
+		index->list[i].size = INDEX_INITIAL_SIZE;
+	}
+
+	// Add the empty set
+	if(!ensure_capacity((void**)&index->groups, &index->groups_size, 1u, sizeof(int)) ||
+	   !ensure_capacity((void**)&index->groupsets, &index->groupsets_size, 1u, sizeof(uint32_t)))
+		return false;
+	index->groups[0] = 0;
+	index->groups_len = 1u;
+	index->groupsets[0] = 0u;
+	index->num_groupsets = 1u;
+
+	// Invalidate the cached union
+	index->last.group = -1;
+	index->last.from = UINT32_MAX;
+
+	return true;
+}
+
+static bool index_read_list(struct gravity_index *index, sqlite3 *db, const enum gravity_tables list,
+                            const char *querystr)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, querystr, -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("gravity_index_build(%s) - SQL error prepare: %s",
+		     index_listname[list], sqlite3_errstr(rc));
+		return false;
+	}
+
+	struct index_list *ilist = &index->list[list];
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const char *domain = (const char*)sqlite3_column_text(stmt, 0);
+		if(domain == NULL)
+			continue;
+
+		struct index_entry *entry = list_insert(ilist, domain);
+		uint32_t groupset = 0u;
+		if(entry == NULL ||
+		   !groupset_with(index, entry->groupset, sqlite3_column_int(stmt, 1), &groupset))
+		{
+			sqlite3_finalize(stmt);
+			return false;
+		}
+		entry->groupset = groupset;
+		entry->id = sqlite3_column_int(stmt, 2);
+	}
+
+	sqlite3_finalize(stmt);
+
+	if(rc != SQLITE_DONE)
+	{
+		logg("gravity_index_build(%s) - SQL error step: %s",
+		     index_listname[list], sqlite3_errstr(rc));
+		return false;
+	}
+
+	return true;
+}
+
+// Temporary node used while building the suffix trie
+struct abp_build_node {
+	const char *label;
+	size_t len;
+	uint32_t groupset;
+	struct abp_build_node **children;
+	uint32_t num_children;
+	uint32_t size_children;
+};
+
+// ABP-style entry with its labels in reversed order, separated by '\x01'. As
+// this character sorts before any character valid in domains, sorting these
+// keys sorts the entries label by label, TLD first
+struct abp_key {
+	char *key;
+	uint32_t groupset;
+};
+
+static int abp_key_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct abp_key*)a)->key, ((const struct abp_key*)b)->key);
+}
+
+static void abp_build_free(struct abp_build_node *node)
+{
+	for(uint32_t i = 0; i < node->num_children; i++)
+	{
+		abp_build_free(node->children[i]);
+		free(node->children[i]);
+	}
+	free(node->children);
+}
+
+static char *abp_reverse_labels(const char *domain, const size_t len)
+{
+	char *key = calloc(len + 1u, sizeof(char));
+	if(key == NULL)
+		return NULL;
+
+	size_t pos = 0u;
+	size_t end = len;
+	while(true)
+	{
+		size_t start = end;
+		while(start > 0u && domain[start - 1u] != '.')
+			start--;
+		memcpy(&key[pos], &domain[start], end - start);
+		pos += end - start;
+		if(start == 0u)
+			break;
+		key[pos++] = '\x01';
+		end = start - 1u;
+	}
+
+	return key;
+}
+
+// Add an entry with sorted key to the trie. As the keys are sorted, a label is
+// either the same as the last child of a node or sorts after all its children
+static bool abp_build_insert(struct abp_build_node *root, const char *key, const uint32_t groupset)
+{
+	struct abp_build_node *node = root;
+	const char *label = key;
+	while(true)
+	{
+		const char *sep = strchr(label, '\x01');
+		const size_t len = sep != NULL ? (size_t)(sep - label) : strlen(label);
+
+		struct abp_build_node *child = NULL;
+		if(node->num_children > 0u)
+		{
+			struct abp_build_node *last = node->children[node->num_children - 1u];
+			if(last->len == len && memcmp(last->label, label, len) == 0)
+				child = last;
+		}
+
+		if(child == NULL)
+		{
+			if(node->num_children == node->size_children)
+			{
+				const uint32_t newsize = node->size_children > 0u ? 2u*node->size_children : 4u;
+				struct abp_build_node **children = realloc(node->children, newsize*sizeof(*children));
+				if(children == NULL)
+					return false;
+				node->children = children;
+				node->size_children = newsize;
+			}
+			child = calloc(1, sizeof(struct abp_build_node));
+			if(child == NULL)
+				return false;
+			child->label = label;
+			child->len = len;
+			node->children[node->num_children++] = child;
+		}
+
+		node = child;
+		if(sep == NULL)
+			break;
+		label = sep + 1;
+	}
+
+	node->groupset = groupset;
+	return true;
+}
+
+// Store the trie in breadth-first order so the children of every node are
+// stored consecutively
+static bool abp_flatten(struct abp_trie *trie, struct abp_build_node *root, const uint32_t num_nodes, const size_t strings_len)
+{
+	trie->nodes = calloc(num_nodes, sizeof(struct abp_node));
+	struct abp_build_node **queue = calloc(num_nodes, sizeof(struct abp_build_node*));
+	trie->strings = calloc(strings_len + 1u, sizeof(char));
+	if(trie->nodes == NULL || queue == NULL || trie->strings == NULL)
+	{
+		free(queue);
+		return false;
+	}
+
+	// The root node has the empty string as label
+	trie->strings_len = 1u;
+	queue[0] = root;
+	uint32_t next = 1u;
+	for(uint32_t i = 0; i < next; i++)
+	{
+		const struct abp_build_node *bnode = queue[i];
+		struct abp_node *node = &trie->nodes[i];
+		node->groupset = bnode->groupset;
+		node->children = next;
+		node->num_children = bnode->num_children;
+		for(uint32_t j = 0; j < bnode->num_children; j++)
+		{
+			struct abp_build_node *child = bnode->children[j];
+			trie->nodes[next].label = trie->strings_len;
+			memcpy(&trie->strings[trie->strings_len], child->label, child->len);
+			trie->strings_len += child->len + 1u;
+			queue[next++] = child;
+		}
+	}
+
+	trie->num_nodes = next;
+	free(queue);
+	return true;
+}
+
+// Build the suffix trie of all ABP-style entries of the gravity list
+static bool abp_build(struct gravity_index *index)
+{
+	const struct index_list *list = &index->list[GRAVITY_TABLE];
+
+	// Collect ABP-style entries
+	struct abp_key *keys = NULL;
+	size_t num_keys = 0u, size_keys = 0u;
+	bool okay = true;
+	for(uint32_t i = 0; okay && i < list->size; i++)
+	{
+		// Entries removed by gravity_index_update() are left in the
+		// hash table with the empty group set
+		const struct index_entry *entry = &list->slots[i];
+		if(entry->name == 0u || entry->groupset == 0u)
+			continue;
+		const char *name = &list->strings[entry->name - 1u];
+		const size_t len = strlen(name);
+		if(len < 4u || name[0] != '|' || name[1] != '|' || name[len - 1u] != '^')
+			continue;
+
+		okay = ensure_capacity((void**)&keys, &size_keys, num_keys + 1u, sizeof(struct abp_key));
+		if(!okay)
+			break;
+		keys[num_keys].key = abp_reverse_labels(name + 2, len - 3u);
+		keys[num_keys].groupset = entry->groupset;
+		okay = keys[num_keys].key != NULL;
+		if(okay)
+			num_keys++;
+	}
+
+	// Sort entries so the trie can be built in a single pass
+	if(num_keys > 0u)
+		qsort(keys, num_keys, sizeof(struct abp_key), abp_key_cmp);
+
+	struct abp_build_node root = { 0 };
+	for(size_t i = 0; okay && i < num_keys; i++)
+		okay = abp_build_insert(&root, keys[i].key, keys[i].groupset);
+
+	// Count nodes and label bytes
+	if(okay)
+	{
+		uint32_t num_nodes = 0u;
+		size_t strings_len = 1u;
+		struct abp_build_node **stack = calloc(num_keys*2u + 1u, sizeof(struct abp_build_node*));
+		okay = stack != NULL;
+		size_t depth = 0u, stack_size = num_keys*2u + 1u;
+		if(okay)
+			stack[depth++] = &root;
+		while(okay && depth > 0u)
+		{
+			struct abp_build_node *node = stack[--depth];
+			num_nodes++;
+			strings_len += node->len + 1u;
+			okay = ensure_capacity((void**)&stack, &stack_size, depth + node->num_children, sizeof(*stack));
+			for(uint32_t j = 0; okay && j < node->num_children; j++)
+				stack[depth++] = node->children[j];
+		}
+		free(stack);
+
+		if(okay)
+			okay = abp_flatten(&index->abp, &root, num_nodes, strings_len);
+	}
+
+	index->abp.num_entries = num_keys;
+	abp_build_free(&root);
+	for(size_t i = 0; i < num_keys; i++)
+		free(keys[i].key);
+	free(keys);
+
+	if(!okay)
+		logg("ERROR: Memory allocation failed when building ABP suffix trie");
+
+	return okay;
+}
+
+// Check if gravity marked the database as containing ABP-style entries
+static bool has_abp_entries(sqlite3 *db)
+{
+	sqlite3_stmt *stmt = NULL;
+	if(sqlite3_prepare_v2(db, "SELECT value FROM info WHERE property = 'abp_domains';", -1, &stmt, NULL) != SQLITE_OK)
+		return false;
+
+	const bool result = sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) != 0;
+	sqlite3_finalize(stmt);
+	return result;
+}
+
+// Second, independent hash function for the Bloom filters (32 bit FNV-1a)
+static uint32_t __attribute__((pure)) hash_fnv1a(const char *s)
+{
+	uint32_t hash = 2166136261u;
+	for(; *s; s++)
+	{
+		hash ^= (unsigned char)*s;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+// Set or test the bits of an entry. The k bit positions are derived from two
+// hashes by double hashing (h1 + i*h2). h2 is made odd so that all positions
+// differ as the number of bits is a power of two
+static void bloom_add(struct bloom_filter *bloom, const uint32_t h1, const uint32_t h2)
+{
+	for(uint32_t i = 0; i < bloom->hashes; i++)
+	{
+		const uint32_t bit = (h1 + i*(h2 | 1u)) & bloom->mask;
+		bloom->bits[bit / 64u] |= 1ull << (bit % 64u);
+	}
+}
+
+static bool __attribute__((pure)) bloom_test(const struct bloom_filter *bloom, const uint32_t h1, const uint32_t h2)
+{
+	for(uint32_t i = 0; i < bloom->hashes; i++)
+	{
+		const uint32_t bit = (h1 + i*(h2 | 1u)) & bloom->mask;
+		if(!(bloom->bits[bit / 64u] & (1ull << (bit % 64u))))
+			return false;
+	}
+
+	return true;
+}
+
+// Expected false-positive rate of a Bloom filter: (1 - e^(-kn/m))^k
+static double bloom_fp_rate(const struct bloom_filter *bloom)
+{
+	if(bloom->entries == 0u)
+		return 0.0;
+
+	const double bits = (double)bloom->mask + 1.0;
+	return pow(1.0 - exp(-(double)bloom->hashes*bloom->entries/bits), bloom->hashes);
+}
+
+static int hash_cmp(const void *a, const void *b)
+{
+	const uint64_t ha = *(const uint64_t*)a, hb = *(const uint64_t*)b;
+	return ha < hb ? -1 : ha > hb ? 1 : 0;
+}
+
+// Build the Bloom filter of one of the lists. All domains are read first so
+// the filter can be sized for their number
+static bool bloom_build(struct bloom_filter *bloom, sqlite3 *db, const enum gravity_tables list)
+{
+	sqlite3_stmt *stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, index_querystr[list], -1, &stmt, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("gravity_index_build(%s) - SQL error prepare: %s",
+		     index_listname[list], sqlite3_errstr(rc));
+		return false;
+	}
+
+	uint64_t *hashes = NULL;
+	size_t num = 0u, size = 0u;
+	while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const char *domain = (const char*)sqlite3_column_text(stmt, 0);
+		if(domain == NULL)
+			continue;
+		if(!ensure_capacity((void**)&hashes, &size, num + 1u, sizeof(uint64_t)))
+		{
+			sqlite3_finalize(stmt);
+			free(hashes);
+			return false;
+		}
+		hashes[num++] = (uint64_t)hashStr(domain) << 32 | hash_fnv1a(domain);
+	}
+	sqlite3_finalize(stmt);
+
+	if(rc != SQLITE_DONE)
+	{
+		logg("gravity_index_build(%s) - SQL error step: %s",
+		     index_listname[list], sqlite3_errstr(rc));
+		free(hashes);
+		return false;
+	}
+
+	// Domains are listed once per group they belong to. Remove duplicates so
+	// the filter is sized for the number of distinct domains
+	if(num > 0u)
+	{
+		qsort(hashes, num, sizeof(uint64_t), hash_cmp);
+		size_t unique = 1u;
+		for(size_t i = 1u; i < num; i++)
+			if(hashes[i] != hashes[unique - 1u])
+				hashes[unique++] = hashes[i];
+		num = unique;
+	}
+
+	// Use at least ten bits per entry (about 1% false positives) rounded up
+	// to the next power of two, and the optimal number of hash functions for
+	// this ratio, k = ln(2)*m/n
+	uint64_t bits = 64u;
+	while(bits < 10u*(uint64_t)num && bits < (1ull << 32))
+		bits *= 2u;
+	bloom->bits = calloc(bits / 64u, sizeof(uint64_t));
+	if(bloom->bits == NULL)
+	{
+		logg("ERROR: Memory allocation failed when building %s Bloom filter", index_listname[list]);
+		free(hashes);
+		return false;
+	}
+	bloom->mask = bits - 1u;
+	bloom->entries = num;
+	bloom->hashes = num > 0u ? (uint32_t)(0.693*bits/num + 0.5) : 1u;
+	if(bloom->hashes < 1u)
+		bloom->hashes = 1u;
+	else if(bloom->hashes > 16u)
+		bloom->hashes = 16u;
+
+	for(size_t i = 0; i < num; i++)
+		bloom_add(bloom, hashes[i] >> 32, hashes[i] & 0xFFFFFFFFu);
+	free(hashes);
+
+	logg("Bloom filter for %s: %u entries, %.1f KB, %u hashes, estimated false-positive rate %.3f%%",
+	     index_listname[list], bloom->entries, bits/8192.0, bloom->hashes, 100.0*bloom_fp_rate(bloom));
+
+	return true;
+}
+
+// Hash the rows returned by the stamp queries above (64 bit FNV-1a). The table
+// of recorded changes only exists after the first incremental update
+static bool index_db_stamp(sqlite3 *db, uint64_t *stamp)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for(unsigned int i = 0; i < sizeof(stamp_querystr)/sizeof(stamp_querystr[0]); i++)
+	{
+		sqlite3_stmt *stmt = NULL;
+		int rc = sqlite3_prepare_v2(db, stamp_querystr[i], -1, &stmt, NULL);
+		if(rc != SQLITE_OK && strstr(stamp_querystr[i], "gravity_changes") != NULL)
+			continue;
+		if(rc != SQLITE_OK)
+		{
+			logg("index_db_stamp(%s) - SQL error prepare: %s", stamp_querystr[i], sqlite3_errstr(rc));
+			return false;
+		}
+
+		while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+		{
+			const int cols = sqlite3_column_count(stmt);
+			for(int col = 0; col < cols; col++)
+			{
+				// Separate columns with a byte not valid in any of them
+				const unsigned char *text = sqlite3_column_text(stmt, col);
+				for(const unsigned char *p = text; p != NULL && *p != '\0'; p++)
+					hash = (hash ^ *p) * 1099511628211ull;
+				hash = (hash ^ 0x1fu) * 1099511628211ull;
+			}
+		}
+		sqlite3_finalize(stmt);
+		hash = (hash ^ 0x1eu) * 1099511628211ull;
+
+		if(rc != SQLITE_DONE)
+		{
+			logg("index_db_stamp(%s) - SQL error step: %s", stamp_querystr[i], sqlite3_errstr(rc));
+			return false;
+		}
+	}
+
+	*stamp = hash;
+	return true;
+}
+
+// Read the exact domain lists from the gravity database into a new index. This
+// uses a dedicated database connection so it can run in the database thread
+// without holding the shared memory lock. If exact is false, only ABP-style
+// entries are read (if there are any) to be matched through the suffix trie
+// while the exact lists are still looked up in the database, optionally with
+// Bloom filters in front of them. Returns NULL on error or if there is nothing
+// to index
+struct gravity_index *gravity_index_build(const char *dbfile, const bool exact, const bool bloom)
+{
+	timer_start(LISTS_TIMER);
+
+	// Remember which database the index is built from so a compiled index
+	// file can later be checked for being up-to-date
+	struct stat st;
+	if(stat(dbfile, &st) != 0)
+	{
+		logg("gravity_index_build(): %s does not exist", dbfile);
+		return NULL;
+	}
+
+	sqlite3 *db = NULL;
+	int rc = sqlite3_open_v2(dbfile, &db, SQLITE_OPEN_READONLY, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("gravity_index_build() - SQL error: %s", sqlite3_errstr(rc));
+		sqlite3_close(db);
+		return NULL;
+	}
+	sqlite3_busy_timeout(db, DATABASE_BUSY_TIMEOUT);
+
+	// Read everything (including the stamp) from the same snapshot of the
+	// database. The transaction ends when closing the connection
+	sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL);
+
+	const bool abp = exact || has_abp_entries(db);
+	if(!exact && !abp && !bloom)
+	{
+		sqlite3_close(db);
+		return NULL;
+	}
+
+	struct gravity_index *index = calloc(1, sizeof(struct gravity_index));
+	if(index == NULL || !index_init(index))
+	{
+		logg("ERROR: Memory allocation failed in gravity_index_build()");
+		gravity_index_free(index);
+		sqlite3_close(db);
+		return NULL;
+	}
+	index->exact = exact;
+	index->source.size = st.st_size;
+	index->source.mtime_sec = st.st_mtim.tv_sec;
+	index->source.mtime_nsec = st.st_mtim.tv_nsec;
+
+	bool okay = index_db_stamp(db, &index->source.stamp);
+	if(exact)
+		for(unsigned int list = 0; okay && list < NUM_INDEXED_LISTS; list++)
+			okay = index_read_list(index, db, list, index_querystr[list]);
+	else
+	{
+		if(abp)
+			okay = index_read_list(index, db, GRAVITY_TABLE, abp_querystr);
+		for(unsigned int list = 0; bloom && okay && list < NUM_INDEXED_LISTS; list++)
+			okay = bloom_build(&index->bloom[list], db, list);
+	}
+
+	sqlite3_close(db);
+
+	if(!okay || (abp && !abp_build(index)))
+	{
+		logg("Gravity index not available, using database lookups");
+		gravity_index_free(index);
+		return NULL;
+	}
+
+	size_t bytes = index->groups_size*sizeof(int) + index->groupsets_size*sizeof(uint32_t) +
+	               index->abp.num_nodes*sizeof(struct abp_node) + index->abp.strings_len;
+	for(unsigned int list = 0; list < NUM_INDEXED_LISTS; list++)
+	{
+		bytes += index->list[list].size*sizeof(struct index_entry) + index->list[list].strings_size;
+		if(index->bloom[list].bits != NULL)
+			bytes += ((size_t)index->bloom[list].mask + 1u)/8u;
+	}
+
+	if(exact)
+		logg("Gravity index: %u gravity, %u blacklist, %u whitelist domains, %u ABP-style entries in %u group sets (%.1f MB, built in %.1f ms)",
+		     index->list[GRAVITY_TABLE].count, index->list[EXACT_BLACKLIST_TABLE].count,
+		     index->list[EXACT_WHITELIST_TABLE].count, index->abp.num_entries, index->num_groupsets,
+		     1e-6*bytes, timer_elapsed_msec(LISTS_TIMER));
+	else
+		logg("Gravity index: %u ABP-style entries in %u group sets (%.1f MB, built in %.1f ms)",
+		     index->abp.num_entries, index->num_groupsets,
+		     1e-6*bytes, timer_elapsed_msec(LISTS_TIMER));
+
+	return index;
+}
+
+// Compiled index files are stored next to the database they were built from
+static void index_file_path(char *path, const size_t len, const char *dbfile)
+{
+	snprintf(path, len, "%s.idx", dbfile);
+}
+
+static bool write_section(FILE *fp, const void *data, const size_t len)
+{
+	static const char padding[8] = { 0 };
+	if(len > 0u && fwrite(data, len, 1, fp) != 1)
+		return false;
+	const size_t pad = (8u - len % 8u) % 8u;
+	return pad == 0u || fwrite(padding, pad, 1, fp) == 1;
+}
+
+static uint64_t section_size(const size_t len)
+{
+	return (len + 7u) & ~(uint64_t)7u;
+}
+
+// Write the index into a file which can be mapped by gravity_index_map(). The
+// file is written under a temporary name and renamed afterwards so a running
+// FTL never maps a partially written file. If outfile is NULL, the file is
+// placed next to the database the index was built from
+bool gravity_index_write(const struct gravity_index *index, const char *dbfile, const char *outfile)
+{
+	// Only complete indices can be used in place of the database
+	if(!index->exact)
+		return false;
+
+	char path[PATH_MAX], tmppath[PATH_MAX];
+	if(outfile == NULL)
+		index_file_path(path, sizeof(path), dbfile);
+	else
+		snprintf(path, sizeof(path), "%s", outfile);
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+
+	// Compute the layout of the file
+	struct index_file_header header = { 0 };
+	memcpy(header.magic, INDEX_FILE_MAGIC, sizeof(INDEX_FILE_MAGIC));
+	header.version = INDEX_FILE_VERSION;
+	header.byteorder = INDEX_FILE_BYTEORDER;
+	header.entry_size = sizeof(struct index_entry);
+	header.num_groupsets = index->num_groupsets;
+	header.db_size = index->source.size;
+	header.db_mtime_sec = index->source.mtime_sec;
+	header.db_mtime_nsec = index->source.mtime_nsec;
+	header.db_stamp = index->source.stamp;
+
+	uint64_t offset = section_size(sizeof(header));
+	for(unsigned int i = 0; i < NUM_INDEXED_LISTS; i++)
+	{
+		const struct index_list *list = &index->list[i];
+		header.list[i].size = list->size;
+		header.list[i].count = list->count;
+		header.list[i].slots = offset;
+		offset += section_size(list->size*sizeof(struct index_entry));
+		header.list[i].strings = offset;
+		header.list[i].strings_len = list->strings_len;
+		offset += section_size(list->strings_len);
+	}
+	header.groups = offset;
+	header.groups_len = index->groups_len;
+	offset += section_size(index->groups_len*sizeof(int));
+	header.groupsets = offset;
+	offset += section_size(index->num_groupsets*sizeof(uint32_t));
+	header.abp_nodes = offset;
+	header.abp_num_nodes = index->abp.num_nodes;
+	header.abp_num_entries = index->abp.num_entries;
+	offset += section_size(index->abp.num_nodes*sizeof(struct abp_node));
+	header.abp_strings = offset;
+	header.abp_strings_len = index->abp.strings_len;
+	offset += section_size(index->abp.strings_len);
+	header.file_size = offset;
+
+	FILE *fp = fopen(tmppath, "w");
+	if(fp == NULL)
+	{
+		logg("Unable to open %s for writing: %s", tmppath, strerror(errno));
+		return false;
+	}
+
+	bool okay = write_section(fp, &header, sizeof(header));
+	for(unsigned int i = 0; okay && i < NUM_INDEXED_LISTS; i++)
+	{
+		const struct index_list *list = &index->list[i];
+		okay = write_section(fp, list->slots, list->size*sizeof(struct index_entry)) &&
+		       write_section(fp, list->strings, list->strings_len);
+	}
+	okay = okay &&
+	       write_section(fp, index->groups, index->groups_len*sizeof(int)) &&
+	       write_section(fp, index->groupsets, index->num_groupsets*sizeof(uint32_t)) &&
+	       write_section(fp, index->abp.nodes, index->abp.num_nodes*sizeof(struct abp_node)) &&
+	       write_section(fp, index->abp.strings, index->abp.strings_len);
+
+	if(fclose(fp) != 0 || !okay)
+	{
+		logg("Unable to write %s: %s", tmppath, strerror(errno));
+		unlink(tmppath);
+		return false;
+	}
+
+	if(rename(tmppath, path) != 0)
+	{
+		logg("Unable to rename %s to %s: %s", tmppath, path, strerror(errno));
+		unlink(tmppath);
+		return false;
+	}
+
+	logg("Gravity index written to %s (%.1f MB)", path, 1e-6*header.file_size);
+	return true;
+}
+
+static bool index_file_range(const struct index_file_header *header, const uint64_t offset, const uint64_t len)
+{
+	return offset % 8u == 0u && offset <= header->file_size && len <= header->file_size - offset;
+}
+
+static bool index_file_valid(const struct index_file_header *header, const size_t size)
+{
+	if(size < sizeof(*header) ||
+	   memcmp(header->magic, INDEX_FILE_MAGIC, sizeof(INDEX_FILE_MAGIC)) != 0 ||
+	   header->version != INDEX_FILE_VERSION ||
+	   header->byteorder != INDEX_FILE_BYTEORDER ||
+	   header->entry_size != sizeof(struct index_entry) ||
+	   header->file_size != size ||
+	   header->num_groupsets == 0u)
+		return false;
+
+	for(unsigned int i = 0; i < NUM_INDEXED_LISTS; i++)
+	{
+		const uint32_t slots = header->list[i].size;
+		if(slots == 0u || (slots & (slots - 1u)) != 0u ||
+		   !index_file_range(header, header->list[i].slots, (uint64_t)slots*sizeof(struct index_entry)) ||
+		   !index_file_range(header, header->list[i].strings, header->list[i].strings_len))
+			return false;
+	}
+
+	if(!index_file_range(header, header->groups, header->groups_len*sizeof(int)) ||
+	   !index_file_range(header, header->groupsets, (uint64_t)header->num_groupsets*sizeof(uint32_t)) ||
+	   header->abp_num_nodes == 0u ||
+	   !index_file_range(header, header->abp_nodes, (uint64_t)header->abp_num_nodes*sizeof(struct abp_node)) ||
+	   !index_file_range(header, header->abp_strings, header->abp_strings_len))
+		return false;
+
+	// Check that all group sets lie within the groups section
+	const char *base = (const char*)header;
+	const int *groups = (const void*)(base + header->groups);
+	const uint32_t *groupsets = (const void*)(base + header->groupsets);
+	for(uint32_t i = 0; i < header->num_groupsets; i++)
+		if(groupsets[i] >= header->groups_len || groups[groupsets[i]] < 0 ||
+		   (uint64_t)groups[groupsets[i]] >= header->groups_len - groupsets[i])
+			return false;
+
+	// Check that every slot references a zero-terminated string of its
+	// list and an existing group set. Terminating the string arena is
+	// sufficient for the former as every string ends within the arena
+	for(unsigned int i = 0; i < NUM_INDEXED_LISTS; i++)
+	{
+		const char *strings = base + header->list[i].strings;
+		const uint64_t strings_len = header->list[i].strings_len;
+		if(header->list[i].count > header->list[i].size ||
+		   (strings_len > 0u && strings[strings_len - 1u] != '\0'))
+			return false;
+
+		const struct index_entry *slots = (const void*)(base + header->list[i].slots);
+		for(uint32_t j = 0; j < header->list[i].size; j++)
+			if(slots[j].name != 0u &&
+			   (slots[j].name - 1u >= strings_len || slots[j].groupset >= header->num_groupsets))
+				return false;
+	}
+
+	// Check that every node of the suffix trie references a zero-terminated
+	// label, an existing group set and children within the trie
+	const char *abp_strings = base + header->abp_strings;
+	if(header->abp_strings_len == 0u || abp_strings[header->abp_strings_len - 1u] != '\0')
+		return false;
+	const struct abp_node *nodes = (const void*)(base + header->abp_nodes);
+	for(uint32_t i = 0; i < header->abp_num_nodes; i++)
+		if(nodes[i].label >= header->abp_strings_len ||
+		   nodes[i].groupset >= header->num_groupsets ||
+		   (uint64_t)nodes[i].children + nodes[i].num_children > header->abp_num_nodes)
+			return false;
+
+	return true;
+}
+
+// Get the stamp of the current contents of a database, see index_db_stamp()
+static bool db_stamp(const char *dbfile, uint64_t *stamp)
+{
+	sqlite3 *db = NULL;
+	int rc = sqlite3_open_v2(dbfile, &db, SQLITE_OPEN_READONLY, NULL);
+	if(rc != SQLITE_OK)
+	{
+		logg("gravity_index_map() - SQL error: %s", sqlite3_errstr(rc));
+		sqlite3_close(db);
+		return false;
+	}
+	sqlite3_busy_timeout(db, DATABASE_BUSY_TIMEOUT);
+
+	const bool okay = index_db_stamp(db, stamp);
+	sqlite3_close(db);
+	return okay;
+}
+
+// Map the compiled index file of the given database read-only into memory. All
+// processes mapping the same file share the very same pages so this needs no
+// private memory. All offsets stored in the file are range-checked once when
+// mapping it so lookups can follow them without further checks. Returns NULL
+// if there is no such file or it is outdated or invalid
+struct gravity_index *gravity_index_map(const char *dbfile)
+{
+	char path[PATH_MAX];
+	index_file_path(path, sizeof(path), dbfile);
+
+	const int fd = open(path, O_RDONLY);
+	if(fd < 0)
+	{
+		if(errno != ENOENT)
+			logg("Unable to open gravity index %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct index_file_header))
+	{
+		logg("Ignoring invalid gravity index %s", path);
+		close(fd);
+		return NULL;
+	}
+
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+	{
+		logg("Unable to map gravity index %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	const struct index_file_header *header = map;
+	if(!index_file_valid(header, st.st_size))
+	{
+		logg("Ignoring invalid gravity index %s", path);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	// Group assignments are changed directly in the database so an index
+	// file is only valid as long as the database has not been modified
+	struct stat dbst;
+	uint64_t stamp = 0u;
+	if(stat(dbfile, &dbst) != 0 ||
+	   (uint64_t)dbst.st_size != header->db_size ||
+	   dbst.st_mtim.tv_sec != header->db_mtime_sec ||
+	   dbst.st_mtim.tv_nsec != header->db_mtime_nsec ||
+	   !db_stamp(dbfile, &stamp) || stamp != header->db_stamp)
+	{
+		logg("Ignoring outdated gravity index %s", path);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	struct gravity_index *index = calloc(1, sizeof(struct gravity_index));
+	if(index == NULL)
+	{
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	// The index is never written to, casting away the const is safe here
+	char *base = map;
+	for(unsigned int i = 0; i < NUM_INDEXED_LISTS; i++)
+	{
+		struct index_list *list = &index->list[i];
+		list->slots = (void*)(base + header->list[i].slots);
+		list->size = header->list[i].size;
+		list->count = header->list[i].count;
+		list->strings = base + header->list[i].strings;
+		list->strings_len = header->list[i].strings_len;
+	}
+	index->groups = (void*)(base + header->groups);
+	index->groups_len = header->groups_len;
+	index->groupsets = (void*)(base + header->groupsets);
+	index->num_groupsets = header->num_groupsets;
+	index->abp.nodes = (void*)(base + header->abp_nodes);
+	index->abp.num_nodes = header->abp_num_nodes;
+	index->abp.num_entries = header->abp_num_entries;
+	index->abp.strings = base + header->abp_strings;
+	index->abp.strings_len = header->abp_strings_len;
+	index->exact = true;
+	index->map = map;
+	index->map_size = st.st_size;
+
+	logg("Gravity index: %u gravity, %u blacklist, %u whitelist domains, %u ABP-style entries mapped from %s",
+	     index->list[GRAVITY_TABLE].count, index->list[EXACT_BLACKLIST_TABLE].count,
+	     index->list[EXACT_WHITELIST_TABLE].count, index->abp.num_entries, path);
+
+	return index;
+}
+
+// Get the index to be used after (re)loading the lists: A valid compiled index
+// file is always preferred. An outdated or invalid one is recompiled so all
+// processes can share it again. Otherwise, an index is built in memory. It
+// contains only the ABP-style entries and Bloom filters (if enabled) unless
+// holding all lists in memory is enabled
+struct gravity_index *gravity_index_load(void)
+{
+	struct gravity_index *index = gravity_index_map(FTLfiles.gravity_db);
+	if(index != NULL)
+		return index;
+
+	char path[PATH_MAX];
+	index_file_path(path, sizeof(path), FTLfiles.gravity_db);
+	if(access(path, F_OK) != 0)
+		return gravity_index_build(FTLfiles.gravity_db, config.gravity_in_memory,
+		                           config.gravity_bloom_filter);
+
+	// Fall back to the index held in memory if the file cannot be written
+	// or the database has been changed in the meantime
+	logg("Recompiling gravity index %s", path);
+	index = gravity_index_build(FTLfiles.gravity_db, true, false);
+	if(index == NULL || !gravity_index_write(index, FTLfiles.gravity_db, NULL))
+		return index;
+
+	struct gravity_index *mapped = gravity_index_map(FTLfiles.gravity_db);
+	if(mapped == NULL)
+		return index;
+
+	gravity_index_free(index);
+	return mapped;
+}
+
+void gravity_index_free(struct gravity_index *index)
+{
+	if(index == NULL)
+		return;
+
+	if(index->map != NULL)
+	{
+		munmap(index->map, index->map_size);
+		free(index);
+		return;
+	}
+
+	for(unsigned int i = 0; i < NUM_INDEXED_LISTS; i++)
+	{
+		free(index->list[i].slots);
+		free(index->list[i].strings);
+	}
+	free(index->groups);
+	free(index->groupsets);
+	free(index->abp.nodes);
+	free(index->abp.strings);
+	for(unsigned int i = 0; i < NUM_INDEXED_LISTS; i++)
+		free(index->bloom[i].bits);
+	free(index);
+}
+
+// Replace the index lookups are served from. Passing NULL disables the index
+// and lookups fall back to the database. The shared memory lock needs to be
+// held when calling this function
+void gravity_index_swap(struct gravity_index *index)
+{
+	gravity_index_free(active);
+	active = index;
+}
+
+// Check if the active index can be changed by gravity_index_update(). Mapped
+// index files are read-only and have to be replaced as a whole
+bool __attribute__((pure)) gravity_index_updatable(void)
+{
+	return active == NULL || active->map == NULL;
+}
+
+// Apply a change of a gravity domain recorded by "pihole-FTL gravity
+// updateList" to the active index. groups are the comma-separated IDs of the
+// groups the domain belongs to after the change (NULL or empty if it is not
+// on any enabled adlist anymore). Domains are never removed from the hash
+// table, their group set is replaced by the empty set which does not match
+// any client instead. The suffix trie has to be rebuilt afterwards using
+// gravity_index_finish_update(). Returns false if the index cannot be updated
+// and has to be rebuilt. The shared memory lock needs to be held when calling
+// this function
+bool gravity_index_update(const char *domain, const char *groups)
+{
+	const size_t len = strlen(domain);
+	const bool abp = len >= 4u && domain[0] == '|' && domain[1] == '|' && domain[len - 1u] == '^';
+	const bool added = groups != NULL && *groups != '\0';
+
+	// Without an index, only the first ABP-style entry requires one
+	if(active == NULL)
+		return !(abp && added);
+	if(active->map != NULL)
+		return false;
+
+	// Bloom filters cannot forget domains. Removed domains are still
+	// looked up in the database until the next full reload
+	struct bloom_filter *bloom = &active->bloom[GRAVITY_TABLE];
+	const uint32_t h1 = hashStr(domain), h2 = hash_fnv1a(domain);
+	if(bloom->bits != NULL && added && !bloom_test(bloom, h1, h2))
+	{
+		bloom_add(bloom, h1, h2);
+		bloom->entries++;
+	}
+
+	// Only ABP-style entries are held in memory unless all lists are
+	if(!active->exact && !abp)
+		return true;
+
+	struct index_list *list = &active->list[GRAVITY_TABLE];
+	struct index_entry *entry = added ? list_insert(list, domain) : list_find(list, domain, h1);
+	if(entry == NULL)
+		return !added;
+
+	uint32_t groupset = 0u;
+	for(const char *p = groups; p != NULL && *p != '\0'; )
+	{
+		char *end = NULL;
+		const long group = strtol(p, &end, 10);
+		if(end == p)
+			break;
+		if(!groupset_with(active, groupset, group, &groupset))
+			return false;
+		p = *end == ',' ? end + 1 : end;
+	}
+	entry->groupset = groupset;
+
+	if(abp)
+		active->abp_changed = true;
+
+	return true;
+}
+
+// Rebuild the suffix trie from the ABP-style entries held in memory if any of
+// them have been changed by gravity_index_update(). Returns false if the index
+// has to be rebuilt. The shared memory lock needs to be held when calling this
+// function
+bool gravity_index_finish_update(void)
+{
+	if(active == NULL || !active->abp_changed)
+		return true;
+
+	active->abp_changed = false;
+	free(active->abp.nodes);
+	free(active->abp.strings);
+	memset(&active->abp, 0, sizeof(active->abp));
+	return abp_build(active);
+}
+
+// Check if the exact lists can be looked up in the index
+bool __attribute__((pure)) gravity_index_available(void)
+{
+	return active != NULL && active->exact;
+}
+
+// Check if ABP-style entries can be matched through the suffix trie
+bool __attribute__((pure)) gravity_index_abp_available(void)
+{
+	return active != NULL && active->abp.nodes != NULL;
+}
+
+// Check if a domain is on one of the exact lists for any of the given groups.
+// The ID of the matching domainlist entry is stored in domain_id (if not NULL)
+enum db_result gravity_index_lookup(const unsigned char list, const char *domain,
+                                    const char *groups, int *domain_id)
+{
+	if(active == NULL || list >= NUM_INDEXED_LISTS)
+		return LIST_NOT_AVAILABLE;
+
+	const struct index_entry *entry = list_find(&active->list[list], domain, hashStr(domain));
+	const bool found = entry != NULL && in_groupset(active, entry->groupset, groups);
+	const int result = found ? entry->id : -1;
+	if(domain_id != NULL)
+		*domain_id = result;
+
+	if(config.debug & DEBUG_DATABASE)
+		logg("gravity_index_lookup(\"%s\", %s): %d", domain, index_listname[list], result);
+
+	return found ? FOUND : NOT_FOUND;
+}
+
+static int label_cmp(const char *label, const size_t len, const char *node_label)
+{
+	const int result = strncmp(label, node_label, len);
+	if(result != 0)
+		return result;
+
+	// The node's label may be longer than the one we are looking for
+	return node_label[len] == '\0' ? 0 : -1;
+}
+
+// Check if any ABP-style entry ||suffix^ of the given groups matches the domain.
+// This walks the suffix trie from the TLD down to the full domain, checking
+// all suffixes the domain can be blocked by in a single pass
+enum db_result gravity_index_abp_lookup(const char *domain, const char *groups)
+{
+	if(active == NULL || active->abp.nodes == NULL)
+		return LIST_NOT_AVAILABLE;
+
+	const struct abp_trie *trie = &active->abp;
+	const struct abp_node *node = &trie->nodes[0];
+	size_t end = strlen(domain);
+	while(end > 0u)
+	{
+		// Get the next label to the left
+		size_t start = end;
+		while(start > 0u && domain[start - 1u] != '.')
+			start--;
+		const char *label = &domain[start];
+		const size_t len = end - start;
+
+		// Binary search amongst the children of the current node
+		const struct abp_node *child = NULL;
+		uint32_t lo = node->children, hi = node->children + node->num_children;
+		while(lo < hi)
+		{
+			const uint32_t mid = lo + (hi - lo)/2u;
+			const int cmp = label_cmp(label, len, &trie->strings[trie->nodes[mid].label]);
+			if(cmp == 0)
+			{
+				child = &trie->nodes[mid];
+				break;
+			}
+			else if(cmp < 0)
+				hi = mid;
+			else
+				lo = mid + 1u;
+		}
+
+		// No entry for this or any longer suffix
+		if(child == NULL)
+			return NOT_FOUND;
+
+		if(child->groupset != 0u && in_groupset(active, child->groupset, groups))
+		{
+			if(config.debug & DEBUG_QUERIES)
+				logg("Checking if \"%s\" is in gravity: yes (ABP-style entry ||%s^)", domain, label);
+			return FOUND;
+		}
+
+		node = child;
+		end = start > 0u ? start - 1u : 0u;
+	}
+
+	return NOT_FOUND;
+}
+
+// Check if a domain may be on one of the lists. Returns false only if the
+// list's Bloom filter rules out the domain. If there is no filter, the domain
+// may be on the list and has to be looked up in the database
+bool __attribute__((pure)) gravity_index_may_contain(const unsigned char list, const char *domain)
+{
+	if(active == NULL || list >= NUM_INDEXED_LISTS || active->bloom[list].bits == NULL)
+		return true;
+
+	return bloom_test(&active->bloom[list], hashStr(domain), hash_fnv1a(domain));
+}
+
+// Get details about the Bloom filter of one of the lists
+bool gravity_index_bloom_info(const unsigned char list, struct gravity_bloom_info *info)
+{
+	if(active == NULL || list >= NUM_INDEXED_LISTS || active->bloom[list].bits == NULL)
+		return false;
+
+	const struct bloom_filter *bloom = &active->bloom[list];
+	info->bits = (uint64_t)bloom->mask + 1u;
+	info->hashes = bloom->hashes;
+	info->entries = bloom->entries;
+	info->fp_rate = bloom_fp_rate(bloom);
+	return true;
+}
@@ -0,0 +1,46 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2023 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  In-memory gravity index prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef GRAVITY_INDEX_H
+#define GRAVITY_INDEX_H
+
+// type bool
+#include <stdbool.h>
+// type uint64_t
+#include <stdint.h>
+// enum db_result
+#include "../enums.h"
+
+struct gravity_index;
+
+struct gravity_bloom_info {
+	uint64_t bits;
+	unsigned int hashes;
+	unsigned int entries;
+	double fp_rate;
+};
+
+struct gravity_index *gravity_index_build(const char *dbfile, const bool exact, const bool bloom);
+bool gravity_index_write(const struct gravity_index *index, const char *dbfile, const char *outfile);
+struct gravity_index *gravity_index_map(const char *dbfile);
+struct gravity_index *gravity_index_load(void);
+void gravity_index_free(struct gravity_index *index);
+void gravity_index_swap(struct gravity_index *index);
+bool gravity_index_updatable(void) __attribute__((pure));
+bool gravity_index_update(const char *domain, const char *groups);
+bool gravity_index_finish_update(void);
+bool gravity_index_available(void) __attribute__((pure));
+bool gravity_index_abp_available(void) __attribute__((pure));
+enum db_result gravity_index_lookup(const unsigned char list, const char *domain,
+                                    const char *groups, int *domain_id);
+enum db_result gravity_index_abp_lookup(const char *domain, const char *groups);
+bool gravity_index_may_contain(const unsigned char list, const char *domain) __attribute__((pure));
+bool gravity_index_bloom_info(const unsigned char list, struct gravity_bloom_info *info);
+
+#endif //GRAVITY_INDEX_H
@@ -265,7 +265,7 @@ int DB_save_queries(sqlite3 *db)
 			continue;
 		}
 
-		if(!query->flags.complete && query->timestamp > currenttimestamp-2)
+		if(!query->flags.complete && query_get_timestamp(query) > currenttimestamp-2)
 		{
 			// Break if a brand new query (age < 2 seconds) is not yet completed
 			// giving it a chance to be stored next time
@@ -280,7 +280,7 @@ int DB_save_queries(sqlite3 *db)
 		}
 
 		// TIMESTAMP
-		sqlite3_bind_int(query_stmt, 1, query->timestamp);
+		sqlite3_bind_int(query_stmt, 1, query_get_timestamp(query));
 
 		// TYPE
 		if(query->type != TYPE_OTHER)
@@ -457,8 +457,8 @@ int DB_save_queries(sqlite3 *db)
 			blocked++;
 
 		// Update lasttimestamp variable with timestamp of the latest stored query
-		if(query->timestamp > newlasttimestamp)
-			newlasttimestamp = query->timestamp;
+		if(query_get_timestamp(query) > newlasttimestamp)
+			newlasttimestamp = query_get_timestamp(query);
 	}
 
 	if(sqlite3_finalize(query_stmt) != SQLITE_OK ||
@@ -857,7 +857,7 @@ void DB_read_queries(void)
 		// Store this query in memory
 		queriesData* query = getQuery(queryIndex, false);
 		query->magic = MAGICBYTE;
-		query->timestamp = queryTimeStamp;
+		query_set_timestamp(query, queryTimeStamp);
 		if(type < 100)
 		{
 			// Mapped query type
@@ -55,6 +55,44 @@ static bool __attribute__ ((pure)) isMAC(const char *input)
 	return false;
 }
 
+// Parse a client table entry of the form address[/cidr]. Returns false for MAC
+// addresses and anything else that is not an IP address. The CIDR defaults to
+// the full address length if it is not specified
+bool parse_client_subnet(const char *addrDBcidr, bool *isIPv6, struct in6_addr *saddrDB, int *cidr)
+{
+	// No match if database entry is a MAC address
+	if(isMAC(addrDBcidr))
+		return false;
+
+	// Extract possible CIDR from database IP string
+	// sscanf() will not overwrite the pre-defined CIDR in cidr if
+	// no CIDR is specified in the database
+	*isIPv6 = strchr(addrDBcidr, ':') != NULL;
+	*cidr = *isIPv6 ? 128 : 32;
+	char *addrDB = NULL;
+	const int rt = sscanf(addrDBcidr, "%m[^/]/%i", &addrDB, cidr);
+
+	// Skip if database row seems to be a CIDR but does not contain an address ('/32' is invalid)
+	// Passing an invalid IP address to inet_pton() causes a SEGFAULT
+	if(rt < 1 || addrDB == NULL)
+		return false;
+
+	// Convert the Internet host address into binary form in network byte order
+	// We use in6_addr as variable type here as it is guaranteed to be large enough
+	// for both, IPv4 and IPv6 addresses (128 bits variable size).
+	memset(saddrDB, 0, sizeof(*saddrDB));
+	if (inet_pton(*isIPv6 ? AF_INET6 : AF_INET, addrDB, saddrDB) == 0)
+	{
+		// This may happen when trying to analyze a hostname
+		free(addrDB);
+		return false;
+	}
+
+	// Free allocated memory
+	free(addrDB);
+	return true;
+}
+
 static void subnet_match_impl(sqlite3_context *context, int argc, sqlite3_value **argv)
 {
 	// Exactly two arguments should be submitted to this routine
@@ -80,55 +118,19 @@ static void subnet_match_impl(sqlite3_context *context, int argc, sqlite3_value
 	// ... and from FTL's side (second argument)
 	const char *addrFTL = (const char*)sqlite3_value_text(argv[1]);
 
-	// Return early (no match) if database entry is a MAC address
-	// We can skip all computations in this case
-	if(isMAC(addrDBcidr))
-	{
-		sqlite3_result_int(context, 0);
-		return;
-	}
-
-	// Return early (no match) if IP types are different
-	// We can skip all computations in this case
-	bool isIPv6_DB = strchr(addrDBcidr, ':') != NULL;
-	bool isIPv6_FTL = strchr(addrFTL, ':') != NULL;
-	if(isIPv6_DB != isIPv6_FTL)
-	{
-		sqlite3_result_int(context, 0);
-		return;
-	}
-
-	// Extract possible CIDR from database IP string
-	// sscanf() will not overwrite the pre-defined CIDR in cidr if
-	// no CIDR is specified in the database
-	int cidr = isIPv6_DB ? 128 : 32;
-	char *addrDB = NULL;
-	const int rt = sscanf(addrDBcidr, "%m[^/]/%i", &addrDB, &cidr);
-
-	// Skip if database row seems to be a CIDR but does not contain an address ('/32' is invalid)
-	// Passing an invalid IP address to inet_pton() causes a SEGFAULT
-	if(rt < 1 || addrDB == NULL)
-	{
-		sqlite3_result_int(context, 0);
-		return;
-	}
-
-	// Convert the Internet host address into binary form in network byte order
-	// We use in6_addr as variable type here as it is guaranteed to be large enough
-	// for both, IPv4 and IPv6 addresses (128 bits variable size).
+	// Return early (no match) if the database entry is not an IP address
+	// or subnet (e.g., a MAC address) or if IP types are different
+	bool isIPv6_DB = false;
+	int cidr = 0;
 	struct in6_addr saddrDB = {{{ 0 }}}, saddrFTL = {{{ 0 }}};
-	if (inet_pton(isIPv6_DB ? AF_INET6 : AF_INET, addrDB, &saddrDB) == 0)
+	const bool isIPv6_FTL = strchr(addrFTL, ':') != NULL;
+	if(!parse_client_subnet(addrDBcidr, &isIPv6_DB, &saddrDB, &cidr) ||
+	   isIPv6_DB != isIPv6_FTL)
 	{
-		// This may happen when trying to analyze a hostname, skip this entry and return NO MATCH (= 0)
-		free(addrDB);
 		sqlite3_result_int(context, 0);
 		return;
 	}
 
-	// Free allocated memory
-	free(addrDB);
-	addrDB = NULL;
-
 	// Check and convert client IP address as seen by FTL
 	if (inet_pton(isIPv6_FTL ? AF_INET6 : AF_INET, addrFTL, &saddrFTL) == 0)
 	{
@@ -8,5 +8,13 @@
 *  This file is copyright under the latest version of the EUPL.
 *  Please see LICENSE file for your rights under this license. */
 
+// type bool
+#include <stdbool.h>
+// struct in6_addr
+#include <netinet/in.h>
+
 // Initialization point for SQLite3 extensions
 extern int sqlite3_pihole_extensions_init(sqlite3 *db, const char **pzErrMsg, const struct sqlite3_api_routines *pApi);
+
+// Parse client table entries of the form address[/cidr]
+bool parse_client_subnet(const char *addrDBcidr, bool *isIPv6, struct in6_addr *saddrDB, int *cidr);
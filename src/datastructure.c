@@ -16,6 +16,8 @@
 #include "regex_r.h"
 // reload_per_client_regex()
 #include "database/gravity-db.h"
+// gravity_index_load()
+#include "database/gravity-index.h"
 // bool startup
 #include "main.h"
 // reset_aliasclient()
@@ -28,6 +30,8 @@
 #include "overTime.h"
 // short_path()
 #include "files.h"
+// lookup_find_id()
+#include "lookup-table.h"
 
 const char *querytypes[TYPE_MAX] = {"UNKNOWN", "A", "AAAA", "ANY", "SRV", "SOA", "PTR", "TXT",
                                     "NAPTR", "MX", "DS", "RRSIG", "DNSKEY", "NS", "OTHER", "SVCB",
@@ -58,35 +62,80 @@ uint32_t __attribute__ ((pure)) hashStr(const char *s)
         return hash;
 }
 
-int findQueryID(const int id)
+// creates a simple hash of an integer that fits into a uint32_t
+static uint32_t __attribute__ ((const)) hashInt(const uint32_t i)
 {
-	// Loop over all queries - we loop in reverse order (start from the most recent query and
-	// continuously walk older queries while trying to find a match. Ideally, we should always
-	// find the correct query with zero iterations, but it may happen that queries are processed
-	// asynchronously, e.g. for slow upstream relies to a huge amount of requests.
-	// We iterate from the most recent query down to at most MAXITER queries in the past to avoid
-	// iterating through the entire array of queries
-	// MAX(0, a) is used to return 0 in case a is negative (negative array indices are harmful)
-	const int until = MAX(0, counters->queries-MAXITER);
-	const int start = MAX(0, counters->queries-1);
-
-	// Check UUIDs of queries
-	for(int i = start; i >= until; i--)
-	{
-		const queriesData* query = getQuery(i, true);
+	// Finalization mix of MurmurHash3, this spreads consecutive
+	// integers (like dnsmasq's query IDs) over the entire range
+	uint32_t hash = i;
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+	return hash;
+}
 
-		// Check if the returned pointer is valid before trying to access it
-		if(query == NULL)
-			continue;
+// The query lookup table stores the absolute query index, i.e., the query ID
+// plus the number of queries removed by the garbage collection so far. This
+// way, the table does not need to be updated when GC moves the remaining
+// queries forward. Stale entries are detected by their index being outside of
+// the range of queries currently in memory
+#define QUERY_INDEX_MASK 0x7FFFFFFFu
+static inline unsigned int query_to_index(const int queryID)
+{
+	return ((unsigned int)queryID + counters->queries_removed) & QUERY_INDEX_MASK;
+}
 
-		if(query->id == id)
-			return i;
-	}
+static inline int index_to_query(const unsigned int idx)
+{
+	const unsigned int queryID = (idx - counters->queries_removed) & QUERY_INDEX_MASK;
+	return queryID < (unsigned int)counters->queries ? (int)queryID : -1;
+}
+
+// Compare the query with the given index against the dnsmasq ID we are looking for
+static bool query_cmp(const unsigned int idx, const struct lookup_data *lookup_data)
+{
+	const queriesData *query = getQuery(index_to_query(idx), true);
+	if(query == NULL)
+		return false;
+
+	return query->id == lookup_data->dnsmasq_id;
+}
+
+int findQueryID(const int id)
+{
+	// Get query from the hash-based lookup table
+	const struct lookup_data lookup_data = { .dnsmasq_id = id };
+	unsigned int idx = 0u;
+	if(lookup_find_id(QUERIES_LOOKUP, hashInt(id), &lookup_data, &idx, query_cmp))
+		return index_to_query(idx);
 
 	// If not found
 	return -1;
 }
 
+// Make a new query findable by its dnsmasq ID. If another query with the same ID
+// is still known, it is replaced as replies always belong to the most recent
+// query with a given ID
+void storeQueryID(const int id, const int queryID)
+{
+	const uint32_t hash = hashInt(id);
+	const struct lookup_data lookup_data = { .dnsmasq_id = id };
+	unsigned int idx = 0u;
+	if(lookup_find_id(QUERIES_LOOKUP, hash, &lookup_data, &idx, query_cmp))
+		lookup_remove(QUERIES_LOOKUP, idx, hash);
+
+	lookup_insert(QUERIES_LOOKUP, query_to_index(queryID), hash);
+}
+
+// Remove a query from the lookup table, this has to be done before the query is
+// removed by the garbage collection
+void removeQueryID(const int id, const int queryID)
+{
+	lookup_remove(QUERIES_LOOKUP, query_to_index(queryID), hashInt(id));
+}
+
 int findUpstreamID(const char * upstreamString, const in_port_t port)
 {
 	// Go through already knows upstream servers and see if we used one of those
@@ -137,34 +186,33 @@ int findUpstreamID(const char * upstreamString, const in_port_t port)
 	return upstreamID;
 }
 
-int findDomainID(const char *domainString, const bool count)
+// Compare the domain with the given ID against the domain we are looking for
+static bool domain_cmp(const unsigned int domainID, const struct lookup_data *lookup_data)
 {
-	uint32_t domainHash = hashStr(domainString);
-	for(int domainID = 0; domainID < counters->domains; domainID++)
-	{
-		// Get domain pointer
-		domainsData* domain = getDomain(domainID, true);
-
-		// Check if the returned pointer is valid before trying to access it
-		if(domain == NULL)
-			continue;
+	const domainsData *domain = getDomain(domainID, true);
+	if(domain == NULL)
+		return false;
 
-		// Quicker test: Does the domain match the pre-computed hash?
-		if(domain->domainhash != domainHash)
-			continue;
+	return strcmp(getstr(domain->domainpos), lookup_data->domain) == 0;
+}
 
-		// If so, compare the full domain using strcmp
-		if(strcmp(getstr(domain->domainpos), domainString) == 0)
-		{
-			if(count)
-				domain->count++;
-			return domainID;
-		}
+int findDomainID(const char *domainString, const bool count)
+{
+	// Get domain from the hash-based lookup table
+	const uint32_t domainHash = hashStr(domainString);
+	const struct lookup_data lookup_data = { .domain = domainString };
+	unsigned int domainID = 0u;
+	if(lookup_find_id(DOMAINS_LOOKUP, domainHash, &lookup_data, &domainID, domain_cmp))
+	{
+		domainsData *domain = getDomain(domainID, true);
+		if(domain != NULL && count)
+			domain->count++;
+		return domainID;
 	}
 
 	// If we did not return until here, then this domain is not known
 	// Store ID
-	const int domainID = counters->domains;
+	domainID = counters->domains;
 
 	// Get domain pointer
 	domainsData* domain = getDomain(domainID, false);
@@ -184,36 +232,105 @@ int findDomainID(const char *domainString, const bool count)
 	// Store domain name - no need to check for NULL here as it doesn't harm
 	domain->domainpos = addstr(domainString);
 	// Store pre-computed hash of domain for faster lookups later on
-	domain->domainhash = hashStr(domainString);
+	domain->domainhash = domainHash;
+	// Add domain to the lookup table
+	lookup_insert(DOMAINS_LOOKUP, domainID, domainHash);
 	// Increase counter by one
 	counters->domains++;
 
 	return domainID;
 }
 
-int findClientID(const char *clientIP, const bool count, const bool aliasclient)
+// creates a simple hash of a binary IP address that fits into a uint32_t
+static uint32_t __attribute__ ((pure)) hashAddr(const struct in6_addr *addr)
 {
-	// Compare content of client against known client IP addresses
-	for(int clientID=0; clientID < counters->clients; clientID++)
+	uint32_t hash = 0;
+	// Jenkins' One-at-a-Time hash (see hashStr() above)
+	for(unsigned int i = 0; i < sizeof(addr->s6_addr); i++)
 	{
-		// Get client pointer
-		clientsData* client = getClient(clientID, true);
+		hash += addr->s6_addr[i];
+		hash += hash << 10;
+		hash ^= hash >> 6;
+	}
 
-		// Check if the returned pointer is valid before trying to access it
-		if(client == NULL)
-			continue;
+	hash += hash << 3;
+	hash ^= hash >> 11;
+	hash += hash << 15;
+	return hash;
+}
 
-		// Quick test: Does the clients IP start with the same character?
-		if(getstr(client->ippos)[0] != clientIP[0])
-			continue;
+// Clients are indexed by their binary address. IPv4 addresses are stored as
+// IPv4-mapped IPv6 addresses (::ffff:a.b.c.d) so that both address families
+// can share the same index. As a consequence, a query arriving from the
+// IPv4-mapped IPv6 address ::ffff:a.b.c.d (e.g., via a dual-stack socket) is
+// counted towards the same client as a query from a.b.c.d. Such a client is
+// always shown by its IPv4 address, no separate ::ffff:a.b.c.d entry exists
+void map_client_addr(const sa_family_t family, const void *src, struct in6_addr *addr)
+{
+	if(family == AF_INET)
+	{
+		memset(addr, 0, sizeof(*addr));
+		addr->s6_addr[10] = 0xff;
+		addr->s6_addr[11] = 0xff;
+		memcpy(&addr->s6_addr[12], src, sizeof(struct in_addr));
+	}
+	else
+		memcpy(addr, src, sizeof(*addr));
+}
 
-		// If so, compare the full IP using strcmp
-		if(strcmp(getstr(client->ippos), clientIP) == 0)
-		{
-			// Add one if count == true (do not add one, e.g., during ARP table processing)
-			if(count && !aliasclient) change_clientcount(client, 1, 0, -1, 0);
-			return clientID;
-		}
+// Compare the client with the given ID against the address we are looking for
+static bool client_addr_cmp(const unsigned int clientID, const struct lookup_data *lookup_data)
+{
+	const clientsData *client = getClient(clientID, true);
+	if(client == NULL)
+		return false;
+
+	return client->flags.addr_valid &&
+	       IN6_ARE_ADDR_EQUAL(&client->addr, lookup_data->client_addr);
+}
+
+// Compare the client with the given ID against the name we are looking for.
+// This is used for clients without an IP address, i.e. alias-clients
+static bool client_name_cmp(const unsigned int clientID, const struct lookup_data *lookup_data)
+{
+	const clientsData *client = getClient(clientID, true);
+	if(client == NULL)
+		return false;
+
+	return !client->flags.addr_valid &&
+	       strcmp(getstr(client->ippos), lookup_data->client_name) == 0;
+}
+
+// Find a client either by its binary address (addr != NULL) or by its name.
+// clientIP may be NULL when addr is given, the textual representation is then
+// only generated when a new client has to be created
+static int _findClientID(const char *clientIP, const struct in6_addr *addr, const bool count, const bool aliasclient)
+{
+	// Get client from the hash-based lookup table
+	struct lookup_data lookup_data;
+	uint32_t clientHash;
+	bool (*cmp)(const unsigned int clientID, const struct lookup_data *lookup_data);
+	if(addr != NULL)
+	{
+		clientHash = hashAddr(addr);
+		lookup_data.client_addr = addr;
+		cmp = client_addr_cmp;
+	}
+	else
+	{
+		clientHash = hashStr(clientIP);
+		lookup_data.client_name = clientIP;
+		cmp = client_name_cmp;
+	}
+
+	unsigned int clientID = 0u;
+	if(lookup_find_id(CLIENTS_LOOKUP, clientHash, &lookup_data, &clientID, cmp))
+	{
+		clientsData* client = getClient(clientID, true);
+		// Add one if count == true (do not add one, e.g., during ARP table processing)
+		if(client != NULL && count && !aliasclient)
+			change_clientcount(client, 1, 0, -1, 0);
+		return clientID;
 	}
 
 	// Return -1 (= not found) if count is false because we do not want to create a new client here
@@ -223,7 +340,7 @@ int findClientID(const char *clientIP, const bool count, const bool aliasclient)
 
 	// If we did not return until here, then this client is definitely new
 	// Store ID
-	const int clientID = counters->clients;
+	clientID = counters->clients;
 
 	// Get client pointer
 	clientsData* client = getClient(clientID, false);
@@ -240,7 +357,28 @@ int findClientID(const char *clientIP, const bool count, const bool aliasclient)
 	// Initialize blocked count to zero
 	client->blockedcount = 0;
 	// Store client IP - no need to check for NULL here as it doesn't harm
-	client->ippos = addstr(clientIP);
+	// IPv4-mapped IPv6 addresses are always stored in their IPv4 form, see
+	// map_client_addr() above
+	if(clientIP == NULL || (addr != NULL && IN6_IS_ADDR_V4MAPPED(addr)))
+	{
+		if(clientIP != NULL && strchr(clientIP, ':') != NULL && config.debug & DEBUG_CLIENTS)
+			logg("IPv4-mapped client %s is merged into its IPv4 client", clientIP);
+		// Generate textual representation of the binary address
+		char ipstr[INET6_ADDRSTRLEN] = { 0 };
+		if(IN6_IS_ADDR_V4MAPPED(addr))
+			inet_ntop(AF_INET, &addr->s6_addr[12], ipstr, sizeof(ipstr));
+		else
+			inet_ntop(AF_INET6, addr, ipstr, sizeof(ipstr));
+		client->ippos = addstr(ipstr);
+	}
+	else
+		client->ippos = addstr(clientIP);
+	// Store binary address (if available)
+	client->flags.addr_valid = addr != NULL;
+	if(addr != NULL)
+		memcpy(&client->addr, addr, sizeof(client->addr));
+	else
+		memset(&client->addr, 0, sizeof(client->addr));
 	// Initialize client hostname
 	// Due to the nature of us being the resolver,
 	// the actual resolving of the host name has
@@ -274,6 +412,9 @@ int findClientID(const char *clientIP, const bool count, const bool aliasclient)
 	// Store client ID
 	client->id = clientID;
 
+	// Add client to the lookup table
+	lookup_insert(CLIENTS_LOOKUP, clientID, clientHash);
+
 	// Increase counter by one
 	counters->clients++;
 
@@ -295,6 +436,32 @@ int findClientID(const char *clientIP, const bool count, const bool aliasclient)
 	return clientID;
 }
 
+int findClientID(const char *clientIP, const bool count, const bool aliasclient)
+{
+	// Regular clients are identified by their binary address, alias-clients
+	// (and anything else that is not a valid IP address) by their name
+	struct in6_addr addr;
+	struct in_addr addr4;
+	if(aliasclient)
+		return _findClientID(clientIP, NULL, count, aliasclient);
+	else if(inet_pton(AF_INET, clientIP, &addr4) == 1)
+	{
+		map_client_addr(AF_INET, &addr4, &addr);
+		return _findClientID(clientIP, &addr, count, aliasclient);
+	}
+	else if(inet_pton(AF_INET6, clientIP, &addr) == 1)
+		return _findClientID(clientIP, &addr, count, aliasclient);
+	else
+		return _findClientID(clientIP, NULL, count, aliasclient);
+}
+
+// Find client by its binary address, this avoids the conversion of the
+// address to text for known clients
+int findClientAddrID(const struct in6_addr *addr, const bool count)
+{
+	return _findClientID(NULL, addr, count, false);
+}
+
 void change_clientcount(clientsData *client, int total, int blocked, int overTimeIdx, int overTimeMod)
 {
 		client->count += total;
@@ -319,31 +486,34 @@ void change_clientcount(clientsData *client, int total, int blocked, int overTim
 		}
 }
 
-int _findCacheID(const int domainID, const int clientID, const enum query_types query_type, const bool create_new, const char *func, int line, const char *file)
+// Compare the DNS cache entry with the given ID against the tuple we are looking for
+static bool dns_cache_cmp(const unsigned int cacheID, const struct lookup_data *lookup_data)
 {
-	// Compare content of client against known client IP addresses
-	for(int cacheID = 0; cacheID < counters->dns_cache_size; cacheID++)
-	{
-		// Get cache pointer
-		DNSCacheData* dns_cache = _getDNSCache(cacheID, true, line, func, file);
+	const DNSCacheData *dns_cache = getDNSCache(cacheID, true);
+	if(dns_cache == NULL)
+		return false;
 
-		// Check if the returned pointer is valid before trying to access it
-		if(dns_cache == NULL)
-			continue;
+	return dns_cache->domainID == lookup_data->dns_cache.domainID &&
+	       dns_cache->clientID == lookup_data->dns_cache.clientID &&
+	       dns_cache->query_type == lookup_data->dns_cache.query_type;
+}
 
-		if(dns_cache->domainID == domainID &&
-		   dns_cache->clientID == clientID &&
-		   dns_cache->query_type == query_type)
-		{
-			return cacheID;
-		}
-	}
+int _findCacheID(const int domainID, const int clientID, const enum query_types query_type, const bool create_new, const char *func, int line, const char *file)
+{
+	// Get cache entry from the hash-based lookup table
+	const uint32_t cacheHash = hashInt(hashInt(hashInt(domainID) ^ clientID) ^ query_type);
+	const struct lookup_data lookup_data = {
+		.dns_cache = { .domainID = domainID, .clientID = clientID, .query_type = query_type }
+	};
+	unsigned int cacheID = 0u;
+	if(lookup_find_id(DNS_CACHE_LOOKUP, cacheHash, &lookup_data, &cacheID, dns_cache_cmp))
+		return cacheID;
 
 	if(!create_new)
 		return -1;
 
 	// Get ID of new cache entry
-	const int cacheID = counters->dns_cache_size;
+	cacheID = counters->dns_cache_size;
 
 	// Get client pointer
 	DNSCacheData* dns_cache = _getDNSCache(cacheID, false, line, func, file);
@@ -363,6 +533,9 @@ int _findCacheID(const int domainID, const int clientID, const enum query_types
 	dns_cache->force_reply = 0u;
 	dns_cache->domainlist_id = -1; // -1 = not set
 
+	// Add cache entry to the lookup table
+	lookup_insert(DNS_CACHE_LOOKUP, cacheID, cacheHash);
+
 	// Increase counter by one
 	counters->dns_cache_size++;
 
@@ -493,22 +666,203 @@ void FTL_reset_per_client_domain_data(void)
 	}
 }
 
+// ID of the last change recorded by "pihole-FTL gravity updateList" which has
+// been applied. Only used by the database thread
+static int last_gravity_change = 0;
+
+// Maximum number of changed ABP-style patterns handled individually
+#define MAX_ABP_CHANGES 100
+
+// Mark the domain (if known) and - for ABP-style patterns - all of its known
+// subdomains as affected by a gravity change
+static void mark_changed_domain(const char *domain, bool *affected)
+{
+	// Exact domain
+	if(strncmp(domain, "||", 2) != 0)
+	{
+		const struct lookup_data lookup_data = { .domain = domain };
+		unsigned int domainID = 0u;
+		if(lookup_find_id(DOMAINS_LOOKUP, hashStr(domain), &lookup_data, &domainID, domain_cmp) &&
+		   domainID < (unsigned int)counters->domains)
+			affected[domainID] = true;
+		return;
+	}
+
+	// ABP-style pattern ||domain^ matches the domain and all its
+	// subdomains, we have to check all known domains
+	const char *pattern = domain + 2;
+	const size_t len = strlen(pattern) - 1u;
+	for(int domainID = 0; domainID < counters->domains; domainID++)
+	{
+		const domainsData *dom = getDomain(domainID, true);
+		if(dom == NULL)
+			continue;
+		const char *name = getstr(dom->domainpos);
+		const size_t name_len = strlen(name);
+		if(name_len < len || strncmp(name + name_len - len, pattern, len) != 0)
+			continue;
+		if(name_len == len || name[name_len - len - 1] == '.')
+			affected[domainID] = true;
+	}
+}
+
+// Rebuild the gravity index (if enabled) outside of the lock after it could
+// not be updated in place. Lookups use the database in the meantime
+static void reload_gravity_index(void)
+{
+	struct gravity_index *index = gravity_index_load();
+	lock_shm();
+	gravity_index_swap(index);
+	unlock_shm();
+}
+
+// Apply changes of individual adlists recorded by "pihole-FTL gravity
+// updateList". In contrast to FTL_reload_all_domainlists(), only the changed
+// domains are updated in the in-memory gravity index and only their per-client
+// DNS cache entries are invalidated so the cache stays warm for everything else
+// May only be called from the database thread
+void FTL_reload_gravity_changes(void)
+{
+	// Mapped index files are read-only. Rebuild the index (if enabled)
+	// outside of the lock, see FTL_reload_all_domainlists()
+	const bool update_index = gravity_index_updatable();
+	struct gravity_index *index = update_index ? NULL : gravity_index_load();
+
+	lock_shm();
+
+	if(!update_index)
+		gravity_index_swap(index);
+
+	// Update number of blocked domains
+	counters->gravity = gravityDB_count(GRAVITY_TABLE);
+
+	// The update may have added the first (or removed the last) ABP-style
+	// entries
+	gravityDB_refresh_ABP_format();
+
+	bool *affected = calloc(counters->domains > 0 ? counters->domains : 1, sizeof(bool));
+	if(affected == NULL || !gravityDB_getChanges(last_gravity_change))
+	{
+		// Fall back to invalidating everything and rebuilding the index
+		free(affected);
+		last_gravity_change = gravityDB_lastChange();
+		FTL_reset_per_client_domain_data();
+		if(update_index)
+			gravity_index_swap(NULL);
+		unlock_shm();
+		if(update_index)
+			reload_gravity_index();
+		return;
+	}
+
+	// Collect changed domains and apply them to the in-memory index
+	const int since = last_gravity_change;
+	unsigned int changes = 0, abp_changes = 0;
+	bool missed = false, reset_all = false, index_updated = update_index;
+	const char *domain = NULL;
+	int changeID = 0;
+	while((domain = gravityDB_getDomain(&changeID)) != NULL)
+	{
+		// The recorded changes are consecutive, a gap at the beginning
+		// means changes we have not seen have already been removed
+		if(changes++ == 0 && since > 0 && changeID != since + 1)
+		{
+			logg("Missed some gravity changes, resetting per-client DNS cache");
+			missed = reset_all = true;
+		}
+		last_gravity_change = changeID;
+
+		if(index_updated && !gravity_index_update(domain, gravityDB_getChangeGroups()))
+			index_updated = false;
+
+		// Each ABP-style pattern needs a walk over all known domains,
+		// resetting everything is cheaper for many of them
+		if(strncmp(domain, "||", 2) == 0 && abp_changes++ == MAX_ABP_CHANGES)
+			reset_all = true;
+
+		if(!reset_all)
+			mark_changed_domain(domain, affected);
+	}
+	gravityDB_finalizeTable();
+
+	// Missed changes cannot be applied to the index either
+	if(index_updated && (missed || !gravity_index_finish_update()))
+		index_updated = false;
+
+	// Fall back to database lookups until the index has been rebuilt
+	const bool rebuild_index = update_index && !index_updated;
+	if(rebuild_index)
+		gravity_index_swap(NULL);
+
+	if(reset_all)
+		FTL_reset_per_client_domain_data();
+	else
+	{
+		// Invalidate the cache entries of affected domains
+		unsigned int invalidated = 0;
+		for(int cacheID = 0; cacheID < counters->dns_cache_size; cacheID++)
+		{
+			DNSCacheData *dns_cache = getDNSCache(cacheID, true);
+			if(dns_cache == NULL || dns_cache->domainID < 0 ||
+			   dns_cache->domainID >= counters->domains ||
+			   !affected[dns_cache->domainID])
+				continue;
+			dns_cache->blocking_status = UNKNOWN_BLOCKED;
+			invalidated++;
+		}
+
+		if(config.debug & DEBUG_DATABASE)
+			logg("Applied %u gravity changes%s, invalidated %u of %i per-client DNS cache entries",
+			     changes, index_updated ? " to the gravity index" : "",
+			     invalidated, counters->dns_cache_size);
+	}
+
+	free(affected);
+	unlock_shm();
+
+	if(rebuild_index)
+		reload_gravity_index();
+}
+
 // Reloads all domainlists and performs a few extra tasks such as cleaning the
 // message table
 // May only be called from the database thread
 void FTL_reload_all_domainlists(void)
 {
+	// Map or build the gravity index (if available) before locking the
+	// shared memory as this may take a while for large lists. Queries are
+	// answered from the previous index in the meantime
+	struct gravity_index *index = gravity_index_load();
+
+	// Likewise, open and prepare the new gravity database connection
+	// while the current one keeps serving queries
+	gravityDB_prepare_swap();
+
 	lock_shm();
 
-	// (Re-)open gravity database connection
-	gravityDB_reopen();
+	// Replace the gravity database connection (or keep the current one if
+	// the database could not be opened)
+	const bool swapped = gravityDB_swap();
+
+	// Replace the in-memory gravity index together with the database
+	// connection. If the connection could not be replaced, the new index
+	// may describe a different gravity database than the one we keep, so
+	// the previous index is kept as well
+	if(swapped)
+		gravity_index_swap(index);
+	else
+		gravity_index_free(index);
 
 	// Reset number of blocked domains
 	counters->gravity = gravityDB_count(GRAVITY_TABLE);
 
-	// Read and compile possible regex filters
-	// only after having called gravityDB_open()
-	read_regex_from_database();
+	// All changes recorded so far are covered by resetting the per-client
+	// DNS cache below
+	last_gravity_change = gravityDB_lastChange();
+
+	// Install the regex filters compiled by gravityDB_prepare_swap() (or
+	// read and compile them now if this was not possible)
+	regex_swap();
 
 	// Check for inaccessible adlist URLs
 	check_inaccessible_adlists();
@@ -625,7 +979,7 @@ void _query_set_status(queriesData *query, const enum query_status new_status, c
 		counters->status[query->status]--;
 		counters->status[new_status]++;
 
-		const int timeidx = getOverTimeID(query->timestamp);
+		const int timeidx = getOverTimeID(query_get_timestamp(query));
 		if(is_blocked(query->status))
 			overTime[timeidx].blocked--;
 		if(is_blocked(new_status))
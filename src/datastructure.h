@@ -21,6 +21,9 @@
 
 extern const char *querytypes[TYPE_MAX];
 
+// There may be millions of these objects in memory (one per query) so the
+// members are ordered (and sized) such that this struct does not contain any
+// padding on both 32 and 64 bit architectures. All enums are packed (one byte)
 typedef struct {
 	unsigned char magic;
 	enum query_status status;
@@ -34,9 +37,7 @@ typedef struct {
 	int upstreamID;
 	int id; // the ID is a (signed) int in dnsmasq, so no need for a long int here
 	int CNAME_domainID; // only valid if query has a CNAME blocking status
-	int ede;
-	unsigned long response; // saved in units of 1/10 milliseconds (1 = 0.1ms, 2 = 0.2ms, 2500 = 250.0ms, etc.)
-	time_t timestamp;
+	int16_t ede; // extended DNS error code (RFC 8914) or -1
 	// Adjacent bit field members in the struct flags may be packed to share
 	// and straddle the individual bytes. It is useful to pack the memory as
 	// tightly as possible as there may be dozens of thousands of these
@@ -50,6 +51,8 @@ typedef struct {
 		bool database :1;
 		bool response_calculated :1;
 	} flags;
+	uint32_t response; // saved in units of 1/10 milliseconds (1 = 0.1ms, 2 = 0.2ms, 2500 = 250.0ms, etc.)
+	int32_t reltime; // seconds since the shared memory epoch, use query_[gs]et_timestamp()
 } queriesData;
 
 typedef struct {
@@ -73,7 +76,9 @@ typedef struct {
 		bool found_group:1;
 		bool aliasclient:1;
 		bool rate_limited:1;
+		bool addr_valid:1;
 	} flags;
+	struct in6_addr addr; // IPv4 addresses are stored as IPv4-mapped IPv6 addresses
 	int count;
 	int blockedcount;
 	int aliasclient_id;
@@ -110,9 +115,13 @@ typedef struct {
 void strtolower(char *str);
 uint32_t hashStr(const char *s) __attribute__((pure));
 int findQueryID(const int id);
+void storeQueryID(const int id, const int queryID);
+void removeQueryID(const int id, const int queryID);
 int findUpstreamID(const char * upstream, const in_port_t port);
 int findDomainID(const char *domain, const bool count);
 int findClientID(const char *client, const bool count, const bool aliasclient);
+int findClientAddrID(const struct in6_addr *addr, const bool count);
+void map_client_addr(const sa_family_t family, const void *src, struct in6_addr *addr);
 #define findCacheID(domainID, clientID, query_type, create_new) _findCacheID(domainID, clientID, query_type, create_new, __FUNCTION__, __LINE__, __FILE__)
 int _findCacheID(const int domainID, const int clientID, const enum query_types query_type, const bool create_new, const char *func, const int line, const char *file);
 bool isValidIPv4(const char *addr);
@@ -123,6 +132,7 @@ bool is_blocked(const enum query_status status) __attribute__ ((const));
 void _query_set_status(queriesData *query, const enum query_status new_status, const char *func, const int line, const char *file);
 
 void FTL_reload_all_domainlists(void);
+void FTL_reload_gravity_changes(void);
 void FTL_reset_per_client_domain_data(void);
 
 const char *getDomainString(const queriesData* query);
@@ -60,13 +60,14 @@ static void _query_set_reply(const unsigned int flags, const enum reply_type rep
                              const struct timeval response, const char *file, const int line);
 #define FTL_check_blocking(queryID, domainID, clientID) _FTL_check_blocking(queryID, domainID, clientID, __FILE__, __LINE__)
 static bool _FTL_check_blocking(int queryID, int domainID, int clientID, const char* file, const int line);
-static unsigned long converttimeval(const struct timeval time) __attribute__((const));
+static uint32_t converttimeval(const struct timeval time) __attribute__((const));
 static enum query_status detect_blocked_IP(const unsigned short flags, const union all_addr *addr, const queriesData *query, const domainsData *domain);
 static void query_blocked(queriesData* query, domainsData* domain, clientsData* client, const enum query_status new_status);
 static void FTL_forwarded(const unsigned int flags, const char *name, const union all_addr *addr, unsigned short port, const int id, const char* file, const int line);
 static void FTL_reply(const unsigned int flags, const char *name, const union all_addr *addr, const char* arg, const int id, const char* file, const int line);
 static void FTL_upstream_error(const union all_addr *addr, const unsigned int flags, const int id, const char* file, const int line);
 static void FTL_dnssec(const char *result, const union all_addr *addr, const int id, const char* file, const int line);
+static void mysockaddr_extract_addr_port(union mysockaddr *server, struct in6_addr *addr, in_port_t *port);
 static void mysockaddr_extract_ip_port(union mysockaddr *server, char ip[ADDRSTRLEN+1], in_port_t *port);
 static void alladdr_extract_ip(union all_addr *addr, const sa_family_t family, char ip[ADDRSTRLEN+1]);
 static void check_pihole_PTR(char *domain);
@@ -95,6 +96,15 @@ static struct {
 // Fork-private copy of the server data the most recent reply came from
 static union mysockaddr last_server = {{ 0 }};
 
+// Names of the RR types known to dnsmasq. querystr() formats into a static
+// buffer, so we copy the names once before any of our threads is started
+struct qtype_name {
+	unsigned short type;
+	char *name;
+};
+static struct qtype_name *qtype_names = NULL;
+static unsigned int qtype_names_count = 0;
+
 unsigned char* pihole_privacylevel = &config.privacylevel;
 const char *flagnames[] = {"F_IMMORTAL ", "F_NAMEP ", "F_REVERSE ", "F_FORWARD ", "F_DHCP ", "F_NEG ", "F_HOSTS ", "F_IPV4 ", "F_IPV6 ", "F_BIGNAME ", "F_NXDOMAIN ", "F_CNAME ", "F_DNSKEY ", "F_CONFIG ", "F_DS ", "F_DNSSECOK ", "F_UPSTREAM ", "F_RRNAME ", "F_SERVER ", "F_QUERY ", "F_NOERR ", "F_AUTH ", "F_DNSSEC ", "F_KEYTAG ", "F_SECSTAT ", "F_NO_RR ", "F_IPSET ", "F_NOEXTRA ", "F_SERVFAIL", "F_RCODE", "F_SRV", "F_STALE" };
 
@@ -591,33 +601,40 @@ bool _FTL_new_query(const unsigned int flags, const char *name,
 	// subnet (ECS) data), however, we do not rewrite the IPs ::1 and
 	// 127.0.0.1 to avoid queries originating from localhost of the
 	// *distant* machine as queries coming from the *local* machine
+	// Clients are looked up by their binary address, the textual
+	// representation is only generated when we see a new client
 	const sa_family_t family = addr ? addr->sa.sa_family : AF_INET;
 	in_port_t clientPort = daemon->port;
 	bool internal_query = false;
-	char clientIP[ADDRSTRLEN+1] = { 0 };
+	struct in6_addr clientAddr = IN6ADDR_ANY_INIT;
 	ednsData *edns = getEDNS();
 	if(config.edns0_ecs && edns && edns->client_set)
 	{
 		// Use ECS provided client
-		strncpy(clientIP, edns->client, ADDRSTRLEN);
-		clientIP[ADDRSTRLEN] = '\0';
+		struct in_addr clientAddr4;
+		if(inet_pton(AF_INET, edns->client, &clientAddr4) == 1)
+			map_client_addr(AF_INET, &clientAddr4, &clientAddr);
+		else
+			inet_pton(AF_INET6, edns->client, &clientAddr);
 	}
 	else if(addr)
 	{
 		// Use original requestor
-		mysockaddr_extract_ip_port(addr, clientIP, &clientPort);
+		mysockaddr_extract_addr_port(addr, &clientAddr, &clientPort);
 	}
 	else
 	{
 		// No client address available, this is an automatically generated (e.g.
 		// DNSSEC) query
 		internal_query = true;
-		strcpy(clientIP, "::");
 	}
 
 	// Check if user wants to skip queries coming from localhost
 	if(config.ignore_localhost &&
-	   (strcmp(clientIP, "127.0.0.1") == 0 || strcmp(clientIP, "::1") == 0))
+	   (IN6_IS_ADDR_LOOPBACK(&clientAddr) ||
+	    (IN6_IS_ADDR_V4MAPPED(&clientAddr) &&
+	     clientAddr.s6_addr[12] == 127 && clientAddr.s6_addr[13] == 0 &&
+	     clientAddr.s6_addr[14] == 0 && clientAddr.s6_addr[15] == 1)))
 	{
 		free(domainString);
 		return false;
@@ -628,7 +645,7 @@ bool _FTL_new_query(const unsigned int flags, const char *name,
 	const int queryID = counters->queries;
 
 	// Find client IP
-	const int clientID = findClientID(clientIP, true, false);
+	const int clientID = findClientAddrID(&clientAddr, true);
 
 	// Get client pointer
 	clientsData* client = getClient(clientID, true);
@@ -642,6 +659,9 @@ bool _FTL_new_query(const unsigned int flags, const char *name,
 		return false;
 	}
 
+	// Textual representation of the client's IP address
+	const char *clientIP = getstr(client->ippos);
+
 	// Interface name is only available for regular queries, not for
 	// automatically generated DNSSEC queries
 	const char *interface = internal_query ? "-" : next_iface.name;
@@ -723,7 +743,7 @@ bool _FTL_new_query(const unsigned int flags, const char *name,
 
 	// Fill query object with available data
 	query->magic = MAGICBYTE;
-	query->timestamp = querytimestamp;
+	query_set_timestamp(query, querytimestamp);
 	query->type = querytype;
 	query->qtype = qtype;
 	query->id = id; // Has to be set before calling query_set_status()
@@ -762,6 +782,9 @@ bool _FTL_new_query(const unsigned int flags, const char *name,
 	// Increase DNS queries counter
 	counters->queries++;
 
+	// Make this query findable by its dnsmasq ID
+	storeQueryID(id, queryID);
+
 	// Update overTime data
 	overTime[timeidx].total++;
 
@@ -1704,7 +1727,7 @@ static void FTL_forwarded(const unsigned int flags, const char *name, const unio
 	if(upstream != NULL)
 	{
 		// Update overTime counts
-		const int timeidx = getOverTimeID(query->timestamp);
+		const int timeidx = getOverTimeID(query_get_timestamp(query));
 		upstream->overTime[timeidx]++;
 		// Update lastQuery timestamp
 		upstream->lastQuery = time(NULL);
@@ -1818,6 +1841,24 @@ static void alladdr_extract_ip(union all_addr *addr, const sa_family_t family, c
 	inet_ntop(family, addr, ip, ADDRSTRLEN);
 }
 
+static void mysockaddr_extract_addr_port(union mysockaddr *server, struct in6_addr *addr, in_port_t *port)
+{
+	// Extract binary IP address
+	map_client_addr(server->sa.sa_family,
+	                server->sa.sa_family == AF_INET ?
+	                  (void*)&server->in.sin_addr :
+	                  (void*)&server->in6.sin6_addr,
+	                addr);
+
+	// Extract port (only if requested)
+	if(port != NULL)
+	{
+		*port = ntohs(server->sa.sa_family == AF_INET ?
+		                server->in.sin_port :
+		                server->in6.sin6_port);
+	}
+}
+
 static void mysockaddr_extract_ip_port(union mysockaddr *server, char ip[ADDRSTRLEN+1], in_port_t *port)
 {
 	// Extract IP address
@@ -2329,7 +2370,7 @@ static void query_blocked(queriesData* query, domainsData* domain, clientsData*
 		upstreamsData* upstream = getUpstream(query->upstreamID, true);
 		if(upstream != NULL)
 		{
-			const int timeidx = getOverTimeID(query->timestamp);
+			const int timeidx = getOverTimeID(query_get_timestamp(query));
 			upstream->overTime[timeidx]--;
 		}
 	}
@@ -2742,6 +2783,46 @@ static void _query_set_reply(const unsigned int flags, const enum reply_type rep
 	set_response_time(query, response);
 }
 
+static void init_querytype_names(void)
+{
+	for(unsigned int type = 0; type <= UINT16_MAX; type++)
+	{
+		// querystr() returns "<NAME>" for known and "<type=1234>"
+		// for unknown types
+		const char *name = querystr(NULL, type);
+		const size_t len = strlen(name);
+		if(len < 3 || strncmp(name, "<type=", 6) == 0)
+			continue;
+
+		struct qtype_name *new = realloc(qtype_names, (qtype_names_count + 1)*sizeof(*qtype_names));
+		if(new == NULL)
+			return;
+		qtype_names = new;
+
+		qtype_names[qtype_names_count].type = type;
+		qtype_names[qtype_names_count].name = strndup(name + 1, len - 2);
+		if(qtype_names[qtype_names_count].name == NULL)
+			return;
+		qtype_names_count++;
+	}
+}
+
+static int cmp_qtype_name(const void *a, const void *b)
+{
+	const struct qtype_name *qa = a, *qb = b;
+	return (int)qa->type - (int)qb->type;
+}
+
+// Name of a RR type or NULL if unknown. Unlike querystr(), this does not use
+// a static buffer and can be called from concurrent API threads
+const char *querytype_name(const unsigned short type)
+{
+	const struct qtype_name key = { .type = type, .name = NULL };
+	const struct qtype_name *found = bsearch(&key, qtype_names, qtype_names_count,
+	                                         sizeof(*qtype_names), cmp_qtype_name);
+	return found != NULL ? found->name : NULL;
+}
+
 void FTL_fork_and_bind_sockets(struct passwd *ent_pw)
 {
 	// Going into daemon mode involves storing the
@@ -2758,6 +2839,9 @@ void FTL_fork_and_bind_sockets(struct passwd *ent_pw)
 	// so they will not listen to real-time signals
 	handle_realtime_signals();
 
+	// Copy dnsmasq's RR type names before the API threads are started
+	init_querytype_names();
+
 	// We will use the attributes object later to start all threads in
 	// detached mode
 	pthread_attr_t attr;
@@ -3037,11 +3121,13 @@ void FTL_forwarding_retried(const struct server *serv, const int oldID, const in
 	return;
 }
 
-static unsigned long __attribute__((const)) converttimeval(const struct timeval time)
+static uint32_t __attribute__((const)) converttimeval(const struct timeval time)
 {
 	// Convert time from struct timeval into units
-	// of 10*milliseconds
-	return time.tv_sec*10000 + time.tv_usec/100;
+	// of 10*milliseconds. The result wraps around every ~5 days, this is
+	// fine as we only ever use the difference of two such values (modulo
+	// 2^32) to compute response times
+	return (uint32_t)time.tv_sec*10000u + (uint32_t)time.tv_usec/100u;
 }
 
 unsigned int FTL_extract_question_flags(struct dns_header *header, const size_t qlen)
@@ -3402,20 +3488,32 @@ static void _query_set_dnssec(queriesData *query, const enum dnssec_status dnsse
 int check_struct_sizes(void)
 {
 	int result = 0;
-	result += check_one_struct("ConfigStruct", sizeof(ConfigStruct), 112, 104);
-	result += check_one_struct("queriesData", sizeof(queriesData), 56, 44);
+	result += check_one_struct("ConfigStruct", sizeof(ConfigStruct), 112, 108);
+	result += check_one_struct("queriesData", sizeof(queriesData), 40, 40);
 	result += check_one_struct("upstreamsData", sizeof(upstreamsData), 616, 604);
-	result += check_one_struct("clientsData", sizeof(clientsData), 672, 648);
+	result += check_one_struct("clientsData", sizeof(clientsData), 688, 664);
 	result += check_one_struct("domainsData", sizeof(domainsData), 24, 20);
 	result += check_one_struct("DNSCacheData", sizeof(DNSCacheData), 16, 16);
 	result += check_one_struct("ednsData", sizeof(ednsData), 76, 76);
 	result += check_one_struct("overTimeData", sizeof(overTimeData), 32, 24);
 	result += check_one_struct("regexData", sizeof(regexData), 64, 48);
 	result += check_one_struct("SharedMemory", sizeof(SharedMemory), 24, 12);
-	result += check_one_struct("ShmSettings", sizeof(ShmSettings), 16, 16);
-	result += check_one_struct("countersStruct", sizeof(countersStruct), 248, 248);
+	result += check_one_struct("ShmSettings", sizeof(ShmSettings), 24, 20);
+	result += check_one_struct("countersStruct", sizeof(countersStruct), 292, 292);
 	result += check_one_struct("sqlite3_stmt_vec", sizeof(sqlite3_stmt_vec), 32, 16);
 
+	// Shared memory used per query in memory: the query itself and its
+	// share of the query lookup table (which is at most half full).
+	// queriesData used to be 56 bytes (44 bytes on 32-bit platforms)
+	// before the timestamp and response time were narrowed
+	const size_t old_query_size = sizeof(void*) == 8 ? 56 : 44;
+	printf("Memory per query: %zu bytes (%zu bytes query + %zu bytes lookup table)\n",
+	       sizeof(queriesData) + 2*sizeof(struct lookup_table),
+	       sizeof(queriesData), 2*sizeof(struct lookup_table));
+	printf("Memory per query before: %zu bytes (%zu bytes query + %zu bytes lookup table)\n",
+	       old_query_size + 2*sizeof(struct lookup_table),
+	       old_query_size, 2*sizeof(struct lookup_table));
+
 	if(result == 0)
 		printf("All okay\n");
 
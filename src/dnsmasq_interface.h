@@ -47,6 +47,7 @@ void FTL_TCP_worker_created(const int confd);
 void FTL_TCP_worker_terminating(bool finished);
 
 bool FTL_unlink_DHCP_lease(const char *ipaddr);
+const char *querytype_name(const unsigned short type) __attribute__((pure));
 
 // defined in src/dnsmasq/cache.c
 extern char *querystr(char *desc, unsigned short type);
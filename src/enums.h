@@ -17,7 +17,12 @@ enum memory_type {
 	DOMAINS,
 	OVERTIME,
 	DNS_CACHE,
-	STRINGS
+	STRINGS,
+	DOMAINS_LOOKUP,
+	CLIENTS_LOOKUP,
+	QUERIES_LOOKUP,
+	DNS_CACHE_LOOKUP,
+	STRINGS_LOOKUP
 } __attribute__ ((packed));
 
 enum dnssec_status {
@@ -163,6 +168,7 @@ enum events {
 	REIMPORT_ALIASCLIENTS,
 	PARSE_NEIGHBOR_CACHE,
 	RELOAD_BLOCKINGSTATUS,
+	RELOAD_GRAVITY_CHANGES,
 	EVENTS_MAX
 } __attribute__ ((packed));
 
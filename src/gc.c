@@ -111,6 +111,131 @@ static void check_load(void)
 		log_resource_shortage(load[2], nprocs, -1, -1, NULL, NULL);
 }
 
+// Remove all queries older than mintime, but at most limit queries in one go
+// (zero means no limit). done is set to true if no query older than mintime
+// remains in memory afterwards. Has to be called with the SHM lock held
+static int remove_old_queries(const time_t mintime, const unsigned int limit, bool *done)
+{
+	// Process queries starting at the oldest one
+	int removed = 0;
+	*done = true;
+	for(long int i=0; i < counters->queries; i++)
+	{
+		// Stop if we reached the maximum size of this batch
+		if(limit > 0 && (unsigned int)removed >= limit)
+		{
+			*done = false;
+			break;
+		}
+
+		queriesData* query = getQuery(i, true);
+		if(query == NULL)
+			continue;
+
+		// Test if this query is too new
+		if(query_get_timestamp(query) > mintime)
+			break;
+
+		// Adjust client counter (total and overTime)
+		clientsData* client = getClient(query->clientID, true);
+		const int timeidx = getOverTimeID(query_get_timestamp(query));
+		overTime[timeidx].total--;
+		if(client != NULL)
+			change_clientcount(client, -1, 0, timeidx, -1);
+
+		// Adjust domain counter (no overTime information)
+		domainsData* domain = getDomain(query->domainID, true);
+		if(domain != NULL)
+			domain->count--;
+
+		// Get upstream pointer
+
+		// Change other counters according to status of this query
+		switch(query->status)
+		{
+			case QUERY_UNKNOWN:
+				// Unknown (?)
+				break;
+			case QUERY_FORWARDED: // (fall through)
+			case QUERY_RETRIED: // (fall through)
+			case QUERY_RETRIED_DNSSEC:
+				// Forwarded to an upstream DNS server
+				// Adjusting counters is done below in moveOverTimeMemory()
+				break;
+			case QUERY_CACHE:
+			case QUERY_CACHE_STALE:
+				// Answered from local cache _or_ local config
+				break;
+			case QUERY_GRAVITY: // Blocked by Pi-hole's blocking lists (fall through)
+			case QUERY_BLACKLIST: // Exact blocked (fall through)
+			case QUERY_REGEX: // Regex blocked (fall through)
+			case QUERY_EXTERNAL_BLOCKED_IP: // Blocked by upstream provider (fall through)
+			case QUERY_EXTERNAL_BLOCKED_NXRA: // Blocked by upstream provider (fall through)
+			case QUERY_EXTERNAL_BLOCKED_NULL: // Blocked by upstream provider (fall through)
+			case QUERY_GRAVITY_CNAME: // Gravity domain in CNAME chain (fall through)
+			case QUERY_REGEX_CNAME: // Regex blacklisted domain in CNAME chain (fall through)
+			case QUERY_BLACKLIST_CNAME: // Exactly blacklisted domain in CNAME chain (fall through)
+			case QUERY_DBBUSY: // Blocked because gravity database was busy
+			case QUERY_SPECIAL_DOMAIN: // Blocked by special domain handling
+				if(domain != NULL)
+					domain->blockedcount--;
+				if(client != NULL)
+					change_clientcount(client, 0, -1, -1, 0);
+				break;
+			case QUERY_IN_PROGRESS: // Don't have to do anything here
+			case QUERY_STATUS_MAX: // fall through
+			default:
+				/* That cannot happen */
+				break;
+		}
+
+		// Update reply counters
+		counters->reply[query->reply]--;
+
+		// Update type counters
+		if(query->type >= TYPE_A && query->type < TYPE_MAX)
+		{
+			counters->querytype[query->type-1]--;
+		}
+
+		// Remove query from the dnsmasq ID lookup table
+		removeQueryID(query->id, i);
+
+		// Set query again to UNKNOWN to reset the counters
+		query_set_status(query, QUERY_UNKNOWN);
+
+		// Finally, remove the last trace of this query
+		counters->status[QUERY_UNKNOWN]--;
+
+		// Zero out the memory so it can be reused for new queries
+		memset(query, 0, sizeof(queriesData));
+
+		// Count removed queries
+		removed++;
+	}
+
+	// Only update the ring buffer when we actually removed queries
+	if(removed > 0)
+	{
+		// Advance head of the queries ring buffer. There is no
+		// need to move any memory around, the remaining queries
+		// are shifted only logically
+		// Example: (I = now invalid, X = still valid queries, F = free space)
+		//   Before: IIIIIIXXXXFF (head at the first I)
+		//   After:  FFFFFFXXXXFF (head at the first X)
+		shm_remove_oldest_queries(removed);
+
+		// Update queries counter
+		counters->queries -= removed;
+		// Keep absolute query indices in the lookup table valid
+		counters->queries_removed += removed;
+		// Update DB index as total number of queries reduced
+		lastdbindex -= removed;
+	}
+
+	return removed;
+}
+
 void *GC_thread(void *val)
 {
 	// Set thread name
@@ -122,6 +247,13 @@ void *GC_thread(void *val)
 	lastRateLimitCleaner = time(NULL);
 	time_t lastResourceCheck = 0;
 
+	// State of the current GC run
+	time_t mintime = 0;
+	bool GCpending = false;
+	bool GCbacklog = false;
+	int GCremoved = 0;
+	unsigned int GCbatches = 0;
+
 	// Remember disk usage
 	int LastLogStorageUsage = 0;
 	int LastDBStorageUsage = 0;
@@ -157,12 +289,8 @@ void *GC_thread(void *val)
 			// Update lastGCrun timer
 			lastGCrun = now - GCdelay - (now - GCdelay)%GCinterval;
 
-			// Lock FTL's data structure, since it is likely that it will be changed here
-			// Requests should not be processed/answered when data is about to change
-			lock_shm();
-
 			// Get minimum timestamp to keep (this can be set with MAXLOGAGE)
-			time_t mintime = (now - GCdelay) - config.maxlogage;
+			mintime = (now - GCdelay) - config.maxlogage;
 
 			// Align the start time of this GC run to the GCinterval. This will also align with the
 			// oldest overTime interval after GC is done.
@@ -176,128 +304,76 @@ void *GC_thread(void *val)
 				logg("GC starting, mintime: %s (%llu)", timestring, (long long)mintime);
 			}
 
-			// Process all queries
-			int removed = 0;
-			for(long int i=0; i < counters->queries; i++)
+			// Start a new GC run. In incremental mode (GC_BATCH > 0),
+			// this run may take several iterations of this loop. If the
+			// previous run has not finished by now, queries arrive
+			// faster than GC_BATCH removes them. We continue the
+			// pending run with the new mintime but remember the backlog
+			// as the oldest queries are now more than one GC interval
+			// past MAXLOGAGE and overTime memory has not been moved
+			if(GCpending)
 			{
-				queriesData* query = getQuery(i, true);
-				if(query == NULL)
-					continue;
-
-				// Test if this query is too new
-				if(query->timestamp > mintime)
-					break;
-
-				// Adjust client counter (total and overTime)
-				clientsData* client = getClient(query->clientID, true);
-				const int timeidx = getOverTimeID(query->timestamp);
-				overTime[timeidx].total--;
-				if(client != NULL)
-					change_clientcount(client, -1, 0, timeidx, -1);
-
-				// Adjust domain counter (no overTime information)
-				domainsData* domain = getDomain(query->domainID, true);
-				if(domain != NULL)
-					domain->count--;
+				GCbacklog = true;
+				if(config.debug & DEBUG_GC)
+					logg("GC backlog: %i queries removed in %u batches were not enough",
+					     GCremoved, GCbatches);
+			}
+			else
+			{
+				GCremoved = 0;
+				GCbatches = 0;
+			}
+			GCpending = true;
+		}
 
-				// Get upstream pointer
+		if(GCpending)
+		{
+			// Lock FTL's data structure, since it is likely that it will be changed here
+			// Requests should not be processed/answered when data is about to change
+			lock_shm();
 
-				// Change other counters according to status of this query
-				switch(query->status)
-				{
-					case QUERY_UNKNOWN:
-						// Unknown (?)
-						break;
-					case QUERY_FORWARDED: // (fall through)
-					case QUERY_RETRIED: // (fall through)
-					case QUERY_RETRIED_DNSSEC:
-						// Forwarded to an upstream DNS server
-						// Adjusting counters is done below in moveOverTimeMemory()
-						break;
-					case QUERY_CACHE:
-					case QUERY_CACHE_STALE:
-						// Answered from local cache _or_ local config
-						break;
-					case QUERY_GRAVITY: // Blocked by Pi-hole's blocking lists (fall through)
-					case QUERY_BLACKLIST: // Exact blocked (fall through)
-					case QUERY_REGEX: // Regex blocked (fall through)
-					case QUERY_EXTERNAL_BLOCKED_IP: // Blocked by upstream provider (fall through)
-					case QUERY_EXTERNAL_BLOCKED_NXRA: // Blocked by upstream provider (fall through)
-					case QUERY_EXTERNAL_BLOCKED_NULL: // Blocked by upstream provider (fall through)
-					case QUERY_GRAVITY_CNAME: // Gravity domain in CNAME chain (fall through)
-					case QUERY_REGEX_CNAME: // Regex blacklisted domain in CNAME chain (fall through)
-					case QUERY_BLACKLIST_CNAME: // Exactly blacklisted domain in CNAME chain (fall through)
-					case QUERY_DBBUSY: // Blocked because gravity database was busy
-					case QUERY_SPECIAL_DOMAIN: // Blocked by special domain handling
-						if(domain != NULL)
-							domain->blockedcount--;
-						if(client != NULL)
-							change_clientcount(client, 0, -1, -1, 0);
-						break;
-					case QUERY_IN_PROGRESS: // Don't have to do anything here
-					case QUERY_STATUS_MAX: // fall through
-					default:
-						/* That cannot happen */
-						break;
-				}
+			// Remove (at most GC_BATCH) queries older than mintime. When
+			// there is a backlog, remove all of them at once as the
+			// batches cannot keep up with the rate of incoming queries
+			bool done = false;
+			GCremoved += remove_old_queries(mintime, GCbacklog ? 0 : config.gc_batch, &done);
+			GCbatches++;
+
+			// Determine if overTime memory needs to get moved. We must
+			// not do this before all queries of the outdated slots are
+			// gone as they would otherwise be subtracted from the wrong
+			// overTime slot when they are removed in one of the next
+			// batches
+			if(done)
+			{
+				moveOverTimeMemory(mintime);
 
-				// Update reply counters
-				counters->reply[query->reply]--;
+				// Reclaim memory of strings which are no longer
+				// referenced (e.g., outdated host names)
+				shm_compact_strings();
 
-				// Update type counters
-				if(query->type >= TYPE_A && query->type < TYPE_MAX)
+				if(config.debug & DEBUG_GC)
 				{
-					counters->querytype[query->type-1]--;
+					logg("Notice: GC removed %i queries in %u batch%s (took %.2f ms)",
+					     GCremoved, GCbatches, GCbatches == 1 ? "" : "es", timer_elapsed_msec(GC_TIMER));
+					log_shmem_details();
 				}
-
-				// Set query again to UNKNOWN to reset the counters
-				query_set_status(query, QUERY_UNKNOWN);
-
-				// Finally, remove the last trace of this query
-				counters->status[QUERY_UNKNOWN]--;
-
-				// Count removed queries
-				removed++;
 			}
 
-			// Only perform memory operations when we actually removed queries
-			if(removed > 0)
-			{
-				// Move memory forward to keep only what we want
-				// Note: for overlapping memory blocks, memmove() is a safer approach than memcpy()
-				// Example: (I = now invalid, X = still valid queries, F = free space)
-				//   Before: IIIIIIXXXXFF
-				//   After:  XXXXFFFFFFFF
-				queriesData *dest = getQuery(0, true);
-				queriesData *src = getQuery(removed, true);
-				if(dest && src)
-					memmove(dest, src, (counters->queries - removed)*sizeof(queriesData));
-
-				// Update queries counter
-				counters->queries -= removed;
-				// Update DB index as total number of queries reduced
-				lastdbindex -= removed;
-
-				// ensure remaining memory is zeroed out (marked as "F" in the above example)
-				queriesData *tail = getQuery(counters->queries, true);
-				if(tail)
-					memset(tail, 0, (counters->queries_MAX - counters->queries)*sizeof(queriesData));
-			}
-
-			// Determine if overTime memory needs to get moved
-			moveOverTimeMemory(mintime);
-
-			if(config.debug & DEBUG_GC)
-				logg("Notice: GC removed %i queries (took %.2f ms)", removed, timer_elapsed_msec(GC_TIMER));
-
 			// Release thread lock
 			unlock_shm();
 
-			// After storing data in the database for the next time,
-			// we should scan for old entries, which will then be deleted
-			// to free up pages in the database and prevent it from growing
-			// ever larger and larger
-			DBdeleteoldqueries = true;
+			if(done)
+			{
+				GCpending = false;
+				GCbacklog = false;
+
+				// After storing data in the database for the next time,
+				// we should scan for old entries, which will then be deleted
+				// to free up pages in the database and prevent it from growing
+				// ever larger and larger
+				DBdeleteoldqueries = true;
+			}
 		}
 		thread_sleepms(GC, 1000);
 	}
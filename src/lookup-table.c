@@ -0,0 +1,182 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2023 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Lookup table routines
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#include "FTL.h"
+#include "lookup-table.h"
+// get_lookup_table()
+#include "shmem.h"
+// logg()
+#include "log.h"
+
+// Slot marker for unused entries, see comment in lookup-table.h
+#define LOOKUP_EMPTY 0u
+
+// All tables have a power-of-two size so we can use a bitmask instead of a
+// (much slower) modulo operation when wrapping around the end of the table
+#define LOOKUP_MASK(size) ((size) - 1u)
+
+static bool table_insert(struct lookup_table *table, const unsigned int size,
+                         const unsigned int id, const uint32_t hash)
+{
+	// Linear probing: Start at the slot determined by the hash and walk
+	// forward until we find a free slot. As the tables are never more
+	// than half full (see shm_ensure_size()), this is typically found
+	// after very few steps
+	unsigned int slot = hash & LOOKUP_MASK(size);
+	for(unsigned int i = 0; i < size; i++)
+	{
+		struct lookup_table *entry = &table[slot];
+		if(entry->id == LOOKUP_EMPTY)
+		{
+			entry->hash = hash;
+			entry->id = id + 1u;
+			return true;
+		}
+		slot = (slot + 1u) & LOOKUP_MASK(size);
+	}
+
+	// This should never happen as the table is enlarged well before it
+	// can get full
+	logg("ERROR: Lookup table is full (size %u), cannot add ID %u", size, id);
+	return false;
+}
+
+// Add a new ID with pre-computed hash to the lookup table of the given type
+bool lookup_insert(const enum memory_type type, const unsigned int id, const uint32_t hash)
+{
+	unsigned int size = 0u, *used = NULL;
+	struct lookup_table *table = get_lookup_table(type, &size, &used);
+	if(table == NULL || size == 0u)
+		return false;
+
+	if(!table_insert(table, size, id, hash))
+		return false;
+
+	(*used)++;
+	return true;
+}
+
+// Remove an ID with pre-computed hash from the lookup table of the given type
+bool lookup_remove(const enum memory_type type, const unsigned int id, const uint32_t hash)
+{
+	unsigned int size = 0u, *used = NULL;
+	struct lookup_table *table = get_lookup_table(type, &size, &used);
+	if(table == NULL || size == 0u)
+		return false;
+
+	// Find the slot holding this ID
+	unsigned int slot = hash & LOOKUP_MASK(size);
+	unsigned int i = 0;
+	for(; i < size; i++)
+	{
+		const struct lookup_table *entry = &table[slot];
+		if(entry->id == LOOKUP_EMPTY)
+			return false;
+		if(entry->hash == hash && entry->id == id + 1u)
+			break;
+		slot = (slot + 1u) & LOOKUP_MASK(size);
+	}
+	if(i == size)
+		return false;
+
+	// Backward-shift deletion: We cannot simply empty the slot as this
+	// would interrupt the probe sequence of entries stored behind it.
+	// Instead, we move subsequent entries into the hole unless their home
+	// slot lies (cyclically) between the hole and their current position
+	unsigned int next = (slot + 1u) & LOOKUP_MASK(size);
+	while(table[next].id != LOOKUP_EMPTY)
+	{
+		const unsigned int home = table[next].hash & LOOKUP_MASK(size);
+		const bool stays = slot <= next ?
+		                   (slot < home && home <= next) :
+		                   (slot < home || home <= next);
+		if(!stays)
+		{
+			table[slot] = table[next];
+			slot = next;
+		}
+		next = (next + 1u) & LOOKUP_MASK(size);
+	}
+	table[slot].hash = 0u;
+	table[slot].id = LOOKUP_EMPTY;
+	(*used)--;
+
+	return true;
+}
+
+// Find the ID of an object with the given hash. As different objects may share
+// the same hash, the callback cmp() is used to compare the candidate object
+// against lookup_data. Returns true (and sets matchingID) if a match was found
+bool lookup_find_id(const enum memory_type type, const uint32_t hash, const struct lookup_data *lookup_data,
+                    unsigned int *matchingID, bool (*cmp)(const unsigned int id, const struct lookup_data *lookup_data))
+{
+	unsigned int size = 0u;
+	const struct lookup_table *table = get_lookup_table(type, &size, NULL);
+	if(table == NULL || size == 0u)
+		return false;
+
+	unsigned int slot = hash & LOOKUP_MASK(size);
+	for(unsigned int i = 0; i < size; i++)
+	{
+		const struct lookup_table *entry = &table[slot];
+
+		// An empty slot terminates the probe sequence, the object we are
+		// looking for is not known
+		if(entry->id == LOOKUP_EMPTY)
+			return false;
+
+		// Quick test on the hash before calling the more expensive
+		// comparison function
+		if(entry->hash == hash && cmp(entry->id - 1u, lookup_data))
+		{
+			*matchingID = entry->id - 1u;
+			return true;
+		}
+
+		slot = (slot + 1u) & LOOKUP_MASK(size);
+	}
+
+	return false;
+}
+
+// Get the number of used slots of the lookup table of the given type. This is
+// maintained by lookup_insert() and lookup_remove() so we do not have to scan
+// the table
+unsigned int lookup_count(const enum memory_type type)
+{
+	unsigned int size = 0u, *used = NULL;
+	if(get_lookup_table(type, &size, &used) == NULL)
+		return 0u;
+
+	return *used;
+}
+
+// Redistribute all entries after the table has been enlarged from old_size to
+// new_size. The table memory has to be large enough to hold new_size entries
+void lookup_rehash(struct lookup_table *table, const unsigned int old_size, const unsigned int new_size)
+{
+	// Copy old entries to a temporary buffer as slot positions change with
+	// the table size
+	struct lookup_table *old = calloc(old_size, sizeof(struct lookup_table));
+	if(old == NULL)
+	{
+		logg("FATAL: Memory allocation failed in lookup_rehash(%u, %u)", old_size, new_size);
+		exit(EXIT_FAILURE);
+	}
+	memcpy(old, table, old_size*sizeof(struct lookup_table));
+
+	// Empty the table and re-insert all entries
+	memset(table, 0, new_size*sizeof(struct lookup_table));
+	for(unsigned int i = 0; i < old_size; i++)
+		if(old[i].id != LOOKUP_EMPTY)
+			table_insert(table, new_size, old[i].id - 1u, old[i].hash);
+
+	free(old);
+}
@@ -0,0 +1,53 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2023 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Lookup table prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef LOOKUP_TABLE_H
+#define LOOKUP_TABLE_H
+
+// type uint32_t
+#include <stdint.h>
+// type bool
+#include <stdbool.h>
+// struct in6_addr
+#include <netinet/in.h>
+// enum memory_type
+#include "enums.h"
+
+// A single slot of an open-addressing hash index living in shared memory. IDs
+// are stored with an offset of one so that zero-initialized memory (as we get
+// it from ftlallocate()) is a table full of empty slots
+struct lookup_table {
+	uint32_t hash;
+	unsigned int id;
+};
+
+// Data passed through to the comparison callback of lookup_find_id()
+struct lookup_data {
+	union {
+		const char *domain;
+		const char *string;
+		const char *client_name;
+		const struct in6_addr *client_addr;
+		int dnsmasq_id;
+		struct {
+			int domainID;
+			int clientID;
+			enum query_types query_type;
+		} dns_cache;
+	};
+};
+
+bool lookup_insert(const enum memory_type type, const unsigned int id, const uint32_t hash);
+bool lookup_remove(const enum memory_type type, const unsigned int id, const uint32_t hash);
+bool lookup_find_id(const enum memory_type type, const uint32_t hash, const struct lookup_data *lookup_data,
+                    unsigned int *matchingID, bool (*cmp)(const unsigned int id, const struct lookup_data *lookup_data));
+unsigned int lookup_count(const enum memory_type type);
+void lookup_rehash(struct lookup_table *table, const unsigned int old_size, const unsigned int new_size);
+
+#endif //LOOKUP_TABLE_H
@@ -100,6 +100,7 @@ int main (int argc, char* argv[])
 		DB_read_queries();
 
 	log_counter_info();
+	log_shmem_details();
 	check_setupVarsconf();
 
 	// Check for availability of capabilities in debug mode
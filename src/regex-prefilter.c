@@ -0,0 +1,261 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2023 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Regex literal prefilter
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#include "FTL.h"
+#include "regex-prefilter.h"
+// regex_required_literal()
+#include "regex-set.h"
+// logg()
+#include "log.h"
+// struct config
+#include "config.h"
+
+// Most regex filters contain a string every matching domain has to contain
+// (such as "ads" in "(^|\.)ads\."). These strings are collected in an
+// Aho-Corasick automaton so a single pass over the domain tells us which of
+// them are present. A regex filter whose string is not present cannot match
+// and there is no need to run TRE for it.
+//
+// Filters without such a string (or with a very short one) are not added to
+// the prefilter and always have to be checked using TRE.
+
+// Required literals shorter than this are not worth filtering for
+#define MIN_PREFILTER_LITERAL 2u
+// Only the first characters of a literal are used, every part of a required
+// string is required as well
+#define MAX_PREFILTER_LITERAL 16u
+// Maximum number of automaton states
+#define MAX_PREFILTER_STATES 65536u
+
+struct prefilter_literal {
+	char str[MAX_PREFILTER_LITERAL];
+	unsigned char len;
+	unsigned int index;
+};
+
+struct prefilter_output {
+	unsigned int index;
+	int next;
+};
+
+struct regex_prefilter {
+	// Collected literals
+	struct prefilter_literal *literals;
+	unsigned int num_literals;
+	unsigned int words;
+
+	// Set on first use
+	bool compiled;
+	bool failed;
+
+	// Automaton
+	unsigned char byte_class[256];
+	unsigned int num_classes;
+	unsigned int num_states;
+	int *transitions;
+	// First output of each state and next state with outputs on the
+	// failure chain
+	int *output;
+	int *dict;
+	struct prefilter_output *outputs;
+};
+
+struct regex_prefilter *regex_prefilter_new(void)
+{
+	return calloc(1, sizeof(struct regex_prefilter));
+}
+
+// Add the literal required by a regular expression to the prefilter. Returns
+// false if there is no suitable literal, the regular expression has to be
+// matched using TRE unconditionally in this case
+bool regex_prefilter_add(struct regex_prefilter *filter, const char *pattern, const unsigned int index)
+{
+	if(filter->compiled)
+		return false;
+
+	char literal[MAX_LITERAL];
+	unsigned int len = regex_required_literal(pattern, literal);
+	if(len < MIN_PREFILTER_LITERAL)
+		return false;
+	if(len > MAX_PREFILTER_LITERAL)
+		len = MAX_PREFILTER_LITERAL;
+
+	struct prefilter_literal *literals = realloc(filter->literals, (filter->num_literals + 1)*sizeof(*literals));
+	if(literals == NULL)
+		return false;
+	filter->literals = literals;
+
+	struct prefilter_literal *lit = &filter->literals[filter->num_literals++];
+	memcpy(lit->str, literal, len);
+	lit->len = (unsigned char)len;
+	lit->index = index;
+	if(index / 64u + 1u > filter->words)
+		filter->words = index / 64u + 1u;
+
+	if(config.debug & DEBUG_REGEX)
+		logg("Regex \"%s\" requires \"%.*s\"", pattern, (int)len, literal);
+
+	return true;
+}
+
+unsigned int __attribute__((pure)) regex_prefilter_words(const struct regex_prefilter *filter)
+{
+	return filter != NULL ? filter->words : 0u;
+}
+
+// Build the Aho-Corasick automaton from the collected literals
+static bool compile_prefilter(struct regex_prefilter *filter)
+{
+	filter->compiled = true;
+	filter->failed = true;
+
+	// Bytes not part of any literal share class 0, upper-case letters share
+	// the class of their lower-case counterparts (literals are lower-case)
+	unsigned int states = 1u;
+	filter->num_classes = 1u;
+	for(unsigned int i = 0; i < filter->num_literals; i++)
+	{
+		const struct prefilter_literal *lit = &filter->literals[i];
+		for(unsigned int j = 0; j < lit->len; j++)
+		{
+			const unsigned char c = (unsigned char)lit->str[j];
+			if(filter->byte_class[c] != 0)
+				continue;
+			filter->byte_class[c] = (unsigned char)filter->num_classes;
+			if(c >= 'a' && c <= 'z')
+				filter->byte_class[c - 'a' + 'A'] = (unsigned char)filter->num_classes;
+			filter->num_classes++;
+		}
+		states += lit->len;
+	}
+	if(states > MAX_PREFILTER_STATES)
+	{
+		logg("WARN: Regex prefilter needs too many states (%u), not using it", states);
+		return false;
+	}
+
+	const unsigned int classes = filter->num_classes;
+	filter->transitions = malloc(states*classes*sizeof(int));
+	filter->output = malloc(states*sizeof(int));
+	filter->dict = calloc(states, sizeof(int));
+	filter->outputs = calloc(filter->num_literals, sizeof(struct prefilter_output));
+	int *fail = calloc(states, sizeof(int));
+	int *queue = calloc(states, sizeof(int));
+	if(filter->transitions == NULL || filter->output == NULL || filter->dict == NULL ||
+	   filter->outputs == NULL || fail == NULL || queue == NULL)
+	{
+		free(fail);
+		free(queue);
+		return false;
+	}
+	for(unsigned int i = 0; i < states*classes; i++)
+		filter->transitions[i] = -1;
+	for(unsigned int i = 0; i < states; i++)
+		filter->output[i] = -1;
+
+	// Build trie of the literals
+	filter->num_states = 1u;
+	for(unsigned int i = 0; i < filter->num_literals; i++)
+	{
+		const struct prefilter_literal *lit = &filter->literals[i];
+		int state = 0;
+		for(unsigned int j = 0; j < lit->len; j++)
+		{
+			int *next = &filter->transitions[state*classes + filter->byte_class[(unsigned char)lit->str[j]]];
+			if(*next < 0)
+				*next = (int)filter->num_states++;
+			state = *next;
+		}
+		filter->outputs[i].index = lit->index;
+		filter->outputs[i].next = filter->output[state];
+		filter->output[state] = (int)i;
+	}
+
+	// Compute failure links breadth-first and turn the trie into a DFA
+	unsigned int head = 0, tail = 0;
+	for(unsigned int cls = 0; cls < classes; cls++)
+	{
+		int *next = &filter->transitions[cls];
+		if(*next < 0)
+			*next = 0;
+		else
+		{
+			fail[*next] = 0;
+			filter->dict[*next] = -1;
+			queue[tail++] = *next;
+		}
+	}
+	filter->dict[0] = -1;
+	while(head < tail)
+	{
+		const int state = queue[head++];
+		for(unsigned int cls = 0; cls < classes; cls++)
+		{
+			int *next = &filter->transitions[state*classes + cls];
+			const int fallback = filter->transitions[fail[state]*classes + cls];
+			if(*next < 0)
+			{
+				*next = fallback;
+				continue;
+			}
+			fail[*next] = fallback;
+			filter->dict[*next] = filter->output[fallback] >= 0 ? fallback : filter->dict[fallback];
+			queue[tail++] = *next;
+		}
+	}
+	free(fail);
+	free(queue);
+
+	if(config.debug & DEBUG_REGEX)
+		logg("Built regex prefilter from %u literals (%u states, %u byte classes)",
+		     filter->num_literals, filter->num_states, filter->num_classes);
+
+	filter->failed = false;
+	return true;
+}
+
+// Find the regular expressions whose required literal is contained in input.
+// Their bits are set in candidates (which has to hold regex_prefilter_words()
+// words). Returns false if the prefilter cannot be used
+bool regex_prefilter_match(struct regex_prefilter *filter, const char *input, uint64_t *candidates)
+{
+	if(filter == NULL || filter->num_literals == 0u)
+		return false;
+	if(!filter->compiled)
+		compile_prefilter(filter);
+	if(filter->failed)
+		return false;
+
+	memset(candidates, 0, filter->words*sizeof(*candidates));
+	const unsigned int classes = filter->num_classes;
+	int state = 0;
+	for(const unsigned char *c = (const unsigned char*)input; *c != '\0'; c++)
+	{
+		state = filter->transitions[state*classes + filter->byte_class[*c]];
+		for(int s = filter->output[state] >= 0 ? state : filter->dict[state]; s >= 0; s = filter->dict[s])
+			for(int o = filter->output[s]; o >= 0; o = filter->outputs[o].next)
+				candidates[filter->outputs[o].index / 64u] |= 1ull << (filter->outputs[o].index % 64u);
+	}
+
+	return true;
+}
+
+void regex_prefilter_free(struct regex_prefilter *filter)
+{
+	if(filter == NULL)
+		return;
+
+	free(filter->literals);
+	free(filter->transitions);
+	free(filter->output);
+	free(filter->dict);
+	free(filter->outputs);
+	free(filter);
+}
@@ -0,0 +1,26 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2023 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Regex literal prefilter prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef REGEX_PREFILTER_H
+#define REGEX_PREFILTER_H
+
+// type bool
+#include <stdbool.h>
+// type uint64_t
+#include <stdint.h>
+
+struct regex_prefilter;
+
+struct regex_prefilter *regex_prefilter_new(void) __attribute__((malloc));
+void regex_prefilter_free(struct regex_prefilter *filter);
+bool regex_prefilter_add(struct regex_prefilter *filter, const char *pattern, const unsigned int index);
+unsigned int regex_prefilter_words(const struct regex_prefilter *filter) __attribute__((pure));
+bool regex_prefilter_match(struct regex_prefilter *filter, const char *input, uint64_t *candidates);
+
+#endif //REGEX_PREFILTER_H
@@ -0,0 +1,1357 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2023 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Combined regex automaton
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#include "FTL.h"
+#include "regex-set.h"
+// logg()
+#include "log.h"
+// struct config
+#include "config.h"
+
+// Matching a domain against hundreds of regular expressions one after another
+// is expensive. Instead, all regular expressions of one type are compiled into
+// a single NFA which is turned into a DFA lazily while matching: each DFA state
+// is a set of NFA states and knows which of the regular expressions matched
+// once it is reached. A single pass over the domain hence tells us which of
+// the regular expressions match it, regardless of how many there are.
+//
+// Only the subset of the POSIX extended syntax used by the overwhelming
+// majority of filters is supported here (literals, bracket expressions, '.',
+// anchors, groups, alternation, and repetitions). The parser follows the one
+// of TRE closely so the result is the same as the one of tre_regexec() called
+// with REG_EXTENDED | REG_ICASE. Everything else (back references, word
+// boundaries, approximate matching, ...) is rejected and the caller has to use
+// TRE for such expressions.
+
+// NFA states a single regular expression may add to the automaton
+#define MAX_PATTERN_STATES 4096u
+// Maximum number of DFA states before the cache is flushed
+#define MAX_DFA_STATES 1024u
+// Maximum nesting depth of groups
+#define MAX_DEPTH 32u
+// Maximum number of items in a bracket expression
+#define MAX_BRACKET_ITEMS 512u
+// Maximum repetition count, same as RE_DUP_MAX of TRE
+#define MAX_REPEAT 255
+
+// Byte sets are stored as bitmaps
+typedef uint64_t charset[4];
+#define SET_BIT(set, c) ((set)[(c) / 64] |= 1ull << ((c) % 64))
+#define HAS_BIT(set, c) (((set)[(c) / 64] >> ((c) % 64)) & 1ull)
+
+enum ast_type { AST_CHARS, AST_EMPTY, AST_BOL, AST_EOL, AST_CAT, AST_ALT, AST_REPEAT };
+
+struct ast_node {
+	enum ast_type type;
+	int left;
+	int right;
+	int min;
+	int max;
+	// Node contains a start or end anchor
+	bool anchor;
+	// Node contains a bounded repetition, or a repetition of one
+	bool bound;
+	bool nested_bound;
+	charset chars;
+};
+
+struct parser {
+	const unsigned char *re;
+	unsigned int depth;
+	bool error;
+	struct ast_node *nodes;
+	unsigned int num_nodes;
+	unsigned int alloc_nodes;
+};
+
+enum nfa_type { NFA_CHAR, NFA_SPLIT, NFA_BOL, NFA_EOL, NFA_MATCH };
+
+struct nfa_state {
+	enum nfa_type type;
+	int out;
+	// Second target of NFA_SPLIT, index of the regular expression of NFA_MATCH
+	int out1;
+	// NFA_CHAR: set of bytes while building the NFA, set of byte classes
+	// once the automaton is complete
+	charset chars;
+};
+
+struct dfa_state {
+	// NFA states of this DFA state except those of the restart set which
+	// are part of every DFA state (sorted)
+	int *nfa;
+	unsigned int num_nfa;
+	uint32_t hash;
+	bool eol_known;
+	// Regular expressions matching when this state is reached (NULL if
+	// none) and when it is reached at the end of the input
+	uint64_t *matches;
+	uint64_t *eol_matches;
+};
+
+struct regex_set {
+	// NFA
+	struct nfa_state *nfa;
+	unsigned int num_nfa;
+	unsigned int alloc_nfa;
+	int *starts;
+	unsigned int num_starts;
+	unsigned int words;
+	unsigned int combined;
+	unsigned int rejected;
+
+	// Set on first use
+	bool compiled;
+	bool failed;
+	unsigned char byte_class[256];
+	unsigned int num_classes;
+	bool *in_restart;
+	int *restart;
+	unsigned int num_restart;
+	int *start_nfa;
+	unsigned int num_start_nfa;
+
+	// Lazily built DFA
+	struct dfa_state *dfa;
+	unsigned int num_dfa;
+	int *transitions;
+	int *hash_table;
+	int start;
+
+	// Scratch space
+	unsigned int *mark;
+	unsigned int generation;
+	int *stack;
+	int *list;
+};
+
+/************************************************************************
+ * Parser                                                               *
+ ************************************************************************/
+
+static int new_node(struct parser *p, const enum ast_type type)
+{
+	if(p->num_nodes == p->alloc_nodes)
+	{
+		const unsigned int alloc = p->alloc_nodes > 0u ? 2u*p->alloc_nodes : 64u;
+		struct ast_node *nodes = realloc(p->nodes, alloc*sizeof(*nodes));
+		if(nodes == NULL)
+		{
+			p->error = true;
+			return -1;
+		}
+		p->nodes = nodes;
+		p->alloc_nodes = alloc;
+	}
+	struct ast_node *node = &p->nodes[p->num_nodes];
+	memset(node, 0, sizeof(*node));
+	node->type = type;
+	node->left = node->right = -1;
+	return (int)p->num_nodes++;
+}
+
+static int new_binary(struct parser *p, const enum ast_type type, const int left, const int right)
+{
+	const int node = new_node(p, type);
+	if(node < 0)
+		return -1;
+	p->nodes[node].left = left;
+	p->nodes[node].right = right;
+	p->nodes[node].anchor = p->nodes[left].anchor || (right >= 0 && p->nodes[right].anchor);
+	p->nodes[node].bound = p->nodes[left].bound || (right >= 0 && p->nodes[right].bound);
+	p->nodes[node].nested_bound = p->nodes[left].nested_bound || (right >= 0 && p->nodes[right].nested_bound);
+	return node;
+}
+
+// Add c and its opposite-case counterpart to the set, this is how TRE
+// handles literals when matching case-insensitively
+static void add_icase(charset set, const unsigned char c)
+{
+	if(isupper(c) || islower(c))
+	{
+		SET_BIT(set, (unsigned char)toupper(c));
+		SET_BIT(set, (unsigned char)tolower(c));
+	}
+	else
+		SET_BIT(set, c);
+}
+
+struct bracket_item {
+	int min;
+	int max;
+};
+
+static int item_cmp(const void *a, const void *b)
+{
+	const struct bracket_item *ia = a, *ib = b;
+	if(ia->min != ib->min)
+		return ia->min - ib->min;
+	return ia->max - ib->max;
+}
+
+static bool add_item(struct bracket_item *items, unsigned int *num, const int min, const int max)
+{
+	if(*num >= MAX_BRACKET_ITEMS)
+		return false;
+	items[*num].min = min;
+	items[*num].max = max;
+	(*num)++;
+	return true;
+}
+
+static int (*class_function(const char *name))(int)
+{
+	static const struct {
+		const char *name;
+		int (*func)(int);
+	} classes[] = {
+		{ "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+		{ "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+		{ "lower", islower }, { "print", isprint }, { "punct", ispunct },
+		{ "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit }
+	};
+	for(unsigned int i = 0; i < sizeof(classes)/sizeof(classes[0]); i++)
+		if(strcmp(name, classes[i].name) == 0)
+			return classes[i].func;
+	return NULL;
+}
+
+// Parse a bracket expression, p->re points behind the opening '['. This
+// mirrors tre_parse_bracket() including its handling of negated expressions
+static int parse_bracket(struct parser *p)
+{
+	struct bracket_item items[MAX_BRACKET_ITEMS];
+	unsigned int num = 0u;
+	bool negate = false;
+	if(*p->re == '^')
+	{
+		negate = true;
+		p->re++;
+	}
+
+	const unsigned char *start = p->re;
+	const unsigned char *re = p->re;
+	while(true)
+	{
+		if(*re == '\0')
+			return -1;
+		if(*re == ']' && re > start)
+		{
+			re++;
+			break;
+		}
+
+		int min, max;
+		bool class = false;
+		if(re[1] == '-' && re[2] != '\0' && re[2] != ']')
+		{
+			// Range
+			min = re[0];
+			max = re[2];
+			re += 3;
+			if(min > max)
+				return -1;
+		}
+		else if(re[0] == '[' && (re[1] == '.' || re[1] == '='))
+		{
+			// Collating elements and equivalence classes
+			return -1;
+		}
+		else if(re[0] == '[' && re[1] == ':')
+		{
+			// Character class
+			const unsigned char *end = re + 2;
+			while(*end != '\0' && *end != ':')
+				end++;
+			if(*end == '\0' || end[1] != ']' || end - re - 2 > 63)
+				return -1;
+			char name[64] = { 0 };
+			memcpy(name, re + 2, end - re - 2);
+			int (*func)(int) = class_function(name);
+			if(func == NULL)
+				return -1;
+			re = end + 2;
+
+			// Expand class into ranges (see tre_expand_ctype())
+			min = -1;
+			max = 0;
+			for(int c = 0; c < 256; c++)
+			{
+				if(func(c) || func(tolower(c)) || func(toupper(c)))
+				{
+					if(min < 0)
+						min = c;
+					max = c;
+				}
+				else if(min >= 0)
+				{
+					if(!add_item(items, &num, min, max))
+						return -1;
+					min = -1;
+				}
+			}
+			if(min >= 0 && !add_item(items, &num, min, max))
+				return -1;
+			class = true;
+		}
+		else
+		{
+			// Two ranges are not allowed to share an endpoint
+			if(*re == '-' && re[1] != ']' && re != start)
+				return -1;
+			min = max = *re++;
+		}
+
+		if(class)
+			continue;
+
+		if(!add_item(items, &num, min, max))
+			return -1;
+
+		// Add opposite-case counterpoints
+		while(min <= max)
+		{
+			if(islower(min))
+			{
+				const int cmin = toupper(min++);
+				int ccurr = cmin;
+				while(islower(min) && toupper(min) == ccurr + 1 && min <= max)
+					ccurr = toupper(min++);
+				if(!add_item(items, &num, cmin, ccurr))
+					return -1;
+			}
+			else if(isupper(min))
+			{
+				const int cmin = tolower(min++);
+				int ccurr = cmin;
+				while(isupper(min) && tolower(min) == ccurr + 1 && min <= max)
+					ccurr = tolower(min++);
+				if(!add_item(items, &num, cmin, ccurr))
+					return -1;
+			}
+			else
+				min++;
+		}
+	}
+	p->re = re;
+
+	const int node = new_node(p, AST_CHARS);
+	if(node < 0)
+		return -1;
+	uint64_t *set = p->nodes[node].chars;
+
+	if(!negate)
+	{
+		for(unsigned int i = 0; i < num; i++)
+			for(int c = items[i].min; c <= items[i].max; c++)
+				SET_BIT(set, c);
+		return node;
+	}
+
+	// Negated bracket expressions are built the way TRE does it. Items
+	// overlapping a previous item only extend the excluded range if they
+	// start at the same position (this is a bug in TRE but we want to get
+	// the same results). As TRE does not sort items with the same start
+	// deterministically, such expressions are left to TRE
+	qsort(items, num, sizeof(*items), item_cmp);
+	for(unsigned int i = 1; i < num; i++)
+		if(items[i].min == items[i-1].min && items[i].max != items[i-1].max)
+			return -1;
+
+	int curr_min = 0, curr_max = 0;
+	for(unsigned int i = 0; i < num; i++)
+	{
+		if(items[i].min < curr_max)
+		{
+			// Overlap
+			if(items[i].max + 1 > curr_max)
+				curr_max = items[i].max + 1;
+		}
+		else
+		{
+			curr_max = items[i].min - 1;
+			for(int c = curr_min; c <= curr_max; c++)
+				SET_BIT(set, c);
+			curr_min = curr_max = items[i].max + 1;
+		}
+	}
+	for(int c = curr_min; c < 256; c++)
+		SET_BIT(set, c);
+
+	return node;
+}
+
+// Parse a bracket expression given as string (used for macros such as \w)
+static int parse_macro(struct parser *p, const char *bracket)
+{
+	const unsigned char *re = p->re;
+	p->re = (const unsigned char*)bracket;
+	const int node = parse_bracket(p);
+	p->re = re;
+	return node;
+}
+
+static int parse_alternation(struct parser *p);
+
+static int parse_atom(struct parser *p)
+{
+	const unsigned char c = *p->re;
+	switch(c)
+	{
+		case '\0':
+		case '*':
+		case '+':
+		case '?':
+		case '{':
+			// We were expecting an atom, TRE interprets this as an
+			// empty expression (the operator is parsed afterwards)
+			return new_node(p, AST_EMPTY);
+
+		case '(':
+		{
+			p->re++;
+			if(*p->re == '?')
+			{
+				// Only "(?:" is supported but no other extensions
+				if(p->re[1] != ':')
+					return -1;
+				p->re += 2;
+			}
+			if(++p->depth > MAX_DEPTH)
+				return -1;
+			const int node = parse_alternation(p);
+			if(node < 0 || *p->re != ')')
+				return -1;
+			p->re++;
+			p->depth--;
+			return node;
+		}
+
+		case ')':
+			if(p->depth > 0)
+				return new_node(p, AST_EMPTY);
+			break;
+
+		case '[':
+			p->re++;
+			return parse_bracket(p);
+
+		case '.':
+		{
+			p->re++;
+			const int node = new_node(p, AST_CHARS);
+			if(node < 0)
+				return -1;
+			memset(p->nodes[node].chars, 0xff, sizeof(charset));
+			return node;
+		}
+
+		case '^':
+		case '$':
+		{
+			p->re++;
+			const int node = new_node(p, c == '^' ? AST_BOL : AST_EOL);
+			if(node >= 0)
+				p->nodes[node].anchor = true;
+			return node;
+		}
+
+		case '\\':
+		{
+			const unsigned char e = p->re[1];
+			p->re += 2;
+			switch(e)
+			{
+				case 'w': return parse_macro(p, "[:alnum:]_]");
+				case 'W': return parse_macro(p, "^[:alnum:]_]");
+				case 's': return parse_macro(p, "[:space:]]");
+				case 'S': return parse_macro(p, "^[:space:]]");
+				case 'd': return parse_macro(p, "[:digit:]]");
+				case 'D': return parse_macro(p, "^[:digit:]]");
+				default:
+					break;
+			}
+			// Other letters and digits have special meanings
+			// (control characters, word boundaries, back
+			// references, ...) or are matched case-sensitively.
+			// \< and \> are word boundary assertions as well
+			if(e == '\0' || isalnum(e) || e == '<' || e == '>')
+				return -1;
+			// Escaped character
+			const int node = new_node(p, AST_CHARS);
+			if(node < 0)
+				return -1;
+			SET_BIT(p->nodes[node].chars, e);
+			return node;
+		}
+
+		default:
+			break;
+	}
+
+	// Literal character
+	p->re++;
+	const int node = new_node(p, AST_CHARS);
+	if(node < 0)
+		return -1;
+	add_icase(p->nodes[node].chars, c);
+	return node;
+}
+
+static bool parse_bound(struct parser *p, int *min, int *max)
+{
+	// p->re points behind the opening '{'
+	if(!isdigit(*p->re))
+		return false;
+	*min = 0;
+	while(isdigit(*p->re) && *min <= MAX_REPEAT)
+		*min = 10 * *min + (*p->re++ - '0');
+	*max = *min;
+	if(*p->re == ',')
+	{
+		p->re++;
+		*max = -1;
+		if(isdigit(*p->re))
+		{
+			*max = 0;
+			while(isdigit(*p->re) && *max <= MAX_REPEAT)
+				*max = 10 * *max + (*p->re++ - '0');
+		}
+	}
+	if(*p->re != '}' || *min > MAX_REPEAT || *max > MAX_REPEAT ||
+	   (*max >= 0 && *min > *max))
+		return false;
+	p->re++;
+	return true;
+}
+
+static int parse_piece(struct parser *p)
+{
+	int node = parse_atom(p);
+	while(node >= 0)
+	{
+		int min, max;
+		bool bound = false;
+		const unsigned char c = *p->re;
+		if(c == '*' || c == '+' || c == '?')
+		{
+			min = c == '+' ? 1 : 0;
+			max = c == '?' ? 1 : -1;
+			p->re++;
+		}
+		else if(c == '{')
+		{
+			p->re++;
+			if(!parse_bound(p, &min, &max))
+				return -1;
+			bound = true;
+		}
+		else
+			break;
+
+		// TRE does not handle repeated anchors correctly (e.g. "$?a" does
+		// not match "a"), leave them to TRE to get the same results
+		if(p->nodes[node].anchor)
+			return -1;
+
+		// TRE may report false matches for bounded repetitions inside
+		// nested repetitions (e.g. "z(0(x|.[^A-Z]{2})+|ab)+" matches
+		// "zab0"), these are left to TRE as well
+		if(p->nodes[node].nested_bound)
+			return -1;
+
+		// A trailing '?' marks minimal repetition which does not change
+		// whether there is a match
+		if(*p->re == '?')
+			p->re++;
+		else if(*p->re == '*' || *p->re == '+')
+			return -1;
+
+		const int repeat = new_binary(p, AST_REPEAT, node, -1);
+		if(repeat < 0)
+			return -1;
+		p->nodes[repeat].min = min;
+		p->nodes[repeat].max = max;
+		p->nodes[repeat].nested_bound = p->nodes[node].bound;
+		p->nodes[repeat].bound |= bound;
+		node = repeat;
+	}
+	return node;
+}
+
+static int parse_branch(struct parser *p)
+{
+	int node = -1;
+	while(*p->re != '\0' && *p->re != '|' && !(*p->re == ')' && p->depth > 0))
+	{
+		const int piece = parse_piece(p);
+		if(piece < 0)
+			return -1;
+		node = node < 0 ? piece : new_binary(p, AST_CAT, node, piece);
+		if(node < 0)
+			return -1;
+	}
+	return node < 0 ? new_node(p, AST_EMPTY) : node;
+}
+
+static int parse_alternation(struct parser *p)
+{
+	int node = parse_branch(p);
+	while(node >= 0 && *p->re == '|')
+	{
+		p->re++;
+		const int branch = parse_branch(p);
+		if(branch < 0)
+			return -1;
+		node = new_binary(p, AST_ALT, node, branch);
+	}
+	return node;
+}
+
+// Parse a complete regular expression, returns the root node or -1 if the
+// regular expression is not supported
+static int parse_pattern(struct parser *p, const char *pattern)
+{
+	// Bytes outside of the ASCII range are left to TRE
+	for(const unsigned char *c = (const unsigned char*)pattern; *c != '\0'; c++)
+		if(*c >= 0x80)
+			return -1;
+
+	p->re = (const unsigned char*)pattern;
+	const int root = parse_alternation(p);
+	// An unmatched ')' is a literal but we do not expect it here
+	if(p->error || *p->re != '\0')
+		return -1;
+	return root;
+}
+
+/************************************************************************
+ * Required literals                                                    *
+ ************************************************************************/
+
+// Strings every match of a node has to contain (all lowercase). If exact is
+// set, the node matches only this string and prefix, suffix, and best all
+// contain it. Otherwise, every match starts with prefix, ends with suffix,
+// and contains best somewhere. Longer strings are truncated to MAX_LITERAL
+// characters which is fine as every part of a required string is required
+struct literal {
+	bool exact;
+	unsigned char plen, slen, blen;
+	char prefix[MAX_LITERAL];
+	char suffix[MAX_LITERAL];
+	char best[MAX_LITERAL];
+};
+
+static unsigned char __attribute__((const)) fold(const unsigned char c)
+{
+	return c >= 'A' && c <= 'Z' ? (unsigned char)(c - 'A' + 'a') : c;
+}
+
+static void set_exact(struct literal *lit, const char *str, const unsigned char len)
+{
+	lit->exact = true;
+	lit->plen = lit->slen = lit->blen = len;
+	memcpy(lit->prefix, str, len);
+	memcpy(lit->suffix, str, len);
+	memcpy(lit->best, str, len);
+}
+
+static void keep_best(struct literal *lit, const char *str, const unsigned char len)
+{
+	if(len <= lit->blen)
+		return;
+	lit->blen = len;
+	memcpy(lit->best, str, len);
+}
+
+// Literals of the concatenation of a and b
+static void concat_literals(const struct literal *a, const struct literal *b, struct literal *out)
+{
+	char buf[2*MAX_LITERAL];
+	if(a->exact && b->exact && a->plen + b->plen <= MAX_LITERAL)
+	{
+		memcpy(buf, a->prefix, a->plen);
+		memcpy(buf + a->plen, b->prefix, b->plen);
+		set_exact(out, buf, (unsigned char)(a->plen + b->plen));
+		return;
+	}
+
+	struct literal res = { .exact = false };
+	// Prefix
+	if(a->exact)
+	{
+		memcpy(buf, a->prefix, a->plen);
+		memcpy(buf + a->plen, b->prefix, b->plen);
+		const unsigned int len = (unsigned int)a->plen + b->plen;
+		res.plen = (unsigned char)(len < MAX_LITERAL ? len : MAX_LITERAL);
+		memcpy(res.prefix, buf, res.plen);
+	}
+	else
+	{
+		res.plen = a->plen;
+		memcpy(res.prefix, a->prefix, a->plen);
+	}
+	// Suffix
+	if(b->exact)
+	{
+		memcpy(buf, a->suffix, a->slen);
+		memcpy(buf + a->slen, b->suffix, b->slen);
+		const unsigned int len = (unsigned int)a->slen + b->slen;
+		res.slen = (unsigned char)(len < MAX_LITERAL ? len : MAX_LITERAL);
+		memcpy(res.suffix, buf + len - res.slen, res.slen);
+	}
+	else
+	{
+		res.slen = b->slen;
+		memcpy(res.suffix, b->suffix, b->slen);
+	}
+	// Longest string found anywhere
+	memcpy(buf, a->suffix, a->slen);
+	memcpy(buf + a->slen, b->prefix, b->plen);
+	const unsigned int len = (unsigned int)a->slen + b->plen;
+	keep_best(&res, buf, (unsigned char)(len < MAX_LITERAL ? len : MAX_LITERAL));
+	keep_best(&res, a->best, a->blen);
+	keep_best(&res, b->best, b->blen);
+	keep_best(&res, res.prefix, res.plen);
+	keep_best(&res, res.suffix, res.slen);
+	*out = res;
+}
+
+// Get the longest literal string every match of the regular expression has to
+// contain (converted to lowercase). Returns the length of the string written
+// to literal (at most MAX_LITERAL characters, not terminated), or 0 if there
+// is no such string or the regular expression is not supported
+unsigned int regex_required_literal(const char *pattern, char literal[MAX_LITERAL])
+{
+	struct parser p = { .re = NULL };
+	const int root = parse_pattern(&p, pattern);
+	struct literal *lits = root >= 0 ? calloc(p.num_nodes, sizeof(*lits)) : NULL;
+	if(lits == NULL)
+	{
+		free(p.nodes);
+		return 0u;
+	}
+
+	// Children are always created before their parents so we can walk the
+	// nodes in order
+	for(unsigned int i = 0; i <= (unsigned int)root; i++)
+	{
+		const struct ast_node *n = &p.nodes[i];
+		struct literal *lit = &lits[i];
+		switch(n->type)
+		{
+			case AST_CHARS:
+			{
+				// A set is a literal if all of its characters fold to
+				// the same character
+				int c = -1;
+				for(unsigned int j = 0; j < 256u && c != -2; j++)
+					if(HAS_BIT(n->chars, j))
+						c = c == -1 || c == fold((unsigned char)j) ? fold((unsigned char)j) : -2;
+				if(c >= 0)
+				{
+					const char chr = (char)c;
+					set_exact(lit, &chr, 1);
+				}
+				break;
+			}
+			case AST_EMPTY:
+			case AST_BOL:
+			case AST_EOL:
+				// Match the empty string
+				set_exact(lit, "", 0);
+				break;
+			case AST_CAT:
+				concat_literals(&lits[n->left], &lits[n->right], lit);
+				break;
+			case AST_ALT:
+				// Nothing is required in general
+				break;
+			case AST_REPEAT:
+			{
+				// Nothing is required if the body is optional
+				if(n->min == 0)
+					break;
+				const struct literal *body = &lits[n->left];
+				*lit = *body;
+				for(int j = 1; j < n->min; j++)
+					concat_literals(lit, body, lit);
+				// Further repetitions may follow, the match still ends
+				// with the body
+				if(n->max != n->min)
+				{
+					lit->exact = false;
+					lit->slen = body->slen;
+					memcpy(lit->suffix, body->suffix, body->slen);
+				}
+				break;
+			}
+		}
+	}
+
+	const unsigned int len = lits[root].blen;
+	memcpy(literal, lits[root].best, len);
+	free(lits);
+	free(p.nodes);
+	return len;
+}
+
+/************************************************************************
+ * NFA construction                                                     *
+ ************************************************************************/
+
+static int new_state(struct regex_set *set, const enum nfa_type type, const int out, const int out1,
+                     const unsigned int limit)
+{
+	if(set->num_nfa >= limit)
+		return -1;
+	if(set->num_nfa == set->alloc_nfa)
+	{
+		const unsigned int alloc = set->alloc_nfa > 0u ? 2u*set->alloc_nfa : 256u;
+		struct nfa_state *nfa = realloc(set->nfa, alloc*sizeof(*nfa));
+		if(nfa == NULL)
+			return -1;
+		set->nfa = nfa;
+		set->alloc_nfa = alloc;
+	}
+	struct nfa_state *state = &set->nfa[set->num_nfa];
+	memset(state, 0, sizeof(*state));
+	state->type = type;
+	state->out = out;
+	state->out1 = out1;
+	return (int)set->num_nfa++;
+}
+
+// Emit the NFA states of an AST node backwards: the returned state is the entry
+// point of the node, its exits lead to next
+static int emit(struct regex_set *set, const struct parser *p, const int node, const int next,
+                const unsigned int limit)
+{
+	if(next < 0)
+		return -1;
+
+	const struct ast_node *n = &p->nodes[node];
+	switch(n->type)
+	{
+		case AST_CHARS:
+		{
+			const int state = new_state(set, NFA_CHAR, next, -1, limit);
+			if(state >= 0)
+				memcpy(set->nfa[state].chars, n->chars, sizeof(charset));
+			return state;
+		}
+		case AST_EMPTY:
+			return next;
+		case AST_BOL:
+			return new_state(set, NFA_BOL, next, -1, limit);
+		case AST_EOL:
+			return new_state(set, NFA_EOL, next, -1, limit);
+		case AST_CAT:
+			return emit(set, p, n->left, emit(set, p, n->right, next, limit), limit);
+		case AST_ALT:
+		{
+			const int left = emit(set, p, n->left, next, limit);
+			const int right = emit(set, p, n->right, next, limit);
+			if(left < 0 || right < 0)
+				return -1;
+			return new_state(set, NFA_SPLIT, left, right, limit);
+		}
+		case AST_REPEAT:
+		{
+			int entry = next;
+			if(n->max < 0)
+			{
+				// Unbounded: loop state which either enters the
+				// body (leading back to the loop) or leaves
+				const int loop = new_state(set, NFA_SPLIT, -1, next, limit);
+				if(loop < 0)
+					return -1;
+				const int body = emit(set, p, n->left, loop, limit);
+				if(body < 0)
+					return -1;
+				set->nfa[loop].out = body;
+				entry = loop;
+			}
+			else
+			{
+				// Optional copies: (x(x(x)?)?)?
+				for(int i = n->min; i < n->max; i++)
+				{
+					const int body = emit(set, p, n->left, entry, limit);
+					if(body < 0)
+						return -1;
+					entry = new_state(set, NFA_SPLIT, body, next, limit);
+					if(entry < 0)
+						return -1;
+				}
+			}
+			// Mandatory copies
+			for(int i = 0; i < n->min; i++)
+				if((entry = emit(set, p, n->left, entry, limit)) < 0)
+					return -1;
+			return entry;
+		}
+	}
+
+	return -1;
+}
+
+struct regex_set *regex_set_new(void)
+{
+	struct regex_set *set = calloc(1, sizeof(struct regex_set));
+	if(set != NULL)
+		set->start = -1;
+	return set;
+}
+
+// Add a regular expression to the automaton. Returns false if the regular
+// expression is not supported, it has to be matched using TRE in this case
+bool regex_set_add(struct regex_set *set, const char *pattern, const unsigned int index)
+{
+	// Parse regular expression
+	struct parser p = { .re = NULL };
+	const int root = parse_pattern(&p, pattern);
+
+	// Emit NFA states, the regular expression is rolled back if it needs
+	// too many states
+	const unsigned int num_nfa = set->num_nfa;
+	int entry = -1;
+	if(root >= 0 && !set->compiled)
+	{
+		const unsigned int limit = num_nfa + MAX_PATTERN_STATES;
+		entry = new_state(set, NFA_MATCH, -1, (int)index, limit);
+		entry = emit(set, &p, root, entry, limit);
+	}
+	free(p.nodes);
+
+	if(entry < 0)
+	{
+		set->num_nfa = num_nfa;
+		set->rejected++;
+		return false;
+	}
+
+	int *starts = realloc(set->starts, (set->num_starts + 1)*sizeof(*starts));
+	if(starts == NULL)
+	{
+		set->num_nfa = num_nfa;
+		set->rejected++;
+		return false;
+	}
+	set->starts = starts;
+	set->starts[set->num_starts++] = entry;
+	if(index / 64u + 1u > set->words)
+		set->words = index / 64u + 1u;
+	set->combined++;
+
+	return true;
+}
+
+/************************************************************************
+ * Lazy DFA                                                             *
+ ************************************************************************/
+
+// Collect the NFA states reachable from state without consuming input. Only
+// states consuming input, end anchors, and match states are recorded. Start
+// anchors can only be passed at the beginning of the input. States of the
+// restart set are not recorded as they are part of every DFA state. If we are
+// not at the beginning of the input, we can stop there as everything reachable
+// from them is part of the restart set as well
+static void closure(struct regex_set *set, const int state, const bool bol, unsigned int *num)
+{
+	unsigned int sp = 0;
+	if(set->mark[state] == set->generation)
+		return;
+	set->mark[state] = set->generation;
+	set->stack[sp++] = state;
+
+	while(sp > 0)
+	{
+		const int q = set->stack[--sp];
+		if(set->in_restart != NULL && set->in_restart[q] && !bol)
+			continue;
+
+		const struct nfa_state *s = &set->nfa[q];
+		int next[2] = { -1, -1 };
+		switch(s->type)
+		{
+			case NFA_SPLIT:
+				next[0] = s->out;
+				next[1] = s->out1;
+				break;
+			case NFA_BOL:
+				if(bol)
+					next[0] = s->out;
+				break;
+			case NFA_CHAR:
+			case NFA_EOL:
+			case NFA_MATCH:
+				if(set->in_restart == NULL || !set->in_restart[q])
+					set->list[(*num)++] = q;
+				break;
+		}
+
+		for(unsigned int i = 0; i < 2; i++)
+		{
+			if(next[i] >= 0 && set->mark[next[i]] != set->generation)
+			{
+				set->mark[next[i]] = set->generation;
+				set->stack[sp++] = next[i];
+			}
+		}
+	}
+}
+
+static void next_generation(struct regex_set *set)
+{
+	if(++set->generation == 0u)
+	{
+		memset(set->mark, 0, set->num_nfa*sizeof(*set->mark));
+		set->generation = 1u;
+	}
+}
+
+static int int_cmp(const void *a, const void *b)
+{
+	const int ia = *(const int*)a, ib = *(const int*)b;
+	return (ia > ib) - (ia < ib);
+}
+
+static uint32_t hash_list(const int *list, const unsigned int num)
+{
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for(unsigned int i = 0; i < num; i++)
+	{
+		hash ^= (uint32_t)list[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static void flush_dfa(struct regex_set *set)
+{
+	for(unsigned int i = 0; i < set->num_dfa; i++)
+	{
+		free(set->dfa[i].nfa);
+		free(set->dfa[i].matches);
+		free(set->dfa[i].eol_matches);
+	}
+	set->num_dfa = 0u;
+	memset(set->hash_table, 0xff, 2u*MAX_DFA_STATES*sizeof(*set->hash_table));
+	memset(set->transitions, 0xff, MAX_DFA_STATES*set->num_classes*sizeof(*set->transitions));
+	set->start = -1;
+}
+
+// Set the bits of all regular expressions whose match state is in the list
+static uint64_t *collect_matches(const struct regex_set *set, const int *list, const unsigned int num,
+                                 const bool restart)
+{
+	uint64_t *matches = NULL;
+	for(unsigned int i = 0; i < num + (restart ? set->num_restart : 0u); i++)
+	{
+		const int q = i < num ? list[i] : set->restart[i - num];
+		if(set->nfa[q].type != NFA_MATCH)
+			continue;
+		if(matches == NULL && (matches = calloc(set->words, sizeof(*matches))) == NULL)
+			return NULL;
+		const unsigned int index = (unsigned int)set->nfa[q].out1;
+		matches[index / 64u] |= 1ull << (index % 64u);
+	}
+	return matches;
+}
+
+// Get the DFA state for the set of NFA states in set->list, it is created if
+// it does not exist yet. The list is sorted in place
+static int get_dfa_state(struct regex_set *set, const unsigned int num)
+{
+	qsort(set->list, num, sizeof(*set->list), int_cmp);
+	const uint32_t hash = hash_list(set->list, num);
+	const unsigned int mask = 2u*MAX_DFA_STATES - 1u;
+	unsigned int slot = hash & mask;
+	while(set->hash_table[slot] >= 0)
+	{
+		const struct dfa_state *d = &set->dfa[set->hash_table[slot]];
+		if(d->hash == hash && d->num_nfa == num &&
+		   memcmp(d->nfa, set->list, num*sizeof(*set->list)) == 0)
+			return set->hash_table[slot];
+		slot = (slot + 1u) & mask;
+	}
+
+	// The caller flushes the cache if it is full
+	if(set->num_dfa >= MAX_DFA_STATES)
+		return -1;
+
+	struct dfa_state *d = &set->dfa[set->num_dfa];
+	memset(d, 0, sizeof(*d));
+	d->hash = hash;
+	d->num_nfa = num;
+	if(num > 0u)
+	{
+		if((d->nfa = malloc(num*sizeof(*d->nfa))) == NULL)
+			return -1;
+		memcpy(d->nfa, set->list, num*sizeof(*d->nfa));
+	}
+	d->matches = collect_matches(set, set->list, num, true);
+	set->hash_table[slot] = (int)set->num_dfa;
+	return (int)set->num_dfa++;
+}
+
+// Get the DFA state at the beginning of the input
+static int start_state(struct regex_set *set)
+{
+	memcpy(set->list, set->start_nfa, set->num_start_nfa*sizeof(*set->list));
+	return set->start = get_dfa_state(set, set->num_start_nfa);
+}
+
+// Compute the transition of DFA state from on byte class cls
+static int transition(struct regex_set *set, const int from, const unsigned int cls)
+{
+	next_generation(set);
+	unsigned int num = 0u;
+	const struct dfa_state *d = &set->dfa[from];
+	for(unsigned int i = 0; i < d->num_nfa + set->num_restart; i++)
+	{
+		const int q = i < d->num_nfa ? d->nfa[i] : set->restart[i - d->num_nfa];
+		const struct nfa_state *s = &set->nfa[q];
+		if(s->type == NFA_CHAR && HAS_BIT(s->chars, cls))
+			closure(set, s->out, false, &num);
+	}
+
+	int to = get_dfa_state(set, num);
+	if(to >= 0)
+	{
+		set->transitions[from*set->num_classes + cls] = to;
+		return to;
+	}
+
+	// The cache is full: start over with an empty cache. The list is
+	// preserved but the start state has to be recreated first
+	int *list = malloc((num > 0u ? num : 1u)*sizeof(*list));
+	if(list == NULL)
+		return -1;
+	memcpy(list, set->list, num*sizeof(*list));
+	flush_dfa(set);
+	if(start_state(set) < 0)
+	{
+		free(list);
+		return -1;
+	}
+	memcpy(set->list, list, num*sizeof(*list));
+	free(list);
+	return get_dfa_state(set, num);
+}
+
+// Get the regular expressions which match if the input ends in state
+static const uint64_t *eol_matches(struct regex_set *set, const int state)
+{
+	struct dfa_state *d = &set->dfa[state];
+	if(d->eol_known)
+		return d->eol_matches;
+
+	// Pass the end anchors and collect the match states reachable from
+	// them. Use the in_restart == NULL mode of closure() as the restart
+	// set has no special meaning at the end of the input
+	bool *in_restart = set->in_restart;
+	set->in_restart = NULL;
+	next_generation(set);
+	unsigned int num = 0u;
+	for(unsigned int i = 0; i < d->num_nfa + set->num_restart; i++)
+	{
+		const int q = i < d->num_nfa ? d->nfa[i] : set->restart[i - d->num_nfa];
+		if(set->nfa[q].type != NFA_EOL)
+			continue;
+		// Collect everything reachable behind this anchor,
+		// including further anchors
+		unsigned int first = num;
+		closure(set, set->nfa[q].out, false, &num);
+		for(unsigned int j = first; j < num; j++)
+		{
+			const int e = set->list[j];
+			if(set->nfa[e].type == NFA_EOL)
+				closure(set, set->nfa[e].out, false, &num);
+		}
+	}
+	set->in_restart = in_restart;
+
+	d->eol_matches = collect_matches(set, set->list, num, false);
+	d->eol_known = true;
+	return d->eol_matches;
+}
+
+// Prepare the automaton for matching: compute the byte classes, the restart
+// set, and the start state
+static bool compile_set(struct regex_set *set)
+{
+	set->compiled = true;
+	set->failed = true;
+
+	// Compute byte classes: two bytes are in the same class if they are
+	// members of exactly the same sets
+	memset(set->byte_class, 0, sizeof(set->byte_class));
+	set->num_classes = 1u;
+	for(unsigned int q = 0; q < set->num_nfa; q++)
+	{
+		const struct nfa_state *s = &set->nfa[q];
+		if(s->type != NFA_CHAR)
+			continue;
+		int remap[2*256];
+		memset(remap, 0xff, sizeof(remap));
+		unsigned int num_classes = 0u;
+		unsigned char byte_class[256];
+		for(unsigned int c = 0; c < 256u; c++)
+		{
+			const unsigned int key = 2u*set->byte_class[c] + HAS_BIT(s->chars, c);
+			if(remap[key] < 0)
+				remap[key] = (int)num_classes++;
+			byte_class[c] = (unsigned char)remap[key];
+		}
+		if(num_classes != set->num_classes)
+		{
+			memcpy(set->byte_class, byte_class, sizeof(byte_class));
+			set->num_classes = num_classes;
+		}
+	}
+
+	// Translate sets of bytes into sets of classes
+	for(unsigned int q = 0; q < set->num_nfa; q++)
+	{
+		struct nfa_state *s = &set->nfa[q];
+		if(s->type != NFA_CHAR)
+			continue;
+		charset classes = { 0 };
+		for(unsigned int c = 0; c < 256u; c++)
+			if(HAS_BIT(s->chars, c))
+				SET_BIT(classes, set->byte_class[c]);
+		memcpy(s->chars, classes, sizeof(classes));
+	}
+
+	// Allocate memory
+	const unsigned int n = set->num_nfa > 0u ? set->num_nfa : 1u;
+	set->mark = calloc(n, sizeof(*set->mark));
+	set->stack = calloc(n, sizeof(*set->stack));
+	set->list = calloc(n, sizeof(*set->list));
+	set->restart = calloc(n, sizeof(*set->restart));
+	set->start_nfa = calloc(n, sizeof(*set->start_nfa));
+	set->in_restart = calloc(n, sizeof(*set->in_restart));
+	set->dfa = calloc(MAX_DFA_STATES, sizeof(*set->dfa));
+	set->hash_table = calloc(2u*MAX_DFA_STATES, sizeof(*set->hash_table));
+	set->transitions = calloc(MAX_DFA_STATES*set->num_classes, sizeof(*set->transitions));
+	if(set->mark == NULL || set->stack == NULL || set->list == NULL ||
+	   set->restart == NULL || set->start_nfa == NULL || set->in_restart == NULL ||
+	   set->dfa == NULL || set->hash_table == NULL || set->transitions == NULL)
+		return false;
+
+	// The restart set is entered at every position of the input as we are
+	// looking for matches anywhere in the input
+	bool *in_restart = set->in_restart;
+	set->in_restart = NULL;
+	next_generation(set);
+	for(unsigned int i = 0; i < set->num_starts; i++)
+		closure(set, set->starts[i], false, &set->num_restart);
+	memcpy(set->restart, set->list, set->num_restart*sizeof(*set->restart));
+	for(unsigned int i = 0; i < set->num_restart; i++)
+		in_restart[set->restart[i]] = true;
+
+	// Also mark the states we passed on the way as they do not lead to
+	// anything outside of the restart set
+	for(unsigned int q = 0; q < set->num_nfa; q++)
+		if(set->mark[q] == set->generation && set->nfa[q].type == NFA_SPLIT)
+			in_restart[q] = true;
+	set->in_restart = in_restart;
+
+	// At the beginning of the input, start anchors can be passed
+	next_generation(set);
+	for(unsigned int i = 0; i < set->num_starts; i++)
+		closure(set, set->starts[i], true, &set->num_start_nfa);
+	memcpy(set->start_nfa, set->list, set->num_start_nfa*sizeof(*set->start_nfa));
+
+	flush_dfa(set);
+	if(start_state(set) < 0)
+		return false;
+
+	if(config.debug & DEBUG_REGEX)
+		logg("Combined %u regex filters into one automaton (%u NFA states, %u byte classes), "
+		     "%u regex filters are matched individually",
+		     set->combined, set->num_nfa, set->num_classes, set->rejected);
+
+	set->failed = false;
+	return true;
+}
+
+unsigned int __attribute__((pure)) regex_set_words(const struct regex_set *set)
+{
+	return set != NULL ? set->words : 0u;
+}
+
+// Match input against all regular expressions of the set at once. On success,
+// the bits of all matching regular expressions are set in matches (which has to
+// hold regex_set_words() words). Returns false if input has to be matched
+// using TRE
+bool regex_set_match(struct regex_set *set, const char *input, uint64_t *matches)
+{
+	if(set == NULL || set->num_starts == 0u || *input == '\0')
+		return false;
+	if(!set->compiled)
+		compile_set(set);
+	if(set->failed)
+		return false;
+
+	memset(matches, 0, set->words*sizeof(*matches));
+	int state = set->start >= 0 ? set->start : start_state(set);
+	if(state < 0)
+		return false;
+
+	const unsigned int words = set->words;
+	for(const unsigned char *c = (const unsigned char*)input; ; c++)
+	{
+		const uint64_t *m = set->dfa[state].matches;
+		if(m != NULL)
+			for(unsigned int i = 0; i < words; i++)
+				matches[i] |= m[i];
+
+		if(*c == '\0')
+			break;
+
+		const unsigned int cls = set->byte_class[*c];
+		int next = set->transitions[state*set->num_classes + cls];
+		if(next < 0 && (next = transition(set, state, cls)) < 0)
+			return false;
+		state = next;
+	}
+
+	const uint64_t *m = eol_matches(set, state);
+	if(m != NULL)
+		for(unsigned int i = 0; i < words; i++)
+			matches[i] |= m[i];
+
+	return true;
+}
+
+void regex_set_free(struct regex_set *set)
+{
+	if(set == NULL)
+		return;
+
+	if(set->dfa != NULL && set->hash_table != NULL && set->transitions != NULL)
+		flush_dfa(set);
+	free(set->dfa);
+	free(set->hash_table);
+	free(set->transitions);
+	free(set->mark);
+	free(set->stack);
+	free(set->list);
+	free(set->restart);
+	free(set->start_nfa);
+	free(set->in_restart);
+	free(set->starts);
+	free(set->nfa);
+	free(set);
+}
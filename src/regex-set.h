@@ -0,0 +1,30 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2023 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Combined regex automaton prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef REGEX_SET_H
+#define REGEX_SET_H
+
+// type bool
+#include <stdbool.h>
+// type uint64_t
+#include <stdint.h>
+
+struct regex_set;
+
+struct regex_set *regex_set_new(void);
+void regex_set_free(struct regex_set *set);
+bool regex_set_add(struct regex_set *set, const char *pattern, const unsigned int index);
+unsigned int regex_set_words(const struct regex_set *set) __attribute__((pure));
+bool regex_set_match(struct regex_set *set, const char *input, uint64_t *matches);
+
+// Maximum length of a literal returned by regex_required_literal()
+#define MAX_LITERAL 32u
+unsigned int regex_required_literal(const char *pattern, char literal[MAX_LITERAL]);
+
+#endif //REGEX_SET_H
@@ -25,6 +25,10 @@
 #include "config.h"
 // cli_stuff()
 #include "args.h"
+// struct regex_set
+#include "regex-set.h"
+// struct regex_prefilter
+#include "regex-prefilter.h"
 
 // Safety-measure for future extensions
 #if TYPE_MAX > 30
@@ -37,8 +41,25 @@ static regexData *white_regex = NULL;
 static regexData *black_regex = NULL;
 static regexData   *cli_regex = NULL;
 static unsigned int num_regex[REGEX_MAX] = { 0 };
+// Combined automata of the black- and whitelist regex filters
+static struct regex_set *regex_sets[REGEX_MAX] = { NULL };
+// Literal prefilters of the black- and whitelist regex filters
+static struct regex_prefilter *regex_prefilters[REGEX_MAX] = { NULL };
 unsigned int regex_change = 0;
 
+// Regex filters of one type compiled from the database. On reload, the new
+// filters are compiled by regex_prepare_swap() while the current ones are still
+// in use and installed by regex_swap() with the shared memory locked
+struct regex_table {
+	regexData *regex;
+	unsigned int num;
+	struct regex_set *set;
+	struct regex_prefilter *prefilter;
+};
+static struct regex_table next_regex[REGEX_CLI] = {{ NULL, 0u, NULL, NULL }};
+static bool next_regex_prepared = false;
+static double next_regex_msec = 0.0;
+
 static inline regexData *get_regex_ptr(const enum regex_type regexid)
 {
 	switch (regexid)
@@ -55,31 +76,30 @@ static inline regexData *get_regex_ptr(const enum regex_type regexid)
 	}
 }
 
-static inline void free_regex_ptr(const enum regex_type regexid)
+// Make table the current regex filters of this type. The previous ones have
+// to be freed using free_regex() before
+static void install_regex_table(const enum regex_type regexid, struct regex_table *table)
 {
-	regexData **regex;
 	switch (regexid)
 	{
 		case REGEX_BLACKLIST:
-			regex = &black_regex;
+			black_regex = table->regex;
 			break;
 		case REGEX_WHITELIST:
-			regex = &white_regex;
+			white_regex = table->regex;
 			break;
 		case REGEX_CLI:
-			regex = &cli_regex;
+			cli_regex = table->regex;
 			break;
 		case REGEX_MAX: // Fall through
 		default: // This is not possible
 			return;
 	}
 
-	// Free pointer (if not already NULL)
-	if(*regex != NULL)
-	{
-		free(*regex);
-		*regex = NULL;
-	}
+	num_regex[regexid] = table->num;
+	regex_sets[regexid] = table->set;
+	regex_prefilters[regexid] = table->prefilter;
+	memset(table, 0, sizeof(*table));
 }
 
 static __attribute__ ((pure)) regexData *get_regex_ptr_from_id(unsigned int regexID)
@@ -140,10 +160,11 @@ unsigned int __attribute__((pure)) get_num_regex(const enum regex_type regexid)
 #define FTL_REGEX_SEP ";"
 /* Compile regular expressions into data structures that can be used with
    regexec() to match against a string */
-static bool compile_regex(const char *regexin, const enum regex_type regexid, const int dbidx)
+static bool compile_regex(const char *regexin, const enum regex_type regexid, const int dbidx,
+                          struct regex_table *table)
 {
-	regexData *regex = get_regex_ptr(regexid);
-	int index = num_regex[regexid]++;
+	regexData *regex = table->regex;
+	int index = table->num++;
 
 	// Extract possible Pi-hole extensions
 	char rgxbuf[strlen(regexin) + 1u];
@@ -330,17 +351,174 @@ static bool compile_regex(const char *regexin, const enum regex_type regexid, co
 	regex[index].string = strdup(regexin);
 	regex[index].available = true;
 
+	// Add regex to the combined automaton of this type (if enabled). Filters
+	// not supported by the automaton are matched using TRE
+	if(config.regex_combined && regexid != REGEX_CLI)
+	{
+		if(table->set == NULL)
+			table->set = regex_set_new();
+		if(table->set != NULL)
+			regex[index].combined = regex_set_add(table->set, rgxbuf, index);
+	}
+
+	// Add literal required by regex to the prefilter of this type (if
+	// enabled). Filters without such a literal are always matched using TRE
+	if(config.regex_prefilter && regexid != REGEX_CLI && !regex[index].combined)
+	{
+		if(table->prefilter == NULL)
+			table->prefilter = regex_prefilter_new();
+		if(table->prefilter != NULL)
+			regex[index].prefiltered = regex_prefilter_add(table->prefilter, rgxbuf, index);
+	}
+
 	return true;
 }
 
-static int match_regex(const char *input, DNSCacheData* dns_cache, const int clientID,
-                       const enum regex_type regexid, const bool regextest)
+// Memoized match results of the most recently checked domains. The results of
+// all regex filters of a type only depend on the domain so they are computed
+// once per domain instead of once per domain/client combination. Entries are
+// indexed by domain ID and store a copy of the checked string as the same ID
+// may be checked with different strings (e.g. with and without "www.")
+#define REGEX_CACHE_SIZE 4096u
+struct regex_cache_entry {
+	int domainID;
+	char *input;
+};
+static struct {
+	struct regex_cache_entry *entries;
+	uint64_t *matches;
+	unsigned int words;
+} regex_cache[REGEX_MAX] = {{ NULL, NULL, 0u }};
+
+static const uint64_t *get_cached_matches(const enum regex_type regexid, const int domainID, const char *input)
+{
+	if(domainID < 0 || regex_cache[regexid].entries == NULL)
+		return NULL;
+
+	const unsigned int slot = (unsigned int)domainID % REGEX_CACHE_SIZE;
+	const struct regex_cache_entry *entry = &regex_cache[regexid].entries[slot];
+	if(entry->domainID != domainID || entry->input == NULL || strcmp(entry->input, input) != 0)
+		return NULL;
+
+	return &regex_cache[regexid].matches[slot * regex_cache[regexid].words];
+}
+
+// Get the cache slot for this domain (allocating the cache if needed). Returns
+// NULL if the result cannot be cached
+static uint64_t *cache_matches(const enum regex_type regexid, const int domainID, const char *input)
+{
+	if(domainID < 0 || num_regex[regexid] == 0u)
+		return NULL;
+
+	if(regex_cache[regexid].entries == NULL)
+	{
+		const unsigned int words = (num_regex[regexid] + 63u) / 64u;
+		regex_cache[regexid].entries = calloc(REGEX_CACHE_SIZE, sizeof(struct regex_cache_entry));
+		regex_cache[regexid].matches = calloc(REGEX_CACHE_SIZE * words, sizeof(uint64_t));
+		if(regex_cache[regexid].entries == NULL || regex_cache[regexid].matches == NULL)
+		{
+			free(regex_cache[regexid].entries);
+			free(regex_cache[regexid].matches);
+			regex_cache[regexid].entries = NULL;
+			regex_cache[regexid].matches = NULL;
+			return NULL;
+		}
+		for(unsigned int i = 0; i < REGEX_CACHE_SIZE; i++)
+			regex_cache[regexid].entries[i].domainID = -1;
+		regex_cache[regexid].words = words;
+	}
+
+	const unsigned int slot = (unsigned int)domainID % REGEX_CACHE_SIZE;
+	struct regex_cache_entry *entry = &regex_cache[regexid].entries[slot];
+	free(entry->input);
+	entry->input = strdup(input);
+	if(entry->input == NULL)
+	{
+		entry->domainID = -1;
+		return NULL;
+	}
+	entry->domainID = domainID;
+	return &regex_cache[regexid].matches[slot * regex_cache[regexid].words];
+}
+
+static void free_regex_cache(const enum regex_type regexid)
+{
+	if(regex_cache[regexid].entries != NULL)
+		for(unsigned int i = 0; i < REGEX_CACHE_SIZE; i++)
+			free(regex_cache[regexid].entries[i].input);
+	free(regex_cache[regexid].entries);
+	free(regex_cache[regexid].matches);
+	regex_cache[regexid].entries = NULL;
+	regex_cache[regexid].matches = NULL;
+	regex_cache[regexid].words = 0u;
+}
+
+// Match input against all available regex filters of this type and set the
+// bits of the matching ones in matches (taking inversion into account)
+static void match_all_regex(const char *input, const enum regex_type regexid, uint64_t *matches)
 {
-	int match_idx = -1;
 	regexData *regex = get_regex_ptr(regexid);
 #ifdef USE_TRE_REGEX
 	regmatch_t match[1] = {{ 0 }}; // This also disables any sub-matching
 #endif
+	memset(matches, 0, (num_regex[regexid] + 63u) / 64u * sizeof(*matches));
+
+	// Match input against all combined regex filters of this type at once
+	const unsigned int words = regex_set_words(regex_sets[regexid]);
+	uint64_t combined_matches[words + 1u];
+	const bool combined = regex_set_match(regex_sets[regexid], input, combined_matches);
+
+	// Find regex filters whose required literal is contained in input
+	const unsigned int cwords = regex_prefilter_words(regex_prefilters[regexid]);
+	uint64_t candidates[cwords + 1u];
+	const bool prefiltered = regex_prefilter_match(regex_prefilters[regexid], input, candidates);
+
+	for(unsigned int index = 0; index < num_regex[regexid]; index++)
+	{
+		if(!regex[index].available)
+			continue;
+
+		// Try to match the compiled regular expression against input
+		int retval;
+		if(combined && regex[index].combined)
+		{
+			// Use result of the combined automaton
+			retval = (combined_matches[index / 64u] >> (index % 64u)) & 1u ? REG_OK : REG_NOMATCH;
+		}
+		else if(prefiltered && regex[index].prefiltered &&
+		        !((candidates[index / 64u] >> (index % 64u)) & 1u))
+		{
+			// Required literal is not contained in input, this
+			// regex cannot match
+			retval = REG_NOMATCH;
+			counters->regex_skipped++;
+			if(config.debug & DEBUG_REGEX)
+				logg("Skipping: index = %d, str = \"%s\" (required literal not found)", index, input);
+		}
+		else
+		{
+			counters->regex_executed++;
+			if(config.debug & DEBUG_REGEX)
+				logg("Executing: index = %d, preg = %p, str = \"%s\", pmatch = %p", index, &regex[index].regex, input, &match);
+#ifdef USE_TRE_REGEX
+			retval = tre_regexec(&regex[index].regex, input, 0, match, 0);
+#else
+			retval = regexec(&regex[index].regex, input, 0, NULL, 0);
+#endif
+		}
+
+		// regexec() returns REG_OK for a successful match or REG_NOMATCH for failure.
+		if((retval == REG_OK && !regex[index].ext.inverted) ||
+		   (retval == REG_NOMATCH && regex[index].ext.inverted))
+			matches[index / 64u] |= 1ull << (index % 64u);
+	}
+}
+
+static int match_regex(const char *input, DNSCacheData* dns_cache, const int clientID,
+                       const enum regex_type regexid, const bool regextest)
+{
+	int match_idx = -1;
+	regexData *regex = get_regex_ptr(regexid);
 
 	// Check if we need to recompile regex because they were changed in
 	// another fork. If this is the case, reload everything (regex
@@ -354,9 +532,40 @@ static int match_regex(const char *input, DNSCacheData* dns_cache, const int cli
 		regex = get_regex_ptr(regexid);
 	}
 
+	// Get match results of all regex filters of this type, they are
+	// memoized per domain as they do not depend on the client
+	const unsigned int words = (num_regex[regexid] + 63u) / 64u;
+	uint64_t local_matches[words + 1u];
+	const int domainID = dns_cache != NULL ? dns_cache->domainID : -1;
+	const uint64_t *matches = get_cached_matches(regexid, domainID, input);
+	if(matches == NULL)
+	{
+		uint64_t *cached = cache_matches(regexid, domainID, input);
+		match_all_regex(input, regexid, cached != NULL ? cached : local_matches);
+		matches = cached != NULL ? cached : local_matches;
+	}
+
+	// Get bitmask of the regex filters of this type enabled for this
+	// client. We allow clientID = -1 to get all regex (for testing)
+	const uint64_t *enabled = NULL;
+	if(clientID >= 0 && (enabled = get_per_client_regex_words(clientID, regexid)) == NULL)
+		return -1;
+
 	// Loop over all configured regex filters of this type
 	for(unsigned int index = 0; index < num_regex[regexid]; index++)
 	{
+		// Skip 64 regex filters at once if none of them matches and is
+		// enabled for this client (unless every result is logged)
+		if(index % 64u == 0u && !regextest && !(config.debug & DEBUG_REGEX))
+		{
+			const uint64_t hits = matches[index / 64u] & (enabled != NULL ? enabled[index / 64u] : ~0ull);
+			if(hits == 0u)
+			{
+				index += 63u;
+				continue;
+			}
+		}
+
 		// Only check regex which have been successfully compiled ...
 		if(!regex[index].available)
 		{
@@ -369,16 +578,7 @@ static int match_regex(const char *input, DNSCacheData* dns_cache, const int cli
 			continue;
 		}
 		// ... and are enabled for this client
-		int regexID = index;
-		if(regexid == REGEX_WHITELIST)
-			regexID += num_regex[REGEX_BLACKLIST];
-		else if(regexid == REGEX_CLI)
-			regexID += num_regex[REGEX_BLACKLIST] +
-			           num_regex[REGEX_WHITELIST];
-
-		// Only use regular expressions enabled for this client
-		// We allow clientID = -1 to get all regex (for testing)
-		if(clientID >= 0 && !get_per_client_regex(clientID, regexID))
+		if(enabled != NULL && !((enabled[index / 64u] >> (index % 64u)) & 1u))
 		{
 			if(config.debug & DEBUG_REGEX)
 			{
@@ -393,17 +593,9 @@ static int match_regex(const char *input, DNSCacheData* dns_cache, const int cli
 			continue;
 		}
 
-		// Try to match the compiled regular expression against input
-		if(config.debug & DEBUG_REGEX)
-			logg("Executing: index = %d, preg = %p, str = \"%s\", pmatch = %p", index, &regex[index].regex, input, &match);
-#ifdef USE_TRE_REGEX
-		int retval = tre_regexec(&regex[index].regex, input, 0, match, 0);
-#else
-		int retval = regexec(&regex[index].regex, input, 0, NULL, 0);
-#endif
-		// regexec() returns REG_OK for a successful match or REG_NOMATCH for failure.
-		if ((retval == REG_OK && !regex[index].ext.inverted) ||
-		    (retval == REG_NOMATCH && regex[index].ext.inverted))
+		// The bit is set if the regex matched (or did not match if it
+		// is inverted)
+		if((matches[index / 64u] >> (index % 64u)) & 1u)
 		{
 			// Check possible additional regex settings
 			if(dns_cache != NULL)
@@ -526,6 +718,32 @@ bool in_regex(const char *domain, DNSCacheData *dns_cache, const int clientID, c
 	return false;
 }
 
+// Free all regex filters of a table
+static void free_regex_table(struct regex_table *table)
+{
+	for(unsigned int index = 0; index < table->num; index++)
+	{
+		if(!table->regex[index].available)
+			continue;
+
+		regfree(&table->regex[index].regex);
+
+		// Also free buffered regex strings
+		free(table->regex[index].string);
+	}
+
+	// Free array with regex datastructure
+	free(table->regex);
+
+	// Free combined automaton
+	regex_set_free(table->set);
+
+	// Free literal prefilter
+	regex_prefilter_free(table->prefilter);
+
+	memset(table, 0, sizeof(*table));
+}
+
 static void free_regex(void)
 {
 	// Return early if we don't use any regex filters
@@ -550,45 +768,31 @@ static void free_regex(void)
 	// Loop over regex types
 	for(enum regex_type regexid = REGEX_BLACKLIST; regexid < REGEX_MAX; regexid++)
 	{
-		regexData *regex = get_regex_ptr(regexid);
+		struct regex_table table = {
+			get_regex_ptr(regexid), num_regex[regexid],
+			regex_sets[regexid], regex_prefilters[regexid]
+		};
 
 		// Reset counter for number of regex
-		const unsigned int oldcount = num_regex[regexid];
 		num_regex[regexid] = 0;
 
 		// Exit early if the regex has already been freed (or has never been used)
-		if(regex == NULL)
+		if(table.regex == NULL)
 			continue;
 
 		if(config.debug & DEBUG_DATABASE)
 		{
 			logg("Going to free %i entries in %s regex struct",
-			     oldcount, regextype[regexid]);
+			     table.num, regextype[regexid]);
 		}
 
-		// Loop over entries with this regex type
-		for(unsigned int index = 0; index < oldcount; index++)
-		{
-			if(!regex[index].available)
-				continue;
-
-			regfree(&regex[index].regex);
-
-			// Also free buffered regex strings
-			if(regex[index].string != NULL)
-			{
-				free(regex[index].string);
-				regex[index].string = NULL;
-			}
-		}
+		// Free compiled regex, their combined automaton and literal
+		// prefilter and reset the pointers to them
+		free_regex_table(&table);
+		install_regex_table(regexid, &table);
 
-		if(config.debug & DEBUG_DATABASE)
-		{
-			logg("Loop done, freeing regex pointer (%p)", regex);
-		}
-
-		// Free array with regex datastructure
-		free_regex_ptr(regexid);
+		// Free memoized match results
+		free_regex_cache(regexid);
 	}
 }
 
@@ -617,7 +821,10 @@ void reload_per_client_regex(clientsData *client)
 		                                  "vw_regex_whitelist");
 }
 
-static void read_regex_table(const enum regex_type regexid)
+// Read and compile the regex filters of this type into table. If next is true,
+// they are read from the gravity database connection prepared by
+// gravityDB_prepare_swap() instead of the current one
+static void read_regex_table(const enum regex_type regexid, struct regex_table *table, const bool next)
 {
 	// Get table ID
 	const enum gravity_tables tableID = (regexid == REGEX_BLACKLIST) ? REGEX_BLACKLIST_TABLE : REGEX_WHITELIST_TABLE;
@@ -626,8 +833,8 @@ static void read_regex_table(const enum regex_type regexid)
 		logg("Reading regex %s from database", regextype[regexid]);
 
 	// Get number of lines in the regex table
-	num_regex[regexid] = 0;
-	int count = gravityDB_count(tableID);
+	table->num = 0;
+	int count = next ? gravityDB_countNext(tableID) : gravityDB_count(tableID);
 
 	if(count == 0)
 	{
@@ -640,20 +847,10 @@ static void read_regex_table(const enum regex_type regexid)
 	}
 
 	// Allocate memory for regex
-	regexData *regex = NULL;
-	if(regexid == REGEX_BLACKLIST)
-	{
-		black_regex = calloc(count, sizeof(regexData));
-		regex = black_regex;
-	}
-	else
-	{
-		white_regex = calloc(count, sizeof(regexData));
-		regex = white_regex;
-	}
+	table->regex = calloc(count, sizeof(regexData));
 
 	// Connect to regex table
-	if(!gravityDB_getTable(tableID))
+	if(!(next ? gravityDB_getNextTable(tableID) : gravityDB_getTable(tableID)))
 	{
 		logg("read_regex_from_database(): Error getting %s regex table from database",
 		     regextype[regexid]);
@@ -663,14 +860,14 @@ static void read_regex_table(const enum regex_type regexid)
 	// Walk database table
 	const char *domain = NULL;
 	int rowid = 0;
-	while((domain = gravityDB_getDomain(&rowid)) != NULL)
+	while((domain = next ? gravityDB_getNextDomain(&rowid) : gravityDB_getDomain(&rowid)) != NULL)
 	{
 		// Avoid buffer overflow if database table changed
 		// since we counted its entries
-		if(num_regex[regexid] >= (unsigned int)count)
+		if(table->num >= (unsigned int)count)
 		{
 			logg("INFO: read_regex_table(%s) exiting early to avoid overflow (%d/%d).",
-			     regextype[regexid], num_regex[regexid], count);
+			     regextype[regexid], table->num, count);
 			break;
 		}
 
@@ -687,46 +884,36 @@ static void read_regex_table(const enum regex_type regexid)
 		if(config.debug & DEBUG_REGEX)
 		{
 			logg("Compiling %s regex %i (DB ID %i): %s",
-			     regextype[regexid], num_regex[regexid], rowid, domain);
+			     regextype[regexid], table->num, rowid, domain);
 		}
 
-		compile_regex(domain, regexid, rowid);
-		regex[num_regex[regexid]-1].database_id = rowid;
+		compile_regex(domain, regexid, rowid, table);
+		table->regex[table->num-1].database_id = rowid;
 
-		// Signal other forks that the regex data has changed and should be updated
-		regex_change = ++counters->regex_change;
+		// Signal other forks that the regex data has changed and should
+		// be updated (regex_swap() does this for prepared filters)
+		if(!next)
+			regex_change = ++counters->regex_change;
 	}
 
 	// Finalize statement and close gravity database handle
-	gravityDB_finalizeTable();
+	if(next)
+		gravityDB_finalizeNextTable();
+	else
+		gravityDB_finalizeTable();
 
 	if(config.debug & DEBUG_DATABASE)
 	{
 		logg("Read %i %s regex entries",
-		     num_regex[regexid],
+		     table->num,
 		     regextype[regexid]);
 	}
 }
 
-void read_regex_from_database(void)
+// Load per-client regex data of all clients, not all of the regex read and
+// compiled will also be used by all clients
+static void reload_all_per_client_regex(void)
 {
-	// Free regex filters
-	// This routine is safe to be called even when there
-	// are no regex filters at the moment
-	free_regex();
-
-	// Start timer for regex compilation analysis
-	timer_start(REGEX_TIMER);
-
-	// Read and compile regex blacklist
-	read_regex_table(REGEX_BLACKLIST);
-
-	// Read and compile regex whitelist
-	read_regex_table(REGEX_WHITELIST);
-
-	// Loop over all clients and ensure we have enough space and load
-	// per-client regex data, not all of the regex read and compiled above
-	// will also be used by all clients
 	if(config.debug & DEBUG_DATABASE)
 		logg("Loading per-client regex data");
 	for(int clientID = 0; clientID < counters->clients; clientID++)
@@ -739,6 +926,29 @@ void read_regex_from_database(void)
 
 		reload_per_client_regex(client);
 	}
+}
+
+void read_regex_from_database(void)
+{
+	// Free regex filters
+	// This routine is safe to be called even when there
+	// are no regex filters at the moment
+	free_regex();
+
+	// Start timer for regex compilation analysis
+	timer_start(REGEX_TIMER);
+
+	// Read and compile regex blacklist and whitelist
+	for(enum regex_type regexid = REGEX_BLACKLIST; regexid < REGEX_CLI; regexid++)
+	{
+		struct regex_table table = { NULL, 0u, NULL, NULL };
+		read_regex_table(regexid, &table, false);
+		install_regex_table(regexid, &table);
+	}
+
+	// Loop over all clients and ensure we have enough space and load
+	// per-client regex data
+	reload_all_per_client_regex();
 
 	// Print message to FTL's log after reloading regex filters
 	logg("Compiled %i whitelist and %i blacklist regex filters for %i clients in %.1f msec",
@@ -746,6 +956,53 @@ void read_regex_from_database(void)
 	     counters->clients, timer_elapsed_msec(REGEX_TIMER));
 }
 
+// Compile the regex filters of the gravity database connection prepared by
+// gravityDB_prepare_swap(). The current regex filters are not touched so this
+// can be done without locking the shared memory
+void regex_prepare_swap(void)
+{
+	// Discard filters prepared earlier but never installed
+	for(enum regex_type regexid = REGEX_BLACKLIST; regexid < REGEX_CLI; regexid++)
+		free_regex_table(&next_regex[regexid]);
+
+	timer_start(REGEX_TIMER);
+	for(enum regex_type regexid = REGEX_BLACKLIST; regexid < REGEX_CLI; regexid++)
+		read_regex_table(regexid, &next_regex[regexid], true);
+	next_regex_msec = timer_elapsed_msec(REGEX_TIMER);
+
+	next_regex_prepared = true;
+}
+
+// Replace the current regex filters by the ones compiled by
+// regex_prepare_swap() and load the per-client regex data. If no filters have
+// been prepared, they are read from the current gravity database connection.
+// May only be called while the shared memory is locked
+void regex_swap(void)
+{
+	if(!next_regex_prepared)
+	{
+		read_regex_from_database();
+		return;
+	}
+
+	free_regex();
+	for(enum regex_type regexid = REGEX_BLACKLIST; regexid < REGEX_CLI; regexid++)
+		install_regex_table(regexid, &next_regex[regexid]);
+	next_regex_prepared = false;
+
+	// Signal other forks that the regex data has changed and should be updated
+	regex_change = ++counters->regex_change;
+
+	// Loop over all clients and ensure we have enough space and load
+	// per-client regex data
+	reload_all_per_client_regex();
+
+	// Print message to FTL's log after reloading regex filters
+	logg("Compiled %i whitelist and %i blacklist regex filters for %i clients in %.1f msec",
+	     num_regex[REGEX_WHITELIST], num_regex[REGEX_BLACKLIST],
+	     counters->clients, next_regex_msec);
+}
+
 int regex_test(const bool debug_mode, const bool quiet, const char *domainin, const char *regexin)
 {
 	// Prepare counters and regex memories
@@ -768,8 +1025,12 @@ int regex_test(const bool debug_mode, const bool quiet, const char *domainin, co
 		logg("%s Loading regex filters from database...", cli_info());
 		timer_start(REGEX_TIMER);
 		log_ctrl(false, true); // Temporarily re-enable terminal output for error logging
-		read_regex_table(REGEX_BLACKLIST);
-		read_regex_table(REGEX_WHITELIST);
+		for(enum regex_type regexid = REGEX_BLACKLIST; regexid < REGEX_CLI; regexid++)
+		{
+			struct regex_table table = { NULL, 0u, NULL, NULL };
+			read_regex_table(regexid, &table, false);
+			install_regex_table(regexid, &table);
+		}
 		log_ctrl(false, !quiet); // Re-apply quiet option after compilation
 		logg("    Compiled %i black- and %i whitelist regex filters in %.3f msec\n",
 		     num_regex[REGEX_BLACKLIST],
@@ -794,12 +1055,14 @@ int regex_test(const bool debug_mode, const bool quiet, const char *domainin, co
 	{
 		// Compile CLI regex
 		logg("%s Compiling regex filter...", cli_info());
-		cli_regex = calloc(1, sizeof(regexData));
+		struct regex_table table = { calloc(1, sizeof(regexData)), 0u, NULL, NULL };
 
 		// Compile CLI regex
 		timer_start(REGEX_TIMER);
 		log_ctrl(false, true); // Temporarily re-enable terminal output for error logging
-		if(!compile_regex(regexin, REGEX_CLI, -1))
+		const bool compiled = compile_regex(regexin, REGEX_CLI, -1, &table);
+		install_regex_table(REGEX_CLI, &table);
+		if(!compiled)
 			return EXIT_FAILURE;
 		log_ctrl(false, !quiet); // Re-apply quiet option after compilation
 		logg("    Compiled regex filter in %.3f msec\n", timer_elapsed_msec(REGEX_TIMER));
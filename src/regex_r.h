@@ -28,6 +28,8 @@ extern const char *regextype[];
 
 typedef struct {
 	bool available :1;
+	bool combined :1;
+	bool prefiltered :1;
 	struct {
 		bool inverted :1;
 		bool custom_ip4 :1;
@@ -47,6 +49,8 @@ bool in_regex(const char *domain, DNSCacheData *dns_cache, const int clientID, c
 void allocate_regex_client_enabled(clientsData *client, const int clientID);
 void reload_per_client_regex(clientsData *client);
 void read_regex_from_database(void);
+void regex_prepare_swap(void);
+void regex_swap(void);
 bool regex_get_redirect(const int regexID, struct in_addr *addr4, struct in6_addr *addr6);
 
 int regex_test(const bool debug_mode, const bool quiet, const char *domainin, const char *regexin);
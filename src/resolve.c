@@ -317,16 +317,12 @@ char *resolveHostname(const char *addr)
 	return hostname;
 }
 
-// Resolve upstream destination host names
-static size_t resolveAndAddHostname(size_t ippos, size_t oldnamepos)
+// Resolve host name of the given IP address. Returns the new host name if it
+// differs from oldname (has to be free'd by the caller) or NULL if unchanged.
+// Neither ipaddr nor oldname may point into shared memory as we don't hold
+// the lock while resolving
+static char *resolveNewHostname(const char *ipaddr, const char *oldname)
 {
-	// Get IP and host name strings. They are cloned in case shared memory is
-	// resized before the next lock
-	lock_shm();
-	char *ipaddr = strdup(getstr(ippos));
-	char *oldname = strdup(getstr(oldnamepos));
-	unlock_shm();
-
 	// Test if we want to resolve host names, otherwise all calls to resolveHostname()
 	// and getNameFromIP() can be skipped as they will all return empty names (= no records)
 	if(!resolve_this_name(ipaddr))
@@ -334,12 +330,8 @@ static size_t resolveAndAddHostname(size_t ippos, size_t oldnamepos)
 		if(config.debug & DEBUG_RESOLVER)
 			logg(" ---> \"\" (configured to not resolve host name)");
 
-		// Free allocated memory
-		free(ipaddr);
-		free(oldname);
-
-		// Return fixed position of empty string
-		return 0;
+		// Return empty string (if not already empty)
+		return strlen(oldname) > 0 ? strdup("") : NULL;
 	}
 
 	// Important: Don't hold a lock while resolving as the main thread
@@ -356,21 +348,11 @@ static size_t resolveAndAddHostname(size_t ippos, size_t oldnamepos)
 			logg(" ---> \"%s\" (provided by database)", newname);
 	}
 
-	// Only store new newname if it is valid and differs from oldname
+	// Only return new newname if it is valid and differs from oldname
 	// We do not need to check for oldname == NULL as names are
 	// always initialized with an empty string at position 0
 	if(newname != NULL && strcmp(oldname, newname) != 0)
-	{
-		lock_shm();
-		size_t newnamepos = addstr(newname);
-		// newname has already been checked against NULL
-		// so we can safely free it
-		free(newname);
-		free(ipaddr);
-		free(oldname);
-		unlock_shm();
-		return newnamepos;
-	}
+		return newname;
 	else if(config.debug & DEBUG_SHMEM)
 	{
 		// Debugging output
@@ -379,11 +361,9 @@ static size_t resolveAndAddHostname(size_t ippos, size_t oldnamepos)
 
 	if(newname != NULL)
 		free(newname);
-	free(ipaddr);
-	free(oldname);
 
-	// Not changed, return old namepos
-	return oldnamepos;
+	// Not changed
+	return NULL;
 }
 
 // Resolve client host names
@@ -417,9 +397,12 @@ static void resolveClients(const bool onlynew, const bool force_refreshing)
 			continue;
 		}
 
+		// Get IP and host name strings. They are cloned as string
+		// positions may change (resizing, compaction during GC) before
+		// the next lock
 		bool newflag = client->flags.new;
-		size_t ippos = client->ippos;
-		size_t oldnamepos = client->namepos;
+		char *ipaddr = strdup(getstr(client->ippos));
+		char *oldname = strdup(getstr(client->namepos));
 
 		// Only try to resolve host names of clients which were recently active if we are re-resolving
 		// Limit for a "recently active" client is two hours ago
@@ -428,9 +411,11 @@ static void resolveClients(const bool onlynew, const bool force_refreshing)
 			if(config.debug & DEBUG_RESOLVER)
 			{
 				logg("Skipping client %s (%s) because it was inactive for %i seconds",
-				     getstr(ippos), getstr(oldnamepos), (int)(now - client->lastQuery));
+				     ipaddr, oldname, (int)(now - client->lastQuery));
 			}
 			unlock_shm();
+			free(ipaddr);
+			free(oldname);
 			continue;
 		}
 
@@ -443,17 +428,16 @@ static void resolveClients(const bool onlynew, const bool force_refreshing)
 			if(config.debug & DEBUG_RESOLVER)
 			{
 				logg("Skipping client %s (%s) because it is not new",
-				     getstr(ippos), getstr(oldnamepos));
+				     ipaddr, oldname);
 			}
 			skipped++;
+			free(ipaddr);
+			free(oldname);
 			continue;
 		}
 
 		// Check if we want to resolve an IPv6 address
-		bool IPv6 = false;
-		const char *ipaddr = NULL;
-		if((ipaddr = getstr(ippos)) != NULL && strstr(ipaddr,":") != NULL)
-			IPv6 = true;
+		const bool IPv6 = strstr(ipaddr,":") != NULL;
 
 		// If we're in refreshing mode (onlynew == false), we skip clients if
 		// 1. We should not refresh any hostnames
@@ -463,7 +447,7 @@ static void resolveClients(const bool onlynew, const bool force_refreshing)
 		if(onlynew == false &&
 		   (config.refresh_hostnames == REFRESH_NONE ||
 		   (config.refresh_hostnames == REFRESH_IPV4_ONLY && IPv6) ||
-		   (config.refresh_hostnames == REFRESH_UNKNOWN && oldnamepos != 0)))
+		   (config.refresh_hostnames == REFRESH_UNKNOWN && strlen(oldname) > 0)))
 		{
 			if(config.debug & DEBUG_RESOLVER)
 			{
@@ -476,20 +460,18 @@ static void resolveClients(const bool onlynew, const bool force_refreshing)
 					reason = "Looking only for unknown hostnames";
 
 				logg("Skipping client %s (%s) because it should not be refreshed: %s",
-				     getstr(ippos), getstr(oldnamepos), reason);
+				     ipaddr, oldname, reason);
 			}
 			skipped++;
 			if(config.debug & DEBUG_RESOLVER)
-			{
-				lock_shm();
-				logg("Client %s -> \"%s\" already known", getstr(ippos), getstr(oldnamepos));
-				unlock_shm();
-			}
+				logg("Client %s -> \"%s\" already known", ipaddr, oldname);
+			free(ipaddr);
+			free(oldname);
 			continue;
 		}
 
 		// Obtain/update hostname of this client
-		size_t newnamepos = resolveAndAddHostname(ippos, oldnamepos);
+		char *newname = resolveNewHostname(ipaddr, oldname);
 
 		lock_shm();
 		// Get client pointer for the second time (writing data)
@@ -502,18 +484,27 @@ static void resolveClients(const bool onlynew, const bool force_refreshing)
 			logg("ERROR: Unable to get client pointer (2) with ID %i, skipping...", clientID);
 			skipped++;
 			unlock_shm();
+			free(ipaddr);
+			free(oldname);
+			if(newname != NULL)
+				free(newname);
 			continue;
 		}
 
-		// Store obtained host name (may be unchanged)
-		client->namepos = newnamepos;
+		// Store obtained host name (if changed)
+		if(newname != NULL)
+			client->namepos = addstr(newname);
 		// Mark entry as not new
 		client->flags.new = false;
 
 		if(config.debug & DEBUG_RESOLVER)
-			logg("Client %s -> \"%s\" is new", getstr(ippos), getstr(newnamepos));
+			logg("Client %s -> \"%s\" is new", ipaddr, getstr(client->namepos));
 
 		unlock_shm();
+		free(ipaddr);
+		free(oldname);
+		if(newname != NULL)
+			free(newname);
 	}
 
 	if(config.debug & DEBUG_RESOLVER)
@@ -547,9 +538,12 @@ static void resolveUpstreams(const bool onlynew)
 			continue;
 		}
 
+		// Get IP and host name strings. They are cloned as string
+		// positions may change (resizing, compaction during GC) before
+		// the next lock
 		bool newflag = upstream->new;
-		size_t ippos = upstream->ippos;
-		size_t oldnamepos = upstream->namepos;
+		char *ipaddr = strdup(getstr(upstream->ippos));
+		char *oldname = strdup(getstr(upstream->namepos));
 
 		// Only try to resolve host names of upstream servers which were recently active
 		// Limit for a "recently active" upstream server is two hours ago
@@ -558,9 +552,11 @@ static void resolveUpstreams(const bool onlynew)
 			if(config.debug & DEBUG_RESOLVER)
 			{
 				logg("Skipping upstream %s (%s) because it was inactive for %i seconds",
-				     getstr(ippos), getstr(oldnamepos), (int)(now - upstream->lastQuery));
+				     ipaddr, oldname, (int)(now - upstream->lastQuery));
 			}
 			unlock_shm();
+			free(ipaddr);
+			free(oldname);
 			continue;
 		}
 		unlock_shm();
@@ -571,16 +567,14 @@ static void resolveUpstreams(const bool onlynew)
 		{
 			skipped++;
 			if(config.debug & DEBUG_RESOLVER)
-			{
-				lock_shm();
-				logg("Upstream %s -> \"%s\" already known", getstr(ippos), getstr(oldnamepos));
-				unlock_shm();
-			}
+				logg("Upstream %s -> \"%s\" already known", ipaddr, oldname);
+			free(ipaddr);
+			free(oldname);
 			continue;
 		}
 
 		// Obtain/update hostname of this client
-		size_t newnamepos = resolveAndAddHostname(ippos, oldnamepos);
+		char *newname = resolveNewHostname(ipaddr, oldname);
 
 		lock_shm();
 		// Get upstream pointer for the second time (writing data)
@@ -593,18 +587,27 @@ static void resolveUpstreams(const bool onlynew)
 			logg("ERROR: Unable to get upstream pointer with ID %i, skipping...", upstreamID);
 			skipped++;
 			unlock_shm();
+			free(ipaddr);
+			free(oldname);
+			if(newname != NULL)
+				free(newname);
 			continue;
 		}
 
-		// Store obtained host name (may be unchanged)
-		upstream->namepos = newnamepos;
+		// Store obtained host name (if changed)
+		if(newname != NULL)
+			upstream->namepos = addstr(newname);
 		// Mark entry as not new
 		upstream->new = false;
 
 		if(config.debug & DEBUG_RESOLVER)
-			logg("Upstream %s -> \"%s\" is new", getstr(ippos), getstr(newnamepos));
+			logg("Upstream %s -> \"%s\" is new", ipaddr, getstr(upstream->namepos));
 
 		unlock_shm();
+		free(ipaddr);
+		free(oldname);
+		if(newname != NULL)
+			free(newname);
 	}
 
 	if(config.debug & DEBUG_RESOLVER)
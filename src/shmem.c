@@ -30,9 +30,11 @@
 #include "database/message-table.h"
 // check_running_FTL()
 #include "procps.h"
+// SYS_tgkill
+#include <sys/syscall.h>
 
 /// The version of shared memory used
-#define SHARED_MEMORY_VERSION 14
+#define SHARED_MEMORY_VERSION 28
 
 /// The name of the shared memory. Use this when connecting to the shared memory.
 #define SHMEM_PATH "/dev/shm"
@@ -47,6 +49,11 @@
 #define SHARED_SETTINGS_NAME "FTL-settings"
 #define SHARED_DNS_CACHE "FTL-dns-cache"
 #define SHARED_PER_CLIENT_REGEX "FTL-per-client-regex"
+#define SHARED_DOMAINS_LOOKUP_NAME "FTL-domains-lookup"
+#define SHARED_CLIENTS_LOOKUP_NAME "FTL-clients-lookup"
+#define SHARED_QUERIES_LOOKUP_NAME "FTL-queries-lookup"
+#define SHARED_DNS_CACHE_LOOKUP_NAME "FTL-dns-cache-lookup"
+#define SHARED_STRINGS_LOOKUP_NAME "FTL-strings-lookup"
 
 // Allocation step for FTL-strings bucket. This is somewhat special as we use
 // this as a general-purpose storage which should always be large enough. If,
@@ -70,6 +77,11 @@ static SharedMemory shm_overTime = { 0 };
 static SharedMemory shm_settings = { 0 };
 static SharedMemory shm_dns_cache = { 0 };
 static SharedMemory shm_per_client_regex = { 0 };
+static SharedMemory shm_domains_lookup = { 0 };
+static SharedMemory shm_clients_lookup = { 0 };
+static SharedMemory shm_queries_lookup = { 0 };
+static SharedMemory shm_dns_cache_lookup = { 0 };
+static SharedMemory shm_strings_lookup = { 0 };
 
 static SharedMemory *sharedMemories[] = { &shm_lock,
                                           &shm_strings,
@@ -81,7 +93,12 @@ static SharedMemory *sharedMemories[] = { &shm_lock,
                                           &shm_overTime,
                                           &shm_settings,
                                           &shm_dns_cache,
-                                          &shm_per_client_regex };
+                                          &shm_per_client_regex,
+                                          &shm_domains_lookup,
+                                          &shm_clients_lookup,
+                                          &shm_queries_lookup,
+                                          &shm_dns_cache_lookup,
+                                          &shm_strings_lookup };
 #define NUM_SHMEM (sizeof(sharedMemories)/sizeof(SharedMemory*))
 
 // Variable size array structs
@@ -90,16 +107,48 @@ static clientsData *clients = NULL;
 static domainsData *domains = NULL;
 static upstreamsData *upstreams = NULL;
 static DNSCacheData *dns_cache = NULL;
+static struct lookup_table *domains_lookup = NULL;
+static struct lookup_table *clients_lookup = NULL;
+static struct lookup_table *queries_lookup = NULL;
+static struct lookup_table *dns_cache_lookup = NULL;
+static struct lookup_table *strings_lookup = NULL;
+
+// Maximum number of concurrent shared readers. This needs to be at least the
+// number of API threads. If all slots are in use, further readers fall back
+// to taking the exclusive lock
+#define MAX_SHM_READERS 16
+
+// Time a writer waits for the last reader before it checks if the readers
+// are still alive
+#define SHM_READER_TIMEOUT_MS 100
 
 typedef struct {
 	struct {
 		pthread_mutex_t outer;
 		pthread_mutex_t inner;
+		// Protects readers, num_readers and readers_done below
+		pthread_mutex_t readers;
 	} lock;
 	struct {
 		volatile pid_t pid;
 		volatile pid_t tid;
+		// When the lock was obtained and by which call site (index
+		// into stats below)
+		uint64_t since;
+		int site;
 	} owner;
+	// Wait and hold times of the exclusive lock per call site
+	unsigned int num_sites;
+	lockStatsData stats[LOCK_STATS_SITES];
+	// Threads currently holding a shared (read-only) lock. A slot is
+	// in use when its pid is non-zero
+	struct {
+		pid_t pid;
+		pid_t tid;
+	} readers[MAX_SHM_READERS];
+	unsigned int num_readers;
+	// Signaled by the last reader releasing its slot
+	pthread_cond_t readers_done;
 } ShmLock;
 static ShmLock *shmLock = NULL;
 static ShmSettings *shmSettings = NULL;
@@ -258,6 +307,46 @@ bool strcmp_escaped(const char *a, const char *b)
 }
 
 
+static bool string_cmp(const unsigned int pos, const struct lookup_data *lookup_data)
+{
+	return strcmp(&((const char*)shm_strings.ptr)[pos], lookup_data->string) == 0;
+}
+
+// Store a string in the shared string buffer unless it is already known, in
+// which case the position of the existing copy is returned. len includes the
+// terminating character
+static size_t intern_string(const char *str, const size_t len)
+{
+	// Check if this string is already stored
+	const uint32_t hash = hashStr(str);
+	const struct lookup_data lookup_data = { .string = str };
+	unsigned int pos = 0u;
+	if(lookup_find_id(STRINGS_LOOKUP, hash, &lookup_data, &pos, string_cmp))
+	{
+		if(config.debug & DEBUG_SHMEM)
+			logg("Reusing \"%s\" at position %u in buffer", str, pos);
+		return pos;
+	}
+
+	// Debugging output
+	if(config.debug & DEBUG_SHMEM)
+		logg("Adding \"%s\" (len %zu) to buffer. next_str_pos is %u", str, len, shmSettings->next_str_pos);
+
+	// Copy the C string pointed by str into the shared string buffer
+	pos = shmSettings->next_str_pos;
+	strncpy(&((char*)shm_strings.ptr)[pos], str, len);
+
+	// Increment string length counter
+	shmSettings->next_str_pos += len;
+
+	// Remember where we stored this string
+	lookup_insert(STRINGS_LOOKUP, pos, hash);
+	counters->strings++;
+
+	// Return start of stored string
+	return pos;
+}
+
 size_t addstr(const char *input)
 {
 	if(input == NULL)
@@ -295,19 +384,128 @@ size_t addstr(const char *input)
 	if(N > 0)
 		logg("INFO: FTL replaced %u invalid characters with ~ in the query \"%s\"", N, str);
 
-	// Debugging output
-	if(config.debug & DEBUG_SHMEM)
-		logg("Adding \"%s\" (len %zu) to buffer. next_str_pos is %u", str, len, shmSettings->next_str_pos);
+	// Terminate (possibly shortened) string so it can be compared against
+	// the strings already stored in the buffer
+	str[len-1] = '\0';
 
-	// Copy the C string pointed by str into the shared string buffer
-	strncpy(&((char*)shm_strings.ptr)[shmSettings->next_str_pos], str, len);
+	const size_t pos = intern_string(str, len);
 	free(str);
 
-	// Increment string length counter
-	shmSettings->next_str_pos += len;
+	return pos;
+}
 
-	// Return start of stored string
-	return (shmSettings->next_str_pos - len);
+// Call update() for all string positions stored in shared memory objects
+static void foreach_string_pos(void (*update)(size_t *pos, void *data), void *data)
+{
+	for(int domainID = 0; domainID < counters->domains; domainID++)
+	{
+		domainsData *domain = getDomain(domainID, true);
+		if(domain == NULL)
+			continue;
+
+		update(&domain->domainpos, data);
+	}
+
+	for(int clientID = 0; clientID < counters->clients; clientID++)
+	{
+		clientsData *client = getClient(clientID, true);
+		if(client == NULL)
+			continue;
+
+		update(&client->ippos, data);
+		update(&client->namepos, data);
+		update(&client->groupspos, data);
+		update(&client->ifacepos, data);
+	}
+
+	for(int upstreamID = 0; upstreamID < counters->upstreams; upstreamID++)
+	{
+		upstreamsData *upstream = getUpstream(upstreamID, true);
+		if(upstream == NULL)
+			continue;
+
+		update(&upstream->ippos, data);
+		update(&upstream->namepos, data);
+	}
+}
+
+struct string_usage {
+	unsigned char *seen;
+	size_t live;
+};
+
+static void count_live_string(size_t *pos, void *data)
+{
+	struct string_usage *usage = data;
+
+	// Strings may be referenced more than once, count each one only once
+	if(*pos == 0 || *pos >= shmSettings->next_str_pos ||
+	   usage->seen[*pos / 8] & (1u << (*pos % 8)))
+		return;
+
+	usage->seen[*pos / 8] |= 1u << (*pos % 8);
+	usage->live += strlen(&((const char*)shm_strings.ptr)[*pos]) + 1;
+}
+
+static void reintern_string(size_t *pos, void *data)
+{
+	const char *old = data;
+	if(*pos == 0 || *pos >= shmSettings->next_str_pos)
+		return;
+
+	const char *str = &old[*pos];
+	*pos = intern_string(str, strlen(str) + 1);
+}
+
+void shm_compact_strings(void)
+{
+	// Find out how much of the string buffer is still in use
+	const size_t used = shmSettings->next_str_pos;
+	struct string_usage usage = { NULL, 1 };
+	usage.seen = calloc(used / 8 + 1, sizeof(unsigned char));
+	if(usage.seen == NULL)
+		return;
+	foreach_string_pos(count_live_string, &usage);
+	free(usage.seen);
+
+	// Only compact when at least a quarter of the used memory (and at
+	// least one page) is wasted by strings nobody references any longer
+	const size_t wasted = used - usage.live;
+	if(config.debug & DEBUG_SHMEM)
+		logg("String buffer: %zu bytes used, %zu bytes live", used, usage.live);
+	if(wasted < used / 4 || wasted < (size_t)pagesize)
+		return;
+
+	// Copy the current buffer as we are going to rebuild it in place
+	char *old = malloc(used);
+	if(old == NULL)
+		return;
+	memcpy(old, shm_strings.ptr, used);
+
+	// Rebuild string buffer and index from scratch. As we only ever write
+	// to memory that has already been read into old, we can reuse the
+	// shared memory object directly
+	memset(strings_lookup, 0, counters->strings_lookup_MAX*sizeof(struct lookup_table));
+	counters->strings_lookup_used = 0;
+	counters->strings = 0;
+	shmSettings->next_str_pos = 1;
+	foreach_string_pos(reintern_string, old);
+	free(old);
+
+	// Clear memory no longer in use
+	memset(&((char*)shm_strings.ptr)[shmSettings->next_str_pos], 0, used - shmSettings->next_str_pos);
+
+	logg("Compacted shared string buffer from %zu to %u bytes", used, shmSettings->next_str_pos);
+}
+
+time_t query_get_timestamp(const queriesData *query)
+{
+	return shmSettings->epoch + query->reltime;
+}
+
+void query_set_timestamp(queriesData *query, const time_t timestamp)
+{
+	query->reltime = (int32_t)(timestamp - shmSettings->epoch);
 }
 
 const char *_getstr(const size_t pos, const char *func, const int line, const char *file)
@@ -346,6 +544,26 @@ static pthread_mutex_t create_mutex(void) {
 	return lock;
 }
 
+static void init_cond(pthread_cond_t *cond)
+{
+	pthread_condattr_t cond_attr = {};
+
+	// Initialize the condition variable attributes
+	pthread_condattr_init(&cond_attr);
+
+	// Allow the condition variable to be used by other processes
+	pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+
+	// Use the monotonic clock for timed waits
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+
+	// Initialize the condition variable
+	pthread_cond_init(cond, &cond_attr);
+
+	// Destroy the attributes since we're done with them
+	pthread_condattr_destroy(&cond_attr);
+}
+
 static void remap_shm(void)
 {
 	// Remap shared object pointers which might have changed
@@ -364,22 +582,107 @@ static void remap_shm(void)
 	realloc_shm(&shm_dns_cache, counters->dns_cache_MAX, sizeof(DNSCacheData), false);
 	dns_cache = (DNSCacheData*)shm_dns_cache.ptr;
 
-	realloc_shm(&shm_per_client_regex, counters->per_client_regex_MAX, sizeof(bool), false);
-	// per-client-regex bools are not exposed by a global pointer
+	realloc_shm(&shm_per_client_regex, counters->per_client_regex_MAX, sizeof(uint64_t), false);
+	// per-client-regex bitmasks are not exposed by a global pointer
 
 	realloc_shm(&shm_strings, counters->strings_MAX, sizeof(char), false);
 	// strings are not exposed by a global pointer
 
+	realloc_shm(&shm_domains_lookup, counters->domains_lookup_MAX, sizeof(struct lookup_table), false);
+	domains_lookup = (struct lookup_table*)shm_domains_lookup.ptr;
+
+	realloc_shm(&shm_clients_lookup, counters->clients_lookup_MAX, sizeof(struct lookup_table), false);
+	clients_lookup = (struct lookup_table*)shm_clients_lookup.ptr;
+
+	realloc_shm(&shm_queries_lookup, counters->queries_lookup_MAX, sizeof(struct lookup_table), false);
+	queries_lookup = (struct lookup_table*)shm_queries_lookup.ptr;
+
+	realloc_shm(&shm_dns_cache_lookup, counters->dns_cache_lookup_MAX, sizeof(struct lookup_table), false);
+	dns_cache_lookup = (struct lookup_table*)shm_dns_cache_lookup.ptr;
+
+	realloc_shm(&shm_strings_lookup, counters->strings_lookup_MAX, sizeof(struct lookup_table), false);
+	strings_lookup = (struct lookup_table*)shm_strings_lookup.ptr;
+
 	// Update local counter to reflect that we absorbed this change
 	local_shm_counter = shmSettings->global_shm_counter;
 }
 
-// Obtain SHMEM lock
-void _lock_shm(const char *func, const int line, const char *file)
+// Check if the thread holding a reader slot is still alive
+static bool reader_alive(const pid_t pid, const pid_t tid)
 {
-	if(config.debug & DEBUG_LOCKS)
-		logg("Waiting for SHM lock in %s() (%s:%i)", func, file, line);
+	return syscall(SYS_tgkill, pid, tid, 0) == 0 || errno != ESRCH;
+}
+
+// Lock the mutex protecting the reader slots, making it consistent if necessary
+static void lock_readers(void)
+{
+	const int result = pthread_mutex_lock(&shmLock->lock.readers);
+	if(result == EOWNERDEAD)
+		pthread_mutex_consistent(&shmLock->lock.readers);
+	else if(result != 0)
+		logg("Error when obtaining SHM readers lock: %s", strerror(result));
+}
+
+static void unlock_readers(void)
+{
+	const int result = pthread_mutex_unlock(&shmLock->lock.readers);
+	if(result != 0)
+		logg("Failed to unlock SHM readers lock: %s", strerror(result));
+}
 
+// Release the slot of a reader, waking up a waiting writer if this was the
+// last one. Has to be called with the readers lock held
+static void release_reader_slot(const unsigned int i)
+{
+	shmLock->readers[i].tid = 0;
+	__atomic_store_n(&shmLock->readers[i].pid, 0, __ATOMIC_RELEASE);
+	if(--shmLock->num_readers == 0)
+		pthread_cond_signal(&shmLock->readers_done);
+}
+
+// Wait until all shared readers have released their lock. Has to be called
+// with the outer SHM lock held so no new readers can arrive. Readers which
+// died while holding their slot are removed so they cannot block us forever
+static void wait_for_readers(void)
+{
+	lock_readers();
+	while(shmLock->num_readers > 0)
+	{
+		struct timespec timeout;
+		clock_gettime(CLOCK_MONOTONIC, &timeout);
+		timeout.tv_nsec += SHM_READER_TIMEOUT_MS * 1000000L;
+		if(timeout.tv_nsec >= 1000000000L)
+		{
+			timeout.tv_sec++;
+			timeout.tv_nsec -= 1000000000L;
+		}
+
+		const int result = pthread_cond_timedwait(&shmLock->readers_done,
+		                                          &shmLock->lock.readers, &timeout);
+		if(result == EOWNERDEAD)
+			pthread_mutex_consistent(&shmLock->lock.readers);
+		else if(result != ETIMEDOUT)
+			continue;
+
+		// Check if the remaining readers are still alive
+		for(unsigned int i = 0; i < MAX_SHM_READERS; i++)
+		{
+			const pid_t pid = shmLock->readers[i].pid;
+			const pid_t tid = shmLock->readers[i].tid;
+			if(pid == 0 || reader_alive(pid, tid))
+				continue;
+
+			logg("Owner %li/%li of shared SHM lock died, releasing lock",
+			     (long int)pid, (long int)tid);
+			release_reader_slot(i);
+		}
+	}
+	unlock_readers();
+}
+
+// Lock the outer SHM mutex, making it consistent if necessary
+static void lock_outer(void)
+{
 	int result = pthread_mutex_lock(&shmLock->lock.outer);
 
 	if(result != 0)
@@ -395,6 +698,104 @@ void _lock_shm(const char *func, const int line, const char *file)
 		if(result != 0)
 			logg("Failed to make outer SHM lock consistent: %s", strerror(result));
 	}
+}
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+// Find (or add) the statistics entry of the given call site. Has to be called
+// with the exclusive SHM lock held
+static int get_lock_site(const char *func, const int line, const char *file)
+{
+	file = short_path(file);
+	const unsigned int num = shmLock->num_sites;
+	for(unsigned int i = 0; i < num; i++)
+	{
+		const lockStatsData *site = &shmLock->stats[i];
+		if(site->line == line && strncmp(site->file, file, sizeof(site->file)-1) == 0)
+			return i;
+	}
+
+	// Unknown call site, add it if there is room
+	if(num >= LOCK_STATS_SITES)
+		return -1;
+
+	lockStatsData *site = &shmLock->stats[num];
+	strncpy(site->func, func, sizeof(site->func)-1);
+	strncpy(site->file, file, sizeof(site->file)-1);
+	site->line = line;
+	shmLock->num_sites++;
+	return num;
+}
+
+static unsigned int __attribute__((const)) lock_stats_bucket(const uint64_t ns)
+{
+	// log2 of the duration in microseconds
+	const uint64_t us = ns / 1000u;
+	if(us < 2u)
+		return 0u;
+	const unsigned int bucket = 63u - __builtin_clzll(us);
+	return bucket < LOCK_STATS_BUCKETS ? bucket : LOCK_STATS_BUCKETS - 1u;
+}
+
+// Record how long we waited for the exclusive lock and remember when we got it
+static void lock_obtained(const char *func, const int line, const char *file, const uint64_t start)
+{
+	const uint64_t now = monotonic_ns();
+	const int siteID = get_lock_site(func, line, file);
+	shmLock->owner.since = now;
+	shmLock->owner.site = siteID;
+	if(siteID < 0)
+		return;
+
+	lockStatsData *site = &shmLock->stats[siteID];
+	const uint64_t wait = now - start;
+	site->count++;
+	site->wait_ns += wait;
+	if(wait > site->max_wait_ns)
+		site->max_wait_ns = wait;
+	if(config.lock_histograms)
+		site->wait_hist[lock_stats_bucket(wait)]++;
+}
+
+// Record how long the exclusive lock has been held
+static void lock_released(void)
+{
+	const int siteID = shmLock->owner.site;
+	if(siteID < 0 || siteID >= LOCK_STATS_SITES)
+		return;
+
+	lockStatsData *site = &shmLock->stats[siteID];
+	const uint64_t hold = monotonic_ns() - shmLock->owner.since;
+	site->hold_ns += hold;
+	if(hold > site->max_hold_ns)
+		site->max_hold_ns = hold;
+	if(config.lock_histograms)
+		site->hold_hist[lock_stats_bucket(hold)]++;
+}
+
+const lockStatsData *get_lock_stats(unsigned int *num)
+{
+	*num = shmLock->num_sites;
+	return shmLock->stats;
+}
+
+// Obtain SHMEM lock
+void _lock_shm(const char *func, const int line, const char *file)
+{
+	const uint64_t start = monotonic_ns();
+	if(config.debug & DEBUG_LOCKS)
+		logg("Waiting for SHM lock in %s() (%s:%i)", func, file, line);
+
+	lock_outer();
+
+	// Holding the outer lock prevents new readers from arriving, wait for
+	// the active ones to finish before we modify anything
+	wait_for_readers();
 
 	// Store lock owner after lock has been acquired and was made consistent (if required)
 	shmLock->owner.pid = getpid();
@@ -413,7 +814,7 @@ void _lock_shm(const char *func, const int line, const char *file)
 	// Ensure we have enough shared memory available for new data
 	shm_ensure_size();
 
-	result = pthread_mutex_lock(&shmLock->lock.inner);
+	int result = pthread_mutex_lock(&shmLock->lock.inner);
 
 	if(config.debug & DEBUG_LOCKS)
 		logg("Obtained SHM lock for %s() (%s:%i)", func, file, line);
@@ -431,6 +832,9 @@ void _lock_shm(const char *func, const int line, const char *file)
 		if(result != 0)
 			logg("Failed to make inner SHM lock consistent: %s", strerror(result));
 	}
+
+	// Update lock statistics
+	lock_obtained(func, line, file, start);
 }
 
 // Release SHM lock
@@ -442,6 +846,9 @@ void _unlock_shm(const char* func, const int line, const char * file)
 		     (long int)shmLock->owner.pid, (long int)shmLock->owner.tid);
 	}
 
+	// Update lock statistics while we still own the lock
+	lock_released();
+
 	// Unlock mutex
 	int result = pthread_mutex_unlock(&shmLock->lock.inner);
 	shmLock->owner.pid = 0;
@@ -458,13 +865,112 @@ void _unlock_shm(const char* func, const int line, const char * file)
 		logg("Failed to unlock outer SHM lock: %s", strerror(result));
 }
 
-// Return if we locked this mutex (PID and TID match)
+// Obtain shared SHMEM lock. Any number of readers may hold this lock at the
+// same time, writers (lock_shm()) wait until all readers are gone. Holders of
+// this lock must not modify shared memory
+void _lock_shm_read(const char *func, const int line, const char *file)
+{
+	const uint64_t start = monotonic_ns();
+	if(config.debug & DEBUG_LOCKS)
+		logg("Waiting for shared SHM lock in %s() (%s:%i)", func, file, line);
+
+	// The outer lock is only held while registering as reader
+	lock_outer();
+
+	// Check if this process needs to remap the shared memory objects. We
+	// have to wait for other readers of this process to finish first as
+	// they may be using the current mappings
+	if(shmSettings != NULL &&
+	   local_shm_counter != shmSettings->global_shm_counter)
+	{
+		wait_for_readers();
+		if(config.debug & DEBUG_SHMEM)
+			logg("Remapping shared memory for current process %u %u",
+		             local_shm_counter, shmSettings->global_shm_counter);
+		remap_shm();
+	}
+
+	// Find a free reader slot
+	lock_readers();
+	unsigned int i = 0;
+	for(; i < MAX_SHM_READERS; i++)
+		if(shmLock->readers[i].pid == 0)
+			break;
+
+	if(i < MAX_SHM_READERS)
+	{
+		shmLock->readers[i].tid = gettid();
+		__atomic_store_n(&shmLock->readers[i].pid, getpid(), __ATOMIC_RELEASE);
+		shmLock->num_readers++;
+	}
+	unlock_readers();
+
+	if(i == MAX_SHM_READERS)
+	{
+		// No slot available, fall back to the exclusive lock. We
+		// already hold the outer lock so we only have to do what
+		// _lock_shm() does in addition
+		if(config.debug & DEBUG_LOCKS)
+			logg("No free reader slot in %s() (%s:%i), obtaining exclusive lock", func, file, line);
+
+		wait_for_readers();
+		shmLock->owner.pid = getpid();
+		shmLock->owner.tid = gettid();
+		const int result = pthread_mutex_lock(&shmLock->lock.inner);
+		if(result != 0)
+			logg("Error when obtaining inner SHM lock: %s", strerror(result));
+		if(result == EOWNERDEAD)
+			pthread_mutex_consistent(&shmLock->lock.inner);
+		lock_obtained(func, line, file, start);
+		return;
+	}
+
+	const int result = pthread_mutex_unlock(&shmLock->lock.outer);
+	if(result != 0)
+		logg("Failed to unlock outer SHM lock: %s", strerror(result));
+
+	if(config.debug & DEBUG_LOCKS)
+		logg("Obtained shared SHM lock for %s() (%s:%i)", func, file, line);
+}
+
+// Find the reader slot of the current thread (if any)
+static int get_reader_slot(void)
+{
+	const pid_t pid = getpid();
+	const pid_t tid = gettid();
+	for(unsigned int i = 0; i < MAX_SHM_READERS; i++)
+		if(shmLock->readers[i].pid == pid && shmLock->readers[i].tid == tid)
+			return i;
+	return -1;
+}
+
+// Release shared SHM lock
+void _unlock_shm_read(const char* func, const int line, const char * file)
+{
+	const int i = get_reader_slot();
+	if(i < 0)
+	{
+		// We fell back to the exclusive lock in _lock_shm_read()
+		_unlock_shm(func, line, file);
+		return;
+	}
+
+	lock_readers();
+	release_reader_slot(i);
+	unlock_readers();
+
+	if(config.debug & DEBUG_LOCKS)
+		logg("Removed shared lock in %s() (%s:%i)", func, file, line);
+}
+
+// Return if we locked this mutex (PID and TID match), either exclusively or
+// as shared reader
 bool is_our_lock(void)
 {
 	if(shmLock->owner.pid == getpid() &&
 	   shmLock->owner.tid == gettid())
 		return true;
-	return false;
+	return get_reader_slot() > -1;
 }
 
 bool init_shmem()
@@ -481,6 +987,8 @@ bool init_shmem()
 	shmLock = (ShmLock*)shm_lock.ptr;
 	shmLock->lock.outer = create_mutex();
 	shmLock->lock.inner = create_mutex();
+	shmLock->lock.readers = create_mutex();
+	init_cond(&shmLock->readers_done);
 
 	/****************************** shared counters struct ******************************/
 	// Try to create shared memory object
@@ -500,6 +1008,9 @@ bool init_shmem()
 	shmSettings->version = SHARED_MEMORY_VERSION;
 	shmSettings->global_shm_counter = 0;
 	shmSettings->pid = shmem_pid = getpid();
+	// Query timestamps are stored relative to this epoch. Queries imported
+	// from the database are older and get negative relative timestamps
+	shmSettings->epoch = time(NULL);
 
 	/****************************** shared strings buffer ******************************/
 	// Try to create shared memory object
@@ -513,8 +1024,18 @@ bool init_shmem()
 	((char*)shm_strings.ptr)[0] = '\0';
 	shmSettings->next_str_pos = 1;
 
+	/****************************** shared strings lookup table ******************************/
+	size_t size = get_optimal_object_size(sizeof(struct lookup_table), 1);
+	// Try to create shared memory object
+	shm_strings_lookup = create_shm(SHARED_STRINGS_LOOKUP_NAME, size*sizeof(struct lookup_table));
+	if(shm_strings_lookup.ptr == NULL)
+		return false;
+
+	strings_lookup = (struct lookup_table*)shm_strings_lookup.ptr;
+	counters->strings_lookup_MAX = size;
+
 	/****************************** shared domains struct ******************************/
-	size_t size = get_optimal_object_size(sizeof(domainsData), 1);
+	size = get_optimal_object_size(sizeof(domainsData), 1);
 	// Try to create shared memory object
 	shm_domains = create_shm(SHARED_DOMAINS_NAME, size*sizeof(domainsData));
 	if(shm_domains.ptr == NULL)
@@ -523,6 +1044,19 @@ bool init_shmem()
 	domains = (domainsData*)shm_domains.ptr;
 	counters->domains_MAX = size;
 
+	/****************************** shared domains lookup table ******************************/
+	// The size of lookup tables has to be a power of two. This is always
+	// the case here as both the page size and the size of the table
+	// entries are powers of two
+	size = get_optimal_object_size(sizeof(struct lookup_table), 1);
+	// Try to create shared memory object
+	shm_domains_lookup = create_shm(SHARED_DOMAINS_LOOKUP_NAME, size*sizeof(struct lookup_table));
+	if(shm_domains_lookup.ptr == NULL)
+		return false;
+
+	domains_lookup = (struct lookup_table*)shm_domains_lookup.ptr;
+	counters->domains_lookup_MAX = size;
+
 	/****************************** shared clients struct ******************************/
 	size = get_optimal_object_size(sizeof(clientsData), 1);
 	// Try to create shared memory object
@@ -533,6 +1067,16 @@ bool init_shmem()
 	clients = (clientsData*)shm_clients.ptr;
 	counters->clients_MAX = size;
 
+	/****************************** shared clients lookup table ******************************/
+	size = get_optimal_object_size(sizeof(struct lookup_table), 1);
+	// Try to create shared memory object
+	shm_clients_lookup = create_shm(SHARED_CLIENTS_LOOKUP_NAME, size*sizeof(struct lookup_table));
+	if(shm_clients_lookup.ptr == NULL)
+		return false;
+
+	clients_lookup = (struct lookup_table*)shm_clients_lookup.ptr;
+	counters->clients_lookup_MAX = size;
+
 	/****************************** shared upstreams struct ******************************/
 	size = get_optimal_object_size(sizeof(upstreamsData), 1);
 	// Try to create shared memory object
@@ -552,6 +1096,16 @@ bool init_shmem()
 
 	counters->queries_MAX = pagesize;
 
+	/****************************** shared queries lookup table ******************************/
+	size = get_optimal_object_size(sizeof(struct lookup_table), 1);
+	// Try to create shared memory object
+	shm_queries_lookup = create_shm(SHARED_QUERIES_LOOKUP_NAME, size*sizeof(struct lookup_table));
+	if(shm_queries_lookup.ptr == NULL)
+		return false;
+
+	queries_lookup = (struct lookup_table*)shm_queries_lookup.ptr;
+	counters->queries_lookup_MAX = size;
+
 	/****************************** shared overTime struct ******************************/
 	size = get_optimal_object_size(sizeof(overTimeData), OVERTIME_SLOTS);
 	// Try to create shared memory object
@@ -572,6 +1126,16 @@ bool init_shmem()
 	dns_cache = (DNSCacheData*)shm_dns_cache.ptr;
 	counters->dns_cache_MAX = size;
 
+	/****************************** shared DNS cache lookup table ******************************/
+	size = get_optimal_object_size(sizeof(struct lookup_table), 1);
+	// Try to create shared memory object
+	shm_dns_cache_lookup = create_shm(SHARED_DNS_CACHE_LOOKUP_NAME, size*sizeof(struct lookup_table));
+	if(shm_dns_cache_lookup.ptr == NULL)
+		return false;
+
+	dns_cache_lookup = (struct lookup_table*)shm_dns_cache_lookup.ptr;
+	counters->dns_cache_lookup_MAX = size;
+
 	/****************************** shared per-client regex buffer ******************************/
 	size = pagesize; // Allocate one pagesize initially. This may be expanded later on
 	// Try to create shared memory object
@@ -579,7 +1143,7 @@ bool init_shmem()
 	if(shm_per_client_regex.ptr == NULL)
 		return false;
 
-	counters->per_client_regex_MAX = size;
+	counters->per_client_regex_MAX = size / sizeof(uint64_t);
 
 	return true;
 }
@@ -597,6 +1161,8 @@ void destroy_shmem(void)
 	// First, we destroy the mutex
 	if(shmLock != NULL)
 	{
+		pthread_cond_destroy(&shmLock->readers_done);
+		pthread_mutex_destroy(&shmLock->lock.readers);
 		pthread_mutex_destroy(&shmLock->lock.inner);
 		pthread_mutex_destroy(&shmLock->lock.outer);
 	}
@@ -686,6 +1252,7 @@ static void *enlarge_shmem_struct(const char type)
 	SharedMemory *sharedMemory = NULL;
 	size_t sizeofobj, allocation_step;
 	int *counter = NULL;
+	bool rehash = false;
 
 	// Select type of struct that should be enlarged
 	switch(type)
@@ -726,6 +1293,43 @@ static void *enlarge_shmem_struct(const char type)
 			sizeofobj = 1;
 			counter = &counters->strings_MAX;
 			break;
+		case DOMAINS_LOOKUP:
+			sharedMemory = &shm_domains_lookup;
+			// Lookup tables are doubled in size to keep them at
+			// power-of-two sizes
+			allocation_step = counters->domains_lookup_MAX;
+			sizeofobj = sizeof(struct lookup_table);
+			counter = &counters->domains_lookup_MAX;
+			rehash = true;
+			break;
+		case CLIENTS_LOOKUP:
+			sharedMemory = &shm_clients_lookup;
+			allocation_step = counters->clients_lookup_MAX;
+			sizeofobj = sizeof(struct lookup_table);
+			counter = &counters->clients_lookup_MAX;
+			rehash = true;
+			break;
+		case QUERIES_LOOKUP:
+			sharedMemory = &shm_queries_lookup;
+			allocation_step = counters->queries_lookup_MAX;
+			sizeofobj = sizeof(struct lookup_table);
+			counter = &counters->queries_lookup_MAX;
+			rehash = true;
+			break;
+		case DNS_CACHE_LOOKUP:
+			sharedMemory = &shm_dns_cache_lookup;
+			allocation_step = counters->dns_cache_lookup_MAX;
+			sizeofobj = sizeof(struct lookup_table);
+			counter = &counters->dns_cache_lookup_MAX;
+			rehash = true;
+			break;
+		case STRINGS_LOOKUP:
+			sharedMemory = &shm_strings_lookup;
+			allocation_step = counters->strings_lookup_MAX;
+			sizeofobj = sizeof(struct lookup_table);
+			counter = &counters->strings_lookup_MAX;
+			rehash = true;
+			break;
 		default:
 			logg("Invalid argument in enlarge_shmem_struct(%i)", type);
 			return 0;
@@ -735,9 +1339,32 @@ static void *enlarge_shmem_struct(const char type)
 	const size_t current = sharedMemory->size/sizeofobj;
 	realloc_shm(sharedMemory, current + allocation_step, sizeofobj, true);
 
+	// Queries are stored in a ring buffer. If it currently wraps around the
+	// end of the memory, we move the part between head and the old end of
+	// the memory to the new end so the new space ends up between the most
+	// recent and the oldest query
+	if(type == QUERIES && counters->queries_head + counters->queries > (int)current)
+	{
+		queriesData *ring = (queriesData*)sharedMemory->ptr;
+		const size_t head = counters->queries_head;
+		const size_t len = current - head;
+		const size_t new_head = current + allocation_step - len;
+		memmove(&ring[new_head], &ring[head], len*sizeof(queriesData));
+
+		// Zero the memory no longer used by the moved queries
+		memset(&ring[head], 0, (len < allocation_step ? len : allocation_step)*sizeof(queriesData));
+
+		counters->queries_head = new_head;
+	}
+
 	// Add allocated memory to corresponding counter
 	*counter += allocation_step;
 
+	// Entries of hash-based lookup tables have to be redistributed as their
+	// position depends on the size of the table
+	if(rehash)
+		lookup_rehash(sharedMemory->ptr, current, current + allocation_step);
+
 	return sharedMemory->ptr;
 }
 
@@ -906,6 +1533,11 @@ static size_t get_optimal_object_size(const size_t objsize, const size_t minsize
 	}
 }
 
+void shm_remove_oldest_queries(const int num)
+{
+	counters->queries_head = (counters->queries_head + num) % counters->queries_MAX;
+}
+
 // Enlarge shared memory to be able to hold at least one new record
 void shm_ensure_size(void)
 {
@@ -959,6 +1591,57 @@ void shm_ensure_size(void)
 			exit(EXIT_FAILURE);
 		}
 	}
+	// Lookup tables are kept at most half full to keep probe sequences short
+	if(counters->domains >= counters->domains_lookup_MAX/2)
+	{
+		// Have to reallocate shared memory
+		domains_lookup = enlarge_shmem_struct(DOMAINS_LOOKUP);
+		if(domains_lookup == NULL)
+		{
+			logg("FATAL: Memory allocation failed! Exiting");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if(counters->clients >= counters->clients_lookup_MAX/2)
+	{
+		// Have to reallocate shared memory
+		clients_lookup = enlarge_shmem_struct(CLIENTS_LOOKUP);
+		if(clients_lookup == NULL)
+		{
+			logg("FATAL: Memory allocation failed! Exiting");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if(counters->queries >= counters->queries_lookup_MAX/2)
+	{
+		// Have to reallocate shared memory
+		queries_lookup = enlarge_shmem_struct(QUERIES_LOOKUP);
+		if(queries_lookup == NULL)
+		{
+			logg("FATAL: Memory allocation failed! Exiting");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if(counters->dns_cache_size >= counters->dns_cache_lookup_MAX/2)
+	{
+		// Have to reallocate shared memory
+		dns_cache_lookup = enlarge_shmem_struct(DNS_CACHE_LOOKUP);
+		if(dns_cache_lookup == NULL)
+		{
+			logg("FATAL: Memory allocation failed! Exiting");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if(counters->strings >= counters->strings_lookup_MAX/2)
+	{
+		// Have to reallocate shared memory
+		strings_lookup = enlarge_shmem_struct(STRINGS_LOOKUP);
+		if(strings_lookup == NULL)
+		{
+			logg("FATAL: Memory allocation failed! Exiting");
+			exit(EXIT_FAILURE);
+		}
+	}
 	if(shmSettings->next_str_pos + STRINGS_ALLOC_STEP >= shm_strings.size)
 	{
 		// Have to reallocate shared memory
@@ -970,22 +1653,99 @@ void shm_ensure_size(void)
 	}
 }
 
+static void log_lookup_table(const char *name, const enum memory_type type)
+{
+	unsigned int size = 0u;
+	get_lookup_table(type, &size, NULL);
+	const unsigned int used = lookup_count(type);
+	logg(" -> %s lookup table: %u/%u slots used (load factor %.2f)",
+	     name, used, size, size > 0u ? (double)used/size : 0.0);
+}
+
+// Get details about shared memory used by FTL
+void log_shmem_details(void)
+{
+	for(unsigned int i = 0; i < NUM_SHMEM; i++)
+	{
+		char prefix[2] = { 0 };
+		double formatted = 0.0;
+		format_memory_size(prefix, sharedMemories[i]->size, &formatted);
+		logg(" -> Shared memory \"%s\": %.1f%sB", sharedMemories[i]->name, formatted, prefix);
+	}
+
+	log_lookup_table("Domains", DOMAINS_LOOKUP);
+	log_lookup_table("Clients", CLIENTS_LOOKUP);
+	log_lookup_table("Queries", QUERIES_LOOKUP);
+	log_lookup_table("DNS cache", DNS_CACHE_LOOKUP);
+	log_lookup_table("Strings", STRINGS_LOOKUP);
+
+	// Lock statistics (only call sites which waited or held the lock for
+	// more than one millisecond to keep the output readable)
+	unsigned int num = 0;
+	const lockStatsData *stats = get_lock_stats(&num);
+	for(unsigned int i = 0; i < num; i++)
+	{
+		const lockStatsData *site = &stats[i];
+		if(site->count == 0 || (site->max_wait_ns < 1000000u && site->max_hold_ns < 1000000u))
+			continue;
+		logg(" -> Lock %s() (%s:%i): %u times, wait avg %.3f ms, max %.3f ms, hold avg %.3f ms, max %.3f ms",
+		     site->func, site->file, site->line, site->count,
+		     1e-6*site->wait_ns/site->count, 1e-6*site->max_wait_ns,
+		     1e-6*site->hold_ns/site->count, 1e-6*site->max_hold_ns);
+	}
+}
+
+// The enabled state of all regex of a client is stored as a bitmask in 64-bit
+// words. The regex of each type start at a new word so the bits of one type
+// can directly be combined with the match results of this type
+static unsigned int __attribute__((pure)) per_client_regex_words(void)
+{
+	unsigned int words = 0u;
+	for(enum regex_type regexid = REGEX_BLACKLIST; regexid < REGEX_MAX; regexid++)
+		words += (get_num_regex(regexid) + 63u) / 64u;
+	return words;
+}
+
+// Get word and bit of a regex (counting all types in one array)
+static bool per_client_regex_pos(const int clientID, const int regexID, size_t *word, unsigned int *bit)
+{
+	size_t offset = (size_t)clientID * per_client_regex_words();
+	unsigned int id = regexID;
+	for(enum regex_type regexid = REGEX_BLACKLIST; regexid < REGEX_MAX; regexid++)
+	{
+		const unsigned int num = get_num_regex(regexid);
+		if(id < num)
+		{
+			*word = offset + id / 64u;
+			*bit = id % 64u;
+			return *word < shm_per_client_regex.size / sizeof(uint64_t);
+		}
+		id -= num;
+		offset += (num + 63u) / 64u;
+	}
+	return false;
+}
+
 void reset_per_client_regex(const int clientID)
 {
-	const unsigned int num_regex_tot = get_num_regex(REGEX_MAX); // total number
-	for(unsigned int i = 0u; i < num_regex_tot; i++)
+	// Zero-initialize/reset (= false) all regex (white + black)
+	const unsigned int words = per_client_regex_words();
+	const size_t offset = (size_t)clientID * words;
+	if(offset + words > shm_per_client_regex.size / sizeof(uint64_t))
 	{
-		// Zero-initialize/reset (= false) all regex (white + black)
-		set_per_client_regex(clientID, i, false);
+		logg("ERROR: reset_per_client_regex(%d): Out of bounds (%zu > %zu)!",
+		     clientID, offset + words, shm_per_client_regex.size / sizeof(uint64_t));
+		return;
 	}
+	memset((uint64_t*)shm_per_client_regex.ptr + offset, 0, words*sizeof(uint64_t));
 }
 
 void add_per_client_regex(unsigned int clientID)
 {
-	const unsigned int num_regex_tot = get_num_regex(REGEX_MAX); // total number
-	const size_t size = get_optimal_object_size(1, counters->clients * num_regex_tot);
-	if(size > shm_per_client_regex.size &&
-	   realloc_shm(&shm_per_client_regex, 1, size, true))
+	const unsigned int words = per_client_regex_words();
+	const size_t size = get_optimal_object_size(sizeof(uint64_t), counters->clients * words);
+	if(size*sizeof(uint64_t) > shm_per_client_regex.size &&
+	   realloc_shm(&shm_per_client_regex, size, sizeof(uint64_t), true))
 	{
 		reset_per_client_regex(clientID);
 		counters->per_client_regex_MAX = size;
@@ -994,32 +1754,97 @@ void add_per_client_regex(unsigned int clientID)
 
 bool get_per_client_regex(const int clientID, const int regexID)
 {
-	const unsigned int num_regex_tot = get_num_regex(REGEX_MAX); // total number
-	const unsigned int id = clientID * num_regex_tot + regexID;
-	const size_t maxval = shm_per_client_regex.size / sizeof(bool);
-	if(id > maxval)
+	size_t word = 0u;
+	unsigned int bit = 0u;
+	if(!per_client_regex_pos(clientID, regexID, &word, &bit))
 	{
-		logg("ERROR: get_per_client_regex(%d, %d): Out of bounds (%d > %d * %d, shm_per_client_regex.size = %zd)!",
-		     clientID, regexID,
-		     id, counters->clients, num_regex_tot, maxval);
+		logg("ERROR: get_per_client_regex(%d, %d): Out of bounds (%d * %u words, shm_per_client_regex.size = %zu)!",
+		     clientID, regexID, counters->clients, per_client_regex_words(),
+		     shm_per_client_regex.size);
 		return false;
 	}
-	return ((bool*) shm_per_client_regex.ptr)[id];
+	return (((uint64_t*) shm_per_client_regex.ptr)[word] >> bit) & 1u;
 }
 
 void set_per_client_regex(const int clientID, const int regexID, const bool value)
 {
-	const unsigned int num_regex_tot = get_num_regex(REGEX_MAX); // total number
-	const unsigned int id = clientID * num_regex_tot + regexID;
-	const size_t maxval = shm_per_client_regex.size / sizeof(bool);
-	if(id > maxval)
+	size_t word = 0u;
+	unsigned int bit = 0u;
+	if(!per_client_regex_pos(clientID, regexID, &word, &bit))
 	{
-		logg("ERROR: set_per_client_regex(%d, %d, %s): Out of bounds (%d > %d * %d, shm_per_client_regex.size = %zd)!",
+		logg("ERROR: set_per_client_regex(%d, %d, %s): Out of bounds (%d * %u words, shm_per_client_regex.size = %zu)!",
 		     clientID, regexID, value ? "true" : "false",
-		     id, counters->clients, num_regex_tot, maxval);
+		     counters->clients, per_client_regex_words(),
+		     shm_per_client_regex.size);
 		return;
 	}
-	((bool*) shm_per_client_regex.ptr)[id] = value;
+	uint64_t *words = (uint64_t*) shm_per_client_regex.ptr;
+	if(value)
+		words[word] |= 1ull << bit;
+	else
+		words[word] &= ~(1ull << bit);
+}
+
+// Get the bitmask of regex of this type enabled for a client. Bit i of the
+// returned words is set if regex i of this type is enabled. Returns NULL if
+// the client is not known
+const uint64_t *get_per_client_regex_words(const int clientID, const enum regex_type regexid)
+{
+	const unsigned int words = per_client_regex_words();
+	size_t offset = (size_t)clientID * words;
+	for(enum regex_type type = REGEX_BLACKLIST; type < regexid; type++)
+		offset += (get_num_regex(type) + 63u) / 64u;
+	const size_t num = (get_num_regex(regexid) + 63u) / 64u;
+	if(offset + num > shm_per_client_regex.size / sizeof(uint64_t))
+	{
+		logg("ERROR: get_per_client_regex_words(%d, %d): Out of bounds (%zu > %zu)!",
+		     clientID, regexid, offset + num, shm_per_client_regex.size / sizeof(uint64_t));
+		return NULL;
+	}
+	return (const uint64_t*) shm_per_client_regex.ptr + offset;
+}
+
+struct lookup_table *get_lookup_table(const enum memory_type type, unsigned int *size, unsigned int **used)
+{
+	// The number of used slots is only needed when modifying the table
+	unsigned int *dummy = NULL;
+	if(used == NULL)
+		used = &dummy;
+
+	switch(type)
+	{
+		case DOMAINS_LOOKUP:
+			*size = counters->domains_lookup_MAX;
+			*used = &counters->domains_lookup_used;
+			return domains_lookup;
+		case CLIENTS_LOOKUP:
+			*size = counters->clients_lookup_MAX;
+			*used = &counters->clients_lookup_used;
+			return clients_lookup;
+		case QUERIES_LOOKUP:
+			*size = counters->queries_lookup_MAX;
+			*used = &counters->queries_lookup_used;
+			return queries_lookup;
+		case DNS_CACHE_LOOKUP:
+			*size = counters->dns_cache_lookup_MAX;
+			*used = &counters->dns_cache_lookup_used;
+			return dns_cache_lookup;
+		case STRINGS_LOOKUP:
+			*size = counters->strings_lookup_MAX;
+			*used = &counters->strings_lookup_used;
+			return strings_lookup;
+		case QUERIES:
+		case UPSTREAMS:
+		case CLIENTS:
+		case DOMAINS:
+		case OVERTIME:
+		case DNS_CACHE:
+		case STRINGS:
+		default:
+			*size = 0u;
+			*used = NULL;
+			return NULL;
+	}
 }
 
 static inline bool check_range(int ID, int MAXID, const char* type, const char *func, int line, const char *file)
@@ -1065,9 +1890,14 @@ queriesData* _getQuery(int queryID, bool checkMagic, int line, const char *func,
 		return NULL;
 	}
 
-	if(check_range(queryID, counters->queries_MAX, "query", func, line, file) &&
-	   check_magic(queryID, checkMagic, queries[queryID].magic, "query", func, line, file))
-		return &queries[queryID];
+	// Translate the (logical) query ID into the position inside the ring
+	// buffer. The oldest query in memory is always query ID 0
+	if(!check_range(queryID, counters->queries_MAX, "query", func, line, file))
+		return NULL;
+	const int pos = (counters->queries_head + queryID) % counters->queries_MAX;
+
+	if(check_magic(queryID, checkMagic, queries[pos].magic, "query", func, line, file))
+		return &queries[pos];
 	else
 		return NULL;
 }
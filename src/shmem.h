@@ -17,6 +17,8 @@
 
 // TYPE_MAX
 #include "datastructure.h"
+// struct lookup_table
+#include "lookup-table.h"
 
 typedef struct {
     const char *name;
@@ -24,11 +26,32 @@ typedef struct {
     void *ptr;
 } SharedMemory;
 
+// Number of distinct lock_shm() call sites we keep statistics for
+#define LOCK_STATS_SITES 64
+// Number of histogram buckets. Bucket i counts durations of [2^i, 2^(i+1)) us
+// (bucket zero also counts everything shorter), the last bucket counts
+// everything longer
+#define LOCK_STATS_BUCKETS 16
+
+typedef struct {
+	char func[32];
+	char file[32];
+	int line;
+	unsigned int count;
+	uint64_t wait_ns;
+	uint64_t hold_ns;
+	uint64_t max_wait_ns;
+	uint64_t max_hold_ns;
+	unsigned int wait_hist[LOCK_STATS_BUCKETS];
+	unsigned int hold_hist[LOCK_STATS_BUCKETS];
+} lockStatsData;
+
 typedef struct {
 	int version;
 	pid_t pid;
 	unsigned int global_shm_counter;
 	unsigned int next_str_pos;
+	time_t epoch;
 } ShmSettings;
 
 typedef struct {
@@ -45,7 +68,24 @@ typedef struct {
 	int dns_cache_size;
 	int dns_cache_MAX;
 	int per_client_regex_MAX;
+	int domains_lookup_MAX;
+	int clients_lookup_MAX;
+	int queries_lookup_MAX;
+	int dns_cache_lookup_MAX;
+	int strings;
+	int strings_lookup_MAX;
+	// Number of used slots of the lookup tables above
+	unsigned int domains_lookup_used;
+	unsigned int clients_lookup_used;
+	unsigned int queries_lookup_used;
+	unsigned int dns_cache_lookup_used;
+	unsigned int strings_lookup_used;
+	unsigned int queries_removed;
+	int queries_head;
 	unsigned int regex_change;
+	unsigned int bloom_skipped;
+	unsigned int regex_executed;
+	unsigned int regex_skipped;
 	int querytype[TYPE_MAX-1];
 	int status[QUERY_STATUS_MAX];
 	int reply[QUERY_REPLY_MAX];
@@ -80,20 +120,40 @@ static void delete_shm(SharedMemory *sharedMemory);
 /// Block until a lock can be obtained
 #define lock_shm() _lock_shm(__FUNCTION__, __LINE__, __FILE__)
 void _lock_shm(const char* func, const int line, const char* file);
+/// Block until a shared (read-only) lock can be obtained. Any number of
+/// readers can hold this lock concurrently, but none of them may modify
+/// shared memory
+#define lock_shm_read() _lock_shm_read(__FUNCTION__, __LINE__, __FILE__)
+void _lock_shm_read(const char* func, const int line, const char* file);
 #define lock_log() _lock_log(__FUNCTION__, __LINE__, __FILE__)
 void _lock_log(const char* func, const int line, const char* file);
 
 // Return if the current mutex locked the SHM lock
 bool is_our_lock(void);
 
+// Get per-call-site statistics of the exclusive SHM lock. Has to be called
+// with the SHM lock held
+const lockStatsData *get_lock_stats(unsigned int *num);
+
 // This ensures we have enough space available for more objects
 // The function should only be called from within _lock() and when reading
 // content from the database
 void shm_ensure_size(void);
 
+// Remove strings no longer referenced by any domain, client or upstream from
+// the shared string buffer. Positions stored in shared memory objects are
+// updated accordingly
+void shm_compact_strings(void);
+
+// Remove the oldest queries from the queries ring buffer. This only advances
+// the head of the buffer, no memory is moved
+void shm_remove_oldest_queries(const int num);
+
 /// Unlock the lock. Only call this if there is an active lock.
 #define unlock_shm() _unlock_shm(__FUNCTION__, __LINE__, __FILE__)
 void _unlock_shm(const char* func, const int line, const char* file);
+#define unlock_shm_read() _unlock_shm_read(__FUNCTION__, __LINE__, __FILE__)
+void _unlock_shm_read(const char* func, const int line, const char* file);
 #define unlock_log() _unlock_log(__FUNCTION__, __LINE__, __FILE__)
 void _unlock_log(const char* func, const int line, const char * file);
 
@@ -102,6 +162,10 @@ void _unlock_log(const char* func, const int line, const char * file);
 bool init_shmem(void);
 void destroy_shmem(void);
 size_t addstr(const char *str);
+
+// Query timestamps are stored relative to the epoch of the shared memory
+time_t query_get_timestamp(const queriesData *query) __attribute__((pure));
+void query_set_timestamp(queriesData *query, const time_t timestamp);
 #define getstr(pos) _getstr(pos, __FUNCTION__, __LINE__, __FILE__)
 const char *_getstr(const size_t pos, const char *func, const int line, const char *file);
 
@@ -134,10 +198,15 @@ void chown_all_shmem(struct passwd *ent_pw);
 // Get details about shared memory used by FTL
 void log_shmem_details(void);
 
+// Get pointer to, size of and number of used slots in the hash index of the
+// given type. used may be NULL
+struct lookup_table *get_lookup_table(const enum memory_type type, unsigned int *size, unsigned int **used);
+
 // Per-client regex buffer storing whether or not a specific regex is enabled for a particular client
 void add_per_client_regex(unsigned int clientID);
 void reset_per_client_regex(const int clientID);
 bool get_per_client_regex(const int clientID, const int regexID);
 void set_per_client_regex(const int clientID, const int regexID, const bool value);
+const uint64_t *get_per_client_regex_words(const int clientID, const enum regex_type regexid);
 
 #endif //SHARED_MEMORY_SERVER_H
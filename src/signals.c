@@ -318,6 +318,12 @@ static void SIGRT_handler(int signum, siginfo_t *si, void *unused)
 		// Parse neighbor cache
 		set_event(PARSE_NEIGHBOR_CACHE);
 	}
+	else if(rtsig == 6)
+	{
+		// Apply changes recorded by "pihole-FTL gravity updateList"
+		// invalidating only the affected per-client DNS cache entries
+		set_event(RELOAD_GRAVITY_CHANGES);
+	}
 
 	// Restore errno before returning back to previous context
 	errno = _errno;
@@ -12,6 +12,16 @@
 #include "args.h"
 #include <regex.h>
 #include "database/sqlite3.h"
+// mmap()
+#include <sys/mman.h>
+// fstat()
+#include <sys/stat.h>
+// open()
+#include <fcntl.h>
+// pthread_create()
+#include <pthread.h>
+// gravity_index_build()
+#include "database/gravity-index.h"
 
 // Define valid domain patterns
 // No need to include uppercase letters, as we convert to lowercase in gravity_ParseFileIntoDomains() already
@@ -42,251 +52,265 @@
 // Number of invalid domains to print before skipping the rest
 #define MAX_INVALID_DOMAINS 5
 
-int gravity_parseList(const char *infile, const char *outfile, const char *adlistIDstr)
-{
-	const char *info = cli_info();
-	const char *tick = cli_tick();
-	const char *cross = cli_cross();
-	const char *over = cli_over();
+// Number of times committing is retried while the database is busy. Each
+// attempt waits up to DATABASE_BUSY_TIMEOUT milliseconds for readers (such as
+// FTL) to release their locks
+#define COMMIT_RETRIES 10
 
-	// Open input file
-	FILE *fpin = fopen(infile, "r");
-	if(fpin == NULL)
-	{
-		printf("%s  %s Unable to open %s for reading\n", over, cross, infile);
-		return EXIT_FAILURE;
-	}
+// Size of the chunks the input file is split into in parallel mode. Chunks
+// always end at a newline so they are usually slightly larger than this
+#define PARSE_CHUNK_SIZE (4*1024*1024)
 
-	// Open output file
-	sqlite3 *db = NULL;
-	sqlite3_stmt *stmt = NULL;
-	if(sqlite3_open_v2(outfile, &db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK)
-	{
-		printf("%s  %s Unable to open database file %s for writing\n", over, cross, outfile);
-		fclose(fpin);
-		return EXIT_FAILURE;
-	}
-	// Get size of input file
-	fseek(fpin, 0L, SEEK_END);
-	const size_t fsize = ftell(fpin);
-	rewind(fpin);
+// Maximum number of chunks per worker thread that may have been parsed but
+// not yet been written into the database. This bounds the memory needed for
+// the parsed results independent of the size of the input file
+#define PARSE_CHUNKS_PER_THREAD 4
+
+// Number of rows inserted by a single statement in parallel mode. Each row
+// needs one SQL variable and we have to stay below SQLITE_MAX_VARIABLE_NUMBER
+#define INSERT_BATCH_SIZE 500
+
+// Upper limit for the number of worker threads
+#define MAX_PARSE_THREADS 64
+
+// The three regular expressions defined above. They are only used as reference
+// for the hand-written validator below (see gravity_checkValidator())
+struct list_validator {
+	regex_t exact;
+	regex_t abp;
+	regex_t false_positives;
+};
+
+enum list_entry {
+	ENTRY_EXACT,
+	ENTRY_ABP,
+	ENTRY_FALSE_POSITIVE,
+	ENTRY_INVALID
+};
+
+static bool validator_init(struct list_validator *validator)
+{
+	const char *over = cli_over();
+	const char *cross = cli_cross();
 
 	// Compile regular expression to validate domains
-	regex_t exact_regex, abp_regex, false_positives_regex;
-	if(regcomp(&exact_regex, VALID_DOMAIN_REXEX, REG_EXTENDED) != 0)
+	if(regcomp(&validator->exact, VALID_DOMAIN_REXEX, REG_EXTENDED) != 0)
 	{
 		printf("%s  %s Unable to compile regular expression to validate exact domains\n",
 		       over, cross);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		return false;
 	}
-	if(regcomp(&abp_regex, ABP_DOMAIN_REXEX, REG_EXTENDED) != 0)
+	if(regcomp(&validator->abp, ABP_DOMAIN_REXEX, REG_EXTENDED) != 0)
 	{
 		printf("%s  %s Unable to compile regular expression to validate ABP-style domains\n",
 		       over, cross);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		regfree(&validator->exact);
+		return false;
 	}
-	if(regcomp(&false_positives_regex, FALSE_POSITIVES, REG_EXTENDED | REG_NOSUB) != 0)
+	if(regcomp(&validator->false_positives, FALSE_POSITIVES, REG_EXTENDED | REG_NOSUB) != 0)
 	{
 		printf("%s  %s Unable to compile regular expression to identify false positives\n",
 		       over, cross);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		regfree(&validator->exact);
+		regfree(&validator->abp);
+		return false;
 	}
 
-	// Begin transaction
-	if(sqlite3_exec(db, "BEGIN TRANSACTION;", NULL, NULL, NULL) != SQLITE_OK)
-	{
-		printf("%s  %s Unable to begin transaction to insert domains into database file %s\n",
-		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
-	}
+	return true;
+}
 
-	// Prepare SQL statement
-	const char *sql = "INSERT INTO gravity (domain, adlist_id) VALUES (?, ?);";
-	if(sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
-	{
-		printf("%s  %s Unable to prepare SQL statement to insert domains into database file %s\n",
-		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
-	}
+static void validator_free(struct list_validator *validator)
+{
+	regfree(&validator->exact);
+	regfree(&validator->abp);
+	regfree(&validator->false_positives);
+}
 
-	// Bind adlistID
-	const int adlistID = atoi(adlistIDstr);
-	if(sqlite3_bind_int(stmt, 2, adlistID) != SQLITE_OK)
-	{
-		printf("%s  %s Unable to bind adlistID to SQL statement to insert domains into database file %s\n",
-		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
-	}
+// Classify a single (NUL-terminated) line of length len using the regular
+// expressions. This is the reference implementation of classify_entry()
+static enum list_entry classify_entry_regex(const struct list_validator *validator, const char *line, const size_t len)
+{
+	regmatch_t match = { 0 };
+	// Validate line
+	if(line[0] != '|' &&                                           // <- Not an ABP-style match
+	   regexec(&validator->exact, line, 1, &match, 0) == 0 &&      // <- Regex match
+	   match.rm_so == 0 && match.rm_eo == (regoff_t)len)           // <- Match covers entire line
+		return ENTRY_EXACT;
 
-	// Parse list file line by line
-	char *line = NULL;
-	size_t lineno = 0;
-	size_t len = 0;
-	ssize_t read = 0;
-	size_t total_read = 0;
-	int last_progress = 0;
-	char *invalid_domains_list[MAX_INVALID_DOMAINS] = { NULL };
-	unsigned int invalid_domains_list_len = 0;
-	unsigned int exact_domains = 0, abp_domains = 0, invalid_domains = 0;
-	while((read = getline(&line, &len, fpin)) != -1)
-	{
-		// Update total read bytes
-		total_read += read;
-		lineno++;
+	if(line[0] == '|' &&                                           // <- ABP-style match
+	   regexec(&validator->abp, line, 1, &match, 0) == 0 &&        // <- Regex match
+	   match.rm_so == 0 && match.rm_eo == (regoff_t)len)           // <- Match covers entire line
+		return ENTRY_ABP;
 
-		// Remove trailing newline
-		if(line[read-1] == '\n')
-			line[--read] = '\0';
+	// No match - This is an invalid domain or a false positive
+	if(regexec(&validator->false_positives, line, 0, NULL, 0) == 0)
+		return ENTRY_FALSE_POSITIVE;
 
-		// Remove trailing dot (convert FQDN to domain)
-		if(line[read-1] == '.')
-			line[--read] = '\0';
+	return ENTRY_INVALID;
+}
 
+// Character classes of the table-driven validator
+#define CHAR_ALNUM      (1 << 0) // [a-z0-9]
+#define CHAR_HYPHEN     (1 << 1) // -
+#define CHAR_UNDERSCORE (1 << 2) // _
 
-		regmatch_t match = { 0 };
-		// Validate line
-		if(line[0] != '|' &&                                 // <- Not an ABP-style match
-		   regexec(&exact_regex, line, 1, &match, 0) == 0 && // <- Regex match
-		   match.rm_so == 0 && match.rm_eo == read)          // <- Match covers entire line
+static const unsigned char domain_chars[256] = {
+	['0' ... '9'] = CHAR_ALNUM,
+	['a' ... 'z'] = CHAR_ALNUM,
+	['-'] = CHAR_HYPHEN,
+	['_'] = CHAR_UNDERSCORE
+};
+
+// Check if line[0..len) is a sequence of labels matching SUBDOMAIN_PATTERN
+// followed by a TLD matching TLD_PATTERN, i.e., if it matches
+//     ([a-z0-9_-]{0,63}\.){min_labels,}[a-z0-9][a-z0-9-]{0,61}[a-z0-9]
+// entirely. As neither part may contain a dot, the line can be split at the
+// dots without any backtracking
+static bool __attribute__((pure)) valid_labels(const char *line, const size_t len, const unsigned int min_labels)
+{
+	size_t label_start = 0;
+	unsigned int labels = 0;
+	bool underscore = false;
+	for(size_t i = 0; i < len; i++)
+	{
+		const unsigned char c = line[i];
+		if(c == '.')
 		{
-			// Exact match found
-			// Append domain to database using prepared statement
-			if(sqlite3_bind_text(stmt, 1, line, -1, SQLITE_STATIC) != SQLITE_OK)
-			{
-				printf("%s  %s Unable to bind domain to SQL statement to insert domains into database file %s\n",
-				       over, cross, outfile);
-				fclose(fpin);
-				sqlite3_close(db);
-				return EXIT_FAILURE;
-			}
-			if(sqlite3_step(stmt) != SQLITE_DONE)
-			{
-				printf("%s  %s Unable to insert domain into database file %s\n", over, cross, outfile);
-				fclose(fpin);
-				sqlite3_close(db);
-				return EXIT_FAILURE;
-			}
-			sqlite3_reset(stmt);
-			// Increment counter
-			exact_domains++;
+			// Subdomain labels may be empty but not longer than 63
+			// characters
+			if(i - label_start > 63)
+				return false;
+			labels++;
+			label_start = i + 1;
+			underscore = false;
+			continue;
 		}
-		else if(line[0] == '|' &&                               // <- ABP-style match
-		        regexec(&abp_regex, line, 1, &match, 0) == 0 && // <- Regex match
-		        match.rm_so == 0 && match.rm_eo == read)        // <- Match covers entire line
-		{
-			// ABP-style match (see comments above)
 
-			// Append pattern to database using prepared statement
-			if(sqlite3_bind_text(stmt, 1, line, -1, SQLITE_STATIC) != SQLITE_OK)
-			{
-				printf("%s  %s Unable to bind domain to SQL statement to insert domains into database file %s\n",
-				       over, cross, outfile);
-				fclose(fpin);
-				sqlite3_close(db);
-				return EXIT_FAILURE;
-			}
-			if(sqlite3_step(stmt) != SQLITE_DONE)
-			{
-				printf("%s  %s Unable to insert domain into database file %s\n", over, cross, outfile);
-				fclose(fpin);
-				sqlite3_close(db);
-				return EXIT_FAILURE;
-			}
-			sqlite3_reset(stmt);
-			abp_domains++;
-		}
-		else
-		{
-			// No match - This is an invalid domain or a false positive
+		const unsigned char class = domain_chars[c];
+		if(class == 0)
+			return false;
+		if(class & CHAR_UNDERSCORE)
+			underscore = true;
+	}
 
-			// Ignore false positives - they don't count as invalid domains
-			if(regexec(&false_positives_regex, line, 0, NULL, 0) != 0)
-			{
-				// Add the domain to invalid_domains_list only
-				// if the list contains < MAX_INVALID_DOMAINS
-				if(invalid_domains_list_len < MAX_INVALID_DOMAINS)
-				{
-					// Check if we have this domain already
-					bool found = false;
-					for(unsigned int i = 0; i < invalid_domains_list_len; i++)
-					{
-						if(strcmp(invalid_domains_list[i], line) == 0)
-						{
-							found = true;
-							break;
-						}
-					}
-
-					// If not found, add it to the list
-					if(!found)
-						invalid_domains_list[invalid_domains_list_len++] = strdup(line);
+	// The last label is the TLD: 2 - 63 characters without underscores,
+	// starting and ending with a letter or digit
+	const size_t tld_len = len - label_start;
+	return labels >= min_labels &&
+	       tld_len >= 2 && tld_len <= 63 && !underscore &&
+	       (domain_chars[(unsigned char)line[label_start]] & CHAR_ALNUM) &&
+	       (domain_chars[(unsigned char)line[len - 1]] & CHAR_ALNUM);
+}
 
-				}
-				invalid_domains++;
-			}
-		}
+// Hostnames of FALSE_POSITIVES. A dot matches any character as in the regex
+static const char *false_positives[] = {
+	"localhost",
+	"localhost.localdomain",
+	"local",
+	"broadcasthost",
+	"ip6-localhost",
+	"ip6-loopback",
+	"lo0 localhost",
+	"ip6-localnet",
+	"ip6-mcastprefix",
+	"ip6-allnodes",
+	"ip6-allrouters",
+	"ip6-allhosts"
+};
 
-		// Print progress if the file is large enough every 100 lines
-		if(fsize > PRINT_PROGRESS_THRESHOLD && lineno % 100 == 1)
-		{
-			// Calculate progress
-			const int progress = (int)(100.0*total_read/fsize);
-			// Print progress if it has changed
-			if(progress > last_progress)
-			{
-				printf("%s  %s Processed %i%% of downloaded list", over, info, progress);
-				fflush(stdout);
-				last_progress = progress;
-			}
-		}
+static bool __attribute__((pure)) is_false_positive(const char *line, size_t len)
+{
+	// The regex only sees the line up to the first NUL byte
+	const char *nul = memchr(line, '\0', len);
+	if(nul != NULL)
+		len = nul - line;
+
+	for(unsigned int i = 0; i < sizeof(false_positives)/sizeof(false_positives[0]); i++)
+	{
+		const char *fp = false_positives[i];
+		size_t j = 0;
+		for(; j < len && fp[j] != '\0'; j++)
+			if(fp[j] != '.' && fp[j] != line[j])
+				break;
+		if(j == len && fp[j] == '\0')
+			return true;
 	}
 
-	// Finalize SQL statement
-	if(sqlite3_finalize(stmt) != SQLITE_OK)
+	return false;
+}
+
+// Classify a single line of length len in a single pass over the characters.
+// The line does not need to be NUL-terminated. The result is identical to
+// classify_entry_regex(), including lines with embedded NUL bytes (which are
+// never valid domains)
+static enum list_entry __attribute__((pure)) classify_entry(const char *line, const size_t len)
+{
+	if(len > 0 && line[0] != '|')
 	{
-		printf("%s  %s Unable to finalize SQL statement to insert domains into database file %s\n",
-		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		// subdomain.domain.tld (at least one subdomain label)
+		if(valid_labels(line, len, 1))
+			return ENTRY_EXACT;
+	}
+	else if(len > 3 && line[1] == '|' && line[len - 1] == '^')
+	{
+		// ||subdomain.domain.tld^ (subdomain labels are optional)
+		if(valid_labels(line + 2, len - 3, 0))
+			return ENTRY_ABP;
 	}
 
+	// No match - This is an invalid domain or a false positive
+	if(is_false_positive(line, len))
+		return ENTRY_FALSE_POSITIVE;
+
+	return ENTRY_INVALID;
+}
+
+// Add line to the list of invalid domains if it is not already contained and
+// the list has less than MAX_INVALID_DOMAINS entries
+static void add_invalid_sample(char **list, unsigned int *list_len, const char *line)
+{
+	if(*list_len >= MAX_INVALID_DOMAINS)
+		return;
+
+	// Check if we have this domain already
+	for(unsigned int i = 0; i < *list_len; i++)
+		if(strcmp(list[i], line) == 0)
+			return;
+
+	// If not found, add it to the list
+	list[(*list_len)++] = strdup(line);
+}
+
+// Store the list properties and end the transaction. This is shared by the
+// serial and the parallel parser
+static bool finish_list(sqlite3 *db, const char *outfile, const int adlistID,
+                        const unsigned int exact_domains, const unsigned int abp_domains,
+                        const unsigned int invalid_domains)
+{
+	const char *cross = cli_cross();
+	const char *over = cli_over();
+
 	// Update database properties
 	// Are ABP patterns used?
 	if(abp_domains > 0)
 	{
-		sql = "INSERT OR REPLACE INTO info (property,value) VALUES ('abp_domains',1);";
+		const char *sql = "INSERT OR REPLACE INTO info (property,value) VALUES ('abp_domains',1);";
 		if(sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK)
 		{
 			printf("%s  %s Unable to update database properties in database file %s\n",
 			       over, cross, outfile);
-			fclose(fpin);
-			sqlite3_close(db);
-			return EXIT_FAILURE;
+			return false;
 		}
 	}
 
 	// Update number of domains and update timestamp on this list
-	sql = "UPDATE adlist SET number = ?, invalid_domains = ?, date_updated = cast(strftime('%s', 'now') as int) WHERE id = ?;";
+	sqlite3_stmt *stmt = NULL;
+	const char *sql = "UPDATE adlist SET number = ?, invalid_domains = ?, date_updated = cast(strftime('%s', 'now') as int) WHERE id = ?;";
 	if(sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
 	{
 		printf("%s  %s Unable to prepare SQL statement to update adlist properties in database file %s\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		return false;
 	}
 
 	// Update date
@@ -294,56 +318,67 @@ int gravity_parseList(const char *infile, const char *outfile, const char *adlis
 	{
 		printf("%s  %s Unable to bind number of domains to SQL statement to update adlist properties in database file %s\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		sqlite3_finalize(stmt);
+		return false;
 	}
 	if(sqlite3_bind_int(stmt, 2, invalid_domains) != SQLITE_OK)
 	{
 		printf("%s  %s Unable to bind number of invalid domains to SQL statement to update adlist properties in database file %s\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		sqlite3_finalize(stmt);
+		return false;
 	}
 	if(sqlite3_bind_int(stmt, 3, adlistID) != SQLITE_OK)
 	{
 		printf("%s  %s Unable to bind adlist ID to SQL statement to update adlist properties in database file %s\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		sqlite3_finalize(stmt);
+		return false;
 	}
 	if(sqlite3_step(stmt) != SQLITE_DONE)
 	{
 		printf("%s  %s Unable to update adlist properties in database file %s\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		sqlite3_finalize(stmt);
+		return false;
 	}
 	if(sqlite3_finalize(stmt) != SQLITE_OK)
 	{
 		printf("%s  %s Unable to finalize SQL statement to update adlist properties in database file %s\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		return false;
 	}
 
-	// End transaction
-	if(sqlite3_exec(db, "END TRANSACTION", NULL, NULL, NULL) != SQLITE_OK)
+	// End transaction. This fails with SQLITE_BUSY while readers still hold
+	// a shared lock on the database. The transaction is still active in this
+	// case and we can simply try again
+	int rc = SQLITE_BUSY;
+	for(unsigned int i = 0; i < COMMIT_RETRIES && rc == SQLITE_BUSY; i++)
+		rc = sqlite3_exec(db, "END TRANSACTION", NULL, NULL, NULL);
+	if(rc == SQLITE_BUSY)
+	{
+		printf("%s  %s Unable to end transaction to insert domains into database file %s (database is busy, no changes have been made)\n",
+		       over, cross, outfile);
+		sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+		return false;
+	}
+	else if(rc != SQLITE_OK)
 	{
 		printf("%s  %s Unable to end transaction to insert domains into database file %s (database file may be corrupted)\n",
 		       over, cross, outfile);
-		fclose(fpin);
-		sqlite3_close(db);
-		return EXIT_FAILURE;
+		return false;
 	}
 
+	return true;
+}
+
+static void print_summary(const unsigned int exact_domains, const unsigned int abp_domains,
+                          const unsigned int invalid_domains, char **invalid_domains_list,
+                          const unsigned int invalid_domains_list_len)
+{
 	// Print summary
 	printf("%s  %s Parsed %u exact domains and %u ABP-style domains (ignored %u non-domain entries)\n",
-	       over, tick, exact_domains, abp_domains, invalid_domains);
+	       cli_over(), cli_tick(), exact_domains, abp_domains, invalid_domains);
 	if(invalid_domains_list_len > 0)
 	{
 		puts("      Sample of non-domain entries:");
@@ -351,20 +386,1074 @@ int gravity_parseList(const char *infile, const char *outfile, const char *adlis
 			printf("        - \"%s\"\n", invalid_domains_list[i]);
 		puts("");
 	}
+}
 
-	// Free memory
-	free(line);
-	regfree(&exact_regex);
-	regfree(&abp_regex);
-	regfree(&false_positives_regex);
-	for(unsigned int i = 0; i < invalid_domains_list_len; i++)
-		if(invalid_domains_list[i] != NULL)
-			free(invalid_domains_list[i]);
+// Parse a list file line by line and step stmt with each valid domain bound to
+// parameter 1
+static bool parse_lines(FILE *fpin, const size_t fsize, sqlite3_stmt *stmt, const char *outfile,
+                        unsigned int *exact_domains, unsigned int *abp_domains, unsigned int *invalid_domains,
+                        char **invalid_domains_list, unsigned int *invalid_domains_list_len)
+{
+	const char *info = cli_info();
+	const char *cross = cli_cross();
+	const char *over = cli_over();
 
-	// Close files
-	fclose(fpin);
-	sqlite3_close(db);
+	char *line = NULL;
+	size_t lineno = 0;
+	size_t len = 0;
+	ssize_t read = 0;
+	size_t total_read = 0;
+	int last_progress = 0;
+	while((read = getline(&line, &len, fpin)) != -1)
+	{
+		// Update total read bytes
+		total_read += read;
+		lineno++;
 
-	// Return success
+		// Remove trailing newline
+		if(line[read-1] == '\n')
+			line[--read] = '\0';
+
+		// Remove trailing dot (convert FQDN to domain)
+		if(read > 0 && line[read-1] == '.')
+			line[--read] = '\0';
+
+		const enum list_entry type = classify_entry(line, read);
+		if(type == ENTRY_EXACT || type == ENTRY_ABP)
+		{
+			// Exact or ABP-style match found (see comments above)
+			// Append domain to database using prepared statement
+			if(sqlite3_bind_text(stmt, 1, line, -1, SQLITE_STATIC) != SQLITE_OK)
+			{
+				printf("%s  %s Unable to bind domain to SQL statement to insert domains into database file %s\n",
+				       over, cross, outfile);
+				free(line);
+				return false;
+			}
+			if(sqlite3_step(stmt) != SQLITE_DONE)
+			{
+				printf("%s  %s Unable to insert domain into database file %s\n", over, cross, outfile);
+				free(line);
+				return false;
+			}
+			sqlite3_reset(stmt);
+			// Increment counter
+			if(type == ENTRY_EXACT)
+				(*exact_domains)++;
+			else
+				(*abp_domains)++;
+		}
+		else if(type == ENTRY_INVALID)
+		{
+			// False positives are ignored - they don't count as invalid domains
+			add_invalid_sample(invalid_domains_list, invalid_domains_list_len, line);
+			(*invalid_domains)++;
+		}
+
+		// Print progress if the file is large enough every 100 lines
+		if(fsize > PRINT_PROGRESS_THRESHOLD && lineno % 100 == 1)
+		{
+			// Calculate progress
+			const int progress = (int)(100.0*total_read/fsize);
+			// Print progress if it has changed
+			if(progress > last_progress)
+			{
+				printf("%s  %s Processed %i%% of downloaded list", over, info, progress);
+				fflush(stdout);
+				last_progress = progress;
+			}
+		}
+	}
+
+	free(line);
+	return true;
+}
+
+// A valid domain found by one of the parser threads. The domain points into
+// the memory-mapped input file and is not NUL-terminated
+struct parsed_domain {
+	const char *domain;
+	size_t len;
+};
+
+// A chunk of the input file together with the parsing result of its lines
+struct parse_chunk {
+	const char *start;
+	size_t len;
+	bool done;
+	bool failed;
+	struct parsed_domain *domains;
+	unsigned int num_domains;
+	unsigned int exact_domains, abp_domains, invalid_domains;
+	size_t lines;
+	char *invalid_domains_list[MAX_INVALID_DOMAINS];
+	unsigned int invalid_domains_list_len;
+};
+
+// State shared between the writer (main thread) and the parser threads. The
+// writer consumes chunks strictly in order so the domains end up in the same
+// order in the database as in the serial mode
+struct parse_state {
+	pthread_mutex_t lock;
+	pthread_cond_t chunk_done;
+	pthread_cond_t chunk_written;
+	struct parse_chunk *chunks;
+	unsigned int num_chunks;
+	unsigned int next_chunk;
+	unsigned int written_chunks;
+	unsigned int max_pending;
+	bool abort;
+};
+
+// Split the memory-mapped input into chunks ending at line boundaries
+static struct parse_chunk *split_chunks(const char *map, const size_t fsize, unsigned int *num_chunks)
+{
+	unsigned int n = 0, size = 0;
+	struct parse_chunk *chunks = NULL;
+	size_t pos = 0;
+	while(pos < fsize)
+	{
+		size_t end = pos + PARSE_CHUNK_SIZE;
+		if(end >= fsize)
+			end = fsize;
+		else
+		{
+			const char *nl = memchr(map + end, '\n', fsize - end);
+			end = nl != NULL ? (size_t)(nl - map) + 1u : fsize;
+		}
+
+		if(n == size)
+		{
+			size = size > 0 ? 2*size : 64;
+			struct parse_chunk *new_chunks = realloc(chunks, size*sizeof(*chunks));
+			if(new_chunks == NULL)
+			{
+				free(chunks);
+				return NULL;
+			}
+			chunks = new_chunks;
+		}
+
+		memset(&chunks[n], 0, sizeof(*chunks));
+		chunks[n].start = map + pos;
+		chunks[n].len = end - pos;
+		n++;
+		pos = end;
+	}
+
+	*num_chunks = n;
+	return chunks;
+}
+
+// Validate all lines of a chunk. Invalid lines are copied into a (growing)
+// local buffer as the samples of non-domain entries are NUL-terminated strings
+static bool parse_chunk(struct parse_chunk *chunk, char **buffer, size_t *buffer_size)
+{
+	unsigned int size = 0;
+	const char *p = chunk->start;
+	const char *end = chunk->start + chunk->len;
+	while(p < end)
+	{
+		const char *nl = memchr(p, '\n', end - p);
+		const char *next = nl != NULL ? nl + 1 : end;
+		size_t len = (nl != NULL ? nl : end) - p;
+		chunk->lines++;
+
+		// Remove trailing dot (convert FQDN to domain)
+		if(len > 0 && p[len-1] == '.')
+			len--;
+
+		const enum list_entry type = classify_entry(p, len);
+		if(type == ENTRY_EXACT || type == ENTRY_ABP)
+		{
+			if(chunk->num_domains == size)
+			{
+				size = size > 0 ? 2*size : 4096;
+				struct parsed_domain *new_domains = realloc(chunk->domains, size*sizeof(*new_domains));
+				if(new_domains == NULL)
+					return false;
+				chunk->domains = new_domains;
+			}
+			chunk->domains[chunk->num_domains].domain = p;
+			chunk->domains[chunk->num_domains].len = len;
+			chunk->num_domains++;
+
+			if(type == ENTRY_EXACT)
+				chunk->exact_domains++;
+			else
+				chunk->abp_domains++;
+		}
+		else if(type == ENTRY_INVALID)
+		{
+			if(chunk->invalid_domains_list_len < MAX_INVALID_DOMAINS)
+			{
+				if(len + 1 > *buffer_size)
+				{
+					char *new_buffer = realloc(*buffer, len + 1);
+					if(new_buffer == NULL)
+						return false;
+					*buffer = new_buffer;
+					*buffer_size = len + 1;
+				}
+				memcpy(*buffer, p, len);
+				(*buffer)[len] = '\0';
+				add_invalid_sample(chunk->invalid_domains_list, &chunk->invalid_domains_list_len, *buffer);
+			}
+			chunk->invalid_domains++;
+		}
+
+		p = next;
+	}
+
+	return true;
+}
+
+static void *parser_thread(void *arg)
+{
+	struct parse_state *state = arg;
+
+	char *buffer = NULL;
+	size_t buffer_size = 0;
+
+	pthread_mutex_lock(&state->lock);
+	while(!state->abort && state->next_chunk < state->num_chunks)
+	{
+		// Wait until the writer has caught up
+		if(state->next_chunk >= state->written_chunks + state->max_pending)
+		{
+			pthread_cond_wait(&state->chunk_written, &state->lock);
+			continue;
+		}
+
+		struct parse_chunk *chunk = &state->chunks[state->next_chunk++];
+		pthread_mutex_unlock(&state->lock);
+
+		const bool okay = parse_chunk(chunk, &buffer, &buffer_size);
+
+		pthread_mutex_lock(&state->lock);
+		chunk->failed = !okay;
+		chunk->done = true;
+		pthread_cond_broadcast(&state->chunk_done);
+	}
+	pthread_mutex_unlock(&state->lock);
+
+	free(buffer);
+
+	return NULL;
+}
+
+// Insert the domains of a chunk. Full batches are inserted with a single
+// multi-row statement, the remainder is carried over to the next chunk
+static bool write_chunk(sqlite3_stmt *batch, const struct parse_chunk *chunk,
+                        struct parsed_domain *pending, unsigned int *num_pending)
+{
+	for(unsigned int i = 0; i < chunk->num_domains; i++)
+	{
+		pending[(*num_pending)++] = chunk->domains[i];
+		if(*num_pending < INSERT_BATCH_SIZE)
+			continue;
+
+		// Parameter 1 is the adlist ID
+		for(unsigned int j = 0; j < INSERT_BATCH_SIZE; j++)
+			if(sqlite3_bind_text(batch, j + 2, pending[j].domain, pending[j].len, SQLITE_STATIC) != SQLITE_OK)
+				return false;
+		if(sqlite3_step(batch) != SQLITE_DONE)
+			return false;
+		sqlite3_reset(batch);
+		*num_pending = 0;
+	}
+
+	return true;
+}
+
+// Parse a list using multiple threads. The input file is memory-mapped and
+// split into chunks which are validated in parallel. The main thread acts as
+// the only writer and inserts the domains in batches
+static int gravity_parseList_parallel(const char *infile, const char *outfile, const int adlistID,
+                                      unsigned int threads)
+{
+	const char *info = cli_info();
+	const char *cross = cli_cross();
+	const char *over = cli_over();
+
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	// Open and map input file
+	const int fd = open(infile, O_RDONLY);
+	if(fd < 0)
+	{
+		printf("%s  %s Unable to open %s for reading\n", over, cross, infile);
+		return EXIT_FAILURE;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0)
+	{
+		printf("%s  %s Unable to get size of %s\n", over, cross, infile);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	const size_t fsize = st.st_size;
+	const char *map = NULL;
+	if(fsize > 0)
+	{
+		void *addr = mmap(NULL, fsize, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(addr == MAP_FAILED)
+		{
+			printf("%s  %s Unable to map %s into memory\n", over, cross, infile);
+			close(fd);
+			return EXIT_FAILURE;
+		}
+		map = addr;
+		madvise(addr, fsize, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	int ret = EXIT_FAILURE;
+	sqlite3 *db = NULL;
+	sqlite3_stmt *stmt = NULL, *batch = NULL;
+	char *sql = NULL;
+	struct parsed_domain *pending = NULL;
+	pthread_t tid[MAX_PARSE_THREADS];
+	unsigned int running = 0;
+	char *invalid_domains_list[MAX_INVALID_DOMAINS] = { NULL };
+	unsigned int invalid_domains_list_len = 0;
+	unsigned int exact_domains = 0, abp_domains = 0, invalid_domains = 0;
+	size_t lines = 0;
+
+	struct parse_state state = { 0 };
+	pthread_mutex_init(&state.lock, NULL);
+	pthread_cond_init(&state.chunk_done, NULL);
+	pthread_cond_init(&state.chunk_written, NULL);
+
+	state.chunks = split_chunks(map, fsize, &state.num_chunks);
+	if(state.chunks == NULL && fsize > 0)
+	{
+		printf("%s  %s Unable to allocate memory for parsing %s\n", over, cross, infile);
+		goto end_of_parseList_parallel;
+	}
+
+	// Open output file
+	if(sqlite3_open_v2(outfile, &db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK)
+	{
+		printf("%s  %s Unable to open database file %s for writing\n", over, cross, outfile);
+		goto end_of_parseList_parallel;
+	}
+
+	// Begin transaction
+	if(sqlite3_exec(db, "BEGIN TRANSACTION;", NULL, NULL, NULL) != SQLITE_OK)
+	{
+		printf("%s  %s Unable to begin transaction to insert domains into database file %s\n",
+		       over, cross, outfile);
+		goto end_of_parseList_parallel;
+	}
+
+	// Prepare SQL statements: A multi-row statement for full batches and a
+	// single-row statement for the remainder. Parameter 1 is the adlist ID
+	// in both statements
+	const size_t sql_size = 64 + INSERT_BATCH_SIZE*12;
+	sql = calloc(sql_size, sizeof(char));
+	pending = calloc(INSERT_BATCH_SIZE, sizeof(*pending));
+	if(sql == NULL || pending == NULL)
+	{
+		printf("%s  %s Unable to allocate memory for parsing %s\n", over, cross, infile);
+		goto end_of_parseList_parallel;
+	}
+	size_t sql_len = snprintf(sql, sql_size, "INSERT INTO gravity (domain, adlist_id) VALUES ");
+	for(unsigned int i = 0; i < INSERT_BATCH_SIZE; i++)
+		sql_len += snprintf(sql + sql_len, sql_size - sql_len, "%s(?%u,?1)", i > 0 ? "," : "", i + 2);
+	if(sqlite3_prepare_v2(db, sql, -1, &batch, NULL) != SQLITE_OK ||
+	   sqlite3_prepare_v2(db, "INSERT INTO gravity (domain, adlist_id) VALUES (?2, ?1);", -1, &stmt, NULL) != SQLITE_OK)
+	{
+		printf("%s  %s Unable to prepare SQL statement to insert domains into database file %s\n",
+		       over, cross, outfile);
+		goto end_of_parseList_parallel;
+	}
+
+	// Bind adlistID
+	if(sqlite3_bind_int(batch, 1, adlistID) != SQLITE_OK ||
+	   sqlite3_bind_int(stmt, 1, adlistID) != SQLITE_OK)
+	{
+		printf("%s  %s Unable to bind adlistID to SQL statement to insert domains into database file %s\n",
+		       over, cross, outfile);
+		goto end_of_parseList_parallel;
+	}
+
+	// Start parser threads
+	state.max_pending = threads * PARSE_CHUNKS_PER_THREAD;
+	for(; running < threads; running++)
+	{
+		if(pthread_create(&tid[running], NULL, parser_thread, &state) != 0)
+		{
+			printf("%s  %s Unable to start parser thread\n", over, cross);
+			break;
+		}
+	}
+	if(running == 0)
+		goto end_of_parseList_parallel;
+
+	// Write chunks in order as soon as they have been parsed
+	int last_progress = 0;
+	unsigned int num_pending = 0;
+	bool okay = true;
+	for(unsigned int i = 0; i < state.num_chunks && okay; i++)
+	{
+		struct parse_chunk *chunk = &state.chunks[i];
+		pthread_mutex_lock(&state.lock);
+		while(!chunk->done && !state.abort)
+			pthread_cond_wait(&state.chunk_done, &state.lock);
+		pthread_mutex_unlock(&state.lock);
+
+		if(!chunk->done || chunk->failed)
+		{
+			printf("%s  %s Unable to parse %s\n", over, cross, infile);
+			okay = false;
+			break;
+		}
+
+		if(!write_chunk(batch, chunk, pending, &num_pending))
+		{
+			printf("%s  %s Unable to insert domain into database file %s\n", over, cross, outfile);
+			okay = false;
+			break;
+		}
+
+		// Merge results
+		lines += chunk->lines;
+		exact_domains += chunk->exact_domains;
+		abp_domains += chunk->abp_domains;
+		invalid_domains += chunk->invalid_domains;
+		for(unsigned int j = 0; j < chunk->invalid_domains_list_len; j++)
+			add_invalid_sample(invalid_domains_list, &invalid_domains_list_len,
+			                   chunk->invalid_domains_list[j]);
+
+		// Release memory of this chunk and let the parsers continue
+		pthread_mutex_lock(&state.lock);
+		free(chunk->domains);
+		chunk->domains = NULL;
+		for(unsigned int j = 0; j < chunk->invalid_domains_list_len; j++)
+			free(chunk->invalid_domains_list[j]);
+		chunk->invalid_domains_list_len = 0;
+		state.written_chunks = i + 1;
+		pthread_cond_broadcast(&state.chunk_written);
+		pthread_mutex_unlock(&state.lock);
+
+		// Print progress if the file is large enough
+		if(fsize > PRINT_PROGRESS_THRESHOLD)
+		{
+			const int progress = (int)(100.0*(chunk->start + chunk->len - map)/fsize);
+			if(progress > last_progress)
+			{
+				printf("%s  %s Processed %i%% of downloaded list", over, info, progress);
+				fflush(stdout);
+				last_progress = progress;
+			}
+		}
+	}
+
+	// Stop parser threads
+	pthread_mutex_lock(&state.lock);
+	if(!okay)
+		state.abort = true;
+	pthread_cond_broadcast(&state.chunk_written);
+	pthread_mutex_unlock(&state.lock);
+	for(unsigned int i = 0; i < running; i++)
+		pthread_join(tid[i], NULL);
+	running = 0;
+	if(!okay)
+		goto end_of_parseList_parallel;
+
+	// Insert remaining domains
+	for(unsigned int i = 0; i < num_pending; i++)
+	{
+		if(sqlite3_bind_text(stmt, 2, pending[i].domain, pending[i].len, SQLITE_STATIC) != SQLITE_OK ||
+		   sqlite3_step(stmt) != SQLITE_DONE)
+		{
+			printf("%s  %s Unable to insert domain into database file %s\n", over, cross, outfile);
+			goto end_of_parseList_parallel;
+		}
+		sqlite3_reset(stmt);
+	}
+
+	// Finalize SQL statements
+	if(sqlite3_finalize(stmt) != SQLITE_OK || sqlite3_finalize(batch) != SQLITE_OK)
+	{
+		stmt = batch = NULL;
+		printf("%s  %s Unable to finalize SQL statement to insert domains into database file %s\n",
+		       over, cross, outfile);
+		goto end_of_parseList_parallel;
+	}
+	stmt = batch = NULL;
+
+	// Store list properties and end transaction
+	if(!finish_list(db, outfile, adlistID, exact_domains, abp_domains, invalid_domains))
+		goto end_of_parseList_parallel;
+
+	print_summary(exact_domains, abp_domains, invalid_domains,
+	              invalid_domains_list, invalid_domains_list_len);
+
+	// Print throughput
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	const double elapsed = (t1.tv_sec - t0.tv_sec) + 1e-9*(t1.tv_nsec - t0.tv_nsec);
+	printf("%s  %s Processed %zu lines in %.2f seconds using %u threads (%.0f lines/s)\n",
+	       over, info, lines, elapsed, threads, elapsed > 0.0 ? lines/elapsed : 0.0);
+
+	ret = EXIT_SUCCESS;
+
+end_of_parseList_parallel:
+	// Stop parser threads if we did not get that far
+	if(running > 0)
+	{
+		pthread_mutex_lock(&state.lock);
+		state.abort = true;
+		pthread_cond_broadcast(&state.chunk_written);
+		pthread_mutex_unlock(&state.lock);
+		for(unsigned int i = 0; i < running; i++)
+			pthread_join(tid[i], NULL);
+	}
+
+	// Free memory
+	for(unsigned int i = 0; i < state.num_chunks; i++)
+	{
+		free(state.chunks[i].domains);
+		for(unsigned int j = 0; j < state.chunks[i].invalid_domains_list_len; j++)
+			free(state.chunks[i].invalid_domains_list[j]);
+	}
+	free(state.chunks);
+	for(unsigned int i = 0; i < invalid_domains_list_len; i++)
+		free(invalid_domains_list[i]);
+	free(pending);
+	free(sql);
+	pthread_mutex_destroy(&state.lock);
+	pthread_cond_destroy(&state.chunk_done);
+	pthread_cond_destroy(&state.chunk_written);
+
+	// Close files
+	if(stmt != NULL)
+		sqlite3_finalize(stmt);
+	if(batch != NULL)
+		sqlite3_finalize(batch);
+	if(db != NULL)
+		sqlite3_close(db);
+	if(map != NULL)
+		munmap((void*)map, fsize);
+
+	return ret;
+}
+
+int gravity_parseList(const char *infile, const char *outfile, const char *adlistIDstr, const char *threadsstr)
+{
+	// Use the parallel parser if more than one thread was requested. Zero
+	// means one thread per online processor
+	if(threadsstr != NULL)
+	{
+		char *end = NULL;
+		errno = 0;
+		long threads = strtol(threadsstr, &end, 10);
+		if(errno != 0 || end == threadsstr || *end != '\0' || threads < 0)
+		{
+			printf("%s  %s Invalid number of threads \"%s\" (expected a non-negative integer)\n",
+			       cli_over(), cli_cross(), threadsstr);
+			return EXIT_FAILURE;
+		}
+		if(threads == 0)
+			threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if(threads > MAX_PARSE_THREADS)
+			threads = MAX_PARSE_THREADS;
+		if(threads > 1)
+			return gravity_parseList_parallel(infile, outfile, atoi(adlistIDstr), threads);
+	}
+
+	const char *cross = cli_cross();
+	const char *over = cli_over();
+
+	// Open input file
+	FILE *fpin = fopen(infile, "r");
+	if(fpin == NULL)
+	{
+		printf("%s  %s Unable to open %s for reading\n", over, cross, infile);
+		return EXIT_FAILURE;
+	}
+
+	// Open output file
+	sqlite3 *db = NULL;
+	sqlite3_stmt *stmt = NULL;
+	if(sqlite3_open_v2(outfile, &db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK)
+	{
+		printf("%s  %s Unable to open database file %s for writing\n", over, cross, outfile);
+		fclose(fpin);
+		return EXIT_FAILURE;
+	}
+	// Get size of input file
+	fseek(fpin, 0L, SEEK_END);
+	const size_t fsize = ftell(fpin);
+	rewind(fpin);
+
+	// Begin transaction
+	if(sqlite3_exec(db, "BEGIN TRANSACTION;", NULL, NULL, NULL) != SQLITE_OK)
+	{
+		printf("%s  %s Unable to begin transaction to insert domains into database file %s\n",
+		       over, cross, outfile);
+		fclose(fpin);
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	// Prepare SQL statement
+	const char *sql = "INSERT INTO gravity (domain, adlist_id) VALUES (?, ?);";
+	if(sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+	{
+		printf("%s  %s Unable to prepare SQL statement to insert domains into database file %s\n",
+		       over, cross, outfile);
+		fclose(fpin);
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	// Bind adlistID
+	const int adlistID = atoi(adlistIDstr);
+	if(sqlite3_bind_int(stmt, 2, adlistID) != SQLITE_OK)
+	{
+		printf("%s  %s Unable to bind adlistID to SQL statement to insert domains into database file %s\n",
+		       over, cross, outfile);
+		fclose(fpin);
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	// Parse list file line by line
+	char *invalid_domains_list[MAX_INVALID_DOMAINS] = { NULL };
+	unsigned int invalid_domains_list_len = 0;
+	unsigned int exact_domains = 0, abp_domains = 0, invalid_domains = 0;
+	if(!parse_lines(fpin, fsize, stmt, outfile, &exact_domains, &abp_domains, &invalid_domains,
+	                invalid_domains_list, &invalid_domains_list_len))
+	{
+		fclose(fpin);
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	// Finalize SQL statement
+	if(sqlite3_finalize(stmt) != SQLITE_OK)
+	{
+		printf("%s  %s Unable to finalize SQL statement to insert domains into database file %s\n",
+		       over, cross, outfile);
+		fclose(fpin);
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	// Store list properties and end transaction
+	if(!finish_list(db, outfile, adlistID, exact_domains, abp_domains, invalid_domains))
+	{
+		fclose(fpin);
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	print_summary(exact_domains, abp_domains, invalid_domains,
+	              invalid_domains_list, invalid_domains_list_len);
+
+	// Free memory
+	for(unsigned int i = 0; i < invalid_domains_list_len; i++)
+		if(invalid_domains_list[i] != NULL)
+			free(invalid_domains_list[i]);
+
+	// Close files
+	fclose(fpin);
+	sqlite3_close(db);
+
+	// Return success
+	return EXIT_SUCCESS;
+}
+
+// Execute a statement with the adlist ID bound to ?1 and (optionally) the ID
+// of the last change before this update bound to ?2
+static bool exec_update_stmt(sqlite3 *db, const char *sql, const int adlistID, const sqlite3_int64 last_change)
+{
+	sqlite3_stmt *stmt = NULL;
+	if(sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+		return false;
+
+	if(sqlite3_bind_int(stmt, 1, adlistID) != SQLITE_OK ||
+	   (sqlite3_bind_parameter_count(stmt) > 1 && sqlite3_bind_int64(stmt, 2, last_change) != SQLITE_OK) ||
+	   sqlite3_step(stmt) != SQLITE_DONE)
+	{
+		sqlite3_finalize(stmt);
+		return false;
+	}
+
+	return sqlite3_finalize(stmt) == SQLITE_OK;
+}
+
+// Run a query returning a single integer
+static bool query_int64(sqlite3 *db, const char *sql, const int adlistID, const sqlite3_int64 last_change,
+                        sqlite3_int64 *result)
+{
+	sqlite3_stmt *stmt = NULL;
+	if(sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+		return false;
+
+	if((sqlite3_bind_parameter_count(stmt) > 0 && sqlite3_bind_int(stmt, 1, adlistID) != SQLITE_OK) ||
+	   (sqlite3_bind_parameter_count(stmt) > 1 && sqlite3_bind_int64(stmt, 2, last_change) != SQLITE_OK) ||
+	   sqlite3_step(stmt) != SQLITE_ROW)
+	{
+		sqlite3_finalize(stmt);
+		return false;
+	}
+	*result = sqlite3_column_int64(stmt, 0);
+
+	return sqlite3_finalize(stmt) == SQLITE_OK;
+}
+
+// Update the domains of a single adlist in an existing gravity database by
+// applying only the difference between the stored and the new version of the
+// list. All added and removed domains are recorded in the gravity_changes
+// table so FTL can invalidate only the affected cache entries (see
+// FTL_reload_gravity_changes())
+int gravity_updateList(const char *infile, const char *dbfile, const char *adlistIDstr)
+{
+	const char *tick = cli_tick();
+	const char *cross = cli_cross();
+	const char *over = cli_over();
+
+	// Open input file
+	FILE *fpin = fopen(infile, "r");
+	if(fpin == NULL)
+	{
+		printf("%s  %s Unable to open %s for reading\n", over, cross, infile);
+		return EXIT_FAILURE;
+	}
+	fseek(fpin, 0L, SEEK_END);
+	const size_t fsize = ftell(fpin);
+	rewind(fpin);
+
+	// Open database file
+	sqlite3 *db = NULL;
+	if(sqlite3_open_v2(dbfile, &db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK)
+	{
+		printf("%s  %s Unable to open database file %s for writing\n", over, cross, dbfile);
+		fclose(fpin);
+		return EXIT_FAILURE;
+	}
+
+	// FTL keeps reading from this database while we update it. Wait for it
+	// to release its locks instead of failing right away
+	sqlite3_busy_timeout(db, DATABASE_BUSY_TIMEOUT);
+
+	// Create the table of recorded changes if it does not exist yet and
+	// remove changes older than one day. FTL processes them within seconds
+	// after being signaled and falls back to invalidating everything when
+	// it detects that changes it has not seen yet have been removed.
+	// The index on the gravity table is normally created by gravity itself,
+	// we need it to compute the difference efficiently
+	if(sqlite3_exec(db, "BEGIN IMMEDIATE;"
+	                    "CREATE TABLE IF NOT EXISTS gravity_changes "
+	                    "(id INTEGER PRIMARY KEY AUTOINCREMENT, "
+	                    "domain TEXT NOT NULL, "
+	                    "adlist_id INTEGER NOT NULL, "
+	                    "added BOOLEAN NOT NULL, "
+	                    "date_added INTEGER NOT NULL DEFAULT (cast(strftime('%s', 'now') as int)));"
+	                    "DELETE FROM gravity_changes WHERE date_added < cast(strftime('%s', 'now') as int) - 86400;"
+	                    "CREATE INDEX IF NOT EXISTS idx_gravity ON gravity (domain, adlist_id);"
+	                    "CREATE TEMP TABLE gravity_new (domain TEXT PRIMARY KEY) WITHOUT ROWID;",
+	                    NULL, NULL, NULL) != SQLITE_OK)
+	{
+		printf("%s  %s Unable to prepare database file %s for update: %s\n",
+		       over, cross, dbfile, sqlite3_errmsg(db));
+		fclose(fpin);
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	// Parse the new version of the list into a temporary table
+	sqlite3_stmt *stmt = NULL;
+	if(sqlite3_prepare_v2(db, "INSERT OR IGNORE INTO temp.gravity_new (domain) VALUES (?);", -1, &stmt, NULL) != SQLITE_OK)
+	{
+		printf("%s  %s Unable to prepare SQL statement to insert domains into database file %s\n",
+		       over, cross, dbfile);
+		fclose(fpin);
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	char *invalid_domains_list[MAX_INVALID_DOMAINS] = { NULL };
+	unsigned int invalid_domains_list_len = 0;
+	unsigned int exact_domains = 0, abp_domains = 0, invalid_domains = 0;
+	const bool parsed = parse_lines(fpin, fsize, stmt, dbfile, &exact_domains, &abp_domains, &invalid_domains,
+	                                invalid_domains_list, &invalid_domains_list_len);
+	sqlite3_finalize(stmt);
+	fclose(fpin);
+
+	// Compute the difference to the stored version of this list and apply it
+	const int adlistID = atoi(adlistIDstr);
+	sqlite3_int64 last_change = 0, added = 0, removed = 0, count_delta = 0;
+	bool okay = parsed &&
+		query_int64(db, "SELECT IFNULL(MAX(id),0) FROM gravity_changes;", adlistID, 0, &last_change) &&
+		exec_update_stmt(db, "INSERT INTO gravity_changes (domain, adlist_id, added) "
+		                     "SELECT domain, ?1, 0 FROM (SELECT domain FROM gravity WHERE adlist_id = ?1 "
+		                     "EXCEPT SELECT domain FROM temp.gravity_new);", adlistID, 0) &&
+		exec_update_stmt(db, "INSERT INTO gravity_changes (domain, adlist_id, added) "
+		                     "SELECT domain, ?1, 1 FROM (SELECT domain FROM temp.gravity_new "
+		                     "EXCEPT SELECT domain FROM gravity WHERE adlist_id = ?1);", adlistID, 0) &&
+		query_int64(db, "SELECT COUNT(*) FROM gravity_changes WHERE id > ?2 AND added = 1;",
+		            adlistID, last_change, &added) &&
+		query_int64(db, "SELECT COUNT(*) FROM gravity_changes WHERE id > ?2 AND added = 0;",
+		            adlistID, last_change, &removed);
+
+	// Update the number of unique gravity domains without having to count
+	// all of them: removed domains only count if no other list contains
+	// them, added domains only count if no list contained them before
+	sqlite3_int64 unique_added = 0, unique_removed = 0;
+	okay = okay &&
+		query_int64(db, "SELECT COUNT(*) FROM gravity_changes c WHERE id > ?2 AND added = 0 AND NOT EXISTS "
+		                "(SELECT 1 FROM gravity g WHERE g.domain = c.domain AND g.adlist_id != ?1);",
+		            adlistID, last_change, &unique_removed) &&
+		query_int64(db, "SELECT COUNT(*) FROM gravity_changes c WHERE id > ?2 AND added = 1 AND NOT EXISTS "
+		                "(SELECT 1 FROM gravity g WHERE g.domain = c.domain);",
+		            adlistID, last_change, &unique_added) &&
+		exec_update_stmt(db, "DELETE FROM gravity WHERE adlist_id = ?1 AND domain IN "
+		                     "(SELECT domain FROM gravity_changes WHERE id > ?2 AND added = 0);",
+		                 adlistID, last_change) &&
+		exec_update_stmt(db, "INSERT INTO gravity (domain, adlist_id) "
+		                     "SELECT domain, ?1 FROM gravity_changes WHERE id > ?2 AND added = 1;",
+		                 adlistID, last_change);
+	count_delta = unique_added - unique_removed;
+
+	if(okay && count_delta != 0)
+	{
+		char sql[128];
+		snprintf(sql, sizeof(sql), "UPDATE info SET value = value + %lld WHERE property = 'gravity_count';",
+		         (long long)count_delta);
+		okay = sqlite3_exec(db, sql, NULL, NULL, NULL) == SQLITE_OK;
+	}
+
+	// FTL only matches ABP-style entries if the database says there are
+	// any. This may have changed with this update in either direction
+	okay = okay &&
+		sqlite3_exec(db, "INSERT OR REPLACE INTO info (property,value) "
+		                 "SELECT 'abp_domains', EXISTS (SELECT 1 FROM gravity WHERE domain >= '||' AND domain < '|}');",
+		             NULL, NULL, NULL) == SQLITE_OK;
+
+	if(!okay)
+	{
+		if(parsed)
+			printf("%s  %s Unable to apply changes to database file %s: %s\n",
+			       over, cross, dbfile, sqlite3_errmsg(db));
+		for(unsigned int i = 0; i < invalid_domains_list_len; i++)
+			free(invalid_domains_list[i]);
+		sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	// Store list properties and end transaction
+	if(!finish_list(db, dbfile, adlistID, exact_domains, abp_domains, invalid_domains))
+	{
+		for(unsigned int i = 0; i < invalid_domains_list_len; i++)
+			free(invalid_domains_list[i]);
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	print_summary(exact_domains, abp_domains, invalid_domains,
+	              invalid_domains_list, invalid_domains_list_len);
+	printf("%s  %s Added %lld and removed %lld domains\n",
+	       over, tick, (long long)added, (long long)removed);
+
+	// Free memory
+	for(unsigned int i = 0; i < invalid_domains_list_len; i++)
+		free(invalid_domains_list[i]);
+	sqlite3_close(db);
+
+	return EXIT_SUCCESS;
+}
+
+// Compile a memory-mappable index of the exact domain lists of the given
+// gravity database (see gravity_index_map())
+int gravity_compileIndex(const char *dbfile, const char *outfile)
+{
+	const char *tick = cli_tick();
+	const char *cross = cli_cross();
+	const char *over = cli_over();
+
+	// Print messages of the index routines to stdout
+	cli_mode = true;
+
+	struct gravity_index *index = gravity_index_build(dbfile, true, false);
+	if(index == NULL)
+	{
+		printf("%s  %s Unable to build gravity index from %s\n", over, cross, dbfile);
+		return EXIT_FAILURE;
+	}
+
+	const bool okay = gravity_index_write(index, dbfile, outfile);
+	gravity_index_free(index);
+	if(!okay)
+	{
+		printf("%s  %s Unable to write gravity index\n", over, cross);
+		return EXIT_FAILURE;
+	}
+
+	printf("%s  %s Compiled gravity index\n", over, tick);
+	return EXIT_SUCCESS;
+}
+
+// Simple deterministic PRNG (xorshift64) so the generated corpus is the same
+// on every run
+static uint64_t check_rand(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+// Generate a random line close to the boundaries of the domain patterns
+static size_t check_generate(uint64_t *rnd, char *buffer, const size_t size)
+{
+	// Mostly valid characters with some rare ones mixed in
+	static const char common[] = "abcdexyz0189-_";
+	static const char rare[] = ".|^ A\x01\x7f\x80\xff\t\r";
+	size_t len = 0;
+
+	// False positives and variations of them
+	if(check_rand(rnd) % 10 == 0)
+	{
+		const unsigned int n = sizeof(false_positives)/sizeof(false_positives[0]);
+		const char *fp = false_positives[check_rand(rnd) % n];
+		len = strlen(fp);
+		memcpy(buffer, fp, len);
+		if(check_rand(rnd) % 2 == 0)
+			buffer[check_rand(rnd) % len] = common[check_rand(rnd) % (sizeof(common) - 1)];
+		return len;
+	}
+
+	const bool abp = check_rand(rnd) % 4 == 0;
+	if(abp)
+	{
+		buffer[len++] = '|';
+		if(check_rand(rnd) % 8 != 0)
+			buffer[len++] = '|';
+	}
+
+	const unsigned int labels = check_rand(rnd) % 5;
+	for(unsigned int i = 0; i <= labels; i++)
+	{
+		// Label lengths around the limits of the patterns
+		static const unsigned int lengths[] = { 0, 1, 2, 3, 61, 62, 63, 64 };
+		unsigned int label_len = check_rand(rnd) % 2 == 0 ?
+		                         lengths[check_rand(rnd) % (sizeof(lengths)/sizeof(lengths[0]))] :
+		                         check_rand(rnd) % 12;
+		for(unsigned int j = 0; j < label_len && len < size - 3; j++)
+		{
+			const uint64_t r = check_rand(rnd);
+			if(r % 200 == 0)
+				buffer[len++] = '\0';
+			else if(r % 50 == 0)
+				buffer[len++] = rare[(r / 50) % (sizeof(rare) - 1)];
+			else
+				buffer[len++] = common[(r / 50) % (sizeof(common) - 1)];
+		}
+		if(i < labels && len < size - 3)
+			buffer[len++] = '.';
+	}
+
+	if(abp && check_rand(rnd) % 8 != 0)
+		buffer[len++] = '^';
+
+	return len;
+}
+
+// Compare the hand-written validator against the regular expressions it
+// replaces on the lines of a file (if given) and a generated corpus of
+// num_lines lines (default: one million)
+int gravity_checkValidator(const char *infile, const char *linesstr)
+{
+	const char *info = cli_info();
+	const char *tick = cli_tick();
+	const char *cross = cli_cross();
+	const char *over = cli_over();
+
+	struct list_validator validator;
+	if(!validator_init(&validator))
+		return EXIT_FAILURE;
+
+	FILE *fpin = NULL;
+	if(infile != NULL && (fpin = fopen(infile, "r")) == NULL)
+	{
+		printf("%s  %s Unable to open %s for reading\n", over, cross, infile);
+		validator_free(&validator);
+		return EXIT_FAILURE;
+	}
+
+	const unsigned long num_lines = linesstr != NULL ? strtoul(linesstr, NULL, 10) : 1000000ul;
+	uint64_t rnd = 0x9e3779b97f4a7c15ull;
+	unsigned long lines = 0, generated_lines = 0, mismatches = 0;
+	unsigned long types[ENTRY_INVALID + 1] = { 0 };
+	char generated[512];
+	char *line = NULL;
+	size_t len = 0;
+	while(true)
+	{
+		// Use the lines of the input file first, then the generated corpus
+		ssize_t read = -1;
+		if(fpin != NULL && (read = getline(&line, &len, fpin)) != -1)
+		{
+			if(read > 0 && line[read-1] == '\n')
+				line[--read] = '\0';
+			if(read > 0 && line[read-1] == '.')
+				line[--read] = '\0';
+		}
+		else if(generated_lines++ < num_lines)
+		{
+			read = check_generate(&rnd, generated, sizeof(generated));
+			generated[read] = '\0';
+			if(line == NULL || len < sizeof(generated))
+			{
+				free(line);
+				line = calloc(sizeof(generated), sizeof(char));
+				if(line == NULL)
+					break;
+				len = sizeof(generated);
+			}
+			memcpy(line, generated, read + 1);
+		}
+		else
+			break;
+		lines++;
+
+		const enum list_entry expected = classify_entry_regex(&validator, line, read);
+		const enum list_entry type = classify_entry(line, read);
+		types[type]++;
+		if(type == expected)
+			continue;
+
+		if(mismatches++ < MAX_INVALID_DOMAINS)
+		{
+			printf("%s  %s Mismatch (regex: %d, validator: %d): \"", over, cross, expected, type);
+			for(ssize_t i = 0; i < read; i++)
+				if(isprint((unsigned char)line[i]))
+					putchar(line[i]);
+				else
+					printf("\\x%02x", (unsigned char)line[i]);
+			puts("\"");
+		}
+	}
+
+	free(line);
+	if(fpin != NULL)
+		fclose(fpin);
+	validator_free(&validator);
+
+	printf("%s  %s Checked %lu lines: %lu exact, %lu ABP-style, %lu false positives, %lu invalid\n",
+	       over, info, lines, types[ENTRY_EXACT], types[ENTRY_ABP], types[ENTRY_FALSE_POSITIVE], types[ENTRY_INVALID]);
+	if(mismatches > 0)
+	{
+		printf("%s  %s Validator and regular expressions disagree on %lu lines\n", over, cross, mismatches);
+		return EXIT_FAILURE;
+	}
+
+	printf("%s  %s Validator and regular expressions agree on all lines\n", over, tick);
 	return EXIT_SUCCESS;
 }
@@ -10,4 +10,7 @@
 
 #include "FTL.h"
 
-int gravity_parseList(const char *infile, const char *outfile, const char *adlistID);
+int gravity_parseList(const char *infile, const char *outfile, const char *adlistID, const char *threads);
+int gravity_updateList(const char *infile, const char *dbfile, const char *adlistID);
+int gravity_compileIndex(const char *dbfile, const char *outfile);
+int gravity_checkValidator(const char *infile, const char *lines);
@@ -0,0 +1,278 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2023 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Differential check of the regex matchers against TRE
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+
+#include "FTL.h"
+#include "tools/regex-check.h"
+// cli_tick(), etc.
+#include "args.h"
+// regcomp(), tre_regexec()
+#include "regex_r.h"
+// struct regex_set
+#include "regex-set.h"
+// struct regex_prefilter
+#include "regex-prefilter.h"
+
+// Number of mismatches to print before skipping the rest
+#define MAX_MISMATCHES 10
+
+// Maximum length of generated patterns and domains
+#define MAX_PATTERN_LEN 512
+#define MAX_DOMAIN_LEN 256
+
+// Simple deterministic PRNG (xorshift64) so the generated patterns and
+// domains are the same on every run
+static uint64_t check_rand(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+// Building blocks of the generated patterns. They cover the syntax the
+// combined automaton implements as well as constructs it has to reject
+static const char *atoms[] = {
+	"a", "b", "c", "d", "x", "z", "A", "B", "0", "1", "-", "_", ".", "\\.",
+	"ab", "ad", "ab\\.", "xa", "ads", "track", "(^|\\.)", "(\\.|^)",
+	"[a-c]", "[^a]", "[^a-c]", "[A-Z]", "[^A-Z]", "[^a-zA-Z]", "[^ab-c]",
+	"[^b-da-c]", "[a-cb-d]", "[]a]", "[^]a]", "[a-]", "[-a]", "[.]",
+	"[[:digit:]]", "[[:alpha:]]", "[[:upper:]]", "[[:xdigit:]]",
+	"[^[:alnum:]]", "[^[:lower:]]", "[^[:upper:]]", "[[:space:]]",
+	"\\w", "\\W", "\\d", "\\D", "\\s", "\\-", "\\$", "\\^", "\\)", ")",
+	"^", "$", "(?:ab)", "()", "[^\\]", "\\b", "\\<", "\\>", "\\B"
+};
+static const char *repeats[] = {
+	"", "", "", "", "*", "+", "?", "{2}", "{1,3}", "{0,}", "{0}", "{0,1}",
+	"*?", "+?", "??", "{2,}?"
+};
+
+static void append(char *buffer, size_t *len, const char *str)
+{
+	const size_t n = strlen(str);
+	if(*len + n >= MAX_PATTERN_LEN)
+		return;
+	memcpy(&buffer[*len], str, n + 1u);
+	*len += n;
+}
+
+static void generate_pattern(uint64_t *rnd, char *buffer, size_t *len, const unsigned int depth)
+{
+	const unsigned int n = 1u + check_rand(rnd) % 4u;
+	for(unsigned int i = 0; i < n; i++)
+	{
+		if(depth < 3u && check_rand(rnd) % 10u == 0u)
+		{
+			// Group, possibly with an alternative
+			append(buffer, len, "(");
+			generate_pattern(rnd, buffer, len, depth + 1u);
+			if(check_rand(rnd) % 3u == 0u)
+			{
+				append(buffer, len, "|");
+				generate_pattern(rnd, buffer, len, depth + 1u);
+			}
+			append(buffer, len, ")");
+		}
+		else
+			append(buffer, len, atoms[check_rand(rnd) % (sizeof(atoms)/sizeof(atoms[0]))]);
+		append(buffer, len, repeats[check_rand(rnd) % (sizeof(repeats)/sizeof(repeats[0]))]);
+	}
+
+	// Top-level alternative
+	if(depth == 0u && check_rand(rnd) % 5u == 0u)
+	{
+		append(buffer, len, "|");
+		generate_pattern(rnd, buffer, len, 1u);
+	}
+}
+
+static void generate_domain(uint64_t *rnd, char *buffer)
+{
+	// Characters used in the patterns above plus some which are not. Some
+	// long domains are mixed in as these may overflow the DFA cache of TRE
+	static const char chars[] = "abcdxzABXZ01.-_ $^]adstrck\n";
+	const unsigned int len = check_rand(rnd) % 50u == 0u ?
+	                         MAX_DOMAIN_LEN / 2u + check_rand(rnd) % (MAX_DOMAIN_LEN / 2u) :
+	                         1u + check_rand(rnd) % 16u;
+	for(unsigned int i = 0; i < len; i++)
+		buffer[i] = chars[check_rand(rnd) % (sizeof(chars) - 1u)];
+	buffer[len] = '\0';
+}
+
+// Compare the regex matchers against TRE on a number of generated patterns
+// (default: 500) and domains (default: 2000):
+// - TRE's lazy DFA (used when matching without submatches) against TRE's
+//   parallel matcher (used when submatch addressing is requested)
+// - the combined automaton against TRE
+// - the literal prefilter must never rule out a pattern TRE finds a match for
+int regex_check(const char *patternsstr, const char *domainsstr)
+{
+	const char *info = cli_info();
+	const char *tick = cli_tick();
+	const char *cross = cli_cross();
+	const char *over = cli_over();
+
+	const unsigned int num_patterns = patternsstr != NULL ? strtoul(patternsstr, NULL, 10) : 500u;
+	const unsigned int num_domains = domainsstr != NULL ? strtoul(domainsstr, NULL, 10) : 2000u;
+
+	regex_t *regex = calloc(num_patterns, sizeof(regex_t));
+	regex_t *regex_sub = calloc(num_patterns, sizeof(regex_t));
+	char (*patterns)[MAX_PATTERN_LEN] = calloc(num_patterns, sizeof(*patterns));
+	bool *compiled = calloc(num_patterns, sizeof(bool));
+	bool *combined = calloc(num_patterns, sizeof(bool));
+	bool *prefiltered = calloc(num_patterns, sizeof(bool));
+	struct regex_set *set = regex_set_new();
+	struct regex_prefilter *prefilter = regex_prefilter_new();
+	if(regex == NULL || regex_sub == NULL || patterns == NULL || compiled == NULL || combined == NULL ||
+	   prefiltered == NULL || set == NULL || prefilter == NULL)
+	{
+		printf("%s  %s Memory allocation failed\n", over, cross);
+		free(regex);
+		free(regex_sub);
+		free(patterns);
+		free(compiled);
+		free(combined);
+		free(prefiltered);
+		regex_set_free(set);
+		regex_prefilter_free(prefilter);
+		return EXIT_FAILURE;
+	}
+
+	// Compile patterns the same way compile_regex() does and once more
+	// with submatch addressing as reference
+	uint64_t rnd = 0x9e3779b97f4a7c15ull;
+	unsigned int num_compiled = 0u, num_combined = 0u, num_prefiltered = 0u;
+	for(unsigned int i = 0; i < num_patterns; i++)
+	{
+		size_t len = 0u;
+		generate_pattern(&rnd, patterns[i], &len, 0u);
+		if(regcomp(&regex[i], patterns[i], REG_EXTENDED | REG_ICASE | REG_NOSUB) != 0)
+			continue;
+		if(regcomp(&regex_sub[i], patterns[i], REG_EXTENDED | REG_ICASE) != 0)
+		{
+			regfree(&regex[i]);
+			continue;
+		}
+		compiled[i] = true;
+		num_compiled++;
+
+		combined[i] = regex_set_add(set, patterns[i], i);
+		if(combined[i])
+			num_combined++;
+
+		prefiltered[i] = regex_prefilter_add(prefilter, patterns[i], i);
+		if(prefiltered[i])
+			num_prefiltered++;
+	}
+
+	// Match all domains against all patterns
+	const unsigned int words = regex_set_words(set);
+	uint64_t matches[words + 1u];
+	const unsigned int cwords = regex_prefilter_words(prefilter);
+	uint64_t candidates[cwords + 1u];
+	unsigned long checked = 0u, matched = 0u, mismatches = 0u;
+	unsigned long dfa_checked = 0u, dfa_matched = 0u, dfa_mismatches = 0u;
+	unsigned long prefilter_checked = 0u, skipped = 0u, unsound = 0u;
+	for(unsigned int d = 0; d < num_domains; d++)
+	{
+		char domain[MAX_DOMAIN_LEN];
+		generate_domain(&rnd, domain);
+
+		if((num_combined > 0u && !regex_set_match(set, domain, matches)) ||
+		   (num_prefiltered > 0u && !regex_prefilter_match(prefilter, domain, candidates)))
+		{
+			printf("%s  %s Combined automaton or prefilter cannot be used\n", over, cross);
+			mismatches++;
+			break;
+		}
+
+		for(unsigned int i = 0; i < num_patterns; i++)
+		{
+			if(!compiled[i])
+				continue;
+
+			// Requesting a submatch bypasses the DFA
+			regmatch_t match[1] = {{ 0 }};
+			const bool expected = tre_regexec(&regex_sub[i], domain, 1, match, 0) == REG_OK;
+			const bool dfa = tre_regexec(&regex[i], domain, 0, match, 0) == REG_OK;
+			dfa_checked++;
+			if(expected)
+				dfa_matched++;
+			if(dfa != expected && dfa_mismatches++ < MAX_MISMATCHES)
+				printf("%s  %s Mismatch (TRE: %d, TRE DFA: %d): \"%s\" vs. \"%s\"\n",
+				       over, cross, expected, dfa, domain, patterns[i]);
+
+			// A pattern may only be skipped if its required literal
+			// is not contained in the domain
+			if(prefiltered[i])
+			{
+				const bool candidate = (candidates[i / 64u] >> (i % 64u)) & 1u;
+				prefilter_checked++;
+				if(!candidate)
+					skipped++;
+				if(expected && !candidate && unsound++ < MAX_MISMATCHES)
+					printf("%s  %s Prefilter skips matching pattern: \"%s\" vs. \"%s\"\n",
+					       over, cross, domain, patterns[i]);
+			}
+
+			if(!combined[i])
+				continue;
+
+			const bool result = (matches[i / 64u] >> (i % 64u)) & 1u;
+			checked++;
+			if(expected)
+				matched++;
+			if(result == expected)
+				continue;
+
+			if(mismatches++ < MAX_MISMATCHES)
+				printf("%s  %s Mismatch (TRE: %d, combined: %d): \"%s\" vs. \"%s\"\n",
+				       over, cross, expected, result, domain, patterns[i]);
+		}
+	}
+
+	for(unsigned int i = 0; i < num_patterns; i++)
+	{
+		if(!compiled[i])
+			continue;
+		regfree(&regex[i]);
+		regfree(&regex_sub[i]);
+	}
+	free(regex);
+	free(regex_sub);
+	free(patterns);
+	free(compiled);
+	free(combined);
+	free(prefiltered);
+	regex_set_free(set);
+	regex_prefilter_free(prefilter);
+
+	printf("%s  %s Checked %lu matches (%lu positive) of %u domains against %u valid patterns\n",
+	       over, info, dfa_checked, dfa_matched, num_domains, num_compiled);
+	if(dfa_mismatches > 0)
+		printf("%s  %s TRE DFA and parallel matcher disagree on %lu matches\n", over, cross, dfa_mismatches);
+	else
+		printf("%s  %s TRE DFA and parallel matcher agree on all matches\n", over, tick);
+
+	printf("%s  %s Checked %lu matches (%lu positive) of %u domains against %u of %u valid patterns\n",
+	       over, info, checked, matched, num_domains, num_combined, num_compiled);
+	if(mismatches > 0)
+		printf("%s  %s Combined automaton and TRE disagree on %lu matches\n", over, cross, mismatches);
+	else
+		printf("%s  %s Combined automaton and TRE agree on all matches\n", over, tick);
+
+	printf("%s  %s Prefilter skipped %lu of %lu matches of %u patterns with a required literal\n",
+	       over, info, skipped, prefilter_checked, num_prefiltered);
+	if(unsound > 0)
+		printf("%s  %s Prefilter skipped %lu matching patterns\n", over, cross, unsound);
+	else
+		printf("%s  %s Prefilter skipped no matching patterns\n", over, tick);
+
+	return dfa_mismatches > 0 || mismatches > 0 || unsound > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
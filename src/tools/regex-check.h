@@ -0,0 +1,15 @@
+/* Pi-hole: A black hole for Internet advertisements
+*  (c) 2023 Pi-hole, LLC (https://pi-hole.net)
+*  Network-wide ad blocking via your own hardware.
+*
+*  FTL Engine
+*  Regex differential check prototypes
+*
+*  This file is copyright under the latest version of the EUPL.
+*  Please see LICENSE file for your rights under this license. */
+#ifndef REGEX_CHECK_H
+#define REGEX_CHECK_H
+
+int regex_check(const char *patterns, const char *domains);
+
+#endif //REGEX_CHECK_H
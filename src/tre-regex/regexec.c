@@ -186,9 +186,20 @@ tre_match(const tre_tnfa_t *tnfa, const void *string, size_t len,
 #endif /* TRE_APPROX */
   else
     {
-      /* Exact matching, no back references, use the parallel matcher. */
-      status = tre_tnfa_run_parallel(tnfa, string, (int)len, type,
-				     tags, eflags, &eo);
+      /* Exact matching, no back references.  If no submatches are needed,
+	 try the lazy DFA first and use the parallel matcher if it cannot
+	 decide. */
+      int dfa_status = -1;
+      if (tags == NULL && (nmatch == 0 || tnfa->cflags & REG_NOSUB))
+	dfa_status = tre_tnfa_run_dfa(tnfa, string, (int)len, type, eflags);
+      if (dfa_status >= 0)
+	{
+	  status = dfa_status;
+	  eo = -1;
+	}
+      else
+	status = tre_tnfa_run_parallel(tnfa, string, (int)len, type,
+				       tags, eflags, &eo);
     }
 
   if (status == REG_OK)
@@ -2152,6 +2152,10 @@ tre_compile(regex_t *preg, const tre_char_t *regex, size_t n, int cflags)
   tnfa->num_states = parse_ctx.position;
   tnfa->cflags = cflags;
 
+  /* The DFA is only allocated here, its states are computed while
+     matching.  Matching without it is still possible if this fails */
+  tnfa->dfa = tre_dfa_new(tnfa);
+
   DPRINT(("final state %p\n", (void *)tnfa->final));
 
   tre_mem_destroy(mem);
@@ -2229,6 +2233,7 @@ tre_free(regex_t *preg)
     xfree(tnfa->firstpos_chars);
   if (tnfa->minimal_tags)
     xfree(tnfa->minimal_tags);
+  tre_dfa_free(tnfa->dfa);
   xfree(tnfa);
 }
 
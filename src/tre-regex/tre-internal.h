@@ -227,6 +227,9 @@ struct tre_submatch_data {
 typedef struct tre_submatch_data tre_submatch_data_t;
 
 
+/* DFA built while matching, see tre-match-dfa.c. */
+typedef struct tre_dfa tre_dfa_t;
+
 /* TNFA definition. */
 typedef struct tnfa tre_tnfa_t;
 
@@ -249,6 +252,7 @@ struct tnfa {
   int have_backrefs;
   int have_approx;
   int params_depth;
+  tre_dfa_t *dfa;
 };
 
 int
@@ -271,6 +275,16 @@ tre_tnfa_run_parallel(const tre_tnfa_t *tnfa, const void *string, int len,
 		      tre_str_type_t type, int *match_tags, int eflags,
 		      int *match_end_ofs);
 
+int
+tre_tnfa_run_dfa(const tre_tnfa_t *tnfa, const void *string, int len,
+		 tre_str_type_t type, int eflags);
+
+tre_dfa_t *
+tre_dfa_new(const tre_tnfa_t *tnfa);
+
+void
+tre_dfa_free(tre_dfa_t *dfa);
+
 reg_errcode_t
 tre_tnfa_run_backtrack(const tre_tnfa_t *tnfa, const void *string,
 		       int len, tre_str_type_t type, int *match_tags,
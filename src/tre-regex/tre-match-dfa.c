@@ -0,0 +1,437 @@
+/*
+  tre-match-dfa.c - TRE lazy DFA matching engine
+
+  This software is released under a BSD-style license.
+  See the file LICENSE for details and copyright.
+
+*/
+
+/*
+  When submatch addressing is not needed, the parallel matcher only
+  tracks which TNFA states are reachable after each input character.
+  This matcher caches these sets of states as DFA states which are
+  built lazily while matching: once a transition has been computed,
+  matching the same input again is a plain table walk.
+
+  The cache is bounded.  If it overflows, it is flushed and the caller
+  falls back to the parallel matcher for the current input.  TNFAs
+  using word boundary assertions or REG_NEWLINE, and inputs with an
+  explicit length or REG_NOTBOL/REG_NOTEOL are always left to the
+  parallel matcher.
+
+  The DFA is created by tre_compile() and has its own lock, the TNFA
+  itself is never modified while matching.  If another thread holds
+  the lock, the caller falls back to the parallel matcher instead of
+  waiting, see the note on tre_regexec() in tre.h.
+*/
+
+#include "tre-config.h"
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef TRE_WCHAR
+#include <ctype.h>
+#endif /* !TRE_WCHAR */
+
+#include "tre-internal.h"
+#include "tre-match-utils.h"
+#include "tre.h"
+#include "xmalloc.h"
+
+/* Maximum number of cached DFA states per regex. */
+#define TRE_DFA_MAX_STATES 128
+/* Stop using the DFA for a regex after this many cache overflows. */
+#define TRE_DFA_MAX_OVERFLOWS 32
+
+/* Assertions which only depend on the position and the character. */
+#define TRE_DFA_ASSERTIONS (ASSERT_AT_BOL | ASSERT_AT_EOL | ASSERT_CHAR_CLASS \
+			    | ASSERT_CHAR_CLASS_NEG)
+
+struct tre_dfa {
+  const tre_tnfa_t *tnfa;
+  /* Protects everything below, the DFA is modified while matching. */
+  pthread_mutex_t lock;
+  /* Set if the DFA cannot be used for this TNFA. */
+  int disabled;
+  int overflows;
+  /* First transition of each TNFA state. */
+  tre_tnfa_transition_t **tnfa_states;
+  int final_id;
+  /* Bytes which are treated the same by all transitions share a class. */
+  unsigned char byte_class[256];
+  unsigned char class_byte[256];
+  int num_classes;
+  /* Number of 64-bit words of a set of TNFA states. */
+  int words;
+
+  /* DFA states, state 0 is the start state. */
+  int num_states;
+  int alloc_states;
+  /* Set of TNFA states of each DFA state (including the initial states). */
+  uint64_t *sets;
+  /* The final state is part of the set at a character (accept) or at the
+     end of the input (accept_end). */
+  unsigned char *accept;
+  unsigned char *accept_end;
+  /* Transitions for characters followed by another one and for the last
+     character, -1 if not computed yet. */
+  int *next;
+  int hash[2 * TRE_DFA_MAX_STATES];
+  uint64_t *tmp_set;
+};
+
+
+/* Checks the assertions of a transition the same way the parallel matcher
+   does.  `pos' only has to tell whether we are at the beginning of the
+   input and `next_c' whether we are at its end. */
+static int
+tre_dfa_assertions_ok(const tre_tnfa_t *tnfa, const tre_tnfa_transition_t *trans_i,
+		      tre_char_t prev_c, tre_char_t next_c, int pos, int classes)
+{
+  const int reg_notbol = 0, reg_noteol = 0, reg_newline = 0;
+  if (!trans_i->assertions)
+    return 1;
+  if (CHECK_ASSERTIONS(trans_i->assertions))
+    return 0;
+  return !classes || !CHECK_CHAR_CLASSES(trans_i, tnfa, 0);
+}
+
+/* Does the transition accept character `c' (apart from assertions
+   depending on the position)? */
+static int
+tre_dfa_accepts(const tre_tnfa_t *tnfa, const tre_tnfa_transition_t *trans_i,
+		tre_char_t prev_c)
+{
+  if (trans_i->code_min > (tre_cint_t)prev_c
+      || trans_i->code_max < (tre_cint_t)prev_c)
+    return 0;
+  return !(trans_i->assertions & (ASSERT_CHAR_CLASS | ASSERT_CHAR_CLASS_NEG))
+    || !CHECK_CHAR_CLASSES(trans_i, tnfa, 0);
+}
+
+tre_dfa_t *
+tre_dfa_new(const tre_tnfa_t *tnfa)
+{
+  tre_dfa_t *dfa;
+  tre_tnfa_transition_t *trans_i;
+  unsigned int i;
+  int c;
+
+  dfa = xcalloc(1, sizeof(*dfa));
+  if (dfa == NULL)
+    return NULL;
+  dfa->tnfa = tnfa;
+  dfa->final_id = -1;
+  if (pthread_mutex_init(&dfa->lock, NULL) != 0)
+    {
+      xfree(dfa);
+      return NULL;
+    }
+
+  if (tnfa->have_backrefs || tnfa->have_approx
+      || tnfa->cflags & REG_NEWLINE || tnfa->num_states <= 0)
+    {
+      dfa->disabled = 1;
+      return dfa;
+    }
+
+  dfa->tnfa_states = xcalloc((unsigned)tnfa->num_states, sizeof(*dfa->tnfa_states));
+  if (dfa->tnfa_states == NULL)
+    {
+      dfa->disabled = 1;
+      return dfa;
+    }
+
+  /* Map state IDs to states and check that we can handle all assertions. */
+  for (i = 0; i < tnfa->num_transitions; i++)
+    {
+      trans_i = &tnfa->transitions[i];
+      if (trans_i->state == NULL)
+	continue;
+      if (trans_i->assertions & ~TRE_DFA_ASSERTIONS)
+	dfa->disabled = 1;
+      dfa->tnfa_states[trans_i->state_id] = trans_i->state;
+      if (trans_i->state == tnfa->final)
+	dfa->final_id = trans_i->state_id;
+    }
+  for (trans_i = tnfa->initial; trans_i->state != NULL; trans_i++)
+    {
+      if (trans_i->assertions & ~TRE_DFA_ASSERTIONS)
+	dfa->disabled = 1;
+      dfa->tnfa_states[trans_i->state_id] = trans_i->state;
+      if (trans_i->state == tnfa->final)
+	dfa->final_id = trans_i->state_id;
+    }
+  if (dfa->disabled)
+    return dfa;
+
+  /* Split the bytes into classes by refining them with each transition. */
+  dfa->num_classes = 1;
+  for (i = 0; i < tnfa->num_transitions; i++)
+    {
+      int remap[2][256];
+      int num = 0;
+      trans_i = &tnfa->transitions[i];
+      if (trans_i->state == NULL)
+	continue;
+      memset(remap, -1, sizeof(remap));
+      for (c = 0; c < 256; c++)
+	{
+	  const int in = tre_dfa_accepts(tnfa, trans_i, (tre_char_t)c);
+	  int *cls = &remap[in][dfa->byte_class[c]];
+	  if (*cls < 0)
+	    *cls = num++;
+	  dfa->byte_class[c] = (unsigned char)*cls;
+	}
+      dfa->num_classes = num;
+    }
+  for (c = 255; c >= 0; c--)
+    dfa->class_byte[dfa->byte_class[c]] = (unsigned char)c;
+
+  dfa->words = (tnfa->num_states + 63) / 64;
+  dfa->tmp_set = xmalloc(sizeof(uint64_t) * (unsigned)dfa->words);
+  if (dfa->tmp_set == NULL)
+    dfa->disabled = 1;
+  memset(dfa->hash, -1, sizeof(dfa->hash));
+
+  return dfa;
+}
+
+void
+tre_dfa_free(tre_dfa_t *dfa)
+{
+  if (dfa == NULL)
+    return;
+  pthread_mutex_destroy(&dfa->lock);
+  if (dfa->tnfa_states)
+    xfree(dfa->tnfa_states);
+  if (dfa->sets)
+    xfree(dfa->sets);
+  if (dfa->accept)
+    xfree(dfa->accept);
+  if (dfa->accept_end)
+    xfree(dfa->accept_end);
+  if (dfa->next)
+    xfree(dfa->next);
+  if (dfa->tmp_set)
+    xfree(dfa->tmp_set);
+  xfree(dfa);
+}
+
+/* Add the initial states to `set'. */
+static void
+tre_dfa_add_initial(const tre_dfa_t *dfa, uint64_t *set, int at_start, int at_end)
+{
+  const tre_tnfa_transition_t *trans_i;
+  for (trans_i = dfa->tnfa->initial; trans_i->state != NULL; trans_i++)
+    if (tre_dfa_assertions_ok(dfa->tnfa, trans_i, 0, at_end ? 0 : 1,
+			      at_start ? 0 : 1, 0))
+      set[trans_i->state_id / 64] |= 1ull << (trans_i->state_id % 64);
+}
+
+static int
+tre_dfa_has_final(const tre_dfa_t *dfa, const uint64_t *set)
+{
+  return dfa->final_id >= 0
+    && (set[dfa->final_id / 64] >> (dfa->final_id % 64)) & 1;
+}
+
+static unsigned int
+tre_dfa_hash(const tre_dfa_t *dfa, const uint64_t *set)
+{
+  uint64_t h = 14695981039346656037ull;
+  int i;
+  for (i = 0; i < dfa->words; i++)
+    h = (h ^ set[i]) * 1099511628211ull;
+  return (unsigned int)(h ^ (h >> 32)) % (2 * TRE_DFA_MAX_STATES);
+}
+
+/* Drop all cached states.  The DFA is disabled after too many overflows. */
+static void
+tre_dfa_flush(tre_dfa_t *dfa)
+{
+  dfa->num_states = 0;
+  memset(dfa->hash, -1, sizeof(dfa->hash));
+  if (++dfa->overflows >= TRE_DFA_MAX_OVERFLOWS)
+    {
+      DPRINT(("tre_dfa_flush: too many overflows, disabling DFA\n"));
+      dfa->disabled = 1;
+    }
+}
+
+/* Get the DFA state for `set' (which already contains the initial
+   states), adding it if needed.  Returns -1 if the cache is full. */
+static int
+tre_dfa_add_state(tre_dfa_t *dfa, const uint64_t *set, int at_start)
+{
+  const size_t set_bytes = sizeof(uint64_t) * (unsigned)dfa->words;
+  unsigned int h = 0;
+  int state, i;
+
+  /* The start state is never looked up, there is only one. */
+  if (!at_start)
+    {
+      h = tre_dfa_hash(dfa, set);
+      while (dfa->hash[h] >= 0)
+	{
+	  state = dfa->hash[h];
+	  if (memcmp(&dfa->sets[state * dfa->words], set, set_bytes) == 0)
+	    return state;
+	  h = (h + 1) % (2 * TRE_DFA_MAX_STATES);
+	}
+    }
+
+  if (dfa->num_states >= TRE_DFA_MAX_STATES)
+    {
+      tre_dfa_flush(dfa);
+      return -1;
+    }
+
+  if (dfa->num_states == dfa->alloc_states)
+    {
+      const int alloc = dfa->alloc_states ? 2 * dfa->alloc_states : 16;
+      const size_t nexts = 2 * (size_t)dfa->num_classes;
+      uint64_t *sets = xrealloc(dfa->sets, set_bytes * (unsigned)alloc);
+      unsigned char *accept, *accept_end;
+      int *next;
+      if (sets == NULL)
+	return -1;
+      dfa->sets = sets;
+      accept = xrealloc(dfa->accept, (unsigned)alloc);
+      if (accept == NULL)
+	return -1;
+      dfa->accept = accept;
+      accept_end = xrealloc(dfa->accept_end, (unsigned)alloc);
+      if (accept_end == NULL)
+	return -1;
+      dfa->accept_end = accept_end;
+      next = xrealloc(dfa->next, sizeof(int) * nexts * (unsigned)alloc);
+      if (next == NULL)
+	return -1;
+      dfa->next = next;
+      dfa->alloc_states = alloc;
+    }
+
+  state = dfa->num_states++;
+  memcpy(&dfa->sets[state * dfa->words], set, set_bytes);
+  dfa->accept[state] = (unsigned char)tre_dfa_has_final(dfa, set);
+  memcpy(dfa->tmp_set, set, set_bytes);
+  tre_dfa_add_initial(dfa, dfa->tmp_set, at_start, 1);
+  dfa->accept_end[state] = (unsigned char)tre_dfa_has_final(dfa, dfa->tmp_set);
+  for (i = 0; i < 2 * dfa->num_classes; i++)
+    dfa->next[state * 2 * dfa->num_classes + i] = -1;
+  if (!at_start)
+    dfa->hash[h] = state;
+
+  DPRINT(("tre_dfa_add_state: state %d, accept %d, accept_end %d\n", state,
+	  dfa->accept[state], dfa->accept_end[state]));
+  return state;
+}
+
+/* Compute the transition of `state' on a character of class `cls'.  If
+   `last' is set, the character is the last one of the input. */
+static int
+tre_dfa_transition(tre_dfa_t *dfa, int state, int cls, int last)
+{
+  const tre_tnfa_t *tnfa = dfa->tnfa;
+  const tre_char_t c = dfa->class_byte[cls];
+  uint64_t *set = dfa->tmp_set;
+  const tre_tnfa_transition_t *trans_i;
+  int id, next;
+
+  memset(set, 0, sizeof(uint64_t) * (unsigned)dfa->words);
+  for (id = 0; id < tnfa->num_states; id++)
+    {
+      if (!((dfa->sets[state * dfa->words + id / 64] >> (id % 64)) & 1))
+	continue;
+      for (trans_i = dfa->tnfa_states[id]; trans_i->state != NULL; trans_i++)
+	if (tre_dfa_accepts(tnfa, trans_i, c)
+	    && tre_dfa_assertions_ok(tnfa, trans_i, c, last ? 0 : 1, 1, 1))
+	  set[trans_i->state_id / 64] |= 1ull << (trans_i->state_id % 64);
+    }
+  tre_dfa_add_initial(dfa, set, 0, 0);
+
+  /* tmp_set is reused by tre_dfa_add_state(), work on a copy */
+  {
+    uint64_t copy[dfa->words];
+    memcpy(copy, set, sizeof(copy));
+    next = tre_dfa_add_state(dfa, copy, 0);
+  }
+  if (next >= 0)
+    dfa->next[(state * 2 + last) * dfa->num_classes + cls] = next;
+  return next;
+}
+
+/* Match `str' against the DFA, computing missing states.  Has to be called
+   with the lock of the DFA held. */
+static int
+tre_dfa_match(tre_dfa_t *dfa, const unsigned char *str)
+{
+  int state, classes;
+
+  if (dfa->disabled)
+    return -1;
+
+  if (dfa->num_states == 0)
+    {
+      memset(dfa->tmp_set, 0, sizeof(uint64_t) * (unsigned)dfa->words);
+      tre_dfa_add_initial(dfa, dfa->tmp_set, 1, 0);
+      {
+	uint64_t copy[dfa->words];
+	memcpy(copy, dfa->tmp_set, sizeof(copy));
+	if (tre_dfa_add_state(dfa, copy, 1) != 0)
+	  return -1;
+      }
+    }
+
+  classes = dfa->num_classes;
+  state = 0;
+  while (/*CONSTCOND*/(void)1,1)
+    {
+      const unsigned char c = *str++;
+      int last, next;
+      if (c == '\0')
+	return dfa->accept_end[state] ? REG_OK : REG_NOMATCH;
+      if (dfa->accept[state])
+	return REG_OK;
+
+      last = *str == '\0';
+      next = dfa->next[(state * 2 + last) * classes + dfa->byte_class[c]];
+      if (next < 0)
+	{
+	  next = tre_dfa_transition(dfa, state, dfa->byte_class[c], last);
+	  if (next < 0)
+	    return -1;
+	}
+      state = next;
+    }
+}
+
+int
+tre_tnfa_run_dfa(const tre_tnfa_t *tnfa, const void *string, int len,
+		 tre_str_type_t type, int eflags)
+{
+  tre_dfa_t *dfa = tnfa->dfa;
+  int status;
+
+  if (dfa == NULL || type != STR_BYTE || len >= 0
+      || eflags & (REG_NOTBOL | REG_NOTEOL))
+    return -1;
+
+  /* Leave the input to the parallel matcher if another thread is using
+     the DFA of this regex right now */
+  if (pthread_mutex_trylock(&dfa->lock) != 0)
+    return -1;
+  status = tre_dfa_match(dfa, string);
+  pthread_mutex_unlock(&dfa->lock);
+
+  return status;
+}
+
+/* EOF */
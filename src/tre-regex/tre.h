@@ -133,6 +133,11 @@ typedef enum {
 extern int
 tre_regcomp(regex_t *preg, const char *regex, int cflags);
 
+/* Matching without submatch addressing caches DFA states in a structure
+   owned by the compiled regex (see tre-match-dfa.c).  It has its own lock, so
+   the same compiled regex may be used by several threads at once.  A thread
+   finding the DFA in use falls back to the slower parallel matcher instead of
+   waiting for it. */
 extern int
 tre_regexec(const regex_t *preg, const char *string, size_t nmatch,
 	regmatch_t pmatch[], int eflags);
@@ -1380,6 +1380,157 @@
   rm abc.lua
 }
 
+@test "Gravity domain validator agrees with regular expressions" {
+  run bash -c './pihole-FTL gravity checkValidator'
+  printf "%s\n" "${lines[@]}"
+  [[ $status == 0 ]]
+  [[ ${lines[1]} == *"Validator and regular expressions agree on all lines" ]]
+}
+
+@test "Regex matchers agree with TRE" {
+  run bash -c './pihole-FTL regex-check'
+  printf "%s\n" "${lines[@]}"
+  [[ $status == 0 ]]
+  [[ ${lines[1]} == *"TRE DFA and parallel matcher agree on all matches" ]]
+  [[ ${lines[3]} == *"Combined automaton and TRE agree on all matches" ]]
+  [[ ${lines[5]} == *"Prefilter skipped no matching patterns" ]]
+}
+
+@test "Regex prefilter does not change regex-test results (incl. inverted filters)" {
+  # Use a copy of the gravity database with additional regex filters
+  cp /etc/pihole/gravity.db /tmp/gravity-prefilter.db
+  ./pihole-FTL sqlite3 /tmp/gravity-prefilter.db "INSERT INTO domainlist (type,domain) VALUES \
+    (3,'(^|\.)ads\.'),(3,'^track(er)?[0-9]*\.'),(3,'doubleclick'),(3,'^analytics\.;invert'), \
+    (3,'^(www\.)?ad[sv]erver[0-9]+\.;querytype=A'),(2,'(^|\.)cdn-ok\.'),(2,'safe;invert');"
+  cp /etc/pihole/pihole-FTL.conf /tmp/pihole-FTL.conf.bak
+  echo "GRAVITYDB=/tmp/gravity-prefilter.db" >> /etc/pihole/pihole-FTL.conf
+  domains="ads.example.com www.ADS.net tracker12.com track.org doubleclick.net analytics.example.com \
+           example.com safe.example.com cdn-ok.example.com www.adserver7.com advserver1.net regex1.ftl"
+
+  # Collect results without and with prefilter (ignoring timing information)
+  without=""
+  with=""
+  for domain in ${domains}; do
+    without+="$(./pihole-FTL regex-test "${domain}" | grep -v msec)"$'\n'
+  done
+  echo "REGEX_PREFILTER=true" >> /etc/pihole/pihole-FTL.conf
+  for domain in ${domains}; do
+    with+="$(./pihole-FTL regex-test "${domain}" | grep -v msec)"$'\n'
+  done
+
+  # Restore configuration before checking the results
+  mv /tmp/pihole-FTL.conf.bak /etc/pihole/pihole-FTL.conf
+  rm /tmp/gravity-prefilter.db
+  printf "%s\n" "${with}"
+  [[ "${with}" == "${without}" ]]
+  [[ "${with}" == *"^analytics\.;invert"*"matches (regex blacklist"* ]]
+  [[ "${with}" == *"safe;invert"*"matches (regex whitelist"* ]]
+}
+
+@test "Threaded gravity list parser produces the same result as the serial parser" {
+  # Generate a list spanning several parser chunks (4 MiB each) with exact,
+  # hosts-style, ABP-style and invalid entries, comments, CRLF line endings
+  # and no final newline
+  awk 'BEGIN {
+    for(i = 0; i < 600000; i++) {
+      if(i % 7 == 0) printf "0.0.0.0 host%d.example.com\n", i
+      else if(i % 11 == 0) printf "||abp%d.example.net^\n", i
+      else if(i % 13 == 0) printf "# comment %d\n", i
+      else if(i % 17 == 0) printf "invalid_%d!entry\n", i
+      else if(i % 19 == 0) printf "crlf%d.example.org\r\n", i
+      else printf "domain%d.example.com\n", i
+    }
+    printf "last.example.com"
+  }' > /tmp/parseList.txt
+  cp /etc/pihole/gravity.db /tmp/parseList-serial.db
+  ./pihole-FTL sqlite3 /tmp/parseList-serial.db "DELETE FROM gravity; DELETE FROM info WHERE property = 'abp_domains';"
+  cp /tmp/parseList-serial.db /tmp/parseList-threads.db
+
+  # Parse the same list without and with parser threads. Progress is printed
+  # at different steps and only the threaded parser reports its throughput
+  serial="$(./pihole-FTL gravity parseList /tmp/parseList.txt /tmp/parseList-serial.db 1 | tr '\r' '\n' | grep -v -e Processed -e '^$')"
+  threads="$(./pihole-FTL gravity parseList /tmp/parseList.txt /tmp/parseList-threads.db 1 4 | tr '\r' '\n' | grep -v -e Processed -e '^$')"
+
+  # Compare the resulting gravity tables in both directions
+  run bash -c "./pihole-FTL sqlite3 /tmp/parseList-serial.db \"ATTACH '/tmp/parseList-threads.db' AS threads; \
+    SELECT COUNT(*) FROM gravity; SELECT COUNT(*) FROM threads.gravity; \
+    SELECT COUNT(*) FROM (SELECT domain, adlist_id FROM gravity EXCEPT SELECT domain, adlist_id FROM threads.gravity); \
+    SELECT COUNT(*) FROM (SELECT domain, adlist_id FROM threads.gravity EXCEPT SELECT domain, adlist_id FROM gravity); \
+    SELECT number, invalid_domains FROM adlist WHERE id = 1; SELECT number, invalid_domains FROM threads.adlist WHERE id = 1; \
+    SELECT value FROM info WHERE property = 'abp_domains'; SELECT value FROM threads.info WHERE property = 'abp_domains';\""
+  rm /tmp/parseList.txt /tmp/parseList-serial.db /tmp/parseList-threads.db
+  printf "%s\n" "${threads}" "${lines[@]}"
+  [[ "${threads}" == "${serial}" ]]
+  [[ "${threads}" == *"Parsed "*" exact domains and "*" ABP-style domains (ignored "*" non-domain entries)"* ]]
+  [[ ${lines[0]} -gt 400000 ]]
+  [[ ${lines[1]} == "${lines[0]}" ]]
+  [[ ${lines[2]} == "0" ]]
+  [[ ${lines[3]} == "0" ]]
+  [[ ${lines[5]} == "${lines[4]}" ]]
+  [[ ${lines[6]} == "1" ]]
+  [[ ${lines[7]} == "1" ]]
+}
+
+@test "Incremental gravity list update is applied by FTL" {
+  # Remove one domain from the first adlist and add an exact and an ABP-style
+  # domain to it
+  ./pihole-FTL sqlite3 /etc/pihole/gravity.db "SELECT domain FROM gravity WHERE adlist_id = 1;" > /tmp/updateList-orig.txt
+  (grep -v '^gravity-aaaa.ftl$' /tmp/updateList-orig.txt; echo "updatelist-added.ftl"; echo "||updatelist-abp.ftl^") > /tmp/updateList-new.txt
+  count="$(./pihole-FTL sqlite3 /etc/pihole/gravity.db "SELECT value FROM info WHERE property = 'gravity_count';")"
+  change="$(./pihole-FTL sqlite3 /etc/pihole/gravity.db "SELECT IFNULL(MAX(id),0) FROM gravity_changes;" 2> /dev/null || echo 0)"
+
+  # Cache the blocking status of all involved domains
+  run bash -c "dig A gravity-aaaa.ftl @127.0.0.1 +short"
+  [[ ${lines[0]} == "0.0.0.0" ]]
+  run bash -c "dig A updatelist-added.ftl @127.0.0.1 +short"
+  [[ ${lines[0]} != "0.0.0.0" ]]
+  run bash -c "dig A sub.updatelist-abp.ftl @127.0.0.1 +short"
+  [[ ${lines[0]} != "0.0.0.0" ]]
+
+  # Apply the update while another reader holds a lock on the database for
+  # longer than the busy timeout so committing has to be retried
+  (echo "BEGIN; SELECT COUNT(*) FROM gravity;"; sleep 3; echo "COMMIT;") | ./pihole-FTL sqlite3 /etc/pihole/gravity.db > /dev/null &
+  sleep 0.5
+  run bash -c "./pihole-FTL gravity updateList /tmp/updateList-new.txt /etc/pihole/gravity.db 1"
+  wait
+  printf "%s\n" "${lines[@]}"
+  [[ "${lines[@]}" == *"Added 2 and removed 1 domains"* ]]
+  run bash -c "./pihole-FTL sqlite3 /etc/pihole/gravity.db \"SELECT value FROM info WHERE property = 'gravity_count'; \
+    SELECT value FROM info WHERE property = 'abp_domains'; \
+    SELECT domain, added FROM gravity_changes WHERE id > ${change} ORDER BY domain;\""
+  printf "%s\n" "${lines[@]}"
+  [[ ${lines[0]} == "$((count + 1))" ]]
+  [[ ${lines[1]} == "1" ]]
+  [[ ${lines[2]} == "gravity-aaaa.ftl|0" ]]
+  [[ ${lines[3]} == "updatelist-added.ftl|1" ]]
+  [[ ${lines[4]} == "||updatelist-abp.ftl^|1" ]]
+  [[ ${#lines[@]} == 5 ]]
+
+  # Let FTL apply the recorded changes
+  kill -RTMIN+6 "$(cat /run/pihole-FTL.pid)"
+  sleep 2
+  run bash -c "dig A gravity-aaaa.ftl @127.0.0.1 +short"
+  [[ ${lines[0]} != "0.0.0.0" ]]
+  run bash -c "dig A updatelist-added.ftl @127.0.0.1 +short"
+  [[ ${lines[0]} == "0.0.0.0" ]]
+  run bash -c "dig A sub.updatelist-abp.ftl @127.0.0.1 +short"
+  [[ ${lines[0]} == "0.0.0.0" ]]
+
+  # Restore the original list
+  run bash -c "./pihole-FTL gravity updateList /tmp/updateList-orig.txt /etc/pihole/gravity.db 1"
+  printf "%s\n" "${lines[@]}"
+  [[ "${lines[@]}" == *"Added 1 and removed 2 domains"* ]]
+  kill -RTMIN+6 "$(cat /run/pihole-FTL.pid)"
+  sleep 2
+  rm /tmp/updateList-orig.txt /tmp/updateList-new.txt
+  run bash -c "dig A gravity-aaaa.ftl @127.0.0.1 +short"
+  [[ ${lines[0]} == "0.0.0.0" ]]
+  run bash -c "dig A updatelist-added.ftl @127.0.0.1 +short"
+  [[ ${lines[0]} != "0.0.0.0" ]]
+  run bash -c "./pihole-FTL sqlite3 /etc/pihole/gravity.db \"SELECT value FROM info WHERE property = 'gravity_count';\""
+  [[ ${lines[0]} == "${count}" ]]
+}
+
 @test "Pi-hole PTR generation check" {
   run bash -c "bash test/hostnames.sh | tee ptr.log"
   printf "%s\n" "${lines[@]}"